@@ -19,24 +19,6 @@
 
 #define ADDRESS_LENGTH 64
 
-/* Counters used to record cache statistics in printSummary().
-   test-cache uses these numbers to verify correctness of the cache. */
-
-//Increment when a miss occurs
-int miss_count = 0;
-
-//Increment when a hit occurs
-int hit_count = 0;
-
-//Increment when a dirty eviction occurs
-int dirty_eviction_count = 0;
-
-//Increment when a clean eviction occurs
-int clean_eviction_count = 0;
-
-// keep track of the current lru time stamp
-static uword_t lru_stamp = 0;
-
 /*
  * Initialize the cache according to specified arguments
  * Called by cache-runner so do not modify the function signature
@@ -47,7 +29,8 @@ static uword_t lru_stamp = 0;
 cache_t *create_cache(int s_in, int b_in, int E_in, int d_in)
 {
     /* see cache-runner for the meaning of each argument */
-    cache_t *cache = malloc(sizeof(cache_t));
+    /* Statistics and the lru time stamp start at zero */
+    cache_t *cache = calloc(1, sizeof(cache_t));
     cache->s = s_in;
     cache->b = b_in;
     cache->E = E_in;
@@ -81,7 +64,7 @@ cache_t *create_checkpoint(cache_t *cache) {
         for (unsigned int j = 0; j < cache->E; j++) {
             memcpy(&copy_cache->sets[i].lines[j], &cache->sets[i].lines[j], sizeof(cache_line_t));
             copy_cache->sets[i].lines[j].data = calloc(B, sizeof(byte_t));
-            memcpy(copy_cache->sets[i].lines[j].data, cache->sets[i].lines[j].data, sizeof(byte_t));
+            memcpy(copy_cache->sets[i].lines[j].data, cache->sets[i].lines[j].data, B);
         }
     }
     
@@ -121,11 +104,9 @@ void free_cache(cache_t *cache)
  * helper function to retrieve set_index from addr and return the value
  */
 static uword_t get_set_index(cache_t *cache, uword_t addr) {
-    // left shift out tag: t = m - s - b
-    uword_t set_index = addr << (ADDRESS_LENGTH - cache->s - cache->b);
-    // move to lower end: t + b = m - s
-    set_index = set_index >> (ADDRESS_LENGTH - cache->s);
-    return set_index;
+    // shift out the block offset and mask off the tag.  Shifting the
+    // tag out instead would shift by the whole address when s = 0
+    return (addr >> cache->b) & (((uword_t) 1 << cache->s) - 1);
 }
 
 /*  TODO:
@@ -186,8 +167,8 @@ bool check_hit(cache_t *cache, uword_t addr, operation_t operation)
     cache_line_t *line = get_line(cache, addr);
 
     if (line) {
-        hit_count++;
-        line->lru = lru_stamp++;
+        cache->hit_count++;
+        line->lru = cache->lru_stamp++;
         // a line remains dirty for a READ operation
         if (operation == WRITE) {
             line->dirty = true;
@@ -196,7 +177,7 @@ bool check_hit(cache_t *cache, uword_t addr, operation_t operation)
     }
 
     // false valid bit or incorrect tag
-    miss_count++;
+    cache->miss_count++;
     return false;
 }
 
@@ -214,7 +195,7 @@ evicted_line_t *handle_miss(cache_t *cache, uword_t addr, operation_t operation,
     uword_t set_index = get_set_index(cache, addr);
     cache_line_t *old_line = select_line(cache, addr);
 
-    old_line->lru = lru_stamp++;
+    old_line->lru = cache->lru_stamp++;
     // copy valid bit, update for old
     evicted_line->valid = old_line->valid;
     old_line->valid = true;
@@ -231,9 +212,9 @@ evicted_line_t *handle_miss(cache_t *cache, uword_t addr, operation_t operation,
     }
 
     if (evicted_line->valid && evicted_line->dirty) {
-        dirty_eviction_count++;
+        cache->dirty_eviction_count++;
     } else if (evicted_line->valid) {
-        clean_eviction_count++;
+        cache->clean_eviction_count++;
     }
 
     return evicted_line;
@@ -243,11 +224,8 @@ evicted_line_t *handle_miss(cache_t *cache, uword_t addr, operation_t operation,
  * helper function to retrieve block_offset from addr and returnt the value
  */
 static uword_t get_block_offset(cache_t *cache, uword_t addr) {
-    // left shift out tag and set index: t + s = m - b
-    uword_t block_offset = addr << (ADDRESS_LENGTH - cache->b);
-    // undo to move back to lower end
-    block_offset = block_offset >> (ADDRESS_LENGTH - cache->b);
-    return block_offset;
+    // mask off tag and set index, which also works when b = 0
+    return addr & (((uword_t) 1 << cache->b) - 1);
 }
 
 /* TODO:
@@ -25,6 +25,16 @@ typedef struct cache {
     unsigned int b; /* block offset bits */
     unsigned int E; /* associativity */
     unsigned int d; /* cache delay */
+    /* Statistics reported by printSummary() */
+    int hit_count;
+    int miss_count;
+    int dirty_eviction_count;
+    int clean_eviction_count;
+    uword_t lru_stamp; /* current lru time stamp */
+    /* Miss the pipeline is waiting on: its block and the cycles left */
+    bool inflight;
+    size_t inflight_cycles;
+    uword_t inflight_pos;
 } cache_t;
 
 typedef enum {
@@ -46,6 +56,7 @@ void access_data(cache_t *cache, uword_t addr, operation_t operation);
 
 evicted_line_t *handle_miss(cache_t *cache, uword_t addr, operation_t operation, byte_t *incoming_data);
 bool check_hit(cache_t *cache, uword_t addr, operation_t operation);
+cache_line_t *get_line(cache_t *cache, uword_t addr);
 
 void get_byte_cache(cache_t *cache, uword_t addr, byte_t *dest);
 void get_word_cache(cache_t *cache, uword_t addr, word_t *dest);
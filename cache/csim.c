@@ -15,12 +15,6 @@ char* trace_file = NULL;
 
 int verbosity_cache = 0;
 
-/* Counters used to record cache statistics */
-extern int miss_count;
-extern int hit_count;
-extern int dirty_eviction_count;
-extern int clean_eviction_count;
-
 /*
  * printSummary - Summarize the cache simulation statistics. Student cache simulators
  *                must call this function in order to be properly autograded.
@@ -152,10 +146,11 @@ int main(int argc, char* argv[])
 
     replayTrace(cache, trace_file);
 
+    /* Output the hit and miss statistics for the autograder */
+    printSummary(cache->hit_count, cache->miss_count,
+                 cache->dirty_eviction_count, cache->clean_eviction_count);
+
     /* Free allocated memory */
     free_cache(cache);
-
-    /* Output the hit and miss statistics for the autograder */
-    printSummary(hit_count, miss_count, dirty_eviction_count, clean_eviction_count);
     return 0;
 }
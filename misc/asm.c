@@ -0,0 +1,422 @@
+/* Y86-64 assembler library: .ys source straight into a mem_t */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "isa.h"
+#include "asm.h"
+#include "yobj.h"
+
+#define LINELEN 4096
+
+typedef struct {
+    char *name;
+    word_t addr;
+} label_t;
+
+/* State of an assembly.  The source is read in two passes: the first
+   finds the address of every label, the second emits code */
+typedef struct {
+    mem_t m;
+    symtab_t syms;          /* Labels and source lines, or NULL */
+    int pass;
+    int lineno;
+    char *text;             /* Current line as written, for errors */
+    char *cur;              /* Parse position within the current line */
+    word_t addr;            /* Address of the current line */
+    bool in_comment;        /* Inside a multi-line comment */
+    label_t *labels;
+    int nlabels;
+    int maxlabels;
+    int errors;
+    int byte_cnt;
+    int report_error;
+} asm_t;
+
+/* Report an error on the current line.  Errors are only reported on
+   the second pass, so each is printed once */
+static void asm_error(asm_t *a, char *msg, char *detail)
+{
+    if (a->pass != 2)
+	return;
+    a->errors++;
+    if (a->report_error) {
+	fprintf(stderr, "Error on line %d: %s", a->lineno, msg);
+	if (detail)
+	    fprintf(stderr, " '%s'", detail);
+	fprintf(stderr, "\nLine %d, Byte 0x%.4llx: %s", a->lineno, a->addr, a->text);
+	if (!strchr(a->text, '\n'))
+	    fprintf(stderr, "\n");
+    }
+}
+
+static label_t *find_label(asm_t *a, char *name)
+{
+    int i;
+    for (i = 0; i < a->nlabels; i++)
+	if (strcmp(a->labels[i].name, name) == 0)
+	    return &a->labels[i];
+    return NULL;
+}
+
+static void add_label(asm_t *a, char *name)
+{
+    if (a->pass == 2) {
+	label_t *l = find_label(a, name);
+	if (l && l->addr != a->addr)
+	    asm_error(a, "Duplicate label", name);
+	return;
+    }
+    if (find_label(a, name))
+	return;
+    if (a->nlabels == a->maxlabels) {
+	a->maxlabels = a->maxlabels ? 2 * a->maxlabels : 64;
+	a->labels = (label_t *) realloc(a->labels, a->maxlabels * sizeof(label_t));
+    }
+    a->labels[a->nlabels].name = strdup(name);
+    a->labels[a->nlabels].addr = a->addr;
+    a->nlabels++;
+    if (a->syms)
+	add_symbol(a->syms, a->addr, name);
+}
+
+/* Remove comments from buf in place.  '#' runs to the end of the line;
+   C style comments may span lines */
+static void strip_comments(asm_t *a, char *buf)
+{
+    char *src = buf;
+    char *dst = buf;
+    while (*src) {
+	if (a->in_comment) {
+	    if (src[0] == '*' && src[1] == '/') {
+		a->in_comment = false;
+		src += 2;
+		*dst++ = ' ';
+	    } else {
+		src++;
+	    }
+	} else if (src[0] == '/' && src[1] == '*') {
+	    a->in_comment = true;
+	    src += 2;
+	} else if (src[0] == '#') {
+	    break;
+	} else {
+	    *dst++ = *src++;
+	}
+    }
+    while (dst > buf && isspace((int) dst[-1]))
+	dst--;
+    *dst = '\0';
+}
+
+static void skip_space(asm_t *a)
+{
+    while (isspace((int) *a->cur))
+	a->cur++;
+}
+
+static bool at_end(asm_t *a)
+{
+    skip_space(a);
+    return *a->cur == '\0';
+}
+
+/* Consume punctuation character c if it comes next */
+static bool accept(asm_t *a, char c)
+{
+    skip_space(a);
+    if (*a->cur != c)
+	return false;
+    a->cur++;
+    return true;
+}
+
+/* Get an identifier (instruction, directive or label name) */
+static bool get_ident(asm_t *a, char *name)
+{
+    int len = 0;
+    skip_space(a);
+    if (!isalpha((int) *a->cur) && *a->cur != '_' && *a->cur != '.')
+	return false;
+    while ((isalnum((int) *a->cur) || *a->cur == '_' || *a->cur == '.')
+	   && len < LINELEN - 1)
+	name[len++] = *a->cur++;
+    name[len] = '\0';
+    return true;
+}
+
+/* Get a decimal or hexadecimal constant, possibly negative */
+static bool get_number(asm_t *a, word_t *valp)
+{
+    char *start;
+    char *end;
+    skip_space(a);
+    start = a->cur;
+    if (*start == '-')
+	start++;
+    if (!isdigit((int) *start))
+	return false;
+    if (start[0] == '0' && (start[1] == 'x' || start[1] == 'X')) {
+	*valp = (word_t) strtoull(start, &end, 16);
+	if (*a->cur == '-')
+	    *valp = -*valp;
+    } else {
+	*valp = strtoll(a->cur, &end, 10);
+    }
+    a->cur = end;
+    return true;
+}
+
+static bool get_register(asm_t *a, reg_id_t *regp)
+{
+    char name[LINELEN];
+    skip_space(a);
+    if (*a->cur != '%') {
+	asm_error(a, "Expecting register", NULL);
+	return false;
+    }
+    a->cur++;
+    name[0] = '%';
+    if (!get_ident(a, name + 1)) {
+	asm_error(a, "Invalid register", NULL);
+	return false;
+    }
+    *regp = find_register(name);
+    if (*regp == REG_ERR) {
+	asm_error(a, "Invalid register", name);
+	return false;
+    }
+    return true;
+}
+
+/* Get a constant or the address of a label.  Returns false if neither
+   comes next */
+static bool get_value(asm_t *a, word_t *valp)
+{
+    char name[LINELEN];
+    label_t *l;
+    if (get_number(a, valp))
+	return true;
+    if (!get_ident(a, name))
+	return false;
+    *valp = 0;
+    if (a->pass == 2) {
+	l = find_label(a, name);
+	if (l)
+	    *valp = l->addr;
+	else
+	    asm_error(a, "Can't find label", name);
+    }
+    return true;
+}
+
+/* Immediate: [$]value */
+static bool get_immediate(asm_t *a, word_t *valp)
+{
+    accept(a, '$');
+    if (!get_value(a, valp)) {
+	asm_error(a, "Expecting constant or label", NULL);
+	return false;
+    }
+    return true;
+}
+
+/* Memory reference: [$]value, (reg) or value(reg) */
+static bool get_memref(asm_t *a, word_t *dispp, reg_id_t *basep)
+{
+    bool have_disp;
+    accept(a, '$');
+    skip_space(a);
+    have_disp = *a->cur != '(';
+    *dispp = 0;
+    *basep = REG_NONE;
+    if (have_disp && !get_value(a, dispp)) {
+	asm_error(a, "Expecting memory reference", NULL);
+	return false;
+    }
+    if (!accept(a, '('))
+	return true;
+    if (!get_register(a, basep))
+	return false;
+    if (!accept(a, ')')) {
+	asm_error(a, "Expecting ')'", NULL);
+	return false;
+    }
+    return true;
+}
+
+/* Parse one argument of instr into its encoding in code */
+static bool get_arg(asm_t *a, arg_t type, int pos, int hi, byte_t *code)
+{
+    reg_id_t reg;
+    word_t val;
+    int i;
+    switch (type) {
+    case R_ARG:
+	if (!get_register(a, &reg))
+	    return false;
+	code[pos] = hi ? HPACK(reg, LO4(code[pos])) : HPACK(HI4(code[pos]), reg);
+	return true;
+    case M_ARG:
+	if (!get_memref(a, &val, &reg))
+	    return false;
+	code[pos] = hi ? HPACK(reg, LO4(code[pos])) : HPACK(HI4(code[pos]), reg);
+	for (i = 0; i < 8; i++)
+	    code[pos + 1 + i] = (val >> (8 * i)) & 0xFF;
+	return true;
+    case I_ARG:
+	if (!get_immediate(a, &val))
+	    return false;
+	for (i = 0; i < hi; i++)
+	    code[pos + i] = (val >> (8 * i)) & 0xFF;
+	return true;
+    default:
+	return true;
+    }
+}
+
+/* Place code for the current line in memory */
+static void emit(asm_t *a, byte_t *code, int bytes)
+{
+    if (a->pass != 2)
+	return;
+    if (!load_bytes(a->m, a->addr, code, bytes)) {
+	asm_error(a, "Address out of range", NULL);
+	return;
+    }
+    a->byte_cnt += bytes;
+    if (a->syms) {
+	char text[LINELEN];
+	char *start = a->text;
+	char *end;
+	while (isspace((int) *start))
+	    start++;
+	strcpy(text, start);
+	end = text + strlen(text);
+	while (end > text && isspace((int) end[-1]))
+	    end--;
+	*end = '\0';
+	add_src_line(a->syms, a->addr, a->lineno, text);
+    }
+}
+
+/* Assemble one line of source */
+static void assemble_line(asm_t *a, char *buf)
+{
+    char name[LINELEN];
+    char *save;
+    instr_ptr instr;
+    byte_t code[10];
+    word_t val;
+
+    strip_comments(a, buf);
+    a->cur = buf;
+    if (at_end(a))
+	return;
+
+    /* Optional label */
+    save = a->cur;
+    if (get_ident(a, name) && accept(a, ':')) {
+	add_label(a, name);
+	if (at_end(a))
+	    return;
+    } else {
+	a->cur = save;
+    }
+
+    if (!get_ident(a, name)) {
+	asm_error(a, "Invalid line", NULL);
+	return;
+    }
+
+    if (strcmp(name, ".pos") == 0 || strcmp(name, ".align") == 0) {
+	if (!get_number(a, &val)) {
+	    asm_error(a, "Expecting constant", NULL);
+	    return;
+	}
+	if (name[1] == 'p')
+	    a->addr = val;
+	else if (val > 0)
+	    a->addr = ((a->addr + val - 1) / val) * val;
+    } else {
+	instr = find_instr(name);
+	if (!instr) {
+	    asm_error(a, "Invalid instruction", name);
+	    return;
+	}
+	memset(code, 0, sizeof(code));
+	code[0] = instr->code;
+	/* Unused register fields are encoded as REG_NONE */
+	if (instr->bytes > 1 && (instr->arg1 == R_ARG || instr->arg1 == M_ARG ||
+				 instr->arg2 == R_ARG || instr->arg2 == M_ARG))
+	    code[1] = HPACK(REG_NONE, REG_NONE);
+	if (!get_arg(a, instr->arg1, instr->arg1pos, instr->arg1hi, code))
+	    return;
+	if (instr->arg2 != NO_ARG) {
+	    if (!accept(a, ',')) {
+		asm_error(a, "Expecting comma", NULL);
+		return;
+	    }
+	    if (!get_arg(a, instr->arg2, instr->arg2pos, instr->arg2hi, code))
+		return;
+	}
+	emit(a, code, instr->bytes);
+	a->addr += instr->bytes;
+    }
+    if (!at_end(a))
+	asm_error(a, "Unexpected text", a->cur);
+}
+
+int assemble_mem(mem_t m, symtab_t syms, FILE *infile, int report_error)
+{
+    char buf[LINELEN];
+    char **lines = NULL;
+    int nlines = 0;
+    int maxlines = 0;
+    int i;
+    asm_t a;
+
+    /* Both passes work from a copy of the source */
+    while (fgets(buf, LINELEN, infile)) {
+	if (nlines == maxlines) {
+	    maxlines = maxlines ? 2 * maxlines : 256;
+	    lines = (char **) realloc(lines, maxlines * sizeof(char *));
+	}
+	lines[nlines++] = strdup(buf);
+    }
+
+    memset(&a, 0, sizeof(a));
+    a.m = m;
+    a.syms = syms;
+    a.report_error = report_error;
+    for (a.pass = 1; a.pass <= 2; a.pass++) {
+	a.addr = 0;
+	a.in_comment = false;
+	for (i = 0; i < nlines; i++) {
+	    strcpy(buf, lines[i]);
+	    a.lineno = i + 1;
+	    a.text = lines[i];
+	    assemble_line(&a, buf);
+	}
+    }
+
+    for (i = 0; i < nlines; i++)
+	free(lines[i]);
+    free(lines);
+    for (i = 0; i < a.nlabels; i++)
+	free(a.labels[i].name);
+    free(a.labels);
+    return a.errors ? 0 : a.byte_cnt;
+}
+
+int load_code(mem_t m, symtab_t syms, char *fname, FILE *infile, int report_error)
+{
+    size_t len = strlen(fname);
+    if (len > 3 && strcmp(fname + len - 3, ".ys") == 0)
+	return assemble_mem(m, syms, infile, report_error);
+    if (len > 3 && strcmp(fname + len - 3, ".yb") == 0)
+	return load_yobj(m, syms, infile, report_error);
+    return load_mem(m, syms, infile, report_error);
+}
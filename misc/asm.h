@@ -0,0 +1,17 @@
+/* Y86-64 assembler library.  Include isa.h first. */
+
+/*
+ * Assemble the Y86-64 source read from infile straight into memory,
+ * using the instruction table from isa.c.  Accepts the same language as
+ * yas.  Returns the number of bytes of code placed in memory, or 0 if
+ * the source has errors, which are printed to stderr when report_error
+ * is set.  Labels and the source lines that produce code are added to
+ * syms, unless it is NULL.
+ */
+int assemble_mem(mem_t m, symtab_t syms, FILE *infile, int report_error);
+
+/* Load a program into memory, assembling it when fname ends in ".ys",
+   mapping it when fname ends in ".yb" and reading it as a .yo file
+   otherwise.  Returns as load_mem does, filling in syms as each loader
+   can */
+int load_code(mem_t m, symtab_t syms, char *fname, FILE *infile, int report_error);
@@ -0,0 +1,175 @@
+/* Batch regression runner shared by the pipeline simulators */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "isa.h"
+#include "batch.h"
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static void add_name(char ***namesp, int *countp, int *maxp, char *name)
+{
+    if (*countp == *maxp) {
+	*maxp = *maxp ? 2 * *maxp : 64;
+	*namesp = (char **) realloc(*namesp, *maxp * sizeof(char *));
+    }
+    (*namesp)[(*countp)++] = strdup(name);
+}
+
+/* Is name a program load_code can load: a .yo, .ys or .yb file? */
+static bool is_program(char *name)
+{
+    size_t len = strlen(name);
+    return len > 3 && (!strcmp(name + len - 3, ".yo") ||
+		       !strcmp(name + len - 3, ".ys") ||
+		       !strcmp(name + len - 3, ".yb"));
+}
+
+/* Collect the programs of a directory, in name order */
+static char **read_dir(char *dname, int *countp)
+{
+    char **names = NULL;
+    int max = 0;
+    struct dirent *de;
+    char path[4096];
+    DIR *dir = opendir(dname);
+    *countp = 0;
+    if (!dir)
+	return NULL;
+    while ((de = readdir(dir)) != NULL) {
+	if (!is_program(de->d_name))
+	    continue;
+	snprintf(path, sizeof(path), "%s/%s", dname, de->d_name);
+	add_name(&names, countp, &max, path);
+    }
+    closedir(dir);
+    if (*countp > 0)
+	qsort(names, *countp, sizeof(char *), compare_names);
+    return names;
+}
+
+/* Collect the file names listed in a manifest */
+static char **read_manifest(char *fname, int *countp)
+{
+    char **names = NULL;
+    int max = 0;
+    char buf[4096];
+    FILE *f = fopen(fname, "r");
+    *countp = 0;
+    if (!f)
+	return NULL;
+    while (fgets(buf, sizeof(buf), f)) {
+	char *start = buf;
+	char *end;
+	char *comment = strchr(buf, '#');
+	if (comment)
+	    *comment = '\0';
+	while (isspace((int) *start))
+	    start++;
+	end = start + strlen(start);
+	while (end > start && isspace((int) end[-1]))
+	    end--;
+	*end = '\0';
+	if (*start)
+	    add_name(&names, countp, &max, start);
+    }
+    fclose(f);
+    return names;
+}
+
+int run_batch(char *list, int nworkers, batch_fun_t run_one)
+{
+    struct stat sb;
+    char **names;
+    int count = 0;
+    int failed = 0;
+    int i, w;
+    batch_result_t *results;
+    int *next;
+
+    if (stat(list, &sb) != 0) {
+	fprintf(stderr, "Couldn't open batch list %s\n", list);
+	exit(1);
+    }
+    if (S_ISDIR(sb.st_mode))
+	names = read_dir(list, &count);
+    else
+	names = read_manifest(list, &count);
+    if (count == 0) {
+	fprintf(stderr, "No object files found in %s\n", list);
+	exit(1);
+    }
+
+    /* Results and the work counter live in shared memory so that the
+       workers can fill them in.  Each worker pulls the next unclaimed
+       program, which keeps long programs from holding up one worker */
+    results = (batch_result_t *) mmap(NULL, count * sizeof(batch_result_t) + sizeof(int),
+				      PROT_READ | PROT_WRITE,
+				      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) {
+	perror("mmap");
+	exit(1);
+    }
+    next = (int *) (results + count);
+
+    if (nworkers > count)
+	nworkers = count;
+    if (nworkers <= 1) {
+	for (i = 0; i < count; i++)
+	    run_one(names[i], &results[i]);
+    } else {
+	fflush(stdout);
+	for (w = 0; w < nworkers; w++) {
+	    pid_t pid = fork();
+	    if (pid < 0) {
+		perror("fork");
+		exit(1);
+	    }
+	    if (pid == 0) {
+		while ((i = __sync_fetch_and_add(next, 1)) < count)
+		    run_one(names[i], &results[i]);
+		_exit(0);
+	    }
+	}
+	/* A worker that crashes leaves its current program marked as not
+	   run; its unclaimed programs go to the remaining workers */
+	for (w = 0; w < nworkers; w++)
+	    wait(NULL);
+    }
+
+    for (i = 0; i < count; i++) {
+	batch_result_t *res = &results[i];
+	if (!res->ran) {
+	    failed++;
+	    printf("%s: Simulation did not complete\n", names[i]);
+	    continue;
+	}
+	if (!res->match)
+	    failed++;
+	printf("%s: ISA Check %s, CPI: %lld cycles/%lld instructions = %.2f\n",
+	       names[i], res->match ? "Succeeds" : "Fails",
+	       res->cycles, res->instructions,
+	       res->instructions > 0 ? (double) res->cycles/res->instructions : 1.0);
+    }
+    if (failed == 0)
+	printf("  All %d ISA Checks Succeed\n", count);
+    else
+	printf("  %d/%d ISA Checks Failed\n", failed, count);
+
+    for (i = 0; i < count; i++)
+	free(names[i]);
+    free(names);
+    munmap(results, count * sizeof(batch_result_t) + sizeof(int));
+    return failed;
+}
@@ -0,0 +1,23 @@
+/* Batch regression runner shared by the pipeline simulators.
+   Include isa.h first. */
+
+/* Outcome of checking one object file */
+typedef struct {
+    bool ran;              /* Program was loaded and simulated to the end */
+    bool match;            /* Final state agreed with the ISA model */
+    word_t cycles;
+    word_t instructions;
+} batch_result_t;
+
+/* Load, simulate and check one object file, filling in *res.
+   Must print nothing and leave the simulator ready for the next call */
+typedef void (*batch_fun_t)(char *fname, batch_result_t *res);
+
+/*
+ * Run every object file named in a manifest (one path per line, '#'
+ * starts a comment) or every .yo, .ys and .yb file in a directory, each
+ * file counting as a program of its own.  The programs are shared out
+ * among nworkers processes.  Prints one result line per program followed
+ * by a summary, and returns the number of programs that did not pass.
+ */
+int run_batch(char *list, int nworkers, batch_fun_t run_one);
@@ -0,0 +1,194 @@
+/* Branch prediction unit for the pipeline simulators: direction
+   predictors for conditional jumps and a return address stack */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+#include "bpred.h"
+
+/* Counters start weakly taken, like the default prediction */
+#define WEAK_TAKEN 2
+
+static char *bpred_names[BP_NONE] =
+    { "taken", "btfn", "bimodal", "gshare", "tournament" };
+
+bp_kind_t find_bpred(char *name)
+{
+    int k;
+    for (k = 0; k < BP_NONE; k++)
+	if (strcmp(name, bpred_names[k]) == 0)
+	    return (bp_kind_t) k;
+    return BP_NONE;
+}
+
+char *bpred_name(bp_kind_t kind)
+{
+    return kind < BP_NONE ? bpred_names[kind] : "none";
+}
+
+bpred_t new_bpred(bp_kind_t kind, int bits)
+{
+    bpred_t bp = (bpred_t) malloc(sizeof(bpred_rec));
+    word_t size = (word_t) 1 << bits;
+    bp->kind = kind;
+    bp->bits = bits;
+    bp->mask = size - 1;
+    bp->bimodal = (byte_t *) malloc(size);
+    bp->gshare = (byte_t *) malloc(size);
+    bp->chooser = (byte_t *) malloc(size);
+    reset_bpred(bp);
+    return bp;
+}
+
+void free_bpred(bpred_t bp)
+{
+    free(bp->bimodal);
+    free(bp->gshare);
+    free(bp->chooser);
+    free(bp);
+}
+
+void reset_bpred(bpred_t bp)
+{
+    word_t size = bp->mask + 1;
+    memset(bp->bimodal, WEAK_TAKEN, size);
+    memset(bp->gshare, WEAK_TAKEN, size);
+    /* Start out trusting the bimodal table, which warms up faster */
+    memset(bp->chooser, 1, size);
+    bp->history = 0;
+    bp->branches = 0;
+    bp->correct = 0;
+}
+
+void copy_bpred(bpred_t dst, bpred_t src)
+{
+    word_t size = src->mask + 1;
+    memcpy(dst->bimodal, src->bimodal, size);
+    memcpy(dst->gshare, src->gshare, size);
+    memcpy(dst->chooser, src->chooser, size);
+    dst->history = src->history;
+    dst->branches = src->branches;
+    dst->correct = src->correct;
+}
+
+static word_t bimodal_index(bpred_t bp, word_t pc)
+{
+    return pc & bp->mask;
+}
+
+static word_t gshare_index(bpred_t bp, word_t pc)
+{
+    return (pc ^ bp->history) & bp->mask;
+}
+
+/* Move a 2-bit saturating counter towards taken or not taken */
+static void train(byte_t *ctr, bool taken)
+{
+    if (taken && *ctr < 3)
+	(*ctr)++;
+    else if (!taken && *ctr > 0)
+	(*ctr)--;
+}
+
+bool bpred_predict(bpred_t bp, word_t pc, word_t target)
+{
+    switch (bp->kind) {
+    case BP_BTFN:
+	return target <= pc;
+    case BP_BIMODAL:
+	return bp->bimodal[bimodal_index(bp, pc)] >= 2;
+    case BP_GSHARE:
+	return bp->gshare[gshare_index(bp, pc)] >= 2;
+    case BP_TOURNAMENT:
+	if (bp->chooser[bimodal_index(bp, pc)] >= 2)
+	    return bp->gshare[gshare_index(bp, pc)] >= 2;
+	return bp->bimodal[bimodal_index(bp, pc)] >= 2;
+    case BP_TAKEN:
+    default:
+	return true;
+    }
+}
+
+void bpred_update(bpred_t bp, word_t pc, bool predicted, bool taken)
+{
+    byte_t *bim = &bp->bimodal[bimodal_index(bp, pc)];
+    byte_t *gsh = &bp->gshare[gshare_index(bp, pc)];
+
+    bp->branches++;
+    if (predicted == taken)
+	bp->correct++;
+
+    /* The chooser learns only when the two tables disagree */
+    if (bp->kind == BP_TOURNAMENT && (*bim >= 2) != (*gsh >= 2))
+	train(&bp->chooser[bimodal_index(bp, pc)], (*gsh >= 2) == taken);
+    train(bim, taken);
+    train(gsh, taken);
+    bp->history = ((bp->history << 1) | taken) & bp->mask;
+}
+
+ras_t new_ras(int depth)
+{
+    ras_t r = (ras_t) malloc(sizeof(ras_rec));
+    r->depth = depth;
+    r->addrs = (word_t *) calloc(depth, sizeof(word_t));
+    reset_ras(r);
+    return r;
+}
+
+void free_ras(ras_t r)
+{
+    free(r->addrs);
+    free(r);
+}
+
+void reset_ras(ras_t r)
+{
+    r->top = 0;
+    r->count = 0;
+    r->hits = 0;
+    r->misses = 0;
+    r->empty = 0;
+}
+
+void copy_ras(ras_t dst, ras_t src)
+{
+    memcpy(dst->addrs, src->addrs, src->depth * sizeof(word_t));
+    dst->top = src->top;
+    dst->count = src->count;
+    dst->hits = src->hits;
+    dst->misses = src->misses;
+    dst->empty = src->empty;
+}
+
+bool ras_peek(ras_t r, word_t *addrp)
+{
+    if (r->count == 0)
+	return false;
+    *addrp = r->addrs[(r->top + r->depth - 1) % r->depth];
+    return true;
+}
+
+void ras_push(ras_t r, word_t addr)
+{
+    r->addrs[r->top] = addr;
+    r->top = (r->top + 1) % r->depth;
+    if (r->count < r->depth)
+	r->count++;
+}
+
+void ras_pop(ras_t r)
+{
+    if (r->count == 0)
+	return;
+    r->top = (r->top + r->depth - 1) % r->depth;
+    r->count--;
+}
+
+void ras_unpop(ras_t r)
+{
+    r->top = (r->top + 1) % r->depth;
+    if (r->count < r->depth)
+	r->count++;
+}
@@ -0,0 +1,75 @@
+/* Branch prediction unit for the pipeline simulators.
+   Include isa.h first. */
+
+/* Kinds of predictor */
+typedef enum {
+    BP_TAKEN,           /* Always taken, as in the textbook PIPE */
+    BP_BTFN,            /* Backward taken, forward not taken */
+    BP_BIMODAL,         /* 2-bit counters indexed by PC */
+    BP_GSHARE,          /* 2-bit counters indexed by PC xor global history */
+    BP_TOURNAMENT,      /* Bimodal and gshare, with a chooser per PC */
+    BP_NONE
+} bp_kind_t;
+
+typedef struct {
+    bp_kind_t kind;
+    int bits;           /* Each table has 2^bits entries */
+    word_t mask;
+    byte_t *bimodal;
+    byte_t *gshare;
+    byte_t *chooser;    /* 2 or more: trust gshare */
+    word_t history;     /* Outcomes of recent branches, newest in bit 0 */
+    word_t branches;    /* Jumps resolved */
+    word_t correct;     /* Of those, predicted correctly */
+} bpred_rec, *bpred_t;
+
+/* Find a predictor kind by name.  Returns BP_NONE if there is none */
+bp_kind_t find_bpred(char *name);
+char *bpred_name(bp_kind_t kind);
+
+bpred_t new_bpred(bp_kind_t kind, int bits);
+void free_bpred(bpred_t bp);
+
+/* Forget all history and statistics */
+void reset_bpred(bpred_t bp);
+
+/* Copy the tables, history and statistics of src into dst, which has
+   the same kind and size */
+void copy_bpred(bpred_t dst, bpred_t src);
+
+/* Predict whether the conditional jump at pc to target is taken */
+bool bpred_predict(bpred_t bp, word_t pc, word_t target);
+
+/* Train on the outcome of the jump at pc, once it is resolved, given
+   what was predicted for it at fetch.  The global history is updated
+   here rather than speculatively at fetch, so a prediction made while
+   an older jump is unresolved sees slightly stale history */
+void bpred_update(bpred_t bp, word_t pc, bool predicted, bool taken);
+
+/* Return address stack.  Entries live in a circular buffer, so calls
+   nested deeper than the stack lose the oldest return addresses */
+typedef struct {
+    int depth;
+    word_t *addrs;
+    int top;            /* Slot the next push fills */
+    int count;          /* Valid entries, at most depth */
+    word_t hits;        /* Returns predicted correctly */
+    word_t misses;      /* Returns predicted wrongly */
+    word_t empty;       /* Returns fetched with the stack empty */
+} ras_rec, *ras_t;
+
+ras_t new_ras(int depth);
+void free_ras(ras_t r);
+void reset_ras(ras_t r);
+
+/* Copy the entries and statistics of src into dst, of the same depth */
+void copy_ras(ras_t dst, ras_t src);
+
+/* Get the address on top of the stack.  Returns false if it is empty */
+bool ras_peek(ras_t r, word_t *addrp);
+void ras_push(ras_t r, word_t addr);
+void ras_pop(ras_t r);
+
+/* Undo a pop made for a ret that was squashed.  The entry is still in
+   the buffer unless a later squashed call overwrote it */
+void ras_unpop(ras_t r);
@@ -0,0 +1,268 @@
+/* Breakpoints and watchpoints for the interactive simulators */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+#include "script.h"
+#include "breaks.h"
+
+#define BREAK_BIT(pc) ((uword_t) (pc) & ((1<<BREAK_MAP_BITS)-1))
+
+break_t new_breaks(symtab_t syms)
+{
+    break_t b = (break_t) calloc(1, sizeof(break_rec));
+    b->mem_watch = new_watch();
+    b->reg_watch = new_watch();
+    b->syms = syms;
+    b->out = stdout;
+    return b;
+}
+
+void free_breaks(break_t b)
+{
+    free_watch(b->mem_watch);
+    free_watch(b->reg_watch);
+    free((void *) b);
+}
+
+void attach_breaks(break_t b, mem_t mem, mem_t reg)
+{
+    mem->watch = b->mem_watch;
+    reg->watch = b->reg_watch;
+    b->mem_len = mem->len;
+}
+
+static void say(break_t b, const char *format, ...)
+{
+    va_list ap;
+    if (!b->out)
+	return;
+    va_start(ap, format);
+    vfprintf(b->out, format, ap);
+    va_end(ap);
+}
+
+static void map_breaks(break_t b)
+{
+    int i;
+    memset(b->map, 0, sizeof(b->map));
+    for (i = 0; i < b->count; i++)
+	b->map[BREAK_BIT(b->pc[i]) >> 3] |= 1 << (BREAK_BIT(b->pc[i]) & 7);
+}
+
+/* Address of a label or number.  Returns false if arg is neither */
+static bool parse_addr(break_t b, char *arg, word_t *addrp)
+{
+    char *end;
+    int i;
+    if (b->syms) {
+	for (i = 0; i < b->syms->nsyms; i++)
+	    if (!strcmp(b->syms->syms[i].name, arg)) {
+		*addrp = b->syms->syms[i].addr;
+		return true;
+	    }
+    }
+    *addrp = (word_t) strtoull(arg, &end, 0);
+    return *arg != '\0' && *end == '\0';
+}
+
+/* Name of a data address: a label only when it is exactly one */
+static char *data_name(break_t b, word_t addr)
+{
+    symbol_t *sym = find_symbol(b->syms, addr);
+    if (sym && sym->addr == addr)
+	return pc_name(b->syms, addr);
+    return pc_name(NULL, addr);
+}
+
+static int find_break(break_t b, word_t pc)
+{
+    int i;
+    for (i = 0; i < b->count; i++)
+	if (b->pc[i] == pc)
+	    return i;
+    return -1;
+}
+
+bool add_break(break_t b, char *arg)
+{
+    word_t pc;
+    if (!parse_addr(b, arg, &pc)) {
+	say(b, "Unknown address '%s'\n", arg);
+	return false;
+    }
+    if (find_break(b, pc) < 0) {
+	if (b->count == BREAK_MAX) {
+	    say(b, "Too many breakpoints\n");
+	    return false;
+	}
+	b->pc[b->count++] = pc;
+	map_breaks(b);
+    }
+    say(b, "Breakpoint set at %s\n", pc_name(b->syms, pc));
+    return true;
+}
+
+bool add_watchpoint(break_t b, char *arg)
+{
+    reg_id_t id = find_register(arg);
+    word_t addr;
+    if (id != REG_ERR) {
+	if (!add_watch(b->reg_watch, id * 8)) {
+	    say(b, "Too many watchpoints\n");
+	    return false;
+	}
+	say(b, "Watchpoint set on %s\n", reg_name(id));
+	return true;
+    }
+    if (!parse_addr(b, arg, &addr)) {
+	say(b, "Unknown address or register '%s'\n", arg);
+	return false;
+    }
+    if (addr < 0 || addr > b->mem_len - 8) {
+	say(b, "Address 0x%llx is outside memory\n", addr);
+	return false;
+    }
+    if (!add_watch(b->mem_watch, addr)) {
+	say(b, "Too many watchpoints\n");
+	return false;
+    }
+    say(b, "Watchpoint set on %s\n", data_name(b, addr));
+    return true;
+}
+
+bool delete_break(break_t b, char *arg)
+{
+    reg_id_t id = find_register(arg);
+    word_t addr;
+    int i;
+    if (id != REG_ERR) {
+	if (!remove_watch(b->reg_watch, id * 8)) {
+	    say(b, "No watchpoint on %s\n", reg_name(id));
+	    return false;
+	}
+	say(b, "Deleted watchpoint on %s\n", reg_name(id));
+	return true;
+    }
+    if (!parse_addr(b, arg, &addr)) {
+	say(b, "Unknown address or register '%s'\n", arg);
+	return false;
+    }
+    if ((i = find_break(b, addr)) >= 0) {
+	b->pc[i] = b->pc[--b->count];
+	map_breaks(b);
+	say(b, "Deleted breakpoint at %s\n", pc_name(b->syms, addr));
+    } else if (remove_watch(b->mem_watch, addr))
+	say(b, "Deleted watchpoint on %s\n", data_name(b, addr));
+    else {
+	say(b, "No breakpoint or watchpoint at %s\n", pc_name(b->syms, addr));
+	return false;
+    }
+    return true;
+}
+
+void info_breaks(break_t b)
+{
+    int i;
+    if (b->count == 0 && b->mem_watch->count == 0 && b->reg_watch->count == 0) {
+	say(b, "No breakpoints or watchpoints\n");
+	return;
+    }
+    for (i = 0; i < b->count; i++)
+	say(b, "Breakpoint at %s\n", pc_name(b->syms, b->pc[i]));
+    for (i = 0; i < b->reg_watch->count; i++)
+	say(b, "Watchpoint on %s\n", reg_name(b->reg_watch->addr[i] / 8));
+    for (i = 0; i < b->mem_watch->count; i++)
+	say(b, "Watchpoint on %s\n", data_name(b, b->mem_watch->addr[i]));
+}
+
+void json_breaks(json_t j, break_t b)
+{
+    int i;
+    json_open_list(j, "breakpoints");
+    for (i = 0; i < b->count; i++)
+	json_int(j, NULL, b->pc[i]);
+    json_close_list(j);
+    json_open_list(j, "watch_registers");
+    for (i = 0; i < b->reg_watch->count; i++)
+	json_string(j, NULL, reg_name(b->reg_watch->addr[i] / 8));
+    json_close_list(j);
+    json_open_list(j, "watch_memory");
+    for (i = 0; i < b->mem_watch->count; i++)
+	json_int(j, NULL, b->mem_watch->addr[i]);
+    json_close_list(j);
+}
+
+void json_break_why(json_t j, break_t b)
+{
+    switch (b->why) {
+    case BREAK_PC:
+	json_string(j, "stop", "breakpoint");
+	json_int(j, "pc", b->why_addr);
+	break;
+    case BREAK_REG:
+	json_string(j, "stop", "watchpoint");
+	json_string(j, "reg", reg_name(b->why_addr / 8));
+	json_int(j, "old", b->why_old);
+	json_int(j, "new", b->why_new);
+	break;
+    case BREAK_MEM:
+	json_string(j, "stop", "watchpoint");
+	json_int(j, "addr", b->why_addr);
+	json_int(j, "old", b->why_old);
+	json_int(j, "new", b->why_new);
+	break;
+    default:
+	break;
+    }
+}
+
+void clear_break_hits(break_t b)
+{
+    b->mem_watch->hit = false;
+    b->reg_watch->hit = false;
+    b->why = BREAK_NONE;
+}
+
+/* Note the first reason a run stopped */
+static void stop_why(break_t b, break_why_t why, word_t addr, word_t old, word_t new)
+{
+    if (b->why != BREAK_NONE)
+	return;
+    b->why = why;
+    b->why_addr = addr;
+    b->why_old = old;
+    b->why_new = new;
+}
+
+bool break_check(break_t b, word_t pc, bool again)
+{
+    bool stop = false;
+    watch_t w = b->reg_watch;
+    if (w->hit) {
+	say(b, "Watchpoint %s: 0x%llx -> 0x%llx\n", reg_name(w->hit_addr / 8),
+	    w->hit_old, w->hit_new);
+	stop_why(b, BREAK_REG, w->hit_addr, w->hit_old, w->hit_new);
+	w->hit = false;
+	stop = true;
+    }
+    w = b->mem_watch;
+    if (w->hit) {
+	say(b, "Watchpoint %s: 0x%llx -> 0x%llx\n", data_name(b, w->hit_addr),
+	    w->hit_old, w->hit_new);
+	stop_why(b, BREAK_MEM, w->hit_addr, w->hit_old, w->hit_new);
+	w->hit = false;
+	stop = true;
+    }
+    if (b->count > 0 && !again &&
+	(b->map[BREAK_BIT(pc) >> 3] & (1 << (BREAK_BIT(pc) & 7))) &&
+	find_break(b, pc) >= 0) {
+	say(b, "Breakpoint at %s\n", pc_name(b->syms, pc));
+	stop_why(b, BREAK_PC, pc, 0, 0);
+	stop = true;
+    }
+    return stop;
+}
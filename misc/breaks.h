@@ -0,0 +1,67 @@
+/* Breakpoints and watchpoints for the interactive simulators.  Include
+   isa.h and script.h first.
+
+   Breakpoints are PCs, tested against a bitmap indexed by the PC's low
+   bits so that a run with none set, or far from one, pays a single
+   test per cycle.  Watchpoints are words of memory or registers of the
+   register file; the writes themselves notice changes (see watch_rec in
+   isa.h). */
+
+#define BREAK_MAX 64
+#define BREAK_MAP_BITS 12
+
+typedef enum { BREAK_NONE, BREAK_PC, BREAK_REG, BREAK_MEM } break_why_t;
+
+typedef struct {
+    int count;
+    word_t pc[BREAK_MAX];
+    byte_t map[(1<<BREAK_MAP_BITS)/8];
+    watch_t mem_watch;          /* Watched words of memory */
+    word_t mem_len;             /* Size of the memory watched */
+    watch_t reg_watch;          /* Watched registers, as words of the
+				   register file */
+    symtab_t syms;              /* For labels, or NULL */
+    FILE *out;                  /* Where messages go, or NULL */
+    /* Why break_check last stopped a run */
+    break_why_t why;
+    word_t why_addr;            /* PC, register id or address */
+    word_t why_old;
+    word_t why_new;
+} break_rec, *break_t;
+
+break_t new_breaks(symtab_t syms);
+void free_breaks(break_t b);
+
+/* Note changes to the watched words of mem and reg.  Call before
+   setting watchpoints, and again whenever the simulator replaces
+   either */
+void attach_breaks(break_t b, mem_t mem, mem_t reg);
+
+/* Commands.  Each takes its argument as typed, explains itself on
+   b->out and returns false if it failed.  A breakpoint is an address
+   or label; a watchpoint is also one, or a register such as %rax.
+   delete removes either */
+bool add_break(break_t b, char *arg);
+bool add_watchpoint(break_t b, char *arg);
+bool delete_break(break_t b, char *arg);
+void info_breaks(break_t b);
+
+/* The breakpoints and watchpoints, and why the last run stopped, as
+   members of the current JSON object */
+void json_breaks(json_t j, break_t b);
+void json_break_why(json_t j, break_t b);
+
+/* Forget changes seen while not running, such as when replaying, and
+   why the last run stopped */
+void clear_break_hits(break_t b);
+
+/* Call after each cycle or step with the PC just fetched, and again
+   true if fetch stalled and fetched the same instruction once more.
+   True if the run should stop, after saying why and noting it in
+   b->why.  A breakpoint is hit each time an instruction is fetched
+   there, so a loop of one instruction stops on every pass, but not
+   again while fetch stalls */
+bool break_check(break_t b, word_t pc, bool again);
+
+#define BREAK_STOP(b, pc, again) \
+    (((b)->count > 0 || (b)->mem_watch->hit || (b)->reg_watch->hit) && break_check(b, pc, again))
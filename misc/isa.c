@@ -7,8 +7,6 @@
 #include "isa.h"
 #ifdef CACHE_ENABLED
 #include "cache.h"
-
-extern cache_t* cache;
 #endif
 
 /* Bytes Per Line = Block size of memory */
@@ -137,34 +135,304 @@ instr_ptr bad_instr()
 }
 
 
-mem_t init_mem(int len)
+/* Reference counting for shared (copy-on-write) parts of a memory */
+static void release_table(page_table_t t)
+{
+    int j;
+    if (--t->refs > 0)
+	return;
+    for (j = 0; j < PT_ENTRIES; j++)
+	if (t->pages[j] && --t->pages[j]->refs == 0)
+	    free((void *) t->pages[j]);
+    free((void *) t);
+}
+
+static page_dir_t new_dir(int size)
+{
+    page_dir_t d = (page_dir_t) malloc(sizeof(page_dir_rec));
+    d->refs = 1;
+    d->size = size;
+    d->count = 0;
+    d->slots = (page_table_t *) calloc(size, sizeof(page_table_t));
+    return d;
+}
+
+static void release_dir(page_dir_t d)
+{
+    int i;
+    if (--d->refs > 0)
+	return;
+    for (i = 0; i < d->size; i++)
+	if (d->slots[i])
+	    release_table(d->slots[i]);
+    free((void *) d->slots);
+    free((void *) d);
+}
+
+/* Directory slot for page table key */
+static int dir_slot(page_dir_t d, uword_t key)
+{
+    int mask = d->size - 1;
+    int i = (int) ((key * 0x9E3779B97F4A7C15ULL) >> 40) & mask;
+    while (d->slots[i] && d->slots[i]->key != key)
+	i = (i + 1) & mask;
+    return i;
+}
+
+/* Make sure m is the only user of its directory before changing it */
+static void own_dir(mem_t m)
+{
+    page_dir_t d = m->dir;
+    int i;
+    if (d->refs == 1)
+	return;
+    m->dir = new_dir(d->size);
+    m->dir->count = d->count;
+    for (i = 0; i < d->size; i++) {
+	if ((m->dir->slots[i] = d->slots[i]))
+	    d->slots[i]->refs++;
+    }
+    release_dir(d);
+}
+
+/* Find page table for key.  When alloc is set, the table is created if
+   needed and is private to m, so that its pages can be replaced */
+static page_table_t find_table(mem_t m, uword_t key, bool alloc)
+{
+    int i;
+    page_dir_t d;
+    page_table_t t;
+    if (m->last && m->last->key == key &&
+	(!alloc || (m->dir->refs == 1 && m->last->refs == 1)))
+	return m->last;
+    if (alloc)
+	own_dir(m);
+    d = m->dir;
+    i = dir_slot(d, key);
+    t = d->slots[i];
+    if (!t && alloc) {
+	if (2 * (d->count + 1) > d->size) {
+	    /* Grow directory and rehash */
+	    page_table_t *oldslots = d->slots;
+	    int oldsize = d->size;
+	    int j;
+	    d->size *= 2;
+	    d->slots = (page_table_t *) calloc(d->size, sizeof(page_table_t));
+	    for (j = 0; j < oldsize; j++)
+		if (oldslots[j])
+		    d->slots[dir_slot(d, oldslots[j]->key)] = oldslots[j];
+	    free((void *) oldslots);
+	    i = dir_slot(d, key);
+	}
+	t = (page_table_t) calloc(1, sizeof(page_table_rec));
+	t->refs = 1;
+	t->key = key;
+	d->slots[i] = t;
+	d->count++;
+    } else if (t && alloc && t->refs > 1) {
+	/* Table is shared with a copy.  Duplicate it */
+	page_table_t nt = (page_table_t) malloc(sizeof(page_table_rec));
+	int j;
+	memcpy(nt, t, sizeof(page_table_rec));
+	nt->refs = 1;
+	for (j = 0; j < PT_ENTRIES; j++)
+	    if (nt->pages[j])
+		nt->pages[j]->refs++;
+	release_table(t);
+	d->slots[i] = t = nt;
+    }
+    if (t)
+	m->last = t;
+    return t;
+}
+
+/* Find page holding address pos.  Returns NULL for a page that has
+   never been written, unless alloc is set, in which case the page is
+   created or unshared so that it can be written */
+static byte_t *find_page(mem_t m, uword_t pos, bool alloc)
+{
+    uword_t pnum = pos >> PAGE_BITS;
+    page_table_t t = find_table(m, pnum >> PT_BITS, alloc);
+    page_t *pp;
+    if (!t)
+	return NULL;
+    pp = &t->pages[pnum & (PT_ENTRIES-1)];
+    if (alloc) {
+	if (!*pp) {
+	    *pp = (page_t) calloc(1, sizeof(page_rec));
+	    (*pp)->refs = 1;
+	} else if ((*pp)->refs > 1) {
+	    page_t np = (page_t) malloc(sizeof(page_rec));
+	    memcpy(np->bytes, (*pp)->bytes, PAGE_SIZE);
+	    np->refs = 1;
+	    (*pp)->refs--;
+	    *pp = np;
+	}
+    }
+    return *pp ? (*pp)->bytes : NULL;
+}
+
+/* Unchecked byte and word accessors.  Callers check bounds */
+static byte_t read_byte(mem_t m, uword_t pos)
+{
+    byte_t *page = find_page(m, pos, false);
+    return page ? page[pos & (PAGE_SIZE-1)] : 0;
+}
+
+static void write_byte(mem_t m, uword_t pos, byte_t val)
+{
+    find_page(m, pos, true)[pos & (PAGE_SIZE-1)] = val;
+}
+
+static word_t read_word(mem_t m, uword_t pos)
+{
+    int i;
+    word_t val = 0;
+    int off = pos & (PAGE_SIZE-1);
+    if (off + 8 <= PAGE_SIZE) {
+	byte_t *page = find_page(m, pos, false);
+	if (!page)
+	    return 0;
+	for (i = 0; i < 8; i++) {
+	    word_t b = page[off+i] & 0xFF;
+	    val = val | (b <<(8*i));
+	}
+    } else {
+	/* Word straddles two pages */
+	for (i = 0; i < 8; i++) {
+	    word_t b = read_byte(m, pos+i) & 0xFF;
+	    val = val | (b <<(8*i));
+	}
+    }
+    return val;
+}
+
+static void write_word(mem_t m, uword_t pos, word_t val)
+{
+    int i;
+    int off = pos & (PAGE_SIZE-1);
+    if (off + 8 <= PAGE_SIZE) {
+	byte_t *page = find_page(m, pos, true);
+	for (i = 0; i < 8; i++) {
+	    page[off+i] = (byte_t) val & 0xFF;
+	    val >>= 8;
+	}
+    } else {
+	for (i = 0; i < 8; i++) {
+	    write_byte(m, pos+i, (byte_t) val & 0xFF);
+	    val >>= 8;
+	}
+    }
+}
+
+static int compare_uword(const void *a, const void *b)
+{
+    uword_t x = *(const uword_t *) a;
+    uword_t y = *(const uword_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Sort the n page numbers in pnums and drop repeats.  Returns how
+   many are left */
+static size_t unique_pages(uword_t *pnums, size_t n)
+{
+    size_t i, count = 0;
+    qsort(pnums, n, sizeof(uword_t), compare_uword);
+    for (i = 0; i < n; i++)
+	if (count == 0 || pnums[count-1] != pnums[i])
+	    pnums[count++] = pnums[i];
+    return count;
+}
+
+/* Collect sorted numbers of pages written in either memory.  With
+   skip_shared set, pages that a and b still share are left out, since
+   their contents must be equal.  Caller frees result */
+static uword_t *touched_pages(mem_t a, mem_t b, bool skip_shared, size_t *countp)
+{
+    mem_t ms[2] = { a, b };
+    size_t count = 0, n = 0;
+    uword_t *pnums;
+    int k, d, j;
+    if (skip_shared && a->dir == b->dir) {
+	*countp = 0;
+	return (uword_t *) malloc(sizeof(uword_t));
+    }
+    for (k = 0; k < 2; k++)
+	count += (size_t) ms[k]->dir->count * PT_ENTRIES;
+    pnums = (uword_t *) malloc((count ? count : 1) * sizeof(uword_t));
+    for (k = 0; k < 2; k++) {
+	mem_t other = ms[1-k];
+	for (d = 0; d < ms[k]->dir->size; d++) {
+	    page_table_t t = ms[k]->dir->slots[d];
+	    page_table_t ot;
+	    if (!t)
+		continue;
+	    ot = skip_shared ? find_table(other, t->key, false) : NULL;
+	    if (ot == t)
+		continue;
+	    for (j = 0; j < PT_ENTRIES; j++)
+		if (t->pages[j] && !(ot && ot->pages[j] == t->pages[j]))
+		    pnums[n++] = (t->key << PT_BITS) | j;
+	}
+    }
+    *countp = unique_pages(pnums, n);
+    return pnums;
+}
+
+mem_t init_mem(word_t len)
 {
 
     mem_t result = (mem_t) malloc(sizeof(mem_rec));
     len = ((len+BPL-1)/BPL)*BPL;
     result->len = len;
-    result->contents = (byte_t *) calloc(len, 1);
+    result->maxaddr = 0;
+    result->dir = new_dir(16);
+    result->last = NULL;
+    result->watch = NULL;
     return result;
 }
 
 void clear_mem(mem_t m)
 {
-    memset(m->contents, 0, m->len);
+    release_dir(m->dir);
+    m->dir = new_dir(16);
+    m->last = NULL;
 }
 
 void free_mem(mem_t m)
 {
-    free((void *) m->contents);
+    release_dir(m->dir);
     free((void *) m);
 }
 
 mem_t copy_mem(mem_t oldm)
 {
-    mem_t newm = init_mem(oldm->len);
-    memcpy(newm->contents, oldm->contents, oldm->len);
+    mem_t newm = (mem_t) malloc(sizeof(mem_rec));
+    newm->len = oldm->len;
+    newm->maxaddr = oldm->maxaddr;
+    newm->dir = oldm->dir;
+    newm->dir->refs++;
+    newm->last = NULL;
+    newm->watch = NULL;
     return newm;
 }
 
+void copy_pages(mem_t dst, mem_t src)
+{
+    int d, j;
+    for (d = 0; d < src->dir->size; d++) {
+	page_table_t t = src->dir->slots[d];
+	if (!t)
+	    continue;
+	for (j = 0; j < PT_ENTRIES; j++) {
+	    word_t pos = (word_t) (((t->key << PT_BITS) | j) << PAGE_BITS);
+	    if (t->pages[j] && pos < dst->len)
+		load_bytes(dst, pos, t->pages[j]->bytes,
+			   dst->len - pos < PAGE_SIZE ? dst->len - pos : PAGE_SIZE);
+	}
+    }
+}
+
 int hex2dig(char c)
 {
     if (isdigit((int)c))
@@ -175,8 +443,164 @@ int hex2dig(char c)
 	return c - 'a' + 10;
 }
 
+bool load_bytes(mem_t m, word_t pos, byte_t *src, word_t len)
+{
+    if (pos < 0 || len < 0 || pos > m->len - len)
+	return false;
+    while (len > 0) {
+	word_t off = pos & (PAGE_SIZE-1);
+	word_t chunk = PAGE_SIZE - off < len ? PAGE_SIZE - off : len;
+	memcpy(find_page(m, pos, true) + off, src, chunk);
+	pos += chunk;
+	src += chunk;
+	len -= chunk;
+    }
+    return true;
+}
+
 #define LINELEN 4096
-int load_mem(mem_t m, FILE *infile, int report_error)
+
+symtab_t new_symtab()
+{
+    symtab_t t = (symtab_t) calloc(1, sizeof(symtab_rec));
+    return t;
+}
+
+void clear_symtab(symtab_t t)
+{
+    int i;
+    for (i = 0; i < t->nsyms; i++)
+	free(t->syms[i].name);
+    for (i = 0; i < t->nlines; i++)
+	free(t->lines[i].text);
+    t->nsyms = 0;
+    t->nlines = 0;
+}
+
+void free_symtab(symtab_t t)
+{
+    clear_symtab(t);
+    free(t->syms);
+    free(t->lines);
+    free(t);
+}
+
+/* Programs are loaded in address order, so entries nearly always go
+   at the end.  Entries with equal addresses keep the order they were
+   added in. */
+void add_symbol(symtab_t t, word_t addr, char *name)
+{
+    int i;
+    if (t->nsyms == t->maxsyms) {
+	t->maxsyms = t->maxsyms ? 2 * t->maxsyms : 64;
+	t->syms = (symbol_t *) realloc(t->syms, t->maxsyms * sizeof(symbol_t));
+    }
+    for (i = t->nsyms; i > 0 && t->syms[i-1].addr > addr; i--)
+	t->syms[i] = t->syms[i-1];
+    t->syms[i].addr = addr;
+    t->syms[i].name = strdup(name);
+    t->nsyms++;
+}
+
+void add_src_line(symtab_t t, word_t addr, int lineno, char *text)
+{
+    int i;
+    if (t->nlines == t->maxlines) {
+	t->maxlines = t->maxlines ? 2 * t->maxlines : 256;
+	t->lines = (src_line_t *) realloc(t->lines, t->maxlines * sizeof(src_line_t));
+    }
+    for (i = t->nlines; i > 0 && t->lines[i-1].addr > addr; i--)
+	t->lines[i] = t->lines[i-1];
+    t->lines[i].addr = addr;
+    t->lines[i].lineno = lineno;
+    t->lines[i].text = strdup(text);
+    t->nlines++;
+}
+
+symbol_t *find_symbol(symtab_t t, word_t addr)
+{
+    int lo = 0, hi, mid;
+    if (!t)
+	return NULL;
+    /* Find the first symbol above addr; the one before it is the answer */
+    hi = t->nsyms;
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (t->syms[mid].addr <= addr)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    if (lo == 0)
+	return NULL;
+    /* Of several labels on one address, use the first */
+    while (lo > 1 && t->syms[lo-2].addr == t->syms[lo-1].addr)
+	lo--;
+    return &t->syms[lo-1];
+}
+
+src_line_t *find_src_line(symtab_t t, word_t addr)
+{
+    int lo = 0, hi, mid;
+    if (!t)
+	return NULL;
+    hi = t->nlines;
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (t->lines[mid].addr < addr)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    if (lo == t->nlines || t->lines[lo].addr != addr)
+	return NULL;
+    return &t->lines[lo];
+}
+
+char *pc_name(symtab_t t, word_t addr)
+{
+    static _Thread_local char buf[LINELEN];
+    symbol_t *sym = find_symbol(t, addr);
+    if (!sym)
+	snprintf(buf, sizeof(buf), "0x%llx", addr);
+    else if (sym->addr == addr)
+	snprintf(buf, sizeof(buf), "0x%llx <%s>", addr, sym->name);
+    else
+	snprintf(buf, sizeof(buf), "0x%llx <%s+0x%llx>", addr, sym->name, addr - sym->addr);
+    return buf;
+}
+
+/* Record the comment column of a .yo line, which holds the source
+   that produced it.  A label at its start becomes a symbol; a line
+   that placed bytes at [pos, endpos) becomes a source line. */
+static void add_source(symtab_t syms, char *buf, word_t pos, word_t endpos,
+		       int lineno)
+{
+    char *src = strchr(buf, '|');
+    char *name, *end;
+    if (!src)
+	return;
+    src++;
+    while (isspace((int)*src))
+	src++;
+    end = src + strlen(src);
+    while (end > src && isspace((int)end[-1]))
+	end--;
+    *end = '\0';
+
+    name = src;
+    while (isalnum((int)*src) || *src == '_' || *src == '.')
+	src++;
+    if (src > name && *src == ':') {
+	*src = '\0';
+	add_symbol(syms, pos, name);
+	*src = ':';
+    }
+    if (endpos > pos)
+	add_src_line(syms, pos, lineno, name);
+}
+
+int load_mem(mem_t m, symtab_t syms, FILE *infile, int report_error)
 {
     /* Read contents of .yo file */
     char buf[LINELEN];
@@ -184,6 +608,7 @@ int load_mem(mem_t m, FILE *infile, int report_error)
     int byte_cnt = 0;
     int lineno = 0;
     word_t bytepos = 0; 
+    word_t linepos;
     while (fgets(buf, LINELEN, infile)) {
 	int cpos = 0;
 	lineno++;
@@ -202,6 +627,7 @@ int load_mem(mem_t m, FILE *infile, int report_error)
 	    cpos++;
 	    bytepos = bytepos*16 + hex2dig(c);
 	}
+	linepos = bytepos;
 
 	while (isspace((int)buf[cpos]))
 	    cpos++;
@@ -233,72 +659,211 @@ int load_mem(mem_t m, FILE *infile, int report_error)
 		return 0;
 	    }
 	    byte = hex2dig(ch)*16+hex2dig(cl);
-	    m->contents[bytepos++] = byte;
+	    write_byte(m, bytepos++, byte);
 	    byte_cnt++;
 	}
+
+	if (syms)
+	    add_source(syms, buf, linepos, bytepos, lineno);
     }
     return byte_cnt;
 }
 
+watch_t new_watch()
+{
+    return (watch_t) calloc(1, sizeof(watch_rec));
+}
+
+void free_watch(watch_t w)
+{
+    free((void *) w);
+}
+
+/* Bit of the watch map for the 8-byte block holding pos */
+#define WATCH_BIT(pos) (((uword_t) (pos) >> 3) & ((1<<WATCH_MAP_BITS)-1))
+
+static void map_watch(watch_t w)
+{
+    int i;
+    memset(w->map, 0, sizeof(w->map));
+    for (i = 0; i < w->count; i++) {
+	word_t a = w->addr[i];
+	w->map[WATCH_BIT(a) >> 3] |= 1 << (WATCH_BIT(a) & 7);
+	w->map[WATCH_BIT(a+7) >> 3] |= 1 << (WATCH_BIT(a+7) & 7);
+    }
+}
+
+bool add_watch(watch_t w, word_t addr)
+{
+    int i;
+    for (i = 0; i < w->count; i++)
+	if (w->addr[i] == addr)
+	    return true;
+    if (w->count == WATCH_MAX)
+	return false;
+    w->addr[w->count++] = addr;
+    map_watch(w);
+    return true;
+}
+
+bool remove_watch(watch_t w, word_t addr)
+{
+    int i;
+    for (i = 0; i < w->count; i++)
+	if (w->addr[i] == addr) {
+	    w->addr[i] = w->addr[--w->count];
+	    map_watch(w);
+	    return true;
+	}
+    return false;
+}
+
+/* Might writing len bytes at pos change a watched word? */
+static bool watch_near(watch_t w, word_t pos, int len)
+{
+    return (w->map[WATCH_BIT(pos) >> 3] & (1 << (WATCH_BIT(pos) & 7))) ||
+	(w->map[WATCH_BIT(pos+len-1) >> 3] & (1 << (WATCH_BIT(pos+len-1) & 7)));
+}
+
+static bool watch_overlaps(watch_t w, int i, word_t pos, int len)
+{
+    return w->addr[i] < pos + len && pos < w->addr[i] + 8;
+}
+
+/* A watched word as the program sees it.  With a cache, stores only
+   reach memory when a block is evicted */
+static word_t watch_read(mem_t m, void *cache, word_t addr)
+{
+    word_t val = 0;
+#ifdef CACHE_ENABLED
+    if (cache) {
+	peek_word_val_D((struct cache *) cache, m, addr, &val);
+	return val;
+    }
+#endif
+    if (addr >= 0 && addr <= m->len - 8)
+	val = read_word(m, addr);
+    return val;
+}
+
+/* Call before and after writing len bytes at pos when watch_near says
+   the write might change a watched word */
+static void watch_before(mem_t m, void *cache, word_t pos, int len)
+{
+    watch_t w = m->watch;
+    int i;
+    for (i = 0; i < w->count; i++)
+	if (watch_overlaps(w, i, pos, len))
+	    w->old[i] = watch_read(m, cache, w->addr[i]);
+}
+
+static void watch_after(mem_t m, void *cache, word_t pos, int len)
+{
+    watch_t w = m->watch;
+    int i;
+    for (i = 0; i < w->count; i++) {
+	word_t val;
+	if (!watch_overlaps(w, i, pos, len))
+	    continue;
+	val = watch_read(m, cache, w->addr[i]);
+	if (val != w->old[i] && !w->hit) {
+	    w->hit = true;
+	    w->hit_addr = w->addr[i];
+	    w->hit_old = w->old[i];
+	    w->hit_new = val;
+	}
+    }
+}
+
 #ifdef CACHE_ENABLED
 
 static bool get_byte_val(mem_t m, word_t pos, byte_t *dest)
 {
     if (pos < 0 || pos >= m->len)
 	return false;
-    *dest = m->contents[pos];
+    *dest = read_byte(m, pos);
     return true;
 }
 
 static bool get_word_val(mem_t m, word_t pos, word_t *dest)
 {
-    int i;
-    word_t val;
-    if (pos < 0 || pos + 8 > m->len)
+    if (pos < 0 || pos > m->len - 8)
 	return false;
-    val = 0;
-    for (i = 0; i < 8; i++) {
-	word_t b =  m->contents[pos+i] & 0xFF;
-	val = val | (b <<(8*i));
-    }
-    *dest = val;
+    *dest = read_word(m, pos);
     return true;
 }
 
 static bool set_word_val(mem_t m, word_t pos, word_t val)
 {
-    int i;
-    if (pos < 0 || pos + 8 > m->len)
+    if (pos < 0 || pos > m->len - 8)
 	return false;
-    for (i = 0; i < 8; i++) {
-	m->contents[pos+i] = (byte_t) val & 0xFF;
-	val >>= 8;
-    }
+    if (m->watch && watch_near(m->watch, pos, 8)) {
+	watch_before(m, NULL, pos, 8);
+	write_word(m, pos, val);
+	watch_after(m, NULL, pos, 8);
+    } else
+	write_word(m, pos, val);
     return true;
 }
 
-bool diff_mem(mem_t oldm, mem_t newm, FILE *outfile, bool check_cache)
+/* Add the pages under the blocks held in cache to the *countp sorted
+   page numbers in pnums.  Returns the new array */
+static uword_t *cached_pages(cache_t *cache, uword_t *pnums, size_t *countp)
+{
+    uword_t B = (uword_t) 1 << cache->b;
+    size_t lines = ((size_t) 1 << cache->s) * cache->E;
+    size_t n = *countp;
+    uword_t set, addr, p;
+    unsigned int e;
+    pnums = (uword_t *) realloc(pnums, (n + lines * (B / PAGE_SIZE + 1)) * sizeof(uword_t));
+    for (set = 0; set < ((uword_t) 1 << cache->s); set++) {
+	for (e = 0; e < cache->E; e++) {
+	    cache_line_t *line = &cache->sets[set].lines[e];
+	    if (!line->valid)
+		continue;
+	    addr = (line->tag << (cache->s + cache->b)) | (set << cache->b);
+	    for (p = addr >> PAGE_BITS; p <= (addr + B - 1) >> PAGE_BITS; p++)
+		pnums[n++] = p;
+	}
+    }
+    *countp = unique_pages(pnums, n);
+    return pnums;
+}
+
+bool diff_mem(mem_t oldm, mem_t newm, FILE *outfile, cache_t *cache)
 {
     word_t pos;
-    int len = oldm->len;
+    word_t len = oldm->len;
     bool diff = false;
+    size_t i, npages;
+    uword_t *pnums;
     if (newm->len < len)
 	len = newm->len;
 
-    for (pos = 0; (!diff || outfile) && pos < len; pos += 8) {
-        word_t ov = 0;  word_t nv = 0;
-		if(check_hit(cache, pos, false) && check_cache) {
+    /* Pages that neither memory wrote cannot differ in memory, so only
+       those and the pages under blocks in the cache need a look.  Reads
+       that fill the cache leave memory's pages shared */
+    pnums = touched_pages(oldm, newm, true, &npages);
+    if (cache)
+	pnums = cached_pages(cache, pnums, &npages);
+    for (i = 0; (!diff || outfile) && i < npages; i++) {
+	word_t start = pnums[i] << PAGE_BITS;
+	for (pos = start; (!diff || outfile) && pos < start + PAGE_SIZE && pos < len; pos += 8) {
+	    word_t ov = 0;  word_t nv = 0;
+		if(cache && check_hit(cache, pos, false)) {
 			get_word_cache(cache, pos, &nv);
 		} else {
 			get_word_val(newm, pos, &nv);
 		}
-	get_word_val(oldm, pos, &ov);
-	if (nv != ov) {
-	    diff = true;
-	    if (outfile)
-		fprintf(outfile, "0x%.4llx:\t0x%.16llx\t0x%.16llx\n", pos, ov, nv);
+	    get_word_val(oldm, pos, &ov);
+	    if (nv != ov) {
+		diff = true;
+		if (outfile)
+		    fprintf(outfile, "0x%.4llx:\t0x%.16llx\t0x%.16llx\n", pos, ov, nv);
+	    }
 	}
     }
+    free((void *) pnums);
     return diff;
 }
 
@@ -307,50 +872,52 @@ bool get_byte_val_I(mem_t m, word_t pos, byte_t *dest)
 {
     if (pos < 0 || pos >= m->len)
 	return false;
-    *dest = m->contents[pos];
+    *dest = read_byte(m, pos);
     return true;
 }
 
 bool get_word_val_I(mem_t m, word_t pos, word_t *dest)
 {
-    int i;
-    word_t val;
-    if (pos < 0 || pos + 8 > m->len)
+    if (pos < 0 || pos > m->len - 8)
 	return false;
-    val = 0;
-    for (i = 0; i < 8; i++) {
-	word_t b =  m->contents[pos+i] & 0xFF;
-	val = val | (b <<(8*i));
-    }
-    *dest = val;
+    *dest = read_word(m, pos);
+    return true;
+}
+
+/* Get 8 data bytes as the program sees them, without counting a
+   cache access or disturbing replacement state */
+bool peek_word_val_D(cache_t *cache, mem_t m, word_t pos, word_t *dest)
+{
+    if (pos < 0 || pos > m->len - 8)
+	return false;
+    if (get_line(cache, pos))
+	get_word_cache(cache, pos, dest);
+    else
+	*dest = read_word(m, pos);
     return true;
 }
 
 // Read and Write Cache blocks to memory.
 
-static void write_block(mem_t m, word_t pos, void *block) {
+static void write_block(cache_t *cache, mem_t m, word_t pos, void *block) {
     size_t B = pow(2, cache->b);
 	char *block_c = (char*) block;
 	for(int i = 0; i < B; i++) {
-		m->contents[pos + i] = block_c[i];
+		write_byte(m, pos + i, block_c[i]);
 	}
 }
 
-static void read_block(mem_t m, word_t pos, void *block) {
+static void read_block(cache_t *cache, mem_t m, word_t pos, void *block) {
     size_t B = pow(2, cache->b);
 	char *block_c = (char*) block;
 	for(int i = 0; i < B; i++) {
-		block_c[i] = m->contents[pos + i];
+		block_c[i] = read_byte(m, pos + i);
 	}
 }
 
-bool inflight = false;
-size_t inflight_cycles = 0;
-word_t inflight_pos = 0;
-
 // Accesses Memory. Memory has a five cycle delay unless a cache hit occurs.
 
-static mem_status_t access_memory(mem_t m, uword_t pos, operation_t operation, size_t size) {
+static mem_status_t access_memory(cache_t *cache, mem_t m, uword_t pos, operation_t operation, size_t size) {
 	
     size_t B = pow(2, cache->b);
 	uword_t current_address = pos; 
@@ -358,26 +925,26 @@ static mem_status_t access_memory(mem_t m, uword_t pos, operation_t operation, s
     for (size_t i = 0; i < size; i++) {
         if (!check_hit(cache, current_address, operation)) {
             uword_t block_address = current_address & ~(B-1);
-            if(inflight_pos != block_address || !inflight) {
-                inflight_pos = block_address;
-                inflight_cycles = cache->d;
-                inflight = true;
+            if(cache->inflight_pos != block_address || !cache->inflight) {
+                cache->inflight_pos = block_address;
+                cache->inflight_cycles = cache->d;
+                cache->inflight = true;
             }
 
-            inflight_cycles--;
-            if(inflight_cycles > 0) {
+            cache->inflight_cycles--;
+            if(cache->inflight_cycles > 0) {
                 return IN_FLIGHT;
             }
 
-            inflight = false;
+            cache->inflight = false;
 
             void *block = calloc(B, 1);
-            read_block(m, block_address, block);
+            read_block(cache, m, block_address, block);
 
             evicted_line_t *evicted = handle_miss(cache, block_address, operation, block);
 
             if (evicted->valid && evicted->dirty) {
-                write_block(m, evicted->addr & ~(B-1), evicted->data);
+                write_block(cache, m, evicted->addr & ~(B-1), evicted->data);
             }
 
             free(block);
@@ -392,48 +959,58 @@ static mem_status_t access_memory(mem_t m, uword_t pos, operation_t operation, s
 
 // Data Memory Functions. First checks than cache. On miss, five cycle delay is forced.
 
-mem_status_t get_word_val_D(mem_t m, word_t pos, word_t *dest)
+mem_status_t get_word_val_D(cache_t *cache, mem_t m, word_t pos, word_t *dest)
 {
-	if (pos < 0 || pos + 8 > m->len)
+	if (pos < 0 || pos > m->len - 8)
 		return ERROR;
 
-    mem_status_t status = access_memory(m, pos, READ, sizeof(word_t));
+    mem_status_t status = access_memory(cache, m, pos, READ, sizeof(word_t));
 	if(status == READY) {
 		get_word_cache(cache, pos, dest);
 	}
     return status;
 }
 
-mem_status_t set_byte_val_D(mem_t m, word_t pos, byte_t val)
+mem_status_t set_byte_val_D(cache_t *cache, mem_t m, word_t pos, byte_t val)
 {
     if (pos < 0 || pos >= m->len)
 		return ERROR;
 
-    mem_status_t status = access_memory(m, pos, WRITE, sizeof(byte_t));
+    mem_status_t status = access_memory(cache, m, pos, WRITE, sizeof(byte_t));
 	if(status == READY) {
-		set_byte_cache(cache, pos, val);
+		if (m->watch && watch_near(m->watch, pos, 1)) {
+			watch_before(m, cache, pos, 1);
+			set_byte_cache(cache, pos, val);
+			watch_after(m, cache, pos, 1);
+		} else
+			set_byte_cache(cache, pos, val);
 	}
 	return status;
 }
 
-mem_status_t set_word_val_D(mem_t m, word_t pos, word_t val)
+mem_status_t set_word_val_D(cache_t *cache, mem_t m, word_t pos, word_t val)
 {
-    if (pos < 0 || pos + 8 > m->len)
+    if (pos < 0 || pos > m->len - 8)
 		return ERROR;
 
-	mem_status_t status = access_memory(m, pos, WRITE, sizeof(word_t));
+	mem_status_t status = access_memory(cache, m, pos, WRITE, sizeof(word_t));
 	if(status == READY) {
-		set_word_cache(cache, pos, val);
+		if (m->watch && watch_near(m->watch, pos, 8)) {
+			watch_before(m, cache, pos, 8);
+			set_word_cache(cache, pos, val);
+			watch_after(m, cache, pos, 8);
+		} else
+			set_word_cache(cache, pos, val);
 	}
 	return status;
 }
 
-mem_status_t get_byte_val_D(mem_t m, word_t pos, byte_t *dest)
+mem_status_t get_byte_val_D(cache_t *cache, mem_t m, word_t pos, byte_t *dest)
 {
     if (pos < 0 || pos >= m->len)
 		return ERROR;
 
-	mem_status_t status = access_memory(m, pos, READ, sizeof(byte_t));
+	mem_status_t status = access_memory(cache, m, pos, READ, sizeof(byte_t));
 	if(status == READY) {
 		get_byte_cache(cache, pos, dest);
 	}
@@ -444,22 +1021,15 @@ bool get_byte_val(mem_t m, word_t pos, byte_t *dest)
 {
     if (pos < 0 || pos >= m->len)
 	return false;
-    *dest = m->contents[pos];
+    *dest = read_byte(m, pos);
     return true;
 }
 
 bool get_word_val(mem_t m, word_t pos, word_t *dest)
 {
-    int i;
-    word_t val;
-    if (pos < 0 || pos + 8 > m->len)
+    if (pos < 0 || pos > m->len - 8)
 	return false;
-    val = 0;
-    for (i = 0; i < 8; i++) {
-	word_t b =  m->contents[pos+i] & 0xFF;
-	val = val | (b <<(8*i));
-    }
-    *dest = val;
+    *dest = read_word(m, pos);
     return true;
 }
 
@@ -467,39 +1037,52 @@ bool set_byte_val(mem_t m, word_t pos, byte_t val)
 {
     if (pos < 0 || pos >= m->len)
 	return false;
-    m->contents[pos] = val;
+    if (m->watch && watch_near(m->watch, pos, 1)) {
+	watch_before(m, NULL, pos, 1);
+	write_byte(m, pos, val);
+	watch_after(m, NULL, pos, 1);
+    } else
+	write_byte(m, pos, val);
     return true;
 }
 
 bool set_word_val(mem_t m, word_t pos, word_t val)
 {
-    int i;
-    if (pos < 0 || pos + 8 > m->len)
+    if (pos < 0 || pos > m->len - 8)
 	return false;
-    for (i = 0; i < 8; i++) {
-	m->contents[pos+i] = (byte_t) val & 0xFF;
-	val >>= 8;
-    }
+    if (m->watch && watch_near(m->watch, pos, 8)) {
+	watch_before(m, NULL, pos, 8);
+	write_word(m, pos, val);
+	watch_after(m, NULL, pos, 8);
+    } else
+	write_word(m, pos, val);
     return true;
 }
 
 bool diff_mem(mem_t oldm, mem_t newm, FILE *outfile)
 {
     word_t pos;
-    int len = oldm->len;
+    word_t len = oldm->len;
     bool diff = false;
+    size_t i, npages;
+    uword_t *pnums;
     if (newm->len < len)
 	len = newm->len;
-    for (pos = 0; (!diff || outfile) && pos < len; pos += 8) {
-        word_t ov = 0;  word_t nv = 0;
-	get_word_val(oldm, pos, &ov);
-	get_word_val(newm, pos, &nv);
-	if (nv != ov) {
-	    diff = true;
-	    if (outfile)
-		fprintf(outfile, "0x%.4llx:\t0x%.16llx\t0x%.16llx\n", pos, ov, nv);
+    pnums = touched_pages(oldm, newm, true, &npages);
+    for (i = 0; (!diff || outfile) && i < npages; i++) {
+	word_t start = pnums[i] << PAGE_BITS;
+	for (pos = start; (!diff || outfile) && pos < start + PAGE_SIZE && pos < len; pos += 8) {
+	    word_t ov = 0;  word_t nv = 0;
+	    get_word_val(oldm, pos, &ov);
+	    get_word_val(newm, pos, &nv);
+	    if (nv != ov) {
+		diff = true;
+		if (outfile)
+		    fprintf(outfile, "0x%.4llx:\t0x%.16llx\t0x%.16llx\n", pos, ov, nv);
+	    }
 	}
     }
+    free((void *) pnums);
     return diff;
 }
 
@@ -507,7 +1090,8 @@ bool diff_mem(mem_t oldm, mem_t newm, FILE *outfile)
 
 void dump_memory(FILE *outfile, mem_t m, word_t pos, int len)
 {
-    int i, j;
+    word_t i;
+    int j;
     while (pos % BPL) {
 	pos --;
 	len ++;
@@ -565,56 +1149,6 @@ bool diff_reg(mem_t oldr, mem_t newr, FILE *outfile)
     return diff;
 }
 
-
-memory_restore_t *create_memory_restore(mem_t old, mem_t new)
-{
-    word_t pos;
-    int len = old->len;
-    size_t diff_count = 0;
-    if (new->len < len)
-	len = new->len;
-    for (pos = 0;  pos < len; pos += 8) {
-        word_t ov = 0;
-        word_t nv = 0;
-	    get_word_val(old, pos, &ov);
-	    get_word_val(new, pos, &nv);
-	    if (nv != ov) {
-            diff_count++;
-	    }
-    }
-    memory_restore_t *restore = malloc(sizeof(memory_restore_t));
-    restore->num_values = diff_count;
-    restore->positions = NULL;
-    restore->values = NULL;
-    if (diff_count == 0) {
-        return restore;
-    }
-
-    restore->positions = calloc(diff_count, sizeof(word_t));
-    restore->values = calloc(diff_count, sizeof(word_t));
-    diff_count = 0;
-    for (pos = 0;  pos < len; pos += 8) {
-        word_t ov = 0;
-        word_t nv = 0;
-	    get_word_val(old, pos, &ov);
-	    get_word_val(new, pos, &nv);
-	    if (nv != ov) {
-            restore->positions[diff_count] = pos;
-            restore->values[diff_count] = ov;
-            diff_count++;
-	    }
-    }
-    return restore;
-}
-
-void apply_restore(mem_t mem, memory_restore_t *restore)
-{
-    for (int i = 0;  i < restore->num_values; i++) {
-        set_word_val(mem, restore->positions[i], restore->values[i]);
-    }
-}
-
-
 word_t get_reg_val(mem_t r, reg_id_t id)
 {
     word_t val = 0;
@@ -753,7 +1287,7 @@ char *stat_name(stat_t e)
 
 /**************** Implementation of ISA model ************************/
 
-state_ptr new_state(int memlen)
+state_ptr new_state(word_t memlen)
 {
     state_ptr result = (state_ptr) malloc(sizeof(state_rec));
     result->pc = 0;
@@ -84,40 +84,121 @@ instr_ptr find_instr(char *name);
 /* Return invalid instruction for error handling purposes */
 instr_ptr bad_instr();
 
-/* Represent a memory as an array of bytes */
+/* Memory is paged.  Pages of PAGE_SIZE bytes are allocated on first
+   write; reading a page that was never written yields zeros.  Pages,
+   page tables and directories are reference counted so that copies
+   share them until one side writes (copy-on-write). */
+#define PAGE_BITS 12
+#define PAGE_SIZE (1<<PAGE_BITS)
+
+/* Second level of the page table: PT_ENTRIES consecutive pages */
+#define PT_BITS 8
+#define PT_ENTRIES (1<<PT_BITS)
+
+typedef struct {
+  int refs;
+  byte_t bytes[PAGE_SIZE];
+} page_rec, *page_t;
+
+typedef struct {
+  int refs;
+  uword_t key;                  /* Page number >> PT_BITS */
+  page_t pages[PT_ENTRIES];     /* NULL for pages never written */
+} page_table_rec, *page_table_t;
+
+/* First level of the page table: open-addressed hash on key */
+typedef struct {
+  int refs;
+  int size;                     /* Number of slots (power of 2) */
+  int count;                    /* Number of slots in use */
+  page_table_t *slots;
+} page_dir_rec, *page_dir_t;
+
+/* Words of a memory watched for changes.  A write first tests the bit
+   of map for each 8-byte block it touches, so only writes near a
+   watched word look at the list.  The first change is kept in hit_addr,
+   hit_old and hit_new until hit is cleared. */
+#define WATCH_MAX 16
+#define WATCH_MAP_BITS 12
+
+typedef struct {
+  int count;
+  word_t addr[WATCH_MAX];       /* First byte of each watched word */
+  word_t old[WATCH_MAX];        /* Value before the write being checked */
+  byte_t map[(1<<WATCH_MAP_BITS)/8];
+  bool hit;
+  word_t hit_addr;
+  word_t hit_old;
+  word_t hit_new;
+} watch_rec, *watch_t;
+
+watch_t new_watch();
+void free_watch(watch_t w);
+
+/* Watch or stop watching the 8 bytes at addr.  add_watch returns false
+   when the list is full, remove_watch when addr was not watched */
+bool add_watch(watch_t w, word_t addr);
+bool remove_watch(watch_t w, word_t addr);
+
+/* Represent a memory as a sparse array of len bytes.  Since the
+   directory is hashed on the high address bits, len can be as large as
+   MEM_SIZE allows without costing anything until pages are written;
+   accesses at or beyond len fail. */
 typedef struct {
-  int len;
+  word_t len;
   word_t maxaddr;
-  byte_t *contents;
+  page_dir_t dir;
+  page_table_t last;    /* Page table used by most recent access */
+  watch_t watch;        /* Words whose changes are noted, or NULL.  Set
+			   by the owner; copies start without one */
 } mem_rec, *mem_t;
 
 /* Create a memory with len bytes */
-mem_t init_mem(int len);
+mem_t init_mem(word_t len);
 void free_mem(mem_t m);
 
 /* Set contents of memory to 0 */
 void clear_mem(mem_t m);
 
-/* Make a copy of a memory */
+/* Make a copy of a memory.  The copy shares pages with oldm until
+   either is written, so copying takes constant time and only
+   modified pages are ever duplicated. */
 mem_t copy_mem(mem_t oldm);
 
-/* How big should the memory be? */
-#ifdef BIG_MEM
+/* Copy every page written in src into dst.  Unlike copy_mem, dst
+   shares nothing with src afterwards, and src is only read, so several
+   threads can copy from one memory at once. */
+void copy_pages(mem_t dst, mem_t src);
+
+/* How big should the memory be?  Since pages are only allocated when
+   written, a large memory costs nothing until a program touches it.
+   The Makefiles pass -DBIG_MEM or -DHUGE_MEM through MEMFLAGS. */
+#if defined(HUGE_MEM)
+#define MEM_SIZE (1LL<<40)
+#elif defined(BIG_MEM)
 #define MEM_SIZE (1<<16)
 #else
 #define MEM_SIZE (1<<13)
 #endif
 
+/* Copy len bytes of a program image into memory at pos, bypassing
+   any cache.  Returns false if they do not fit */
+bool load_bytes(mem_t m, word_t pos, byte_t *src, word_t len);
+
 #ifdef CACHE_ENABLED
 
+/* Data cache, from cache.h.  Data accesses go through it */
+struct cache;
+
 typedef enum mem_status {
 	ERROR,
 	IN_FLIGHT,
 	READY
 } mem_status_t;
 
-/* Print the differences between two memories */
-bool diff_mem(mem_t oldm, mem_t newm, FILE *outfile, bool check_cache);
+/* Print the differences between two memories, taking newm's data from
+   cache where it holds a block, unless cache is NULL */
+bool diff_mem(mem_t oldm, mem_t newm, FILE *outfile, struct cache *cache);
 
 /* Get instruction byte from memory */
 bool get_byte_val_I(mem_t m, word_t pos, byte_t *dest);
@@ -126,16 +207,19 @@ bool get_byte_val_I(mem_t m, word_t pos, byte_t *dest);
 bool get_word_val_I(mem_t m, word_t pos, word_t *dest);
 
 /* Get data byte from memory */
-mem_status_t get_byte_val_D(mem_t m, word_t pos, byte_t *dest);
+mem_status_t get_byte_val_D(struct cache *cache, mem_t m, word_t pos, byte_t *dest);
 
 /* Get 8 data bytes from memory */
-mem_status_t get_word_val_D(mem_t m, word_t pos, word_t *dest);
+mem_status_t get_word_val_D(struct cache *cache, mem_t m, word_t pos, word_t *dest);
 
 /* Set data byte in memory */
-mem_status_t set_byte_val_D(mem_t m, word_t pos, byte_t val);
+mem_status_t set_byte_val_D(struct cache *cache, mem_t m, word_t pos, byte_t val);
 
 /* Set 8 data bytes in memory */
-mem_status_t set_word_val_D(mem_t m, word_t pos, word_t val);
+mem_status_t set_word_val_D(struct cache *cache, mem_t m, word_t pos, word_t val);
+
+/* Get 8 data bytes, looking through the cache without accessing it */
+bool peek_word_val_D(struct cache *cache, mem_t m, word_t pos, word_t *dest);
 #else
 /* Get byte from memory */
 bool get_byte_val(mem_t m, word_t pos, byte_t *dest);
@@ -154,10 +238,57 @@ bool diff_mem(mem_t oldm, mem_t newm, FILE *outfile);
 
 #endif
 
+/* Symbols and source lines of a loaded program, so that traces and
+   profiles can name a PC instead of printing it in hex.  Both tables
+   are kept sorted by address. */
+typedef struct {
+  word_t addr;
+  char *name;
+} symbol_t;
+
+typedef struct {
+  word_t addr;
+  int lineno;           /* Line of the file the program was loaded from */
+  char *text;           /* Source text of that line */
+} src_line_t;
+
+typedef struct {
+  symbol_t *syms;
+  int nsyms;
+  int maxsyms;
+  src_line_t *lines;
+  int nlines;
+  int maxlines;
+} symtab_rec, *symtab_t;
+
+symtab_t new_symtab();
+void free_symtab(symtab_t t);
+
+/* Remove all symbols and source lines */
+void clear_symtab(symtab_t t);
+
+void add_symbol(symtab_t t, word_t addr, char *name);
+void add_src_line(symtab_t t, word_t addr, int lineno, char *text);
+
+/* Find the closest symbol at or below addr.  Returns NULL if there is
+   none, or if t is NULL */
+symbol_t *find_symbol(symtab_t t, word_t addr);
+
+/* Find the source line that placed code at addr.  Returns NULL if
+   there is none, or if t is NULL */
+src_line_t *find_src_line(symtab_t t, word_t addr);
+
+/* Name addr as "0x1c <loop+0x4>", or as plain hex when there is no
+   symbol for it.  The result is overwritten by the next call in the
+   same thread */
+char *pc_name(symtab_t t, word_t addr);
+
 /*** In the following functions, a return value of 1 means success ***/
 
-/* Load memory from .yo file.  Return number of bytes read */
-int load_mem(mem_t m, FILE *infile, int report_error);
+/* Load memory from .yo file.  Return number of bytes read.  Labels
+   and source lines from the comment column are added to syms, unless
+   it is NULL */
+int load_mem(mem_t m, symtab_t syms, FILE *infile, int report_error);
 
 /* Print contents of memory */
 void dump_memory(FILE *outfile, mem_t m, word_t pos, int cnt);
@@ -167,7 +298,7 @@ void dump_memory(FILE *outfile, mem_t m, word_t pos, int cnt);
 mem_t init_reg();
 void free_reg();
 
-/* Make a copy of a register file */
+/* Make a copy of a register file (copy-on-write, like copy_mem) */
 mem_t copy_reg(mem_t oldr);
 /* Print the differences between two register files */
 bool diff_reg(mem_t oldr, mem_t newr, FILE *outfile);
@@ -218,7 +349,7 @@ typedef struct {
   cc_t cc;
 } state_rec, *state_ptr;
 
-state_ptr new_state(int memlen);
+state_ptr new_state(word_t memlen);
 void free_state(state_ptr s);
 
 state_ptr copy_state(state_ptr s);
@@ -228,21 +359,3 @@ bool cond_holds(cc_t cc, cond_t bcond);
 
 /* Execute single instruction.  Return status. */
 stat_t step_state(state_ptr s, FILE *error_file);
-
-typedef struct memory_restore_struct {
-    size_t num_values;
-    word_t *positions;
-    word_t *values;
-} memory_restore_t;
-
-memory_restore_t *create_memory_restore(mem_t old, mem_t new);
-void apply_restore(mem_t mem, memory_restore_t *restore);
-
-typedef struct processor_state_struct {
-    word_t pc;
-    cc_t cc;
-    stat_t status;
-    word_t icount;
-    memory_restore_t *registers;
-    memory_restore_t *memory;
-} processor_state_t;
\ No newline at end of file
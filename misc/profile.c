@@ -0,0 +1,129 @@
+/* Per-PC pipeline profiler shared by the pipeline simulators */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+#include "profile.h"
+
+#define INIT_SLOTS 256
+
+profile_t new_profile()
+{
+    profile_t p = (profile_t) malloc(sizeof(profile_rec));
+    p->size = INIT_SLOTS;
+    p->count = 0;
+    p->ents = (prof_ent_t *) calloc(p->size, sizeof(prof_ent_t));
+    return p;
+}
+
+void free_profile(profile_t p)
+{
+    free(p->ents);
+    free(p);
+}
+
+void clear_profile(profile_t p)
+{
+    memset(p->ents, 0, p->size * sizeof(prof_ent_t));
+    p->count = 0;
+}
+
+static int find_slot(prof_ent_t *ents, int size, word_t pc)
+{
+    uword_t h = (uword_t) pc * 0x9E3779B97F4A7C15ULL;
+    int i = (int) (h >> 40) & (size - 1);
+    while (ents[i].used && ents[i].pc != pc)
+	i = (i + 1) & (size - 1);
+    return i;
+}
+
+prof_ent_t *profile_entry(profile_t p, word_t pc)
+{
+    int i = find_slot(p->ents, p->size, pc);
+    if (p->ents[i].used)
+	return &p->ents[i];
+
+    /* Keep the table at most half full */
+    if (2 * (p->count + 1) > p->size) {
+	int j;
+	int nsize = 2 * p->size;
+	prof_ent_t *nents = (prof_ent_t *) calloc(nsize, sizeof(prof_ent_t));
+	for (j = 0; j < p->size; j++)
+	    if (p->ents[j].used)
+		nents[find_slot(nents, nsize, p->ents[j].pc)] = p->ents[j];
+	free(p->ents);
+	p->ents = nents;
+	p->size = nsize;
+	i = find_slot(p->ents, p->size, pc);
+    }
+    p->ents[i].used = true;
+    p->ents[i].pc = pc;
+    p->count++;
+    return &p->ents[i];
+}
+
+static int compare_pcs(const void *a, const void *b)
+{
+    word_t pa = (*(prof_ent_t * const *) a)->pc;
+    word_t pb = (*(prof_ent_t * const *) b)->pc;
+    return pa < pb ? -1 : pa > pb;
+}
+
+/* Print s as a quoted CSV field */
+static void write_field(FILE *f, char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+	if (*s == '"')
+	    fputc('"', f);
+	fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+bool write_profile(profile_t p, symtab_t syms, char *fname)
+{
+    prof_ent_t **order;
+    int i, n = 0;
+    FILE *f = fopen(fname, "w");
+    if (!f)
+	return false;
+
+    order = (prof_ent_t **) malloc((p->count + 1) * sizeof(prof_ent_t *));
+    for (i = 0; i < p->size; i++)
+	if (p->ents[i].used)
+	    order[n++] = &p->ents[i];
+    qsort(order, n, sizeof(prof_ent_t *), compare_pcs);
+
+    fprintf(f, "pc,symbol,line,source,execs,cycles,"
+	    "stall_f,stall_d,stall_e,stall_m,stall_w,"
+	    "bubbles,mispredicts,load_use,ret_stalls,mem_stalls,halt_stalls\n");
+    for (i = 0; i < n; i++) {
+	prof_ent_t *e = order[i];
+	symbol_t *sym = find_symbol(syms, e->pc);
+	src_line_t *line = find_src_line(syms, e->pc);
+	int s;
+	fprintf(f, "0x%llx,", e->pc);
+	if (sym && sym->addr == e->pc)
+	    write_field(f, sym->name);
+	else if (sym)
+	    fprintf(f, "\"%s+0x%llx\"", sym->name, e->pc - sym->addr);
+	if (line) {
+	    fprintf(f, ",%d,", line->lineno);
+	    write_field(f, line->text);
+	} else {
+	    fprintf(f, ",,");
+	}
+	fprintf(f, ",%lld,%lld", e->execs, e->cycles);
+	for (s = 0; s < PROF_STAGES; s++)
+	    fprintf(f, ",%lld", e->stalls[s]);
+	fprintf(f, ",%lld", e->bubbles);
+	for (s = 0; s < PROF_EVENTS; s++)
+	    fprintf(f, ",%lld", e->events[s]);
+	fprintf(f, "\n");
+    }
+    free(order);
+    return fclose(f) == 0;
+}
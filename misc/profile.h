@@ -0,0 +1,46 @@
+/* Per-PC pipeline profiler shared by the pipeline simulators.
+   Include isa.h first. */
+
+/* Stages, in the order of stage_id_t */
+#define PROF_STAGES 5
+
+/* Hazards an instruction can cause */
+typedef enum {
+    PROF_MISPREDICT,            /* Times it was a mispredicted branch */
+    PROF_LOAD_USE,              /* Cycles it was a load holding back a user */
+    PROF_RET,                   /* Cycles fetch waited for it to return */
+    PROF_MEM,                   /* Cycles it waited on the data cache */
+    PROF_HALT,                  /* Cycles fetch waited behind it */
+    PROF_EVENTS
+} prof_event_t;
+
+/* Counts for one static instruction */
+typedef struct {
+    bool used;                  /* Slot holds an entry */
+    word_t pc;
+    word_t execs;               /* Times it retired */
+    word_t cycles;              /* Cycles it was the oldest instruction in flight */
+    word_t stalls[PROF_STAGES]; /* Cycles it was held in each stage */
+    word_t bubbles;             /* Bubbles inserted because of it */
+    word_t events[PROF_EVENTS];
+} prof_ent_t;
+
+/* Entries are hashed on the PC, so programs may sit anywhere in memory */
+typedef struct {
+    prof_ent_t *ents;
+    int size;                   /* Number of slots (power of 2) */
+    int count;                  /* Number of slots in use */
+} profile_rec, *profile_t;
+
+profile_t new_profile();
+void free_profile(profile_t p);
+
+/* Remove all entries */
+void clear_profile(profile_t p);
+
+/* Find the entry for pc, creating it if needed */
+prof_ent_t *profile_entry(profile_t p, word_t pc);
+
+/* Write the profile as CSV, one line per PC in address order, naming
+   each PC from syms.  Returns false if the file cannot be written */
+bool write_profile(profile_t p, symtab_t syms, char *fname);
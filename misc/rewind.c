@@ -0,0 +1,78 @@
+/* Reverse execution for the interactive simulators: a ring of
+   periodic snapshots, replayed forward to reach earlier cycles */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "isa.h"
+#include "rewind.h"
+
+rewind_t new_rewind(void *sim, snap_save_t save, snap_restore_t restore, snap_free_t free)
+{
+    rewind_t rw = (rewind_t) calloc(1, sizeof(rewind_rec));
+    rw->sim = sim;
+    rw->save = save;
+    rw->restore = restore;
+    rw->free = free;
+    return rw;
+}
+
+static rewind_slot_t *slot(rewind_t rw, int i)
+{
+    return &rw->ring[(rw->first + i) % REWIND_SLOTS];
+}
+
+void free_rewind(rewind_t rw)
+{
+    int i;
+    for (i = 0; i < rw->count; i++)
+	rw->free(slot(rw, i)->snap);
+    free((void *) rw);
+}
+
+void rewind_note(rewind_t rw, word_t cycle, word_t icount)
+{
+    rewind_slot_t *s;
+    if (cycle % REWIND_INTERVAL != 0)
+	return;
+    /* Snapshots are kept in cycle order.  After going back, the later
+       ones still hold, since running forward again does the same */
+    if (rw->count > 0 && slot(rw, rw->count - 1)->cycle >= cycle)
+	return;
+    if (rw->count == REWIND_SLOTS) {
+	rw->free(slot(rw, 0)->snap);
+	rw->first = (rw->first + 1) % REWIND_SLOTS;
+	rw->count--;
+    }
+    s = slot(rw, rw->count++);
+    s->cycle = cycle;
+    s->icount = icount;
+    s->snap = rw->save(rw->sim);
+}
+
+/* Restore the last snapshot whose cycle (or icount) is at most limit */
+static rewind_slot_t *rewind_to(rewind_t rw, word_t limit, bool by_icount)
+{
+    rewind_slot_t *s;
+    int i;
+    if (rw->count == 0)
+	return NULL;
+    for (i = rw->count - 1; i > 0; i--) {
+	s = slot(rw, i);
+	if ((by_icount ? s->icount : s->cycle) <= limit)
+	    break;
+    }
+    s = slot(rw, i);
+    rw->restore(rw->sim, s->snap);
+    return s;
+}
+
+rewind_slot_t *rewind_to_cycle(rewind_t rw, word_t cycle)
+{
+    return rewind_to(rw, cycle, false);
+}
+
+rewind_slot_t *rewind_to_icount(rewind_t rw, word_t icount)
+{
+    return rewind_to(rw, icount, true);
+}
@@ -0,0 +1,48 @@
+/* Reverse execution for the interactive simulators.  Include isa.h
+   first.
+
+   Every REWIND_INTERVAL cycles the simulator saves its whole state in
+   a ring of REWIND_SLOTS snapshots.  To go back, it restores the last
+   snapshot at or before the cycle it wants and simulates forward from
+   there.  Running forward only costs a snapshot now and then, memory
+   stays bounded, and reaching any cycle costs at most one interval of
+   simulation.  History older than the oldest snapshot is forgotten. */
+
+#define REWIND_INTERVAL 4096
+#define REWIND_SLOTS 256
+
+/* Copy the simulator's whole state, put a copy back, and free one */
+typedef void *(*snap_save_t)(void *sim);
+typedef void (*snap_restore_t)(void *sim, void *snap);
+typedef void (*snap_free_t)(void *snap);
+
+typedef struct {
+    word_t cycle;               /* Cycles simulated when it was taken */
+    word_t icount;              /* Instructions completed by then */
+    void *snap;
+} rewind_slot_t;
+
+typedef struct {
+    void *sim;
+    snap_save_t save;
+    snap_restore_t restore;
+    snap_free_t free;
+    rewind_slot_t ring[REWIND_SLOTS];
+    int first;                  /* Oldest slot */
+    int count;                  /* Slots in use */
+} rewind_rec, *rewind_t;
+
+rewind_t new_rewind(void *sim, snap_save_t save, snap_restore_t restore, snap_free_t free);
+void free_rewind(rewind_t rw);
+
+/* Call before simulating each cycle.  Takes a snapshot at every
+   multiple of REWIND_INTERVAL not already saved, dropping the oldest
+   when the ring is full */
+void rewind_note(rewind_t rw, word_t cycle, word_t icount);
+
+/* Restore the last snapshot taken at or before cycle, or the last one
+   with at most icount instructions completed.  If every snapshot is
+   later, the oldest is restored.  Returns the slot restored, or NULL if
+   there are none */
+rewind_slot_t *rewind_to_cycle(rewind_t rw, word_t cycle);
+rewind_slot_t *rewind_to_icount(rewind_t rw, word_t icount);
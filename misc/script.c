@@ -0,0 +1,201 @@
+/* Command input and JSON output for the interactive simulators */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+#include "script.h"
+
+#define LINELEN 1024
+
+bool read_command(FILE *in, char *cmd, char *arg)
+{
+    char buf[LINELEN];
+    char *hash;
+    int n;
+    while (fgets(buf, LINELEN, in)) {
+	if ((hash = strchr(buf, '#')))
+	    *hash = '\0';
+	cmd[0] = arg[0] = '\0';
+	n = sscanf(buf, "%63s %63s", cmd, arg);
+	if (n >= 1)
+	    return true;
+    }
+    return false;
+}
+
+bool arg_int(char *arg, int *valp)
+{
+    char *end;
+    long val = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0')
+	return false;
+    *valp = (int) val;
+    return true;
+}
+
+json_t new_json(FILE *out)
+{
+    json_t j = (json_t) calloc(1, sizeof(json_rec));
+    j->out = out;
+    return j;
+}
+
+void free_json(json_t j)
+{
+    free((void *) j);
+}
+
+/* Separator and key before a value */
+static void json_key(json_t j, char *key)
+{
+    if (j->depth > 0) {
+	if (!j->first[j->depth - 1])
+	    fputc(',', j->out);
+	j->first[j->depth - 1] = false;
+    }
+    if (key)
+	fprintf(j->out, "\"%s\":", key);
+}
+
+static void json_push(json_t j, char *key, char c)
+{
+    json_key(j, key);
+    fputc(c, j->out);
+    if (j->depth < JSON_DEPTH)
+	j->first[j->depth] = true;
+    j->depth++;
+}
+
+static void json_pop(json_t j, char c)
+{
+    fputc(c, j->out);
+    if (--j->depth == 0) {
+	fputc('\n', j->out);
+	fflush(j->out);
+    }
+}
+
+void json_open(json_t j, char *key)
+{
+    json_push(j, key, '{');
+}
+
+void json_close(json_t j)
+{
+    json_pop(j, '}');
+}
+
+void json_open_list(json_t j, char *key)
+{
+    json_push(j, key, '[');
+}
+
+void json_close_list(json_t j)
+{
+    json_pop(j, ']');
+}
+
+void json_int(json_t j, char *key, word_t val)
+{
+    json_key(j, key);
+    fprintf(j->out, "%lld", val);
+}
+
+void json_double(json_t j, char *key, double val)
+{
+    json_key(j, key);
+    fprintf(j->out, "%.4f", val);
+}
+
+void json_bool(json_t j, char *key, bool val)
+{
+    json_key(j, key);
+    fputs(val ? "true" : "false", j->out);
+}
+
+void json_string(json_t j, char *key, char *val)
+{
+    char *p;
+    json_key(j, key);
+    fputc('"', j->out);
+    for (p = val; *p; p++) {
+	unsigned char c = (unsigned char) *p;
+	if (c == '"' || c == '\\')
+	    fprintf(j->out, "\\%c", c);
+	else if (c == '\n')
+	    fputs("\\n", j->out);
+	else if (c == '\t')
+	    fputs("\\t", j->out);
+	else if (c < 0x20)
+	    fprintf(j->out, "\\u%04x", c);
+	else
+	    fputc(c, j->out);
+    }
+    fputc('"', j->out);
+}
+
+void json_error(json_t j, char *cmd, char *msg)
+{
+    json_open(j, NULL);
+    json_string(j, "cmd", cmd);
+    json_string(j, "error", msg);
+    json_close(j);
+}
+
+void json_result(json_t j, char *cmd, char *arg, bool ok)
+{
+    json_open(j, NULL);
+    json_string(j, "cmd", cmd);
+    json_string(j, "arg", arg);
+    json_bool(j, "ok", ok);
+    json_close(j);
+}
+
+void json_regs(json_t j, char *key, mem_t r)
+{
+    reg_id_t id;
+    json_open(j, key);
+    for (id = 0; id < REG_NONE; id++)
+	json_int(j, reg_name(id), get_reg_val(r, id));
+    json_close(j);
+}
+
+void json_reg_diffs(json_t j, char *key, mem_t oldr, mem_t newr)
+{
+    reg_id_t id;
+    json_open_list(j, key);
+    for (id = 0; id < REG_NONE; id++) {
+	word_t ov = get_reg_val(oldr, id);
+	word_t nv = get_reg_val(newr, id);
+	if (ov != nv) {
+	    json_open(j, NULL);
+	    json_string(j, "reg", reg_name(id));
+	    json_int(j, "old", ov);
+	    json_int(j, "new", nv);
+	    json_close(j);
+	}
+    }
+    json_close_list(j);
+}
+
+void json_mem_diffs(json_t j, char *key, char *text)
+{
+    word_t addr, ov, nv;
+    char *line = text;
+    json_open_list(j, key);
+    while (line && *line) {
+	if (sscanf(line, "0x%llx:\t0x%llx\t0x%llx", &addr, &ov, &nv) == 3) {
+	    json_open(j, NULL);
+	    json_int(j, "addr", addr);
+	    json_int(j, "old", ov);
+	    json_int(j, "new", nv);
+	    json_close(j);
+	}
+	line = strchr(line, '\n');
+	if (line)
+	    line++;
+    }
+    json_close_list(j);
+}
@@ -0,0 +1,55 @@
+/* Command input and JSON output for the interactive simulators.
+   Include isa.h first.
+
+   Each command is one line: a command word and an optional argument.
+   With -x the commands come from a script instead of the terminal, and
+   each answers with one JSON object on a line of its own, so another
+   program can drive a session and read the results without scraping
+   the interactive display. */
+
+#define CMD_LEN 64
+
+/* Read the next command, skipping blank lines and comments (from '#').
+   cmd gets the first word and arg the second, or "" if there is none.
+   Returns false at the end of the input */
+bool read_command(FILE *in, char *cmd, char *arg);
+
+/* Parse arg as a whole decimal number */
+bool arg_int(char *arg, int *valp);
+
+#define JSON_DEPTH 8
+
+typedef struct {
+    FILE *out;
+    int depth;                  /* Objects and lists open */
+    bool first[JSON_DEPTH];     /* Nothing written yet at each depth */
+} json_rec, *json_t;
+
+json_t new_json(FILE *out);
+void free_json(json_t j);
+
+/* Values inside an object take a key; at the top level or in a list the
+   key is NULL.  Closing a top-level object ends its line and flushes it */
+void json_open(json_t j, char *key);
+void json_close(json_t j);
+void json_open_list(json_t j, char *key);
+void json_close_list(json_t j);
+
+void json_int(json_t j, char *key, word_t val);
+void json_double(json_t j, char *key, double val);
+void json_bool(json_t j, char *key, bool val);
+void json_string(json_t j, char *key, char *val);
+
+/* Whole answers: a command that failed, and one that only succeeds
+   or fails */
+void json_error(json_t j, char *cmd, char *msg);
+void json_result(json_t j, char *cmd, char *arg, bool ok);
+
+/* Program registers as an object from name to value */
+void json_regs(json_t j, char *key, mem_t r);
+
+/* Registers that differ, as a list of {reg, old, new} */
+void json_reg_diffs(json_t j, char *key, mem_t oldr, mem_t newr);
+
+/* The lines diff_mem printed into text, as a list of {addr, old, new} */
+void json_mem_diffs(json_t j, char *key, char *text);
@@ -0,0 +1,80 @@
+/* Binary per-cycle pipeline trace shared by the pipeline simulators */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+#include "trace.h"
+
+static char *fwd_names[TRACE_FWDS] = {
+    "-", "reg", "e_valE", "M_valE", "m_valM", "W_valE", "W_valM", "valP"
+};
+
+trace_t open_trace(char *fname)
+{
+    trace_header_t h;
+    trace_t t;
+    FILE *f = fopen(fname, "wb");
+    if (!f)
+	return NULL;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TRACE_MAGIC, 4);
+    h.version = TRACE_VERSION;
+    h.stages = TRACE_STAGES;
+    h.rec_size = sizeof(trace_rec_t);
+    t = (trace_t) malloc(sizeof(trace_rec_writer));
+    t->file = f;
+    t->buf = (trace_rec_t *) malloc(TRACE_BUF * sizeof(trace_rec_t));
+    t->count = 0;
+    t->failed = fwrite(&h, sizeof(h), 1, f) != 1;
+    return t;
+}
+
+static void flush_trace(trace_t t)
+{
+    if (t->count > 0 && fwrite(t->buf, sizeof(trace_rec_t), t->count, t->file) != t->count)
+	t->failed = true;
+    t->count = 0;
+}
+
+void trace_write(trace_t t, trace_rec_t *rec)
+{
+    t->buf[t->count++] = *rec;
+    if (t->count == TRACE_BUF)
+	flush_trace(t);
+}
+
+bool close_trace(trace_t t)
+{
+    bool ok;
+    flush_trace(t);
+    ok = !t->failed;
+    if (fclose(t->file) != 0)
+	ok = false;
+    free(t->buf);
+    free(t);
+    return ok;
+}
+
+bool read_trace_header(FILE *f, char *fname)
+{
+    trace_header_t h;
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, TRACE_MAGIC, 4) != 0) {
+	fprintf(stderr, "%s is not a pipeline trace\n", fname);
+	return false;
+    }
+    if (h.version != TRACE_VERSION || h.stages != TRACE_STAGES ||
+	h.rec_size != sizeof(trace_rec_t)) {
+	fprintf(stderr, "%s has trace version %d, %d stages and %d byte records; expected %d, %d and %d\n",
+		fname, h.version, h.stages, h.rec_size,
+		TRACE_VERSION, TRACE_STAGES, (int) sizeof(trace_rec_t));
+	return false;
+    }
+    return true;
+}
+
+char *trace_fwd_name(int fwd)
+{
+    return fwd >= 0 && fwd < TRACE_FWDS ? fwd_names[fwd] : "?";
+}
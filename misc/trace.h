@@ -0,0 +1,83 @@
+/* Binary per-cycle pipeline trace written by the pipeline simulators
+   (-t) and read by yview.  Include isa.h first.
+
+   A trace is a trace_header_t followed by one trace_rec_t per cycle,
+   in the host's byte order. */
+
+#define TRACE_MAGIC "Y86T"
+#define TRACE_VERSION 1
+
+/* Stages, in the order of stage_id_t */
+#define TRACE_STAGES 5
+
+/* Pipe register operations, as in p_stat_t */
+typedef enum { TRACE_LOAD, TRACE_STALL, TRACE_BUBBLE, TRACE_ERROR } trace_op_t;
+
+/* Where decode took valA or valB from */
+typedef enum {
+    TRACE_FWD_NONE,             /* Operand not used */
+    TRACE_FWD_REG,              /* Register file */
+    TRACE_FWD_E_VALE,           /* ALU result leaving execute */
+    TRACE_FWD_M_VALE,           /* ALU result in the memory register */
+    TRACE_FWD_M_VALM,           /* Word being read by memory */
+    TRACE_FWD_W_VALE,           /* ALU result in the writeback register */
+    TRACE_FWD_W_VALM,           /* Loaded word in the writeback register */
+    TRACE_FWD_VALP,             /* valP of a call or jump */
+    TRACE_FWDS
+} trace_fwd_t;
+
+typedef struct {
+    char magic[4];
+    int version;
+    int stages;
+    int rec_size;               /* sizeof(trace_rec_t) */
+} trace_header_t;
+
+/* One stage in one cycle.  Stage 0 is the instruction fetched that
+   cycle, with the op of the F register; the others are the contents
+   and ops of the D, E, M and W registers.  The op says what the
+   register does at the end of the cycle, so an instruction moves from
+   stage s to s+1 when stage s+1's op is TRACE_LOAD */
+typedef struct {
+    word_t pc;
+    byte_t instr;               /* HPACK(icode, ifun) */
+    byte_t status;              /* stat_t, STAT_BUB for a bubble */
+    byte_t op;                  /* trace_op_t */
+    byte_t pad[5];
+} trace_stage_t;
+
+typedef struct {
+    word_t cycle;
+    trace_stage_t stage[TRACE_STAGES];
+    byte_t fwd_a;               /* trace_fwd_t of valA and valB decoded this cycle */
+    byte_t fwd_b;
+    byte_t pad[6];
+} trace_rec_t;
+
+/* Records are buffered and written TRACE_BUF at a time */
+#define TRACE_BUF 4096
+
+typedef struct {
+    FILE *file;
+    trace_rec_t *buf;
+    int count;                  /* Records in buf */
+    bool failed;                /* A write failed */
+} trace_rec_writer, *trace_t;
+
+/* Create fname and write the header.  Returns NULL if it cannot be
+   created */
+trace_t open_trace(char *fname);
+
+/* Add one cycle to the trace */
+void trace_write(trace_t t, trace_rec_t *rec);
+
+/* Flush and close the trace.  Returns false if any write failed */
+bool close_trace(trace_t t);
+
+/* Read the header of a trace opened for reading, checking that it
+   was written by a simulator with the same layout.  Returns false and
+   explains on stderr if not */
+bool read_trace_header(FILE *f, char *fname);
+
+/* Short name of a forwarding source, e.g. "W_valM" */
+char *trace_fwd_name(int fwd);
@@ -0,0 +1,97 @@
+/* Check that asm.c assembles a .ys file into the same memory image and
+   labels as yas, given the .yo file yas made from it */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+#include "asm.h"
+
+/* yas places code below 64 KiB, whatever MEM_SIZE the tools are
+   built with */
+#define YAS_MEM (1<<16)
+
+void usage(char *pname)
+{
+    printf("Usage: %s file.ys file.yo\n", pname);
+    exit(0);
+}
+
+/* Report the labels of a that b lacks or places elsewhere */
+static bool missing_labels(symtab_t a, symtab_t b, char *aname, char *bname)
+{
+    bool missing = false;
+    int i, k;
+    for (i = 0; i < a->nsyms; i++) {
+	for (k = 0; k < b->nsyms; k++)
+	    if (!strcmp(a->syms[i].name, b->syms[k].name))
+		break;
+	if (k == b->nsyms) {
+	    printf("Label %s at 0x%llx from %s is missing from %s\n",
+		   a->syms[i].name, a->syms[i].addr, aname, bname);
+	    missing = true;
+	} else if (a->syms[i].addr != b->syms[k].addr) {
+	    printf("Label %s is at 0x%llx from %s but 0x%llx from %s\n",
+		   a->syms[i].name, a->syms[i].addr, aname, b->syms[k].addr, bname);
+	    missing = true;
+	}
+    }
+    return missing;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *ys, *yo;
+    mem_t asm_mem = init_mem(YAS_MEM);
+    mem_t yas_mem = init_mem(YAS_MEM);
+    symtab_t asm_syms = new_symtab();
+    symtab_t yas_syms = new_symtab();
+    int asm_bytes, yas_bytes;
+    bool differ;
+
+    if (argc != 3)
+	usage(argv[0]);
+    ys = fopen(argv[1], "r");
+    if (!ys) {
+	fprintf(stderr, "Can't open source file '%s'\n", argv[1]);
+	exit(1);
+    }
+    yo = fopen(argv[2], "r");
+    if (!yo) {
+	fprintf(stderr, "Can't open object file '%s'\n", argv[2]);
+	exit(1);
+    }
+
+    asm_bytes = assemble_mem(asm_mem, asm_syms, ys, 1);
+    yas_bytes = load_mem(yas_mem, yas_syms, yo, 1);
+    fclose(ys);
+    fclose(yo);
+    if (yas_bytes == 0) {
+	printf("%s: yas output could not be loaded\n", argv[2]);
+	exit(1);
+    }
+
+    printf("%s: ", argv[1]);
+    if (asm_bytes == 0) {
+	printf("asm.c rejects it\n");
+	exit(1);
+    }
+    differ = asm_bytes != yas_bytes;
+    if (differ)
+	printf("%d bytes of code from asm.c, %d from yas\n", asm_bytes, yas_bytes);
+    else
+	printf("%d bytes of code\n", asm_bytes);
+    if (diff_mem(yas_mem, asm_mem, stdout)) {
+	printf("Memory differs (address, yas, asm.c)\n");
+	differ = true;
+    }
+    differ |= missing_labels(yas_syms, asm_syms, "yas", "asm.c");
+    differ |= missing_labels(asm_syms, yas_syms, "asm.c", "yas");
+
+    free_mem(asm_mem);
+    free_mem(yas_mem);
+    free_symtab(asm_syms);
+    free_symtab(yas_syms);
+    return differ ? 1 : 0;
+}
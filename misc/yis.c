@@ -4,6 +4,7 @@
 #include <stdlib.h>
 
 #include "isa.h"
+#include "asm.h"
 
 void usage(char *pname)
 {
@@ -17,6 +18,7 @@ int main(int argc, char *argv[])
     int max_steps = 10000;
 
     state_ptr s = new_state(MEM_SIZE);
+    symtab_t syms = new_symtab();
     mem_t saver = copy_reg(s->r);
     mem_t savem;
     int step = 0;
@@ -31,7 +33,7 @@ int main(int argc, char *argv[])
 	exit(1);
     }
 
-    if (!load_mem(s->m, code_file, 1)) {
+    if (!load_code(s->m, syms, argv[1], code_file, 1)) {
 	printf("Exiting\n");
 	return 1;
     }
@@ -46,8 +48,8 @@ int main(int argc, char *argv[])
         e = step_state(s, stdout);
 
         printf("-------- Step %d --------\n", step + 1);
-        printf("PC = 0x%llx, Status '%s', CC %s\n",
-	        s->pc, stat_name(e), cc_name(s->cc));
+        printf("PC = %s, Status '%s', CC %s\n",
+	        pc_name(syms, s->pc), stat_name(e), cc_name(s->cc));
         printf("Changes to registers:\n");
         diff_reg(saver, s->r, stdout);
 
@@ -57,8 +59,8 @@ int main(int argc, char *argv[])
     }
 	
 
-    printf("Stopped in %d steps at PC = 0x%llx.  Status '%s', CC %s\n",
-	   step, s->pc, stat_name(e), cc_name(s->cc));
+    printf("Stopped in %d steps at PC = %s.  Status '%s', CC %s\n",
+	   step, pc_name(syms, s->pc), stat_name(e), cc_name(s->cc));
 
     printf("Changes to registers:\n");
     diff_reg(saver, s->r, stdout);
@@ -67,6 +69,7 @@ int main(int argc, char *argv[])
     diff_mem(savem, s->m, stdout);
 
     free_state(s);
+    free_symtab(syms);
     free_reg(saver);
     free_mem(savem);
 
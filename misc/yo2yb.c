@@ -0,0 +1,55 @@
+/* Convert a Y86-64 .yo object file to the binary .yb format */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+#include "yobj.h"
+
+void usage(char *pname)
+{
+    printf("Usage: %s file.yo [file.yb]\n", pname);
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *yo, *yb;
+    char *outname;
+    size_t len;
+
+    if (argc < 2 || argc > 3)
+	usage(argv[0]);
+    yo = fopen(argv[1], "r");
+    if (!yo) {
+	fprintf(stderr, "Can't open object file '%s'\n", argv[1]);
+	exit(1);
+    }
+
+    /* By default file.yo becomes file.yb */
+    if (argc > 2) {
+	outname = argv[2];
+    } else {
+	len = strlen(argv[1]);
+	outname = (char *) malloc(len + 4);
+	strcpy(outname, argv[1]);
+	if (len > 3 && strcmp(outname + len - 3, ".yo") == 0)
+	    outname[len - 3] = '\0';
+	strcat(outname, ".yb");
+    }
+    yb = fopen(outname, "wb");
+    if (!yb) {
+	fprintf(stderr, "Can't write object file '%s'\n", outname);
+	exit(1);
+    }
+
+    if (!convert_yo(yo, yb, 1)) {
+	fclose(yb);
+	remove(outname);
+	exit(1);
+    }
+    fclose(yo);
+    fclose(yb);
+    return 0;
+}
@@ -0,0 +1,217 @@
+/* Binary Y86-64 object files (.yb): loader and .yo converter */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "isa.h"
+#include "yobj.h"
+
+#define LINELEN 4096
+
+static void yobj_error(int report_error, char *msg)
+{
+    if (report_error)
+	fprintf(stderr, "Error reading object file. %s\n", msg);
+}
+
+int load_yobj(mem_t m, symtab_t syms, FILE *infile, int report_error)
+{
+    struct stat sb;
+    int fd = fileno(infile);
+    byte_t *base;
+    yobj_header_t *hdr;
+    yobj_seg_t *segs;
+    uint64_t size, tables;
+    uint32_t i;
+    int byte_cnt = 0;
+
+    if (fstat(fd, &sb) != 0 || sb.st_size < sizeof(yobj_header_t)) {
+	yobj_error(report_error, "Not a Y86-64 binary object");
+	return 0;
+    }
+    size = sb.st_size;
+    base = (byte_t *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+	yobj_error(report_error, "Couldn't map file");
+	return 0;
+    }
+
+    hdr = (yobj_header_t *) base;
+    tables = sizeof(yobj_header_t) + (uint64_t) hdr->nsegs * sizeof(yobj_seg_t)
+	+ (uint64_t) hdr->nsyms * sizeof(yobj_sym_t);
+    if (memcmp(hdr->magic, YOBJ_MAGIC, 4) != 0 || hdr->version != YOBJ_VERSION
+	|| tables > size) {
+	yobj_error(report_error, "Not a Y86-64 binary object");
+	munmap(base, size);
+	return 0;
+    }
+
+    /* Segment contents are copied straight out of the mapping */
+    segs = (yobj_seg_t *) (hdr + 1);
+    for (i = 0; i < hdr->nsegs; i++) {
+	yobj_seg_t *seg = &segs[i];
+	if (seg->offset > size || seg->size > size - seg->offset) {
+	    yobj_error(report_error, "Truncated segment");
+	    munmap(base, size);
+	    return 0;
+	}
+	if (!load_bytes(m, seg->addr, base + seg->offset, seg->size)) {
+	    if (report_error)
+		fprintf(stderr, "Error reading object file. Invalid address. 0x%llx\n",
+			(word_t) seg->addr);
+	    munmap(base, size);
+	    return 0;
+	}
+	byte_cnt += seg->size;
+    }
+
+    /* Names must lie within the file and be terminated */
+    if (syms) {
+	yobj_sym_t *sym = (yobj_sym_t *) (segs + hdr->nsegs);
+	for (i = 0; i < hdr->nsyms; i++, sym++) {
+	    char *name = (char *) base + sym->name;
+	    if (sym->name < size && memchr(name, '\0', size - sym->name))
+		add_symbol(syms, sym->addr, name);
+	}
+    }
+    munmap(base, size);
+    return byte_cnt;
+}
+
+static int hexval(char c)
+{
+    if (isdigit((int) c))
+	return c - '0';
+    return tolower((int) c) - 'a' + 10;
+}
+
+bool convert_yo(FILE *yo, FILE *yb, int report_error)
+{
+    char buf[LINELEN];
+    int lineno = 0;
+    yobj_header_t hdr;
+    yobj_seg_t *segs = NULL;
+    yobj_sym_t *syms = NULL;
+    byte_t *data = NULL;
+    char *strtab = NULL;
+    uint32_t maxsegs = 0, maxsyms = 0;
+    uint64_t datalen = 0, maxdata = 0;
+    uint64_t strsize = 0, maxstr = 0;
+    uint64_t data_start;
+    uint32_t i;
+    bool ok = true;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, YOBJ_MAGIC, 4);
+    hdr.version = YOBJ_VERSION;
+
+    while (ok && fgets(buf, LINELEN, yo)) {
+	char *cp = buf;
+	char *src;
+	uint64_t addr = 0;
+	uint64_t start = datalen;
+	lineno++;
+
+	while (isspace((int) *cp))
+	    cp++;
+	if (cp[0] != '0' || (cp[1] != 'x' && cp[1] != 'X'))
+	    continue;
+	for (cp += 2; isxdigit((int) *cp); cp++)
+	    addr = addr * 16 + hexval(*cp);
+	while (isspace((int) *cp))
+	    cp++;
+	if (*cp++ != ':') {
+	    if (report_error)
+		fprintf(stderr, "Error reading file. Expected colon\nLine %d:%s\n",
+			lineno, buf);
+	    ok = false;
+	    break;
+	}
+	while (isspace((int) *cp))
+	    cp++;
+
+	/* Code bytes */
+	while (isxdigit((int) cp[0]) && isxdigit((int) cp[1])) {
+	    if (datalen == maxdata) {
+		maxdata = maxdata ? 2 * maxdata : 4096;
+		data = (byte_t *) realloc(data, maxdata);
+	    }
+	    data[datalen++] = hexval(cp[0]) * 16 + hexval(cp[1]);
+	    cp += 2;
+	}
+	if (datalen > start) {
+	    /* Extend the current segment if this line follows on from it */
+	    if (hdr.nsegs > 0 &&
+		segs[hdr.nsegs-1].addr + segs[hdr.nsegs-1].size == addr) {
+		segs[hdr.nsegs-1].size += datalen - start;
+	    } else {
+		if (hdr.nsegs == maxsegs) {
+		    maxsegs = maxsegs ? 2 * maxsegs : 16;
+		    segs = (yobj_seg_t *) realloc(segs, maxsegs * sizeof(yobj_seg_t));
+		}
+		segs[hdr.nsegs].addr = addr;
+		segs[hdr.nsegs].size = datalen - start;
+		segs[hdr.nsegs].offset = start;
+		hdr.nsegs++;
+	    }
+	}
+
+	/* A label at the start of the source column becomes a symbol */
+	src = strchr(cp, '|');
+	if (src) {
+	    char *name;
+	    src++;
+	    while (isspace((int) *src))
+		src++;
+	    name = src;
+	    while (isalnum((int) *src) || *src == '_' || *src == '.')
+		src++;
+	    if (src > name && *src == ':') {
+		uint64_t len = src - name;
+		if (hdr.nsyms == maxsyms) {
+		    maxsyms = maxsyms ? 2 * maxsyms : 16;
+		    syms = (yobj_sym_t *) realloc(syms, maxsyms * sizeof(yobj_sym_t));
+		}
+		while (strsize + len + 1 > maxstr) {
+		    maxstr = maxstr ? 2 * maxstr : 1024;
+		    strtab = (char *) realloc(strtab, maxstr);
+		}
+		syms[hdr.nsyms].addr = addr;
+		syms[hdr.nsyms].name = strsize;
+		memcpy(strtab + strsize, name, len);
+		strtab[strsize + len] = '\0';
+		strsize += len + 1;
+		hdr.nsyms++;
+	    }
+	}
+    }
+
+    if (ok) {
+	/* Make offsets relative to the start of the file */
+	uint64_t str_start = sizeof(hdr) + hdr.nsegs * sizeof(yobj_seg_t)
+	    + hdr.nsyms * sizeof(yobj_sym_t);
+	data_start = str_start + strsize;
+	for (i = 0; i < hdr.nsegs; i++)
+	    segs[i].offset += data_start;
+	for (i = 0; i < hdr.nsyms; i++)
+	    syms[i].name += str_start;
+	ok = fwrite(&hdr, sizeof(hdr), 1, yb) == 1
+	    && fwrite(segs, sizeof(yobj_seg_t), hdr.nsegs, yb) == hdr.nsegs
+	    && fwrite(syms, sizeof(yobj_sym_t), hdr.nsyms, yb) == hdr.nsyms
+	    && fwrite(strtab, 1, strsize, yb) == strsize
+	    && fwrite(data, 1, datalen, yb) == datalen;
+	if (!ok && report_error)
+	    fprintf(stderr, "Error writing object file\n");
+    }
+
+    free(segs);
+    free(syms);
+    free(strtab);
+    free(data);
+    return ok;
+}
@@ -0,0 +1,39 @@
+/* Binary Y86-64 object files (.yb).  Include isa.h first.
+
+   A file holds a header, a table of segments, a table of symbols, a
+   string table with the symbol names, and then the segment contents.
+   Fields are little-endian and offsets count from the start of the
+   file.  Each segment is a run of bytes placed at its load address,
+   so loading is a bounds check and a copy per segment. */
+
+#define YOBJ_MAGIC "Y86B"
+#define YOBJ_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t nsegs;
+    uint32_t nsyms;
+} yobj_header_t;
+
+typedef struct {
+    uint64_t addr;      /* Load address */
+    uint64_t size;      /* Bytes of contents */
+    uint64_t offset;    /* Offset of contents */
+} yobj_seg_t;
+
+typedef struct {
+    uint64_t addr;      /* Address of label */
+    uint64_t name;      /* Offset of NUL-terminated name */
+} yobj_sym_t;
+
+/* Load a .yb file into memory.  Returns the number of bytes loaded, or
+   0 on error, which is printed to stderr when report_error is set.
+   Symbols are added to syms, unless it is NULL; .yb files carry no
+   source lines */
+int load_yobj(mem_t m, symtab_t syms, FILE *infile, int report_error);
+
+/* Convert the .yo file read from yo into a .yb file written to yb.
+   Labels in the source column become symbols.  Returns false if the
+   .yo file cannot be parsed */
+bool convert_yo(FILE *yo, FILE *yb, int report_error);
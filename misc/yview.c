@@ -0,0 +1,279 @@
+/* Render a binary pipeline trace (psim -t) as a pipeline diagram or as
+   a Konata log */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "isa.h"
+#include "trace.h"
+
+/* Letters of an instruction's stages kept for the diagram */
+#define MAX_SPAN 120
+
+/* Instructions in flight at once: one per stage, plus those finishing */
+#define MAX_ACTIVE 16
+
+static char stage_names[TRACE_STAGES] = { 'F', 'D', 'E', 'M', 'W' };
+
+/* How an instruction left the pipeline */
+typedef enum { RETIRED, FLUSHED, IN_FLIGHT } fate_t;
+
+/* An instruction followed through the pipeline */
+typedef struct {
+    word_t id;
+    word_t pc;
+    byte_t instr;
+    byte_t status;
+    word_t first;               /* Cycle it was fetched */
+    int stage;                  /* Stage it was in last cycle */
+    char stages[MAX_SPAN+1];    /* Stage letter for each cycle */
+    int len;                    /* Cycles in the pipeline */
+    byte_t fwd_a;
+    byte_t fwd_b;
+    bool done;
+    fate_t fate;
+    bool shown;                 /* Inside the cycle window */
+} vinstr_t;
+
+/* Options */
+static bool konata = false;
+static word_t first_cycle = 0;
+static word_t last_cycle = -1;  /* -1 for no limit */
+
+/* Instructions in program order, oldest at active[head] */
+static vinstr_t *active[MAX_ACTIVE];
+static int head = 0;
+static int count = 0;
+static word_t next_id = 0;
+static word_t ruler_block = -1;
+
+void usage(char *pname)
+{
+    printf("Usage: %s [-hk] [-c first[-last]] trace\n", pname);
+    printf("   -h     Print this message\n");
+    printf("   -k     Write a Konata log instead of a pipeline diagram\n");
+    printf("   -c c   Only show instructions fetched in cycle c, or in cycles first-last\n");
+    exit(0);
+}
+
+static bool in_window(word_t cyc)
+{
+    return cyc >= first_cycle && (last_cycle < 0 || cyc <= last_cycle);
+}
+
+/* Is any instruction in the window still in flight? */
+static bool shown_in_flight()
+{
+    int i;
+    for (i = 0; i < count; i++)
+	if (active[(head + i) % MAX_ACTIVE]->shown)
+	    return true;
+    return false;
+}
+
+/* Print a cycle ruler above each block of 50 cycles in the diagram */
+static void print_ruler(word_t cyc)
+{
+    int i;
+    if (cyc / 50 == ruler_block)
+	return;
+    ruler_block = cyc / 50;
+    printf("\n%-8s %-8s %-8s ", "Cycle", "PC", "Instr");
+    for (i = 0; i < 50; i += 10)
+	printf("%-10lld", ruler_block * 50 + i);
+    printf("\n");
+}
+
+static void print_instr(vinstr_t *in)
+{
+    print_ruler(in->first);
+    printf("%-8lld 0x%-6llx %-8s %*s%s", in->first, in->pc, iname(in->instr),
+	   (int) (in->first % 50), "", in->stages);
+    if (in->len > MAX_SPAN)
+	printf("... (%d cycles)", in->len);
+    if (in->fwd_a > TRACE_FWD_REG)
+	printf("  valA=%s", trace_fwd_name(in->fwd_a));
+    if (in->fwd_b > TRACE_FWD_REG)
+	printf("  valB=%s", trace_fwd_name(in->fwd_b));
+    if (in->fate == FLUSHED)
+	printf("  (flushed)");
+    else if (in->fate == IN_FLIGHT)
+	printf("  (in flight)");
+    else if (in->status != STAT_AOK)
+	printf("  (%s)", stat_name(in->status));
+    printf("\n");
+}
+
+/* An instruction has left the pipeline.  Konata hears about it at
+   once; the diagram prints instructions in program order as the
+   oldest finish */
+static void finish(vinstr_t *in, fate_t fate)
+{
+    in->done = true;
+    in->fate = fate;
+    if (konata && in->shown && fate != IN_FLIGHT)
+	printf("R\t%lld\t%lld\t%d\n", in->id, in->id, fate == RETIRED ? 0 : 1);
+    while (count > 0 && active[head]->done) {
+	vinstr_t *old = active[head];
+	if (!konata && old->shown)
+	    print_instr(old);
+	free(old);
+	head = (head + 1) % MAX_ACTIVE;
+	count--;
+    }
+}
+
+static vinstr_t *new_instr(trace_stage_t *ts, word_t cyc)
+{
+    vinstr_t *in = (vinstr_t *) calloc(1, sizeof(vinstr_t));
+    if (count == MAX_ACTIVE) {
+	fprintf(stderr, "More than %d instructions in flight at cycle %lld\n", MAX_ACTIVE, cyc);
+	exit(1);
+    }
+    in->id = next_id++;
+    in->pc = ts->pc;
+    in->instr = ts->instr;
+    in->status = ts->status;
+    in->first = cyc;
+    in->stage = -1;
+    in->shown = in_window(cyc);
+    active[(head + count++) % MAX_ACTIVE] = in;
+    if (konata && in->shown) {
+	printf("I\t%lld\t%lld\t0\n", in->id, in->id);
+	printf("L\t%lld\t0\t0x%llx: %s\n", in->id, in->pc, iname(in->instr));
+    }
+    return in;
+}
+
+/* Note that an instruction spent this cycle in stage s */
+static void occupy(vinstr_t *in, int s)
+{
+    if (in->len < MAX_SPAN)
+	in->stages[in->len] = stage_names[s];
+    in->len++;
+    if (konata && in->shown && in->stage != s)
+	printf("S\t%lld\t0\t%c\n", in->id, stage_names[s]);
+    in->stage = s;
+}
+
+/* Where the instruction in a register goes at the end of the cycle,
+   given the op of the register it feeds */
+static vinstr_t *advance(byte_t op, vinstr_t *from, vinstr_t *self)
+{
+    switch (op) {
+    case TRACE_LOAD:
+	return from;
+    case TRACE_BUBBLE:
+	return NULL;
+    default:
+	return self;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *f;
+    trace_rec_t *buf;
+    size_t n, i;
+    int c, s;
+    vinstr_t *cur[TRACE_STAGES] = { NULL };
+    vinstr_t *next[TRACE_STAGES];
+    word_t last = -1;
+    char *dash;
+
+    while ((c = getopt(argc, argv, "hkc:")) != -1) {
+	switch (c) {
+	case 'k':
+	    konata = true;
+	    break;
+	case 'c':
+	    first_cycle = last_cycle = atoll(optarg);
+	    dash = strchr(optarg, '-');
+	    if (dash)
+		last_cycle = atoll(dash + 1);
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+    if (optind != argc - 1)
+	usage(argv[0]);
+
+    f = fopen(argv[optind], "rb");
+    if (!f) {
+	fprintf(stderr, "Can't open trace '%s'\n", argv[optind]);
+	exit(1);
+    }
+    if (!read_trace_header(f, argv[optind]))
+	exit(1);
+
+    if (konata)
+	printf("Kanata\t0004\n");
+    buf = (trace_rec_t *) malloc(TRACE_BUF * sizeof(trace_rec_t));
+    while ((n = fread(buf, sizeof(trace_rec_t), TRACE_BUF, f)) > 0) {
+	for (i = 0; i < n; i++) {
+	    trace_rec_t *r = &buf[i];
+	    /* Follow the window's instructions until they leave */
+	    if (last_cycle >= 0 && r->cycle > last_cycle && !shown_in_flight())
+		break;
+
+	    if (konata) {
+		if (last < 0)
+		    printf("C=\t%lld\n", r->cycle);
+		else
+		    printf("C\t%lld\n", r->cycle - last);
+	    }
+	    last = r->cycle;
+
+	    /* Fetch starts a new instruction unless it is refetching one
+	       that decode could not take */
+	    if (!cur[0])
+		cur[0] = new_instr(&r->stage[0], r->cycle);
+	    for (s = 1; s < TRACE_STAGES; s++) {
+		if (r->stage[s].status == STAT_BUB && cur[s]) {
+		    finish(cur[s], FLUSHED);
+		    cur[s] = NULL;
+		}
+	    }
+	    for (s = 0; s < TRACE_STAGES; s++)
+		if (cur[s])
+		    occupy(cur[s], s);
+	    if (cur[1]) {
+		cur[1]->fwd_a = r->fwd_a;
+		cur[1]->fwd_b = r->fwd_b;
+		if (konata && cur[1]->shown && r->stage[2].op == TRACE_LOAD &&
+		    (r->fwd_a > TRACE_FWD_REG || r->fwd_b > TRACE_FWD_REG))
+		    printf("L\t%lld\t1\tvalA=%s valB=%s\n", cur[1]->id,
+			   trace_fwd_name(r->fwd_a), trace_fwd_name(r->fwd_b));
+	    }
+
+	    /* Move instructions along for the next cycle */
+	    next[0] = r->stage[1].op == TRACE_STALL ? cur[0] : NULL;
+	    for (s = 1; s < TRACE_STAGES; s++)
+		next[s] = advance(r->stage[s].op, cur[s-1], cur[s]);
+	    for (s = 0; s < TRACE_STAGES; s++) {
+		int t;
+		bool kept = false;
+		if (!cur[s])
+		    continue;
+		for (t = 0; t < TRACE_STAGES; t++)
+		    kept |= next[t] == cur[s];
+		if (!kept)
+		    finish(cur[s], s == TRACE_STAGES - 1 ? RETIRED : FLUSHED);
+	    }
+	    memcpy(cur, next, sizeof(cur));
+	}
+	if (i < n)
+	    break;
+    }
+
+    /* Whatever is still in flight when the trace ends */
+    for (s = TRACE_STAGES - 1; s >= 0; s--)
+	if (cur[s])
+	    finish(cur[s], IN_FLIGHT);
+    free(buf);
+    fclose(f);
+    return 0;
+}
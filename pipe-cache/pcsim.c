@@ -12,15 +12,21 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "isa.h"
+#include "asm.h"
+#include "batch.h"
+#include "profile.h"
+#include "trace.h"
+#include "rewind.h"
+#include "script.h"
+#include "breaks.h"
 #include "cache.h"
 #include "pipeline.h"
 #include "stages.h"
 #include "sim.h"
 
-cache_t* cache;
-
 /***************
  * Begin Globals
  ***************/
@@ -32,39 +38,36 @@ char *object_filename;   /* The input object file name. */
 FILE *object_file;       /* Input file handle */
 int verbosity = 2;    /* Verbosity level [TTY only] (-v) */
 word_t instr_limit = 10000; /* Instruction limit [TTY only] (-l) */
-
-/* Log file */
-FILE *dumpfile = NULL;
-
-/* Performance monitoring */
-/* How many cycles have been simulated? */
-word_t cycles = 0;
-/* How many instructions have passed through the WB stage? */
-word_t instructions = 0;
-
-/* Has simulator gotten past initial bubbles? */
-static int starting_up = 1;
-
-
-
-/* Both instruction and data memory */
-mem_t mem;
-
-/* Register file */
-mem_t reg;
-/* Condition code register */
-cc_t cc;
-/* Status code */
-stat_t status;
+bool lockstep = false;    /* Check each instruction as it retires [TTY only] (-k) */
+char *batch_list = NULL; /* Manifest or directory of programs to check (-m) */
+int batch_workers = 0;    /* Workers in batch mode or a sweep (-j), 0 for the default */
+char *profile_filename = NULL; /* Per-PC profile written after the run [TTY only] (-p) */
+char *trace_filename = NULL;   /* Binary pipeline trace written during the run [TTY only] (-t) */
+word_t ff_limit = 0;      /* Instructions run on the ISA model before the pipeline starts [TTY only] (-f) */
+char *script_filename = NULL; /* Interactive commands answered in JSON, - for stdin (-x) */
+
+/* Values given to a data cache flag: one number, a list such as 1,2,4
+   or a range such as 0-4.  More than one value makes a sweep */
+#define MAX_SWEEP 64
+typedef struct {
+    int count;
+    int vals[MAX_SWEEP];
+} cache_param_t;
+
+cache_param_t cache_s, cache_E, cache_b, cache_d; /* Data cache geometry and miss delay (-s -E -b -d) */
 
 /***************************
  * Begin function prototypes
  ***************************/
 
-word_t sim_run_pipe(word_t max_instr, word_t max_cycle, byte_t *statusp, cc_t *ccp);
+word_t sim_run_pipe(sim_ctx_ptr ctx, word_t max_instr, word_t max_cycle, byte_t *statusp, cc_t *ccp);
 static void usage(char *name);           /* Print helpful usage message */
 static void run_tty_sim();               /* Run simulator in TTY mode */
-static void sim_interactive();
+static void run_batch_program(char *fname, batch_result_t *res);
+static void sim_interactive(FILE *in, bool script);
+static word_t fast_forward(sim_ctx_ptr ctx, word_t limit);
+static void parse_cache_param(char *name, char *arg, int min, cache_param_t *param);
+static int run_sweep(int nthreads);
 
 /*************************
  * End function prototypes
@@ -87,28 +90,22 @@ int sim_main(int argc, char **argv)
     int i;
     int c;
     bool interactive = false;
-
-    int s = -1;
-    int E = -1;
-    int b = -1;
-    int d = -1;
-
-    /* your implementation */
+    bool sweep;
 
     /* Parse the command line arguments */
-    while ((c = getopt(argc, argv, "sEbdhtl:v:i")) != -1) {
+    while ((c = getopt(argc, argv, "s:E:b:d:hkl:v:im:j:p:t:f:x:")) != -1) {
         switch(c) {
         case 's':
-            s = atoi(optarg);
+            parse_cache_param("-s", optarg, 0, &cache_s);
             break;
         case 'E':
-            E = atoi(optarg);
+            parse_cache_param("-E", optarg, 1, &cache_E);
             break;
         case 'b':
-            b = atoi(optarg);
+            parse_cache_param("-b", optarg, 0, &cache_b);
             break;
         case 'd':
-            d = atoi(optarg);
+            parse_cache_param("-d", optarg, 1, &cache_d);
             break;
         case 'h':
             usage(argv[0]);
@@ -126,6 +123,27 @@ int sim_main(int argc, char **argv)
         case 'i':
 	        interactive = true;
 	        break;
+        case 'x':
+            script_filename = optarg;
+            break;
+        case 'k':
+            lockstep = true;
+            break;
+        case 'm':
+            batch_list = optarg;
+            break;
+        case 'j':
+            batch_workers = atoi(optarg);
+            break;
+        case 'p':
+            profile_filename = optarg;
+            break;
+        case 't':
+            trace_filename = optarg;
+            break;
+        case 'f':
+            ff_limit = atoll(optarg);
+            break;
         default:
             printf("Invalid option '%c'\n", c);
             usage(argv[0]);
@@ -154,20 +172,40 @@ int sim_main(int argc, char **argv)
         }
     }
 
-    if (object_filename == NULL) {
+    if (object_filename == NULL && !batch_list) {
         fprintf(stderr, "No object file specified\n");
         exit(1);
     }
 
-    if(s == -1 || b == -1 || E == -1 || d == -1) {
+    if(cache_s.count == 0 || cache_b.count == 0 || cache_E.count == 0 || cache_d.count == 0) {
 	    fprintf(stderr, "Missing flags for create_cache\n");
 	    exit(1);
 	}
 
-    cache = create_cache(s, b, E, d);
+    sweep = cache_s.count > 1 || cache_E.count > 1 || cache_b.count > 1 || cache_d.count > 1;
+    if (sweep) {
+        if (batch_list || interactive || script_filename || !object_filename) {
+            fprintf(stderr, "A cache sweep runs one object file, without -m, -i or -x\n");
+            exit(1);
+        }
+        verbosity = 0;
+        exit(run_sweep(batch_workers > 0 ? batch_workers : (int) sysconf(_SC_NPROCESSORS_ONLN)) ? 1 : 0);
+    }
 
-    if (interactive) {
-        sim_interactive();
+    if (batch_list) {
+        verbosity = 0;
+        exit(run_batch(batch_list, batch_workers > 0 ? batch_workers : 1, run_batch_program) ? 1 : 0);
+    }
+
+    if (script_filename) {
+        FILE *script = strcmp(script_filename, "-") ? fopen(script_filename, "r") : stdin;
+        if (!script) {
+            fprintf(stderr, "Couldn't open script %s\n", script_filename);
+            exit(1);
+        }
+        sim_interactive(script, true);
+    } else if (interactive) {
+        sim_interactive(stdin, false);
     } else {
         run_tty_sim();
     }
@@ -176,6 +214,111 @@ int sim_main(int argc, char **argv)
 
 int main(int argc, char *argv[]){return sim_main(argc,argv);}
 
+/* Start the ISA model from the loaded pipeline state */
+static void isa_start(sim_ctx_ptr ctx)
+{
+    ctx->isa_state = new_state(0);
+    free_mem(ctx->isa_state->r);
+    free_mem(ctx->isa_state->m);
+    ctx->isa_state->m = copy_mem(ctx->mem);
+    ctx->isa_state->r = copy_mem(ctx->reg);
+    ctx->isa_state->cc = ctx->cc;
+    ctx->isa_state->pc = ctx->start_pc;
+}
+
+/*
+ * isa_check - Compare the final pipeline state against the ISA model,
+ * explaining the differences when verbosity > 0.  Errors from the ISA
+ * model go to error_file.
+ */
+static bool isa_check(sim_ctx_ptr ctx, cc_t result_cc, FILE *error_file)
+{
+    byte_t e = STAT_AOK;
+    word_t step;
+    bool match = true;
+
+    /* In lockstep mode the ISA model has already been stepped and
+       checked alongside the pipeline, so only the condition codes
+       remain to be compared */
+    if (lockstep) {
+        match = !ctx->diverged;
+    } else {
+        for (step = 0; step < instr_limit && e == STAT_AOK; step++) {
+            e = step_state(ctx->isa_state, error_file);
+        }
+
+        if (diff_reg(ctx->isa_state->r, ctx->reg, NULL)) {
+            match = false;
+            if (verbosity > 0) {
+            printf("ISA Register != Pipeline Register File\n");
+            diff_reg(ctx->isa_state->r, ctx->reg, stdout);
+            }
+        }
+        if (diff_mem(ctx->isa_state->m, ctx->mem, NULL, ctx->cache)) {
+            match = false;
+            if (verbosity > 0) {
+            printf("ISA Memory != Pipeline Memory\n");
+            diff_mem(ctx->isa_state->m, ctx->mem, stdout, ctx->cache);
+            }
+        }
+    }
+
+    if (ctx->isa_state->cc != result_cc) {
+        match = false;
+        if (verbosity > 0) {
+        printf("ISA Cond. Codes (%s) != Pipeline Cond. Codes (%s)\n",
+            cc_name(ctx->isa_state->cc), cc_name(result_cc));
+        }
+    }
+    return match;
+}
+
+static void print_cpi(sim_ctx_ptr ctx)
+{
+    double cpi = ctx->instructions > 0 ? (double) ctx->cycles/ctx->instructions : 1.0;
+    printf("CPI: %lld cycles/%lld instructions = %.2f\n",
+           ctx->cycles, ctx->instructions, cpi);
+}
+
+/* One line of the CPI stack: the CPI added by a kind of hazard */
+static void print_cpi_part(sim_ctx_ptr ctx, char *name, prof_event_t event)
+{
+    printf("  %-12s%.2f  (%lld cycles)\n", name,
+           ctx->instructions > 0 ? (double) ctx->hazard_cycles[event]/ctx->instructions : 0.0,
+           ctx->hazard_cycles[event]);
+}
+
+/*
+ * print_cpi_stack - Break the CPI down into the ideal one cycle per
+ * instruction and the cycles lost to each hazard.  Base is what is
+ * left, so the parts add up to the CPI.  The pipeline empties behind
+ * a halt after the last instruction, so halt stalls are not part of it.
+ */
+static void print_cpi_stack(sim_ctx_ptr ctx)
+{
+    word_t lost = ctx->hazard_cycles[PROF_LOAD_USE] + ctx->hazard_cycles[PROF_MISPREDICT] +
+        ctx->hazard_cycles[PROF_RET] + ctx->hazard_cycles[PROF_MEM];
+    printf("CPI stack:\n");
+    printf("  %-12s%.2f\n", "Base",
+           ctx->instructions > 0 ? (double) (ctx->cycles - lost)/ctx->instructions : 1.0);
+    print_cpi_part(ctx, "Load/use", PROF_LOAD_USE);
+    print_cpi_part(ctx, "Mispredict", PROF_MISPREDICT);
+    print_cpi_part(ctx, "Return", PROF_RET);
+    print_cpi_part(ctx, "Cache wait", PROF_MEM);
+    printf("  Halt stalls: %lld cycles, after the last instruction\n",
+           ctx->hazard_cycles[PROF_HALT]);
+}
+
+/* Everything measured so far, for the stats command */
+static void print_stats(sim_ctx_ptr ctx)
+{
+    print_cpi(ctx);
+    print_cpi_stack(ctx);
+    printf("Data cache: %lld/%lld accesses hit = %.2f%%\n",
+           ctx->dmem_accesses - ctx->dmem_misses, ctx->dmem_accesses,
+           ctx->dmem_accesses > 0 ? 100.0 * (ctx->dmem_accesses - ctx->dmem_misses)/ctx->dmem_accesses : 100.0);
+}
+
 /*
  * run_tty_sim - Run the simulator in TTY mode
  */
@@ -186,17 +329,16 @@ static void run_tty_sim()
     cc_t result_cc = 0;
     word_t byte_cnt = 0;
     mem_t mem0, reg0;
-    state_ptr isa_state = NULL;
+    sim_ctx_ptr ctx = new_sim(cache_s.vals[0], cache_E.vals[0], cache_b.vals[0], cache_d.vals[0]);
 
     if (verbosity >= 2)
-	    dumpfile = stdout;
-    sim_init();
+	    ctx->dumpfile = stdout;
 
     /* Emit simulator name */
     if (verbosity >= 2)
 	    printf("%s\n", simname);
 
-    byte_cnt = load_mem(mem, object_file, 1);
+    byte_cnt = load_code(ctx->mem, ctx->syms, object_filename, object_file, 1);
     if (byte_cnt == 0) {
 	    fprintf(stderr, "No lines of code found\n");
 	    exit(1);
@@ -204,66 +346,257 @@ static void run_tty_sim()
 	    printf("%lld bytes of code read\n", byte_cnt);
     }
     fclose(object_file);
-    isa_state = new_state(0);
-    free_mem(isa_state->r);
-    free_mem(isa_state->m);
-    isa_state->m = copy_mem(mem);
-    isa_state->r = copy_mem(reg);
-    isa_state->cc = cc;
+    if (ff_limit > 0) {
+        word_t skipped = fast_forward(ctx, ff_limit);
+        if (verbosity > 0)
+            printf("Fast-forwarded %lld instructions to PC 0x%llx\n", skipped, ctx->start_pc);
+    }
+    isa_start(ctx);
 
-    mem0 = copy_mem(mem);
-    reg0 = copy_mem(reg);
+    mem0 = copy_mem(ctx->mem);
+    reg0 = copy_mem(ctx->reg);
 
-    icount = sim_run_pipe(instr_limit, 5*instr_limit, &run_status, &result_cc);
+    if (profile_filename)
+        ctx->profile = new_profile();
+    if (trace_filename && !(ctx->trace = open_trace(trace_filename))) {
+        fprintf(stderr, "Couldn't create trace %s\n", trace_filename);
+        exit(1);
+    }
+    icount = sim_run_pipe(ctx, instr_limit, 5*instr_limit, &run_status, &result_cc);
+    if (ctx->trace && !close_trace(ctx->trace)) {
+        fprintf(stderr, "Couldn't write trace %s\n", trace_filename);
+        exit(1);
+    }
+    ctx->trace = NULL;
     if (verbosity > 0) {
         printf("%lld instructions executed\n", icount);
         printf("Status = %s\n", stat_name(run_status));
         printf("Condition Codes: %s\n", cc_name(result_cc));
         printf("Changed Register State:\n");
-        diff_reg(reg0, reg, stdout);
+        diff_reg(reg0, ctx->reg, stdout);
         printf("Changed Memory State:\n");
-        diff_mem(mem0, mem, stdout, true);
+        diff_mem(mem0, ctx->mem, stdout, ctx->cache);
     }
 
-    byte_t e = STAT_AOK;
-    word_t step;
-    bool match = true;
-    for (step = 0; step < instr_limit && e == STAT_AOK; step++) {
-        e = step_state(isa_state, stdout);
+    bool match = isa_check(ctx, result_cc, stdout);
+    if (match) {
+        printf("ISA Check Succeeds\n");
+    } else {
+        printf("ISA Check Fails\n");
     }
 
-    if (diff_reg(isa_state->r, reg, NULL)) {
-        match = false;
-        if (verbosity > 0) {
-        printf("ISA Register != Pipeline Register File\n");
-        diff_reg(isa_state->r, reg, stdout);
-        }
+    /* Emit CPI statistics */
+    print_cpi(ctx);
+    if (verbosity > 0)
+        print_cpi_stack(ctx);
+
+    if (ctx->profile && !write_profile(ctx->profile, ctx->syms, profile_filename)) {
+        fprintf(stderr, "Couldn't write profile %s\n", profile_filename);
+        exit(1);
     }
-    if (diff_mem(isa_state->m, mem, NULL, true)) {
-        match = false;
-        if (verbosity > 0) {
-        printf("ISA Memory != Pipeline Memory\n");
-        diff_mem(isa_state->m, mem, stdout, true);
-        }
+
+}
+
+/*
+ * run_batch_program - Run one object file in batch mode and check it
+ * against the ISA model.  Prints nothing.
+ */
+static void run_batch_program(char *fname, batch_result_t *res)
+{
+    byte_t run_status = STAT_AOK;
+    cc_t result_cc = 0;
+    FILE *f = fopen(fname, "r");
+    sim_ctx_ptr ctx;
+
+    res->ran = false;
+    if (!f)
+        return;
+    /* Each program starts with a cold cache */
+    ctx = new_sim(cache_s.vals[0], cache_E.vals[0], cache_b.vals[0], cache_d.vals[0]);
+    if (load_code(ctx->mem, ctx->syms, fname, f, 0) == 0) {
+        fclose(f);
+        free_sim(ctx);
+        return;
     }
-    if (isa_state->cc != result_cc) {
-        match = false;
-        if (verbosity > 0) {
-        printf("ISA Cond. Codes (%s) != Pipeline Cond. Codes (%s)\n",
-            cc_name(isa_state->cc), cc_name(result_cc));
+    fclose(f);
+
+    fast_forward(ctx, ff_limit);
+    isa_start(ctx);
+    sim_run_pipe(ctx, instr_limit, 5*instr_limit, &run_status, &result_cc);
+    res->match = isa_check(ctx, result_cc, NULL);
+    res->cycles = ctx->cycles;
+    res->instructions = ctx->instructions;
+    free_sim(ctx);
+    res->ran = true;
+}
+
+/*
+ * parse_cache_param - Parse the values of a data cache flag: numbers
+ * and ranges lo-hi separated by commas, each at least min
+ */
+static void parse_cache_param(char *name, char *arg, int min, cache_param_t *param)
+{
+    char *p = arg;
+    char *end;
+    long lo, hi, v;
+
+    param->count = 0;
+    while (*p) {
+        lo = hi = strtol(p, &end, 10);
+        if (end != p && *end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+        }
+        if (end == p || (*end && *end != ',') || lo < min || hi < lo) {
+            fprintf(stderr, "Invalid value '%s' for %s: expected numbers of at least %d"
+                    " or ranges lo-hi, separated by commas\n", arg, name, min);
+            exit(1);
+        }
+        for (v = lo; v <= hi; v++) {
+            if (param->count == MAX_SWEEP) {
+                fprintf(stderr, "Too many values for %s (at most %d)\n", name, MAX_SWEEP);
+                exit(1);
+            }
+            param->vals[param->count++] = v;
         }
+        p = *end ? end + 1 : end;
     }
-    if (match) {
-        printf("ISA Check Succeeds\n");
-    } else {
-        printf("ISA Check Fails\n");
+    if (param->count == 0) {
+        fprintf(stderr, "Invalid value '%s' for %s\n", arg, name);
+        exit(1);
     }
+}
 
-    /* Emit CPI statistics */
-	double cpi = instructions > 0 ? (double) cycles/instructions : 1.0;
-	printf("CPI: %lld cycles/%lld instructions = %.2f\n",
-	       cycles, instructions, cpi);
+/* One cache geometry in a sweep, and what running the program with it
+   gave */
+typedef struct {
+    int s, E, b, d;
+    bool match;
+    word_t cycles;
+    word_t instructions;
+    word_t accesses;
+    word_t misses;
+} sweep_point_t;
+
+/* Work shared by the sweep threads.  The program image is only read
+   once the threads start, so each can copy it into its own memory */
+typedef struct {
+    mem_t image;
+    sweep_point_t *points;
+    int count;
+    int next;               /* First point not yet taken by a thread */
+    pthread_mutex_t lock;
+} sweep_t;
+
+/* Run the program with one cache geometry, on a simulator of its own */
+static void run_sweep_point(mem_t image, sweep_point_t *pt)
+{
+    byte_t run_status = STAT_AOK;
+    cc_t result_cc = 0;
+    sim_ctx_ptr ctx = new_sim(pt->s, pt->E, pt->b, pt->d);
+
+    copy_pages(ctx->mem, image);
+    fast_forward(ctx, ff_limit);
+    isa_start(ctx);
+    sim_run_pipe(ctx, instr_limit, 5*instr_limit, &run_status, &result_cc);
+    pt->match = isa_check(ctx, result_cc, NULL);
+    pt->cycles = ctx->cycles;
+    pt->instructions = ctx->instructions;
+    pt->accesses = ctx->dmem_accesses;
+    pt->misses = ctx->dmem_misses;
+    free_sim(ctx);
+}
 
+/* Thread body: take points off the shared list until none are left */
+static void *sweep_thread(void *arg)
+{
+    sweep_t *sw = (sweep_t *) arg;
+    int i;
+
+    for (;;) {
+        pthread_mutex_lock(&sw->lock);
+        i = sw->next++;
+        pthread_mutex_unlock(&sw->lock);
+        if (i >= sw->count)
+            return NULL;
+        run_sweep_point(sw->image, &sw->points[i]);
+    }
+}
+
+/*
+ * run_sweep - Run the object file once for every combination of the
+ * -s, -E, -b and -d values, on nthreads threads, and print a table of
+ * the CPI and data cache hit rate of each.  Returns the number of runs
+ * that failed the ISA check.
+ */
+static int run_sweep(int nthreads)
+{
+    sweep_t sw;
+    pthread_t *threads;
+    int is, iE, ib, id, i;
+    int failed = 0;
+    sim_ctx_ptr ctx;
+
+    /* Load the program once */
+    ctx = new_sim(cache_s.vals[0], cache_E.vals[0], cache_b.vals[0], cache_d.vals[0]);
+    if (load_code(ctx->mem, ctx->syms, object_filename, object_file, 0) == 0) {
+        fprintf(stderr, "No lines of code found\n");
+        exit(1);
+    }
+    fclose(object_file);
+
+    sw.image = ctx->mem;
+    sw.count = cache_s.count * cache_E.count * cache_b.count * cache_d.count;
+    sw.points = (sweep_point_t *) calloc(sw.count, sizeof(sweep_point_t));
+    sw.next = 0;
+    pthread_mutex_init(&sw.lock, NULL);
+    i = 0;
+    for (is = 0; is < cache_s.count; is++)
+        for (iE = 0; iE < cache_E.count; iE++)
+            for (ib = 0; ib < cache_b.count; ib++)
+                for (id = 0; id < cache_d.count; id++) {
+                    sw.points[i].s = cache_s.vals[is];
+                    sw.points[i].E = cache_E.vals[iE];
+                    sw.points[i].b = cache_b.vals[ib];
+                    sw.points[i].d = cache_d.vals[id];
+                    i++;
+                }
+
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > sw.count)
+        nthreads = sw.count;
+    threads = (pthread_t *) malloc(nthreads * sizeof(pthread_t));
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, sweep_thread, &sw) != 0) {
+            fprintf(stderr, "Couldn't start sweep thread\n");
+            exit(1);
+        }
+    }
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+
+    printf("%s: %d cache geometries on %d threads\n", object_filename, sw.count, nthreads);
+    printf("%4s %4s %4s %4s %10s %10s %10s %6s %8s  %s\n",
+           "s", "E", "b", "d", "Bytes", "Cycles", "Instrs", "CPI", "Hit rate", "ISA Check");
+    for (i = 0; i < sw.count; i++) {
+        sweep_point_t *pt = &sw.points[i];
+        printf("%4d %4d %4d %4d %10lld %10lld %10lld %6.2f %7.2f%%  %s\n",
+               pt->s, pt->E, pt->b, pt->d,
+               ((word_t) pt->E << pt->s) << pt->b,
+               pt->cycles, pt->instructions,
+               pt->instructions > 0 ? (double) pt->cycles/pt->instructions : 1.0,
+               pt->accesses > 0 ? 100.0 * (pt->accesses - pt->misses)/pt->accesses : 100.0,
+               pt->match ? "Succeeds" : "Fails");
+        if (!pt->match)
+            failed++;
+    }
+
+    pthread_mutex_destroy(&sw.lock);
+    free(threads);
+    free(sw.points);
+    free_sim(ctx);
+    return failed;
 }
 
 /*
@@ -271,11 +604,25 @@ static void run_tty_sim()
  */
 static void usage(char *name)
 {
-    printf("Usage: %s [-hi] [-l m] [-v n] file.yo\n", name);
+    printf("Usage: %s [-hik] [-l m] [-v n] [-f n] [-m f] [-j n] [-p f] [-t f] [-x f] -s s -E E -b b -d d file.yo\n", name);
     printf("   -h     Print this message\n");
     printf("   -l m   Set instruction limit to m [TTY mode only] (default %lld)\n", instr_limit);
     printf("   -v n   Set verbosity level to 0 <= n <= 2 [TTY mode only] (default %d)\n", verbosity);
     printf("   -i     Runs the simulator in interactive mode\n");
+    printf("   -x f   Run the interactive commands in file f (- for stdin), answering each with a line of JSON\n");
+    printf("   -k     Check each instruction against the ISA model as it retires [TTY mode only]\n");
+    printf("   -f n   Run the first n instructions on the ISA model, then -l m on the pipeline [TTY mode only]\n");
+    printf("   -m f   Check every program in manifest or directory f, one line each\n");
+    printf("   -j n   Run batch mode (-m) with n worker processes, or a sweep with n threads\n");
+    printf("          (default 1, or one thread per core for a sweep)\n");
+    printf("   -p f   Write a per-PC profile of stalls and hazards to CSV file f [TTY mode only]\n");
+    printf("   -t f   Write a binary trace of every cycle to file f, for yview [TTY mode only]\n");
+    printf("   -s s   Data cache has 2^s sets\n");
+    printf("   -E E   Data cache has E lines per set\n");
+    printf("   -b b   Data cache blocks hold 2^b bytes\n");
+    printf("   -d d   A data cache miss takes d cycles\n");
+    printf("          Each of -s, -E, -b and -d may be a list such as 1,2,4 or a range such as 0-4;\n");
+    printf("          more than one value sweeps every combination and prints a table\n");
     exit(0);
 }
 
@@ -285,182 +632,451 @@ static void usage(char *name)
  * You only need to modify function sim_step_pipe()
  *********************************************************/
 
-/* Pending updates to state */
-word_t cc_in = DEFAULT_CC;
-word_t wb_destE = REG_NONE;
-word_t wb_valE = 0;
-word_t wb_destM = REG_NONE;
-word_t wb_valM = 0;
-word_t mem_addr = 0;
-word_t mem_data = 0;
-bool mem_write = false;
-
-/* output and input states of all pipeline registers */
-fetch_ptr fetch_output;
-decode_ptr decode_output;
-execute_ptr execute_output;
-memory_ptr memory_output;
-writeback_ptr writeback_output;
-
-fetch_ptr fetch_input;
-decode_ptr decode_input;
-execute_ptr execute_input;
-memory_ptr memory_input;
-writeback_ptr writeback_input;
-
-/* Intermediate values */
-word_t f_pc;
-byte_t imem_icode;
-byte_t imem_ifun;
-bool imem_error;
-bool instr_valid;
-word_t d_regvala;
-word_t d_regvalb;
-word_t e_vala;
-word_t e_valb;
-bool e_bcond;
-mem_status_t dmem_status;
-
-/* The pipeline state */
-pipe_ptr fetch_state, decode_state, execute_state, memory_state, writeback_state;
-
 /*****************************************************************************
  * pipeline control
  * These functions can be used to handle hazards
  *****************************************************************************/
 
 /* bubble stage (has effect at next update) */
-void sim_bubble_stage(stage_id_t stage)
+void sim_bubble_stage(sim_ctx_ptr ctx, stage_id_t stage)
 {
     switch (stage)
 	{
-	case FETCH_STAGE     : fetch_state->op     = P_BUBBLE; break;
-	case DECODE_STAGE    : decode_state->op    = P_BUBBLE; break;
-	case EXECUTE_STAGE   : execute_state->op   = P_BUBBLE; break;
-	case MEMORY_STAGE    : memory_state->op    = P_BUBBLE; break;
-	case WRITEBACK_STAGE : writeback_state->op = P_BUBBLE; break;
+	case FETCH_STAGE     : ctx->fetch_state->op     = P_BUBBLE; break;
+	case DECODE_STAGE    : ctx->decode_state->op    = P_BUBBLE; break;
+	case EXECUTE_STAGE   : ctx->execute_state->op   = P_BUBBLE; break;
+	case MEMORY_STAGE    : ctx->memory_state->op    = P_BUBBLE; break;
+	case WRITEBACK_STAGE : ctx->writeback_state->op = P_BUBBLE; break;
 	}
 }
 
 /* stall stage (has effect at next update) */
-void sim_stall_stage(stage_id_t stage) {
+void sim_stall_stage(sim_ctx_ptr ctx, stage_id_t stage) {
     switch (stage)
 	{
-	case FETCH_STAGE     : fetch_state->op     = P_STALL; break;
-	case DECODE_STAGE    : decode_state->op    = P_STALL; break;
-	case EXECUTE_STAGE   : execute_state->op   = P_STALL; break;
-	case MEMORY_STAGE    : memory_state->op    = P_STALL; break;
-	case WRITEBACK_STAGE : writeback_state->op = P_STALL; break;
+	case FETCH_STAGE     : ctx->fetch_state->op     = P_STALL; break;
+	case DECODE_STAGE    : ctx->decode_state->op    = P_STALL; break;
+	case EXECUTE_STAGE   : ctx->execute_state->op   = P_STALL; break;
+	case MEMORY_STAGE    : ctx->memory_state->op    = P_STALL; break;
+	case WRITEBACK_STAGE : ctx->writeback_state->op = P_STALL; break;
 	}
 }
 
-static int initialized = 0;
+/* Connect the stages to the current buffers of the pipe registers.  A
+   load swaps a register's input and output, so this follows every
+   update */
+static void connect_pipes(sim_ctx_ptr ctx)
+{
+    ctx->fetch_input      = ctx->fetch_state->input;
+    ctx->fetch_output     = ctx->fetch_state->output;
+
+    ctx->decode_input     = ctx->decode_state->input;
+    ctx->decode_output    = ctx->decode_state->output;
+
+    ctx->execute_input    = ctx->execute_state->input;
+    ctx->execute_output   = ctx->execute_state->output;
+
+    ctx->memory_input     = ctx->memory_state->input;
+    ctx->memory_output    = ctx->memory_state->output;
+
+    ctx->writeback_input  = ctx->writeback_state->input;
+    ctx->writeback_output = ctx->writeback_state->output;
+}
 
-void sim_init()
+sim_ctx_ptr new_sim(int s, int E, int b, int d)
 {
-    /* Create memory and register files */
-    initialized = 1;
-    mem = init_mem(MEM_SIZE);
-    reg = init_reg();
+    sim_ctx_ptr ctx = calloc(1, sizeof(sim_ctx));
+
+    /* Create memory, register files and cache */
+    ctx->mem = init_mem(MEM_SIZE);
+    ctx->reg = init_reg();
+    ctx->syms = new_symtab();
+    ctx->cache = create_cache(s, b, E, d);
 
     /* create 5 pipe registers */
-    fetch_state     = new_pipe(sizeof(fetch_ele), (void *) &bubble_fetch);
-    decode_state    = new_pipe(sizeof(decode_ele), (void *) &bubble_decode);
-    execute_state   = new_pipe(sizeof(execute_ele), (void *) &bubble_execute);
-    memory_state    = new_pipe(sizeof(memory_ele), (void *) &bubble_memory);
-    writeback_state = new_pipe(sizeof(writeback_ele), (void *) &bubble_writeback);
+    ctx->fetch_state     = new_pipe(ctx, sizeof(fetch_ele), (void *) &bubble_fetch);
+    ctx->decode_state    = new_pipe(ctx, sizeof(decode_ele), (void *) &bubble_decode);
+    ctx->execute_state   = new_pipe(ctx, sizeof(execute_ele), (void *) &bubble_execute);
+    ctx->memory_state    = new_pipe(ctx, sizeof(memory_ele), (void *) &bubble_memory);
+    ctx->writeback_state = new_pipe(ctx, sizeof(writeback_ele), (void *) &bubble_writeback);
 
     /* connect them to the pipeline stages */
-    fetch_input      = fetch_state->input;
-    fetch_output     = fetch_state->output;
+    connect_pipes(ctx);
 
-    decode_input     = decode_state->input;
-    decode_output    = decode_state->output;
+    sim_reset(ctx);
+    clear_mem(ctx->mem);
+    return ctx;
+}
 
-    execute_input    = execute_state->input;
-    execute_output   = execute_state->output;
+void free_sim(sim_ctx_ptr ctx)
+{
+    int s;
+    for (s = 0; s < ctx->pipe_count; s++) {
+        free(ctx->pipes[s]->output);
+        free(ctx->pipes[s]->input);
+        free(ctx->pipes[s]);
+    }
+    if (ctx->isa_state)
+        free_state(ctx->isa_state);
+    if (ctx->profile)
+        free_profile(ctx->profile);
+    free_cache(ctx->cache);
+    free_symtab(ctx->syms);
+    free_reg(ctx->reg);
+    free_mem(ctx->mem);
+    free(ctx);
+}
 
-    memory_input     = memory_state->input;
-    memory_output    = memory_state->output;
+void sim_reset(sim_ctx_ptr ctx)
+{
+    clear_pipes(ctx);
+    clear_mem(ctx->reg);
+    ctx->starting_up = 1;
+    ctx->start_pc = 0;
+    ctx->cycles = ctx->instructions = 0;
+    ctx->cc = DEFAULT_CC;
+    ctx->status = STAT_AOK;
+
+    ctx->cc = ctx->cc_in = DEFAULT_CC;
+    ctx->wb_destE = REG_NONE;
+    ctx->wb_valE = 0;
+    ctx->wb_destM = REG_NONE;
+    ctx->wb_valM = 0;
+    ctx->mem_addr = 0;
+    ctx->mem_data = 0;
+    ctx->imem_error = false;
+    ctx->diverged = false;
+    ctx->checked = 0;
+    memset(ctx->hazard_cycles, 0, sizeof(ctx->hazard_cycles));
+    ctx->dmem_status = READY;
+    ctx->dmem_accesses = ctx->dmem_misses = 0;
+    ctx->mem_write = false;
+}
 
-    writeback_input  = writeback_state->input;
-    writeback_output = writeback_state->output;
+/* Look up the blocks holding the 8 bytes at addr in the cache, and
+   bring in any that miss, without the miss delay */
+static void warm_cache(sim_ctx_ptr ctx, word_t addr, operation_t operation)
+{
+    uword_t B = (uword_t) 1 << ctx->cache->b;
+    uword_t block;
+    for (block = addr & ~(B - 1); block < (uword_t) addr + 8; block += B) {
+        if (!check_hit(ctx->cache, block, operation)) {
+            evicted_line_t *evicted = handle_miss(ctx->cache, block, operation, NULL);
+            free(evicted->data);
+            free(evicted);
+        }
+    }
+}
 
-    sim_reset();
-    clear_mem(mem);
+/* Copy into every line of the cache the data of its block in memory */
+static void fill_cache(sim_ctx_ptr ctx)
+{
+    uword_t S = (uword_t) 1 << ctx->cache->s;
+    uword_t B = (uword_t) 1 << ctx->cache->b;
+    uword_t set, i;
+    unsigned int e;
+    for (set = 0; set < S; set++) {
+        for (e = 0; e < ctx->cache->E; e++) {
+            cache_line_t *line = &ctx->cache->sets[set].lines[e];
+            uword_t block = (line->tag << (ctx->cache->s + ctx->cache->b)) | (set << ctx->cache->b);
+            if (!line->valid)
+                continue;
+            for (i = 0; i < B; i++)
+                get_byte_val_I(ctx->mem, block + i, &line->data[i]);
+        }
+    }
 }
 
-void sim_reset()
+/*
+ * fast_forward - Run up to limit instructions of the loaded program on
+ * the ISA model, warming the cache with their data accesses, then
+ * start the pipeline from the state the model reached.  Returns how
+ * many instructions ran.  If the program stops first, the pipeline
+ * starts at the instruction that stopped it.  Warming only tracks
+ * which blocks are cached; their data is read from memory once the
+ * ISA model is done with it.
+ */
+static word_t fast_forward(sim_ctx_ptr ctx, word_t limit)
 {
-    if (!initialized)
-	    sim_init();
-    clear_pipes();
-    clear_mem(reg);
-    starting_up = 1;
-    cycles = instructions = 0;
-    cc = DEFAULT_CC;
-    status = STAT_AOK;
+    state_ptr s = new_state(0);
+    stat_t e = STAT_AOK;
+    word_t n;
+
+    free_mem(s->r);
+    free_mem(s->m);
+    s->m = copy_mem(ctx->mem);
+    s->r = copy_mem(ctx->reg);
+    s->cc = ctx->cc;
+    for (n = 0; n < limit; n++) {
+        word_t rsp = get_reg_val(s->r, REG_RSP);
+        byte_t byte0 = 0;
+        byte_t byte1 = 0;
+        word_t valc = 0;
+        word_t addr = 0;
+        operation_t operation = READ;
+        bool access = true;
+
+        get_byte_val_I(s->m, s->pc, &byte0);
+        get_byte_val_I(s->m, s->pc + 1, &byte1);
+        get_word_val_I(s->m, s->pc + 2, &valc);
+        switch (HI4(byte0)) {
+        case I_RMMOVQ:
+            operation = WRITE;
+            // fall through
+        case I_MRMOVQ:
+            addr = valc + get_reg_val(s->r, LO4(byte1));
+            break;
+        case I_PUSHQ:
+        case I_CALL:
+            operation = WRITE;
+            addr = rsp - 8;
+            break;
+        case I_POPQ:
+        case I_RET:
+            addr = rsp;
+            break;
+        default:
+            access = false;
+            break;
+        }
+        if ((e = step_state(s, NULL)) != STAT_AOK)
+            break;
+        if (access)
+            warm_cache(ctx, addr, operation);
+    }
 
-    cc = cc_in = DEFAULT_CC;
-    wb_destE = REG_NONE;
-    wb_valE = 0;
-    wb_destM = REG_NONE;
-    wb_valM = 0;
-    mem_addr = 0;
-    mem_data = 0;
-    mem_write = false;
+    free_mem(ctx->mem);
+    free_mem(ctx->reg);
+    ctx->mem = copy_mem(s->m);
+    ctx->reg = copy_mem(s->r);
+    ctx->cc = s->cc;
+    fill_cache(ctx);
+    ctx->start_pc = s->pc;
+    ctx->fetch_input->predPC = ctx->fetch_output->predPC = ctx->start_pc;
+    free_state(s);
+    return n;
 }
 
-static void print_state(word_t cyc) {
-    sim_log("\nCycle = %lld. CC = %s, Stat = %s\n", cyc, cc_name(cc), stat_name(status));
+static void print_state(sim_ctx_ptr ctx, word_t cyc) {
+    SIM_LOG(ctx, "\nCycle = %lld. CC = %s, Stat = %s\n", cyc, cc_name(ctx->cc), stat_name(ctx->status));
 }
 
-static void print_fetch() {
-    sim_log("F: predPC = 0x%llx\n", fetch_output->predPC);
+static void print_fetch(sim_ctx_ptr ctx) {
+    SIM_LOG(ctx, "F: predPC = %s\n", pc_name(ctx->syms, ctx->fetch_output->predPC));
 }
 
-static void print_decode() {
-    sim_log("D: instr = %s, rA = %s, rB = %s, valC = 0x%llx, valP = 0x%llx, Stat = %s, Stage PC = 0x%llx\n",
-	    iname(HPACK(decode_output->icode, decode_output->ifun)),
-	    reg_name(decode_output->ra), reg_name(decode_output->rb),
-	    decode_output->valc, decode_output->valp,
-	    stat_name(decode_output->status), decode_output->stage_pc);
+static void print_decode(sim_ctx_ptr ctx) {
+    SIM_LOG(ctx, "D: instr = %s, rA = %s, rB = %s, valC = 0x%llx, valP = 0x%llx, Stat = %s, Stage PC = %s\n",
+	    iname(HPACK(ctx->decode_output->icode, ctx->decode_output->ifun)),
+	    reg_name(ctx->decode_output->ra), reg_name(ctx->decode_output->rb),
+	    ctx->decode_output->valc, ctx->decode_output->valp,
+	    stat_name(ctx->decode_output->status), pc_name(ctx->syms, ctx->decode_output->stage_pc));
 }
 
-static void print_execute() {
-    sim_log("E: instr = %s, valC = 0x%llx, valA = 0x%llx, valB = 0x%llx\n   srcA = %s, srcB = %s, dstE = %s, dstM = %s, Stat = %s, Stage PC = 0x%llx\n",
-	    iname(HPACK(execute_output->icode, execute_output->ifun)),
-	    execute_output->valc, execute_output->vala, execute_output->valb,
-	    reg_name(execute_output->srca), reg_name(execute_output->srcb),
-	    reg_name(execute_output->deste), reg_name(execute_output->destm),
-	    stat_name(execute_output->status), execute_output->stage_pc);
+static void print_execute(sim_ctx_ptr ctx) {
+    SIM_LOG(ctx, "E: instr = %s, valC = 0x%llx, valA = 0x%llx, valB = 0x%llx\n   srcA = %s, srcB = %s, dstE = %s, dstM = %s, Stat = %s, Stage PC = %s\n",
+	    iname(HPACK(ctx->execute_output->icode, ctx->execute_output->ifun)),
+	    ctx->execute_output->valc, ctx->execute_output->vala, ctx->execute_output->valb,
+	    reg_name(ctx->execute_output->srca), reg_name(ctx->execute_output->srcb),
+	    reg_name(ctx->execute_output->deste), reg_name(ctx->execute_output->destm),
+	    stat_name(ctx->execute_output->status), pc_name(ctx->syms, ctx->execute_output->stage_pc));
 }
 
-static void print_memory() {
-    sim_log("M: instr = %s, Cnd = %d, valE = 0x%llx, valA = 0x%llx\n   dstE = %s, dstM = %s, Stat = %s, Stage PC = 0x%llx\n",
-	    iname(HPACK(memory_output->icode, memory_output->ifun)),
-	    memory_output->takebranch,
-	    memory_output->vale, memory_output->vala,
-	    reg_name(memory_output->deste), reg_name(memory_output->destm),
-	    stat_name(memory_output->status), memory_output->stage_pc);
+static void print_memory(sim_ctx_ptr ctx) {
+    SIM_LOG(ctx, "M: instr = %s, Cnd = %d, valE = 0x%llx, valA = 0x%llx\n   dstE = %s, dstM = %s, Stat = %s, Stage PC = %s\n",
+	    iname(HPACK(ctx->memory_output->icode, ctx->memory_output->ifun)),
+	    ctx->memory_output->takebranch,
+	    ctx->memory_output->vale, ctx->memory_output->vala,
+	    reg_name(ctx->memory_output->deste), reg_name(ctx->memory_output->destm),
+	    stat_name(ctx->memory_output->status), pc_name(ctx->syms, ctx->memory_output->stage_pc));
 }
 
-static void print_writeback() {
-    sim_log("W: instr = %s, valE = 0x%llx, valM = 0x%llx, dstE = %s, dstM = %s, Stat = %s, Stage PC = 0x%llx\n",
-	    iname(HPACK(writeback_output->icode, writeback_output->ifun)),
-	    writeback_output->vale, writeback_output->valm,
-	    reg_name(writeback_output->deste), reg_name(writeback_output->destm),
-	    stat_name(writeback_output->status), writeback_output->stage_pc);
+static void print_writeback(sim_ctx_ptr ctx) {
+    SIM_LOG(ctx, "W: instr = %s, valE = 0x%llx, valM = 0x%llx, dstE = %s, dstM = %s, Stat = %s, Stage PC = %s\n",
+	    iname(HPACK(ctx->writeback_output->icode, ctx->writeback_output->ifun)),
+	    ctx->writeback_output->vale, ctx->writeback_output->valm,
+	    reg_name(ctx->writeback_output->deste), reg_name(ctx->writeback_output->destm),
+	    stat_name(ctx->writeback_output->status), pc_name(ctx->syms, ctx->writeback_output->stage_pc));
+}
+
+/* Source line of the instruction in each stage */
+static void print_source_line(sim_ctx_ptr ctx, char *stage, word_t pc, stat_t stage_status) {
+    src_line_t *line = find_src_line(ctx->syms, pc);
+    if (stage_status == STAT_BUB)
+        SIM_LOG(ctx, "%s: bubble\n", stage);
+    else if (line)
+        SIM_LOG(ctx, "%s: %s, line %d: %s\n", stage, pc_name(ctx->syms, pc), line->lineno, line->text);
+    else
+        SIM_LOG(ctx, "%s: %s\n", stage, pc_name(ctx->syms, pc));
+}
+
+static void print_source(sim_ctx_ptr ctx) {
+    print_source_line(ctx, "F", ctx->fetch_output->predPC, STAT_AOK);
+    print_source_line(ctx, "D", ctx->decode_output->stage_pc, ctx->decode_output->status);
+    print_source_line(ctx, "E", ctx->execute_output->stage_pc, ctx->execute_output->status);
+    print_source_line(ctx, "M", ctx->memory_output->stage_pc, ctx->memory_output->status);
+    print_source_line(ctx, "W", ctx->writeback_output->stage_pc, ctx->writeback_output->status);
 }
 
 /* Text representation of status */
-void tty_report(word_t cyc) {
-    print_state(cyc);
-    print_fetch();
-    print_decode();
-    print_execute();
-    print_memory();
-    print_writeback();
+void tty_report(sim_ctx_ptr ctx, word_t cyc) {
+    print_state(ctx, cyc);
+    print_fetch(ctx);
+    print_decode(ctx);
+    print_execute(ctx);
+    print_memory(ctx);
+    print_writeback(ctx);
+}
+
+/* Address the ISA model is about to write, if its next instruction stores */
+static bool isa_write_addr(sim_ctx_ptr ctx, word_t *addrp)
+{
+    byte_t byte0 = 0;
+    byte_t byte1 = 0;
+    word_t valc = 0;
+    get_byte_val_I(ctx->isa_state->m, ctx->isa_state->pc, &byte0);
+    switch (GET_ICODE(byte0)) {
+    case I_RMMOVQ:
+        get_byte_val_I(ctx->isa_state->m, ctx->isa_state->pc + 1, &byte1);
+        get_word_val_I(ctx->isa_state->m, ctx->isa_state->pc + 2, &valc);
+        *addrp = valc + get_reg_val(ctx->isa_state->r, LO4(byte1));
+        return true;
+    case I_PUSHQ:
+    case I_CALL:
+        *addrp = get_reg_val(ctx->isa_state->r, REG_RSP) - 8;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Compare one stored word between the ISA model and the pipeline */
+static bool lockstep_word_match(sim_ctx_ptr ctx, word_t addr)
+{
+    word_t isa_val = 0;
+    word_t pipe_val = 0;
+    get_word_val_I(ctx->isa_state->m, addr, &isa_val);
+    peek_word_val_D(ctx->cache, ctx->mem, addr, &pipe_val);
+    if (isa_val == pipe_val)
+        return true;
+    if (verbosity > 0) {
+        printf("ISA Memory != Pipeline Memory\n");
+        printf("\tISA Memory\t\tPipeline Memory\n");
+        printf("0x%.4llx:\t0x%.16llx\t0x%.16llx\n", addr, isa_val, pipe_val);
+    }
+    return false;
+}
+
+/*
+ * lockstep_check - Step the ISA model over the instruction retiring in
+ * writeback and compare the state it changed.  The register file is
+ * small enough to compare whole; memory is only checked at the word
+ * the instruction stored.
+ */
+static void lockstep_check(sim_ctx_ptr ctx)
+{
+    word_t pc = ctx->isa_state->pc;
+    word_t isa_addr = 0;
+    bool isa_store = isa_write_addr(ctx, &isa_addr);
+    bool match = true;
+
+    if (pc != ctx->writeback_output->stage_pc) {
+        match = false;
+        if (verbosity > 0)
+            printf("ISA PC (0x%llx) != Pipeline PC (0x%llx)\n",
+                   pc, ctx->writeback_output->stage_pc);
+    } else {
+        byte_t e = step_state(ctx->isa_state, NULL);
+        if (e != ctx->writeback_output->status) {
+            match = false;
+            if (verbosity > 0)
+                printf("ISA Status (%s) != Pipeline Status (%s)\n",
+                       stat_name(e), stat_name(ctx->writeback_output->status));
+        }
+        if (diff_reg(ctx->isa_state->r, ctx->reg, NULL)) {
+            match = false;
+            if (verbosity > 0) {
+                printf("ISA Register != Pipeline Register File\n");
+                printf("\tISA register\t\tPipeline Register\n");
+                diff_reg(ctx->isa_state->r, ctx->reg, stdout);
+            }
+        }
+        if (e == STAT_AOK && isa_store)
+            match = lockstep_word_match(ctx, isa_addr) && match;
+        if (ctx->writeback_output->status == STAT_AOK &&
+            (ctx->writeback_output->icode == I_RMMOVQ ||
+             ctx->writeback_output->icode == I_PUSHQ ||
+             ctx->writeback_output->icode == I_CALL) &&
+            !(isa_store && ctx->writeback_output->vale == isa_addr))
+            match = lockstep_word_match(ctx, ctx->writeback_output->vale) && match;
+    }
+    ctx->checked++;
+    if (!match) {
+        ctx->diverged = true;
+        if (verbosity > 0)
+            printf("Lockstep check diverges at instruction %lld, PC 0x%llx\n",
+                   ctx->checked, pc);
+    }
+}
+
+/*
+ * count_hazard - Count a hazard found by do_stall_check, which cost
+ * the given number of bubbles, and charge it to the instruction at pc
+ * when profiling.  A cache wait costs one cycle and no bubbles.
+ */
+static void count_hazard(sim_ctx_ptr ctx, word_t pc, prof_event_t event, int bubbles)
+{
+    prof_ent_t *ent;
+    /* While a data access is in flight every stage but decode (behind
+       a halt) stalls, so the other hazards take effect on a later cycle */
+    if (event != PROF_MEM && event != PROF_HALT && ctx->dmem_status == IN_FLIGHT)
+        return;
+    ctx->hazard_cycles[event] += event == PROF_MEM ? 1 : bubbles;
+    if (!ctx->profile)
+        return;
+    ent = profile_entry(ctx->profile, pc);
+    ent->events[event]++;
+    ent->bubbles += bubbles;
+}
+
+/*
+ * profile_pipes - Charge n cycles like the one just simulated to the
+ * instructions in the pipeline.  Called by update_pipes before the pipe
+ * registers change, while the stall decisions of do_stall_check are in
+ * place.
+ */
+static void profile_pipes(sim_ctx_ptr ctx, word_t n)
+{
+    pipe_ptr regs[PROF_STAGES] = { ctx->fetch_state, ctx->decode_state, ctx->execute_state,
+                                   ctx->memory_state, ctx->writeback_state };
+    word_t pcs[PROF_STAGES];
+    bool valid[PROF_STAGES];
+    int s;
+
+    /* Fetch holds the PC it will fetch from; later stages hold an
+       instruction unless they hold a bubble */
+    pcs[FETCH_STAGE] = ctx->fetch_output->predPC;
+    valid[FETCH_STAGE] = true;
+    pcs[DECODE_STAGE] = ctx->decode_output->stage_pc;
+    valid[DECODE_STAGE] = ctx->decode_output->status != STAT_BUB;
+    pcs[EXECUTE_STAGE] = ctx->execute_output->stage_pc;
+    valid[EXECUTE_STAGE] = ctx->execute_output->status != STAT_BUB;
+    pcs[MEMORY_STAGE] = ctx->memory_output->stage_pc;
+    valid[MEMORY_STAGE] = ctx->memory_output->status != STAT_BUB;
+    pcs[WRITEBACK_STAGE] = ctx->writeback_output->stage_pc;
+    valid[WRITEBACK_STAGE] = ctx->writeback_output->status != STAT_BUB;
+
+    for (s = 0; s < PROF_STAGES; s++)
+        if (valid[s] && regs[s]->op == P_STALL)
+            profile_entry(ctx->profile, pcs[s])->stalls[s] += n;
+
+    /* The cycle belongs to the oldest instruction in flight */
+    for (s = WRITEBACK_STAGE; s > FETCH_STAGE; s--) {
+        if (valid[s]) {
+            profile_entry(ctx->profile, pcs[s])->cycles += n;
+            break;
+        }
+    }
 }
 
 /******************************************************************
@@ -469,29 +1085,66 @@ void tty_report(word_t cyc) {
  * number of instructions that want to complete during this
  * simulation run.
  * You should update intermediate values for each stage, update
- * global state values after all stages, and finally return the
+ * the state values in ctx after all stages, and finally return the
  * correct state.
  ******************************************************************/
 
+/* One stage of a trace record */
+static void trace_stage(trace_stage_t *ts, word_t pc, byte_t icode, byte_t ifun,
+                        byte_t stage_status, pipe_ptr p)
+{
+    ts->pc = pc;
+    ts->instr = HPACK(icode, ifun);
+    ts->status = stage_status;
+    ts->op = p->op;
+}
+
+/* Add the cycle just simulated to the trace: what fetch fetched, what
+   the other pipe registers held, what each register will do at the
+   end of the cycle and where decode took its operands from */
+static void trace_cycle(sim_ctx_ptr ctx, word_t cyc)
+{
+    trace_rec_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.cycle = cyc;
+    trace_stage(&rec.stage[0], ctx->decode_input->stage_pc, ctx->decode_input->icode,
+                ctx->decode_input->ifun, ctx->decode_input->status, ctx->fetch_state);
+    trace_stage(&rec.stage[1], ctx->decode_output->stage_pc, ctx->decode_output->icode,
+                ctx->decode_output->ifun, ctx->decode_output->status, ctx->decode_state);
+    trace_stage(&rec.stage[2], ctx->execute_output->stage_pc, ctx->execute_output->icode,
+                ctx->execute_output->ifun, ctx->execute_output->status, ctx->execute_state);
+    trace_stage(&rec.stage[3], ctx->memory_output->stage_pc, ctx->memory_output->icode,
+                ctx->memory_output->ifun, ctx->memory_output->status, ctx->memory_state);
+    trace_stage(&rec.stage[4], ctx->writeback_output->stage_pc, ctx->writeback_output->icode,
+                ctx->writeback_output->ifun, ctx->writeback_output->status, ctx->writeback_state);
+    rec.fwd_a = ctx->fwd_a;
+    rec.fwd_b = ctx->fwd_b;
+    trace_write(ctx->trace, &rec);
+}
+
 /* Run pipeline for one cycle */
 /* Return status of processor */
-static byte_t sim_step_pipe(word_t ccount)
+static byte_t sim_step_pipe(sim_ctx_ptr ctx, word_t ccount)
 {
+    /* A stalled writeback register still holds a checked instruction */
+    bool wb_loaded = ctx->writeback_state->op != P_STALL;
     /* Update pipe registers */
-    update_pipes();
+    update_pipes(ctx);
+    connect_pipes(ctx);
     /* print status report in TTY mode */
-    tty_report(ccount);
+    if (ctx->dumpfile)
+        tty_report(ctx, ccount);
     /* error checking */
-    if (fetch_state->op == P_ERROR)
-	    fetch_output->status = STAT_PIP;
-    if (decode_state->op == P_ERROR)
-	    decode_output->status = STAT_PIP;
-    if (execute_state->op == P_ERROR)
-	    execute_output->status = STAT_PIP;
-    if (memory_state->op == P_ERROR)
-	    memory_output->status = STAT_PIP;
-    if (writeback_state->op == P_ERROR)
-	    writeback_output->status = STAT_PIP;
+    if (ctx->fetch_state->op == P_ERROR)
+	    ctx->fetch_output->status = STAT_PIP;
+    if (ctx->decode_state->op == P_ERROR)
+	    ctx->decode_output->status = STAT_PIP;
+    if (ctx->execute_state->op == P_ERROR)
+	    ctx->execute_output->status = STAT_PIP;
+    if (ctx->memory_state->op == P_ERROR)
+	    ctx->memory_output->status = STAT_PIP;
+    if (ctx->writeback_state->op == P_ERROR)
+	    ctx->writeback_output->status = STAT_PIP;
 
     /****************** Stage implementations ******************
      * TODO: implement the following functions to simulate the
@@ -505,25 +1158,31 @@ static byte_t sim_step_pipe(word_t ccount)
      * values properly.
      ***********************************************************/
 
-    do_writeback_stage();
-    do_memory_stage();
-    do_execute_stage();
-    do_decode_stage();
-    do_fetch_stage();
+    do_writeback_stage(ctx);
+    if (lockstep && ctx->isa_state && wb_loaded && ctx->writeback_output->status != STAT_BUB)
+        lockstep_check(ctx);
+    if (ctx->profile && wb_loaded && ctx->writeback_output->status != STAT_BUB)
+        profile_entry(ctx->profile, ctx->writeback_output->stage_pc)->execs++;
+    do_memory_stage(ctx);
+    do_execute_stage(ctx);
+    do_decode_stage(ctx);
+    do_fetch_stage(ctx);
 
-    do_stall_check();
+    do_stall_check(ctx);
+    if (ctx->trace)
+        trace_cycle(ctx, ccount);
 
     /* Performance monitoring. Do not change anything below */
-    if (writeback_output->status != STAT_BUB) {
-        starting_up = 0;
-        instructions++;
-        cycles++;
+    if (ctx->writeback_output->status != STAT_BUB) {
+        ctx->starting_up = 0;
+        ctx->instructions++;
+        ctx->cycles++;
     } else {
-        if (!starting_up)
-            cycles++;
+        if (!ctx->starting_up)
+            ctx->cycles++;
     }
 
-    return status;
+    return ctx->status;
 }
 
 /*************************** Fetch stage ***************************
@@ -534,28 +1193,28 @@ static byte_t sim_step_pipe(word_t ccount)
  * imem_error is defined for logging purpose, you can use it to help
  * with your design, but it's also fine to neglect it
  *******************************************************************/
-void do_fetch_stage()
+void do_fetch_stage(sim_ctx_ptr ctx)
 {
     /* your implementation */
-    fetch_input->status = STAT_AOK;
-    f_pc = fetch_output->predPC;
+    ctx->fetch_input->status = STAT_AOK;
+    ctx->f_pc = ctx->fetch_output->predPC;
     
-    decode_input->stage_pc = f_pc;
+    ctx->decode_input->stage_pc = ctx->f_pc;
     byte_t byte0;
-    imem_error |= !get_byte_val_I(mem, f_pc, &byte0);
+    ctx->imem_error |= !get_byte_val_I(ctx->mem, ctx->f_pc, &byte0);
 
-    decode_input->status = (imem_error) ? STAT_ADR : STAT_AOK;
-    decode_input->icode = GET_ICODE(byte0);
-    decode_input->ifun = GET_FUN(byte0);
-    decode_input->ra = REG_NONE;
-    decode_input->rb = REG_NONE;
-    decode_input->valc = 0;
+    ctx->decode_input->status = (ctx->imem_error) ? STAT_ADR : STAT_AOK;
+    ctx->decode_input->icode = GET_ICODE(byte0);
+    ctx->decode_input->ifun = GET_FUN(byte0);
+    ctx->decode_input->ra = REG_NONE;
+    ctx->decode_input->rb = REG_NONE;
+    ctx->decode_input->valc = 0;
 
     byte_t tempB;
     switch (byte0) {
     case HPACK(I_NOP, F_NONE):
     case HPACK(I_HALT, F_NONE):
-        decode_input->valp = f_pc + 1;
+        ctx->decode_input->valp = ctx->f_pc + 1;
         break;
 
     case HPACK(I_RRMOVQ, F_NONE):
@@ -565,36 +1224,36 @@ void do_fetch_stage()
     case HPACK(I_RRMOVQ, C_NE):
     case HPACK(I_RRMOVQ, C_GE):
     case HPACK(I_RRMOVQ, C_G):
-        imem_error |= !get_byte_val_I(mem, f_pc + 1, &tempB);
-        decode_input->ra = HI4(tempB);
-        decode_input->rb = LO4(tempB);
-        decode_input->valp = f_pc + 2;
+        ctx->imem_error |= !get_byte_val_I(ctx->mem, ctx->f_pc + 1, &tempB);
+        ctx->decode_input->ra = HI4(tempB);
+        ctx->decode_input->rb = LO4(tempB);
+        ctx->decode_input->valp = ctx->f_pc + 2;
         break;
 
     case HPACK(I_IRMOVQ, F_NONE):
-        imem_error |= !get_byte_val_I(mem, f_pc + 1, &tempB);
-        decode_input->rb = LO4(tempB);
-        imem_error |= !get_word_val_I(mem, f_pc + 2, &decode_input->valc);
-        decode_input->valp = f_pc + 10;
+        ctx->imem_error |= !get_byte_val_I(ctx->mem, ctx->f_pc + 1, &tempB);
+        ctx->decode_input->rb = LO4(tempB);
+        ctx->imem_error |= !get_word_val_I(ctx->mem, ctx->f_pc + 2, &ctx->decode_input->valc);
+        ctx->decode_input->valp = ctx->f_pc + 10;
         break;
 
     case HPACK(I_RMMOVQ, F_NONE):
     case HPACK(I_MRMOVQ, F_NONE):
-        imem_error |= !get_byte_val_I(mem, f_pc + 1, &tempB);
-        decode_input->ra = HI4(tempB);
-        decode_input->rb = LO4(tempB);
-        imem_error |= !get_word_val_I(mem, f_pc + 2, &decode_input->valc);
-        decode_input->valp = f_pc + 10;
+        ctx->imem_error |= !get_byte_val_I(ctx->mem, ctx->f_pc + 1, &tempB);
+        ctx->decode_input->ra = HI4(tempB);
+        ctx->decode_input->rb = LO4(tempB);
+        ctx->imem_error |= !get_word_val_I(ctx->mem, ctx->f_pc + 2, &ctx->decode_input->valc);
+        ctx->decode_input->valp = ctx->f_pc + 10;
         break;
 
     case HPACK(I_ALU, A_ADD):
     case HPACK(I_ALU, A_SUB):
     case HPACK(I_ALU, A_AND):
     case HPACK(I_ALU, A_XOR):
-        imem_error |= !get_byte_val_I(mem, f_pc + 1, &tempB);
-        decode_input->ra = HI4(tempB);
-        decode_input->rb = LO4(tempB);
-        decode_input->valp = f_pc + 2;
+        ctx->imem_error |= !get_byte_val_I(ctx->mem, ctx->f_pc + 1, &tempB);
+        ctx->decode_input->ra = HI4(tempB);
+        ctx->decode_input->rb = LO4(tempB);
+        ctx->decode_input->valp = ctx->f_pc + 2;
         break;
 
     case HPACK(I_JMP, C_YES):
@@ -604,44 +1263,44 @@ void do_fetch_stage()
     case HPACK(I_JMP, C_NE):
     case HPACK(I_JMP, C_GE):
     case HPACK(I_JMP, C_G):
-        imem_error |= !get_word_val_I(mem, f_pc + 1, &decode_input->valc);
-        decode_input->valp = f_pc + 9;
+        ctx->imem_error |= !get_word_val_I(ctx->mem, ctx->f_pc + 1, &ctx->decode_input->valc);
+        ctx->decode_input->valp = ctx->f_pc + 9;
         break;
 
     case HPACK(I_CALL, F_NONE):
-        imem_error |= !get_word_val_I(mem, f_pc + 1, &decode_input->valc);
-        decode_input->valp = f_pc + 9;
+        ctx->imem_error |= !get_word_val_I(ctx->mem, ctx->f_pc + 1, &ctx->decode_input->valc);
+        ctx->decode_input->valp = ctx->f_pc + 9;
         break;
 
     case HPACK(I_RET, F_NONE):
-        decode_input->valp = f_pc + 1;
+        ctx->decode_input->valp = ctx->f_pc + 1;
         break;
 
     case HPACK(I_PUSHQ, F_NONE):
     case HPACK(I_POPQ, F_NONE):
-        imem_error |= !get_byte_val_I(mem, f_pc + 1, &tempB);
-        decode_input->ra = HI4(tempB);
-        decode_input->rb = LO4(tempB);
-        decode_input->valp = f_pc + 2;
+        ctx->imem_error |= !get_byte_val_I(ctx->mem, ctx->f_pc + 1, &tempB);
+        ctx->decode_input->ra = HI4(tempB);
+        ctx->decode_input->rb = LO4(tempB);
+        ctx->decode_input->valp = ctx->f_pc + 2;
         break;
 
     default:
-        decode_input->status = STAT_INS;
+        ctx->decode_input->status = STAT_INS;
         printf("Invalid instruction\n");
         break;
     }
 
     // update predPC
     if (HI4(byte0) == I_JMP || HI4(byte0) == I_CALL) {
-            fetch_input->predPC = decode_input->valc;
+            ctx->fetch_input->predPC = ctx->decode_input->valc;
     } else {
-        fetch_input->predPC = decode_input->valp;
+        ctx->fetch_input->predPC = ctx->decode_input->valp;
     }
 
     /* logging function, do not change this */
-    if (!imem_error) {
-        sim_log("\tFetch: f_pc = 0x%llx, f_instr = %s\n",
-            f_pc, iname(HPACK(decode_input->icode, decode_input->ifun)));
+    if (!ctx->imem_error) {
+        SIM_LOG(ctx, "\tFetch: f_pc = 0x%llx, f_instr = %s\n",
+            ctx->f_pc, iname(HPACK(ctx->decode_input->icode, ctx->decode_input->ifun)));
     }
 }
 
@@ -650,133 +1309,150 @@ void do_fetch_stage()
  * you may find these functions useful:
  * get_reg_val()
  *******************************************************************/
-void do_decode_stage()
+void do_decode_stage(sim_ctx_ptr ctx)
 {
     /* your implementation */
-    execute_input->status = decode_output->status;
-    execute_input->icode = decode_output->icode;
-    execute_input->ifun = decode_output->ifun;
-    execute_input->vala = 0;
-    execute_input->valb = 0;
-    execute_input->valc = decode_output->valc;
-    execute_input->srca = REG_NONE;
-    execute_input->srcb = REG_NONE;
-    execute_input->deste = REG_NONE;
-    execute_input->destm = REG_NONE;
-    execute_input->stage_pc = decode_output->stage_pc;
-
-    switch (decode_output->icode) {
+    ctx->execute_input->status = ctx->decode_output->status;
+    ctx->execute_input->icode = ctx->decode_output->icode;
+    ctx->execute_input->ifun = ctx->decode_output->ifun;
+    ctx->execute_input->vala = 0;
+    ctx->execute_input->valb = 0;
+    ctx->execute_input->valc = ctx->decode_output->valc;
+    ctx->execute_input->srca = REG_NONE;
+    ctx->execute_input->srcb = REG_NONE;
+    ctx->execute_input->deste = REG_NONE;
+    ctx->execute_input->destm = REG_NONE;
+    ctx->execute_input->stage_pc = ctx->decode_output->stage_pc;
+
+    switch (ctx->decode_output->icode) {
     case I_HALT:
     case I_NOP:
     
         break;
 
     case I_RRMOVQ: // aka CMOVQ
-        execute_input->srca = decode_output->ra;
-        execute_input->deste = decode_output->rb;
+        ctx->execute_input->srca = ctx->decode_output->ra;
+        ctx->execute_input->deste = ctx->decode_output->rb;
         break;
 
     case I_IRMOVQ:
-        execute_input->deste = decode_output->rb;
-        execute_input->valc = decode_output->valc;
+        ctx->execute_input->deste = ctx->decode_output->rb;
+        ctx->execute_input->valc = ctx->decode_output->valc;
         break;
 
     case I_RMMOVQ:
-        execute_input->srca = decode_output->ra;
-        execute_input->srcb = decode_output->rb;
+        ctx->execute_input->srca = ctx->decode_output->ra;
+        ctx->execute_input->srcb = ctx->decode_output->rb;
         break;
 
     case I_MRMOVQ:
-        execute_input->srcb = decode_output->rb;
-        execute_input->destm = decode_output->ra;
+        ctx->execute_input->srcb = ctx->decode_output->rb;
+        ctx->execute_input->destm = ctx->decode_output->ra;
         break;
 
     case I_ALU:
-        execute_input->srca = decode_output->ra;
-        execute_input->srcb = decode_output->rb;
-        execute_input->deste = decode_output->rb;
+        ctx->execute_input->srca = ctx->decode_output->ra;
+        ctx->execute_input->srcb = ctx->decode_output->rb;
+        ctx->execute_input->deste = ctx->decode_output->rb;
         break;
 
     case I_JMP:
         break;
 
     case I_CALL:
-        execute_input->srcb = REG_RSP;
-        execute_input->deste = REG_RSP;
+        ctx->execute_input->srcb = REG_RSP;
+        ctx->execute_input->deste = REG_RSP;
         break;
 
     case I_RET:
-        execute_input->srca = REG_RSP;
-        execute_input->srcb = REG_RSP;
-        execute_input->deste = REG_RSP;
+        ctx->execute_input->srca = REG_RSP;
+        ctx->execute_input->srcb = REG_RSP;
+        ctx->execute_input->deste = REG_RSP;
         break;
 
     case I_PUSHQ:
-        execute_input->srca = decode_output->ra;
-        execute_input->srcb = REG_RSP;
-        execute_input->deste = REG_RSP;
+        ctx->execute_input->srca = ctx->decode_output->ra;
+        ctx->execute_input->srcb = REG_RSP;
+        ctx->execute_input->deste = REG_RSP;
         break;
 
     case I_POPQ:
-        execute_input->srca = REG_RSP;
-        execute_input->srcb = REG_RSP;
-        execute_input->deste = REG_RSP;
-        execute_input->destm = decode_output->ra;
+        ctx->execute_input->srca = REG_RSP;
+        ctx->execute_input->srcb = REG_RSP;
+        ctx->execute_input->deste = REG_RSP;
+        ctx->execute_input->destm = ctx->decode_output->ra;
         break;
 
     default:
-        execute_input->status = STAT_INS;
-        printf("icode is not valid (%d)", decode_output->icode);
+        ctx->execute_input->status = STAT_INS;
+        printf("icode is not valid (%d)", ctx->decode_output->icode);
         break;
     }
-    execute_input->vala = get_reg_val(reg, execute_input->srca);
-    execute_input->valb = get_reg_val(reg, execute_input->srcb);
+    ctx->execute_input->vala = get_reg_val(ctx->reg, ctx->execute_input->srca);
+    ctx->execute_input->valb = get_reg_val(ctx->reg, ctx->execute_input->srcb);
+    ctx->fwd_a = ctx->fwd_b = TRACE_FWD_REG;
 
     // def-use forwarding writeback vale
-    if (writeback_output->deste == execute_input->srca) {
-        execute_input->vala = writeback_output->vale;
+    if (ctx->writeback_output->deste == ctx->execute_input->srca) {
+        ctx->execute_input->vala = ctx->writeback_output->vale;
+        ctx->fwd_a = TRACE_FWD_W_VALE;
     }
     // def-use forwarding memory
-    if (memory_output->deste == execute_input->srca) {
-        execute_input->vala = memory_output->vale;
+    if (ctx->memory_output->deste == ctx->execute_input->srca) {
+        ctx->execute_input->vala = ctx->memory_output->vale;
+        ctx->fwd_a = TRACE_FWD_M_VALE;
     }
     // def-use forwarding execute
-    if (memory_input->deste == execute_input->srca) {
-        execute_input->vala = memory_input->vale;
+    if (ctx->memory_input->deste == ctx->execute_input->srca) {
+        ctx->execute_input->vala = ctx->memory_input->vale;
+        ctx->fwd_a = TRACE_FWD_E_VALE;
     }
     // load-use forwarding writeback valm
-    if (writeback_output->destm == execute_input->srca) {
-        execute_input->vala = writeback_output->valm;
+    if (ctx->writeback_output->destm == ctx->execute_input->srca) {
+        ctx->execute_input->vala = ctx->writeback_output->valm;
+        ctx->fwd_a = TRACE_FWD_W_VALM;
     }
     // load-use forwarding memory valm
-    if (memory_output->destm == execute_input->srca) {
-        execute_input->vala = writeback_input->valm;
+    if (ctx->memory_output->destm == ctx->execute_input->srca) {
+        ctx->execute_input->vala = ctx->writeback_input->valm;
+        ctx->fwd_a = TRACE_FWD_M_VALM;
     }
 
     // def-use forwarding writeback vale
-    if (writeback_output->deste == execute_input->srcb) {
-        execute_input->valb = writeback_output->vale;
+    if (ctx->writeback_output->deste == ctx->execute_input->srcb) {
+        ctx->execute_input->valb = ctx->writeback_output->vale;
+        ctx->fwd_b = TRACE_FWD_W_VALE;
     }
     // def-use forwarding memory
-    if (memory_output->deste == execute_input->srcb) {
-        execute_input->valb = memory_output->vale;
+    if (ctx->memory_output->deste == ctx->execute_input->srcb) {
+        ctx->execute_input->valb = ctx->memory_output->vale;
+        ctx->fwd_b = TRACE_FWD_M_VALE;
     }
     // def-use forwarding execute
-    if (memory_input->deste == execute_input->srcb) {
-        execute_input->valb = memory_input->vale;
+    if (ctx->memory_input->deste == ctx->execute_input->srcb) {
+        ctx->execute_input->valb = ctx->memory_input->vale;
+        ctx->fwd_b = TRACE_FWD_E_VALE;
     }
     // load-use forwarding writeback valm
-    if (writeback_output->destm == execute_input->srcb) {
-        execute_input->valb = writeback_output->valm;
+    if (ctx->writeback_output->destm == ctx->execute_input->srcb) {
+        ctx->execute_input->valb = ctx->writeback_output->valm;
+        ctx->fwd_b = TRACE_FWD_W_VALM;
     }
     // load-use forwarding memory valm
-    if (memory_output->destm == execute_input->srcb) {
-        execute_input->valb = writeback_input->valm;
+    if (ctx->memory_output->destm == ctx->execute_input->srcb) {
+        ctx->execute_input->valb = ctx->writeback_input->valm;
+        ctx->fwd_b = TRACE_FWD_M_VALM;
     }
 
+    if (ctx->execute_input->srca == REG_NONE)
+        ctx->fwd_a = TRACE_FWD_NONE;
+    if (ctx->execute_input->srcb == REG_NONE)
+        ctx->fwd_b = TRACE_FWD_NONE;
+
     // return address forwarding
-    if (decode_output->icode == I_CALL || decode_output->icode == I_JMP) {
-        execute_input->vala = decode_output->valp;
+    if (ctx->decode_output->icode == I_CALL || ctx->decode_output->icode == I_JMP) {
+        ctx->execute_input->vala = ctx->decode_output->valp;
+        ctx->fwd_a = TRACE_FWD_VALP;
     }
 }
 
@@ -785,7 +1461,7 @@ void do_decode_stage()
  * you may find these functions useful:
  * cond_holds(), compute_alu(), compute_cc()
  *******************************************************************/
-void do_execute_stage()
+void do_execute_stage(sim_ctx_ptr ctx)
 {
     /* some useful variables for logging purpose */
     bool setcc = false;
@@ -794,86 +1470,87 @@ void do_execute_stage()
     alua = alub = 0;
 
     /* your implementation */
-    memory_input->status = execute_output->status;
-    memory_input->icode = execute_output->icode;
-    memory_input->ifun = execute_output->ifun;
-    memory_input->vale = 0;
-    memory_input->vala = execute_output->vala;
-    memory_input->deste = execute_output->deste;
-    memory_input->destm = execute_output->destm;
-    memory_input->srca = execute_output->srca;
-    memory_input->stage_pc = execute_output->stage_pc;
-
-    e_bcond = false;
-    switch (execute_output->icode) {
+    ctx->memory_input->status = ctx->execute_output->status;
+    ctx->memory_input->icode = ctx->execute_output->icode;
+    ctx->memory_input->ifun = ctx->execute_output->ifun;
+    ctx->memory_input->vale = 0;
+    ctx->memory_input->takebranch = false;
+    ctx->memory_input->vala = ctx->execute_output->vala;
+    ctx->memory_input->deste = ctx->execute_output->deste;
+    ctx->memory_input->destm = ctx->execute_output->destm;
+    ctx->memory_input->srca = ctx->execute_output->srca;
+    ctx->memory_input->stage_pc = ctx->execute_output->stage_pc;
+
+    ctx->e_bcond = false;
+    switch (ctx->execute_output->icode) {
     case I_HALT:
     case I_NOP:
         break;
 
     case I_RRMOVQ: // aka CMOVQ
-        e_bcond = cond_holds(cc, execute_output->ifun);
-        memory_input->vale = execute_output->vala;
-        if (!e_bcond) {
-            memory_input->deste = REG_NONE;
+        ctx->e_bcond = cond_holds(ctx->cc, ctx->execute_output->ifun);
+        ctx->memory_input->vale = ctx->execute_output->vala;
+        if (!ctx->e_bcond) {
+            ctx->memory_input->deste = REG_NONE;
         }
         break;
 
     case I_IRMOVQ:
-        memory_input->vale = execute_output->valc;
+        ctx->memory_input->vale = ctx->execute_output->valc;
         break;
 
     case I_RMMOVQ:
-        memory_input->vale = execute_output->valb + execute_output->valc;
+        ctx->memory_input->vale = ctx->execute_output->valb + ctx->execute_output->valc;
         break;
 
     case I_MRMOVQ:
-        memory_input->vale = execute_output->valb + execute_output->valc;
+        ctx->memory_input->vale = ctx->execute_output->valb + ctx->execute_output->valc;
         break;
 
     case I_ALU:
-        alufun = execute_output->ifun;
-        alua = execute_output->vala;
-        alub = execute_output->valb;
-        memory_input->vale = compute_alu(alufun, alua, alub);
-        cc_in = compute_cc(alufun, alua, alub);
+        alufun = ctx->execute_output->ifun;
+        alua = ctx->execute_output->vala;
+        alub = ctx->execute_output->valb;
+        ctx->memory_input->vale = compute_alu(alufun, alua, alub);
+        ctx->cc_in = compute_cc(alufun, alua, alub);
         setcc = true;
         break;
 
     case I_JMP:
-        memory_input->takebranch = cond_holds(cc, execute_output->ifun);;
-        if (!memory_input->takebranch) {
-            memory_input->deste = REG_NONE;
+        ctx->memory_input->takebranch = cond_holds(ctx->cc, ctx->execute_output->ifun);;
+        if (!ctx->memory_input->takebranch) {
+            ctx->memory_input->deste = REG_NONE;
         }
         break;
 
     case I_CALL:
     case I_PUSHQ:
-        memory_input->vale = execute_output->valb - 8;
+        ctx->memory_input->vale = ctx->execute_output->valb - 8;
         break;
 
     case I_RET:
     case I_POPQ:
-        memory_input->vale = execute_output->valb + 8;
+        ctx->memory_input->vale = ctx->execute_output->valb + 8;
         break;
 
     default:
-        memory_input->status = STAT_INS;
-        printf("icode is not valid (%d)", execute_output->icode);
+        ctx->memory_input->status = STAT_INS;
+        printf("icode is not valid (%d)", ctx->execute_output->icode);
         break;
     }
 
     /* logging functions, do not change these */
-    if (execute_output->icode == I_JMP) {
-        sim_log("\tExecute: instr = %s, cc = %s, branch %staken\n",
-            iname(HPACK(execute_output->icode, execute_output->ifun)),
-            cc_name(cc),
-            memory_input->takebranch ? "" : "not ");
-    }
-    sim_log("\tExecute: ALU: %c 0x%llx 0x%llx --> 0x%llx\n",
-        op_name(alufun), alua, alub, memory_input->vale);
+    if (ctx->execute_output->icode == I_JMP) {
+        SIM_LOG(ctx, "\tExecute: instr = %s, cc = %s, branch %staken\n",
+            iname(HPACK(ctx->execute_output->icode, ctx->execute_output->ifun)),
+            cc_name(ctx->cc),
+            ctx->memory_input->takebranch ? "" : "not ");
+    }
+    SIM_LOG(ctx, "\tExecute: ALU: %c 0x%llx 0x%llx --> 0x%llx\n",
+        op_name(alufun), alua, alub, ctx->memory_input->vale);
     if (setcc) {
-        cc = cc_in;
-	    sim_log("\tExecute: New cc=%s\n", cc_name(cc_in));
+        ctx->cc = ctx->cc_in;
+	    SIM_LOG(ctx, "\tExecute: New cc=%s\n", cc_name(ctx->cc_in));
     }
 }
 
@@ -882,26 +1559,29 @@ void do_execute_stage()
  * you may find these functions useful:
  * get_word_val_D(), set_word_val_D()
  *******************************************************************/
-void do_memory_stage()
+void do_memory_stage(sim_ctx_ptr ctx)
 {
-    mem_addr = 0;
-    mem_data = 0;
-    mem_write = false;
+    ctx->mem_addr = 0;
+    ctx->mem_data = 0;
+    ctx->mem_write = false;
     bool mem_read = false;
+    /* An access that missed is repeated until the block arrives */
+    bool retry = ctx->dmem_status == IN_FLIGHT;
+    int misses = ctx->cache->miss_count;
 
     /* your implementation */
-    writeback_input->status = memory_output->status;
-    writeback_input->icode = memory_output->icode;
-    writeback_input->ifun = memory_output->ifun;
-    writeback_input->vale = memory_output->vale;
-    writeback_input->valm = 0;
-    writeback_input->deste = memory_output->deste;
-    writeback_input->destm = memory_output->destm;
-    writeback_input->stage_pc = memory_output->stage_pc;
-
-    switch (memory_output->icode) {
+    ctx->writeback_input->status = ctx->memory_output->status;
+    ctx->writeback_input->icode = ctx->memory_output->icode;
+    ctx->writeback_input->ifun = ctx->memory_output->ifun;
+    ctx->writeback_input->vale = ctx->memory_output->vale;
+    ctx->writeback_input->valm = 0;
+    ctx->writeback_input->deste = ctx->memory_output->deste;
+    ctx->writeback_input->destm = ctx->memory_output->destm;
+    ctx->writeback_input->stage_pc = ctx->memory_output->stage_pc;
+
+    switch (ctx->memory_output->icode) {
     case I_HALT:
-        writeback_input->status = STAT_HLT;
+        ctx->writeback_input->status = STAT_HLT;
         break;
 
     case I_NOP:
@@ -910,14 +1590,14 @@ void do_memory_stage()
         break;
 
     case I_RMMOVQ:
-        mem_write = true;
-        mem_addr = memory_output->vale;
-        mem_data = memory_output->vala;
+        ctx->mem_write = true;
+        ctx->mem_addr = ctx->memory_output->vale;
+        ctx->mem_data = ctx->memory_output->vala;
         break;
 
     case I_MRMOVQ:
         mem_read = true;
-        mem_addr = memory_output->vale;
+        ctx->mem_addr = ctx->memory_output->vale;
         break;
 
     case I_ALU:
@@ -926,76 +1606,81 @@ void do_memory_stage()
 
     case I_CALL:
     case I_PUSHQ:
-        mem_write = true;
-        mem_addr = memory_output->vale;
-        mem_data = memory_output->vala;
+        ctx->mem_write = true;
+        ctx->mem_addr = ctx->memory_output->vale;
+        ctx->mem_data = ctx->memory_output->vala;
         break;
 
     case I_RET:
     case I_POPQ:
         mem_read = true;
-        mem_addr = memory_output->vala;
+        ctx->mem_addr = ctx->memory_output->vala;
         break;
 
     default:
-        writeback_input->status = STAT_INS;
-        printf("icode is not valid (%d)", memory_output->icode);
+        ctx->writeback_input->status = STAT_INS;
+        printf("icode is not valid (%d)", ctx->memory_output->icode);
         break;
     }
 
     if (mem_read) {
-        if ((dmem_status = get_word_val_D(mem, mem_addr, &mem_data)) != READY) {
-            sim_log("\tMemory: Couldn't Read from 0x%llx\n", mem_addr);
+        if ((ctx->dmem_status = get_word_val_D(ctx->cache, ctx->mem, ctx->mem_addr, &ctx->mem_data)) != READY) {
+            SIM_LOG(ctx, "\tMemory: Couldn't Read from 0x%llx\n", ctx->mem_addr);
         } else {
-            sim_log("\tMemory: Read 0x%llx from 0x%llx\n",
-                writeback_input->valm, mem_addr);
+            SIM_LOG(ctx, "\tMemory: Read 0x%llx from 0x%llx\n",
+                ctx->writeback_input->valm, ctx->mem_addr);
         }
     }
-    if (memory_output->icode == I_RET) {
-        fetch_output->predPC = mem_data;
+    if (ctx->memory_output->icode == I_RET) {
+        ctx->fetch_output->predPC = ctx->mem_data;
     }
-    writeback_input->valm = mem_data;
+    ctx->writeback_input->valm = ctx->mem_data;
 
-    if (mem_write) {
-        if ((dmem_status = set_word_val_D(mem, mem_addr, mem_data)) != READY) {
-            sim_log("\tMemory: Couldn't write to address 0x%llx\n", mem_addr);
+    if (ctx->mem_write) {
+        if ((ctx->dmem_status = set_word_val_D(ctx->cache, ctx->mem, ctx->mem_addr, ctx->mem_data)) != READY) {
+            SIM_LOG(ctx, "\tMemory: Couldn't write to address 0x%llx\n", ctx->mem_addr);
         } else {
-            sim_log("\tMemory: Wrote 0x%llx to address 0x%llx\n", mem_data, mem_addr);
+            SIM_LOG(ctx, "\tMemory: Wrote 0x%llx to address 0x%llx\n", ctx->mem_data, ctx->mem_addr);
         }
     }
+    if ((mem_read || ctx->mem_write) && !retry) {
+        ctx->dmem_accesses++;
+        if (ctx->cache->miss_count != misses)
+            ctx->dmem_misses++;
+    }
 }
 
 /******************** Writeback stage *********************
  * TODO: update [wb_destE, wb_valE, wb_destM, wb_valM, status]
  *******************************************************************/
-void do_writeback_stage()
+void do_writeback_stage(sim_ctx_ptr ctx)
 {
-    wb_destE = writeback_output->deste;
-    wb_valE = writeback_output->vale;
-    wb_destM = writeback_output->destm;
-    wb_valM = writeback_output->valm;
+    ctx->wb_destE = ctx->writeback_output->deste;
+    ctx->wb_valE = ctx->writeback_output->vale;
+    ctx->wb_destM = ctx->writeback_output->destm;
+    ctx->wb_valM = ctx->writeback_output->valm;
 
     /* your implementation */
 
-    status = writeback_output->status;
-    if (wb_destE != REG_NONE && writeback_output -> status == STAT_AOK) {
-	    sim_log("\tWriteback: Wrote 0x%llx to register %s\n",
-		    wb_valE, reg_name(wb_destE));
-	    set_reg_val(reg, wb_destE, wb_valE);
+    ctx->status = ctx->writeback_output->status;
+    if (ctx->wb_destE != REG_NONE && ctx->writeback_output -> status == STAT_AOK) {
+	    SIM_LOG(ctx, "\tWriteback: Wrote 0x%llx to register %s\n",
+		    ctx->wb_valE, reg_name(ctx->wb_destE));
+	    set_reg_val(ctx->reg, ctx->wb_destE, ctx->wb_valE);
     }
-    if (wb_destM != REG_NONE && writeback_output -> status == STAT_AOK) {
-	    sim_log("\tWriteback: Wrote 0x%llx to register %s\n",
-		    wb_valM, reg_name(wb_destM));
-	    set_reg_val(reg, wb_destM, wb_valM);
+    if (ctx->wb_destM != REG_NONE && ctx->writeback_output -> status == STAT_AOK) {
+	    SIM_LOG(ctx, "\tWriteback: Wrote 0x%llx to register %s\n",
+		    ctx->wb_valM, reg_name(ctx->wb_destM));
+	    set_reg_val(ctx->reg, ctx->wb_destM, ctx->wb_valM);
     }
 }
 
 /* given stall and bubble flag, return the correct control operation */
-p_stat_t pipe_cntl(char *name, word_t stall, word_t bubble)
+p_stat_t pipe_cntl(sim_ctx_ptr ctx, char *name, word_t stall, word_t bubble)
 {
     if (stall) {
         if (bubble) {
-            sim_log("%s: Conflicting control signals for pipe register\n",
+            SIM_LOG(ctx, "%s: Conflicting control signals for pipe register\n",
                 name);
             return P_ERROR;
         } else {
@@ -1014,48 +1699,52 @@ p_stat_t pipe_cntl(char *name, word_t stall, word_t bubble)
  * update_pipes() will handle the real control behavior later
  * make sure you have a working PIPE before implementing this
  *******************************************************************/
-void do_stall_check()
+void do_stall_check(sim_ctx_ptr ctx)
 {
     /* your implementation */
     // reset
-    fetch_state->op = pipe_cntl("PC", false, false);
-    decode_state->op = pipe_cntl("ID", false, false);
-    execute_state->op = pipe_cntl("EX", false, false);
-    memory_state->op = pipe_cntl("MEM", false, false);
-    writeback_state->op = pipe_cntl("WB", false, false);
+    ctx->fetch_state->op = pipe_cntl(ctx, "PC", false, false);
+    ctx->decode_state->op = pipe_cntl(ctx, "ID", false, false);
+    ctx->execute_state->op = pipe_cntl(ctx, "EX", false, false);
+    ctx->memory_state->op = pipe_cntl(ctx, "MEM", false, false);
+    ctx->writeback_state->op = pipe_cntl(ctx, "WB", false, false);
 
     // return instructions must process
     // load-use after correctly handles combination B
-    if (decode_output->icode == I_RET || execute_output->icode == I_RET ||
-            memory_output->icode == I_RET) {
-        fetch_state->op = pipe_cntl("PC", true, false);
-        decode_state->op = pipe_cntl("ID", false, true);
+    if (ctx->decode_output->icode == I_RET || ctx->execute_output->icode == I_RET ||
+            ctx->memory_output->icode == I_RET) {
+        ctx->fetch_state->op = pipe_cntl(ctx, "PC", true, false);
+        ctx->decode_state->op = pipe_cntl(ctx, "ID", false, true);
     }
     
-    switch (execute_output->icode) {
+    switch (ctx->execute_output->icode) {
     case I_MRMOVQ:
     case I_POPQ:
         // load-use-hazard
-        if (execute_output->destm == execute_input->srca || execute_output->destm == execute_input->srcb) {
-            fetch_state->op = pipe_cntl("PC", true, false);
-            decode_state->op = pipe_cntl("ID", true, false);
-            execute_state->op = pipe_cntl("EX", false, true);
+        if (ctx->execute_output->destm == ctx->execute_input->srca || ctx->execute_output->destm == ctx->execute_input->srcb) {
+            ctx->fetch_state->op = pipe_cntl(ctx, "PC", true, false);
+            ctx->decode_state->op = pipe_cntl(ctx, "ID", true, false);
+            ctx->execute_state->op = pipe_cntl(ctx, "EX", false, true);
+            count_hazard(ctx, ctx->execute_output->stage_pc, PROF_LOAD_USE, 1);
         }
         break;
     
     case I_JMP: // mispredicted branch
-        if (!memory_input->takebranch && decode_output->icode == I_RET) {
+        if (!ctx->memory_input->takebranch && ctx->decode_output->icode == I_RET) {
             // combination A: mispredicted jmp and ret
-            fetch_state->op = pipe_cntl("PC", true, false);
-            decode_state->op = pipe_cntl("ID", false, true);
-            execute_state->op = pipe_cntl("EX", false, true);
+            ctx->fetch_state->op = pipe_cntl(ctx, "PC", true, false);
+            ctx->decode_state->op = pipe_cntl(ctx, "ID", false, true);
+            ctx->execute_state->op = pipe_cntl(ctx, "EX", false, true);
             // vala is valp i.e. fall through
-            fetch_input->predPC = execute_output->vala;
-        } else if (!memory_input->takebranch) {
+            ctx->fetch_input->predPC = ctx->execute_output->vala;
+            // the ret has been charged for the decode bubble
+            count_hazard(ctx, ctx->execute_output->stage_pc, PROF_MISPREDICT, 1);
+        } else if (!ctx->memory_input->takebranch) {
             // normal case
-            decode_state->op = pipe_cntl("ID", false, true);
-            execute_state->op = pipe_cntl("EX", false, true);
-            fetch_input->predPC = execute_output->vala;
+            ctx->decode_state->op = pipe_cntl(ctx, "ID", false, true);
+            ctx->execute_state->op = pipe_cntl(ctx, "EX", false, true);
+            ctx->fetch_input->predPC = ctx->execute_output->vala;
+            count_hazard(ctx, ctx->execute_output->stage_pc, PROF_MISPREDICT, 2);
         }
         break;
 
@@ -1063,19 +1752,70 @@ void do_stall_check()
         break;
     }
 
-    if (dmem_status == IN_FLIGHT) {
-            fetch_state->op = pipe_cntl("PC", true, false);
-            decode_state->op = pipe_cntl("ID", true, false);
-            execute_state->op = pipe_cntl("EX", true, false);
-            memory_state->op = pipe_cntl("MEM", true, false);
-            writeback_state->op = pipe_cntl("WB", true, false);
+    // a load-use stall holds a ret in decode instead of bubbling behind it
+    if (ctx->decode_state->op == P_BUBBLE && (ctx->decode_output->icode == I_RET ||
+            ctx->execute_output->icode == I_RET || ctx->memory_output->icode == I_RET))
+        count_hazard(ctx, ctx->decode_output->icode == I_RET ? ctx->decode_output->stage_pc :
+                     ctx->execute_output->icode == I_RET ? ctx->execute_output->stage_pc :
+                     ctx->memory_output->stage_pc, PROF_RET, 1);
+
+    if (ctx->dmem_status == IN_FLIGHT) {
+            ctx->fetch_state->op = pipe_cntl(ctx, "PC", true, false);
+            ctx->decode_state->op = pipe_cntl(ctx, "ID", true, false);
+            ctx->execute_state->op = pipe_cntl(ctx, "EX", true, false);
+            ctx->memory_state->op = pipe_cntl(ctx, "MEM", true, false);
+            ctx->writeback_state->op = pipe_cntl(ctx, "WB", true, false);
+            count_hazard(ctx, ctx->memory_output->stage_pc, PROF_MEM, 0);
+    }
+
+    if (ctx->decode_output->icode == I_HALT || ctx->execute_output->icode == I_HALT ||
+            ctx->memory_output->icode == I_HALT) {
+        ctx->fetch_state->op = pipe_cntl(ctx, "PC", true, false);
+        ctx->decode_state->op = pipe_cntl(ctx, "ID", false, true);
+        count_hazard(ctx, ctx->decode_output->icode == I_HALT ? ctx->decode_output->stage_pc :
+                     ctx->execute_output->icode == I_HALT ? ctx->execute_output->stage_pc :
+                     ctx->memory_output->stage_pc, PROF_HALT, 1);
     }
+}
 
-    if (decode_output->icode == I_HALT || execute_output->icode == I_HALT ||
-            memory_output->icode == I_HALT) {
-        fetch_state->op = pipe_cntl("PC", true, false);
-        decode_state->op = pipe_cntl("ID", false, true);
+/*
+ * skip_cache_wait - Skip ahead over a data cache miss.  Once a miss has
+ * stalled every pipe register, each cycle until the block arrives
+ * repeats the one before: the stages compute the same values, the
+ * registers hold them and only the cache's countdown moves.  Rather
+ * than simulate those cycles, count them down at once and charge them
+ * to the statistics and profile as sim_step_pipe would have, leaving
+ * the cycle that completes the access to be simulated.  At most limit
+ * cycles are skipped.  Cycles that must be shown or traced one by one
+ * are not skipped.  Returns the number of cycles skipped.
+ */
+static word_t skip_cache_wait(sim_ctx_ptr ctx, word_t limit)
+{
+    word_t n;
+    int s;
+    if (ctx->dmem_status != IN_FLIGHT || ctx->dumpfile || ctx->trace)
+        return 0;
+    for (s = 0; s < ctx->pipe_count; s++)
+        if (ctx->pipes[s]->op != P_STALL)
+            return 0;
+    n = (word_t) ctx->cache->inflight_cycles - 1;
+    if (n > limit)
+        n = limit;
+    if (n <= 0)
+        return 0;
+    ctx->cache->inflight_cycles -= n;
+    ctx->hazard_cycles[PROF_MEM] += n;
+    if (ctx->profile) {
+        profile_pipes(ctx, n);
+        profile_entry(ctx->profile, ctx->memory_output->stage_pc)->events[PROF_MEM] += n;
+    }
+    if (ctx->writeback_output->status != STAT_BUB) {
+        ctx->instructions += n;
+        ctx->cycles += n;
+    } else if (!ctx->starting_up) {
+        ctx->cycles += n;
     }
+    return n;
 }
 
 /*
@@ -1088,49 +1828,60 @@ void do_stall_check()
   if statusp nonnull, then will be set to status of final instruction
   if ccp nonnull, then will be set to condition codes of final instruction
 */
-word_t sim_run_pipe(word_t max_instr, word_t max_cycle, byte_t *statusp, cc_t *ccp)
+word_t sim_run_pipe(sim_ctx_ptr ctx, word_t max_instr, word_t max_cycle, byte_t *statusp, cc_t *ccp)
 {
     word_t icount = 0;
     word_t ccount = 0;
+    word_t limit, skipped;
     byte_t run_status = STAT_AOK;
     while (icount < max_instr && ccount < max_cycle) {
-        run_status = sim_step_pipe(ccount);
+        run_status = sim_step_pipe(ctx, ccount);
         if (run_status != STAT_BUB)
             icount++;
         if (run_status != STAT_AOK && run_status != STAT_BUB)
             break;
+        if (ctx->diverged)
+            break;
         ccount++;
+        /* The cycles skipped each end with the same status */
+        limit = max_cycle - ccount;
+        if (run_status != STAT_BUB && max_instr - icount < limit)
+            limit = max_instr - icount;
+        skipped = skip_cache_wait(ctx, limit);
+        if (run_status != STAT_BUB)
+            icount += skipped;
+        ccount += skipped;
     }
     if (statusp)
         *statusp = run_status;
     if (ccp)
-        *ccp = cc;
+        *ccp = ctx->cc;
     return icount;
 }
 
-void sim_run_cycle(word_t *icount, word_t* ccount, byte_t *statusp, cc_t *ccp)
+void sim_run_cycle(sim_ctx_ptr ctx, word_t *icount, word_t* ccount, byte_t *statusp, cc_t *ccp)
 {
 
     byte_t run_status = STAT_AOK;
-    run_status = sim_step_pipe(*ccount);
+    run_status = sim_step_pipe(ctx, *ccount);
     if (run_status != STAT_BUB)
         (*icount)++;
     (*ccount)++;
     if (statusp)
 	    *statusp = run_status;
     if (ccp)
-	    *ccp = cc;
+	    *ccp = ctx->cc;
 }
 
 /*
  * sim_log dumps a formatted string to the dumpfile, if it exists
  * accepts variable argument list
  */
-void sim_log( const char *format, ... ) {
-    if (dumpfile) {
+void sim_log(sim_ctx_ptr ctx, const char *format, ... ) {
+    if (ctx->dumpfile) {
         va_list arg;
         va_start( arg, format );
-        vfprintf( dumpfile, format, arg );
+        vfprintf( ctx->dumpfile, format, arg );
         va_end( arg );
     }
 }
@@ -1140,26 +1891,13 @@ void sim_log( const char *format, ... ) {
  * Do not change any of these
  *************************************************************/
 
-/******************************************************************************
- *	defines
- ******************************************************************************/
-
-#define MAX_STAGE 10
-
-/******************************************************************************
- *	static variables
- ******************************************************************************/
-
-static pipe_ptr pipes[MAX_STAGE];
-static int pipe_count = 0;
-
 /******************************************************************************
  *	function definitions
  ******************************************************************************/
 
 /* Create new pipe with count bytes of state */
 /* bubble_val indicates state corresponding to pipeline bubble */
-pipe_ptr new_pipe(int count, void *bubble_val)
+pipe_ptr new_pipe(sim_ctx_ptr ctx, int count, void *bubble_val)
 {
     pipe_ptr result = (pipe_ptr) malloc(sizeof(pipe_ele));
     result->output = malloc(count);
@@ -1169,16 +1907,19 @@ pipe_ptr new_pipe(int count, void *bubble_val)
     result->count = count;
     result->op = P_LOAD;
     result->bubble_val = bubble_val;
-    pipes[pipe_count++] = result;
+    ctx->pipes[ctx->pipe_count++] = result;
     return result;
 }
 
 /* Update all pipes */
-void update_pipes()
+void update_pipes(sim_ctx_ptr ctx)
 {
     int s;
-    for (s = 0; s < pipe_count; s++) {
-        pipe_ptr p = pipes[s];
+    void *tmp;
+    if (ctx->profile)
+        profile_pipes(ctx, 1);
+    for (s = 0; s < ctx->pipe_count; s++) {
+        pipe_ptr p = ctx->pipes[s];
         switch (p->op)
         {
         case P_BUBBLE:
@@ -1187,8 +1928,11 @@ void update_pipes()
             break;
 
         case P_LOAD:
-            /* copy calculated state from previous stage */
-            memcpy(p->output, p->input, p->count);
+            /* the state calculated by the previous stage becomes the
+               output, and the old output is written over next cycle */
+            tmp = p->output;
+            p->output = p->input;
+            p->input = tmp;
             break;
         case P_ERROR:
             /* Like a bubble, but insert error condition */
@@ -1205,11 +1949,11 @@ void update_pipes()
 }
 
 /* Set all pipes to bubble values */
-void clear_pipes()
+void clear_pipes(sim_ctx_ptr ctx)
 {
     int s;
-    for (s = 0; s < pipe_count; s++) {
-        pipe_ptr p = pipes[s];
+    for (s = 0; s < ctx->pipe_count; s++) {
+        pipe_ptr p = ctx->pipes[s];
         memcpy(p->output, p->bubble_val, p->count);
         memcpy(p->input, p->bubble_val, p->count);
         p->op = P_LOAD;
@@ -1232,20 +1976,16 @@ writeback_ele bubble_writeback = { I_NOP, 0, 0, 0, REG_NONE, REG_NONE,
 			     STAT_BUB, 0};
 
 
-extern bool inflight;
-extern size_t inflight_cycles;
-extern word_t inflight_pos;
-
-typedef struct pipe_cache_restore_struct {
-    processor_state_t state;
-    word_t cycles;
-    pipe_ptr pipes[5];
+/* Whole simulator state, saved every so often for reverse execution
+   (see rewind.h).  The memory and registers are copy-on-write copies */
+typedef struct {
+    sim_ctx ctx;                    /* Counters, statistics and stage values */
+    mem_t mem;
+    mem_t reg;
     cache_t *cache;
-    bool inflight;
-    size_t inflight_cycles;
-    word_t inflight_pos;
-    struct pipe_cache_restore_struct *next;
-} pipe_cache_restore_t;
+    p_stat_t ops[MAX_STAGE];
+    byte_t *regs[MAX_STAGE][2];     /* Output and input of each pipe register */
+} snap_t;
 
 /*
  * help - Prints the help information for the Trace Runner.
@@ -1261,173 +2001,354 @@ void help() {
     printf("set n             -  display info about set n\n");
     printf("undo n            -  steps back n instructions\n");
     printf("back n            -  steps back n cycles\n");
+    printf("break X           -  stop when the instruction at address or label X is fetched\n");
+    printf("watch X           -  stop when register X (e.g. %%rax) or the word at X changes\n");
+    printf("delete X          -  remove the breakpoint or watchpoint on X\n");
+    printf("info              -  list breakpoints and watchpoints\n");
     printf("pipe X            -  displays pipeline info for stage X (f, d, e, m , w) \n");
+    printf("lines             -  display the source line in each stage\n");
+    printf("stats             -  display CPI, hazard and cache statistics so far\n");
     printf("quit              -  exit the program\n\n");
 }
 
-static pipe_cache_restore_t *create_pipe_cache_restore_point(word_t *icount, word_t* ccount, byte_t *statusp, cc_t *ccp) {
-    pipe_cache_restore_t *pipe_cache_restore_point = malloc(sizeof(pipe_cache_restore_t));
-    pipe_cache_restore_point->state.cc = *ccp;
-    pipe_cache_restore_point->state.status = *statusp;
-    pipe_cache_restore_point->cycles = *ccount;
-    pipe_cache_restore_point->state.icount = *icount;
-    pipe_cache_restore_point->inflight = inflight;
-    pipe_cache_restore_point->inflight_cycles = inflight_cycles;
-    pipe_cache_restore_point->inflight_pos = inflight_pos;
-    pipe_cache_restore_point->cache = create_checkpoint(cache);
-    for (int s = 0; s < pipe_count; s++) {
-        pipe_ptr p = pipes[s];
-        pipe_cache_restore_point->pipes[s] = (pipe_ptr) malloc(sizeof(pipe_ele));
-        pipe_cache_restore_point->pipes[s]->bubble_val = p->bubble_val;
-        pipe_cache_restore_point->pipes[s]->op = p->op;
-        pipe_cache_restore_point->pipes[s]->count = p->count;
-        pipe_cache_restore_point->pipes[s]->output = malloc(p->count);
-        pipe_cache_restore_point->pipes[s]->input = malloc(p->count);
-        memcpy(pipe_cache_restore_point->pipes[s]->input, p->input, p->count);
-        memcpy(pipe_cache_restore_point->pipes[s]->output, p->output, p->count);
-    }
-    mem_t previous_memory = copy_mem(mem);
-    mem_t previous_registers = copy_mem(reg);
-    sim_run_cycle(icount, ccount, statusp, ccp);
-    pipe_cache_restore_point->state.memory = create_memory_restore(previous_memory, mem);
-    pipe_cache_restore_point->state.registers = create_memory_restore(previous_registers, reg);
-    return pipe_cache_restore_point;
-}
-
-static void restore_pipes_and_free(pipe_cache_restore_t *pipe_cache_restore_point) {
-
-    inflight_pos = pipe_cache_restore_point->inflight_pos;
-    inflight_cycles = pipe_cache_restore_point->inflight_cycles;
-    inflight = pipe_cache_restore_point->inflight;
-    cache_t *temp = cache;
-    cache = pipe_cache_restore_point->cache;
-    free_cache(temp);
-
-    for (int s = 0; s < pipe_count; s++) {
-        pipe_ptr p = pipes[s];
-        p->bubble_val = pipe_cache_restore_point->pipes[s]->bubble_val;
-        p->op = pipe_cache_restore_point->pipes[s]->op;
-        p->count = pipe_cache_restore_point->pipes[s]->count;
-        memcpy(p->input, pipe_cache_restore_point->pipes[s]->input, p->count);
-        memcpy(p->output, pipe_cache_restore_point->pipes[s]->output, p->count);
-        free(pipe_cache_restore_point->pipes[s]->output);
-        free(pipe_cache_restore_point->pipes[s]->input);
-        free(pipe_cache_restore_point->pipes[s]);
-    }
-
-    if (pipe_cache_restore_point->state.memory->positions != NULL)
-        free(pipe_cache_restore_point->state.memory->positions);
-    if (pipe_cache_restore_point->state.memory->values != NULL)
-        free(pipe_cache_restore_point->state.memory->values);
-    free(pipe_cache_restore_point->state.memory);
-
-    if (pipe_cache_restore_point->state.registers->positions != NULL)
-        free(pipe_cache_restore_point->state.registers->positions);
-    if (pipe_cache_restore_point->state.registers->values != NULL)
-        free(pipe_cache_restore_point->state.registers->values);
-    free(pipe_cache_restore_point->state.registers);
-
-    free(pipe_cache_restore_point);
-}
-
-void sim_interactive()
+static void *save_snap(void *sim) {
+    sim_ctx_ptr ctx = (sim_ctx_ptr) sim;
+    snap_t *snap = (snap_t *) malloc(sizeof(snap_t));
+    snap->ctx = *ctx;
+    snap->mem = copy_mem(ctx->mem);
+    snap->reg = copy_reg(ctx->reg);
+    snap->cache = create_checkpoint(ctx->cache);
+    for (int s = 0; s < ctx->pipe_count; s++) {
+        pipe_ptr p = ctx->pipes[s];
+        snap->ops[s] = p->op;
+        snap->regs[s][0] = (byte_t *) malloc(p->count);
+        snap->regs[s][1] = (byte_t *) malloc(p->count);
+        memcpy(snap->regs[s][0], p->output, p->count);
+        memcpy(snap->regs[s][1], p->input, p->count);
+    }
+    return snap;
+}
+
+/* Put a snapshot back into the live simulator, which keeps its own
+   pipe registers, trace file and other objects */
+static void restore_snap(void *sim, void *data) {
+    sim_ctx_ptr ctx = (sim_ctx_ptr) sim;
+    snap_t *snap = (snap_t *) data;
+    sim_ctx live = *ctx;
+    *ctx = snap->ctx;
+    ctx->dumpfile = live.dumpfile;
+    ctx->mem = copy_mem(snap->mem);
+    ctx->reg = copy_reg(snap->reg);
+    ctx->mem->watch = live.mem->watch;
+    ctx->reg->watch = live.reg->watch;
+    free_mem(live.mem);
+    free_reg(live.reg);
+    free_cache(live.cache);
+    ctx->cache = create_checkpoint(snap->cache);
+    for (int s = 0; s < ctx->pipe_count; s++) {
+        pipe_ptr p = ctx->pipes[s];
+        p->op = snap->ops[s];
+        memcpy(p->output, snap->regs[s][0], p->count);
+        memcpy(p->input, snap->regs[s][1], p->count);
+    }
+    connect_pipes(ctx);
+}
+
+static void free_snap(void *data) {
+    snap_t *snap = (snap_t *) data;
+    free_mem(snap->mem);
+    free_reg(snap->reg);
+    free_cache(snap->cache);
+    for (int s = 0; s < snap->ctx.pipe_count; s++) {
+        free(snap->regs[s][0]);
+        free(snap->regs[s][1]);
+    }
+    free(snap);
+}
+
+/* Simulate from the snapshot just restored up to cycle target, quietly */
+static void replay(sim_ctx_ptr ctx, rewind_slot_t *slot, word_t target, word_t *icount, word_t *ccount) {
+    FILE *dumpfile = ctx->dumpfile;
+    byte_t status;
+    *icount = slot->icount;
+    *ccount = slot->cycle;
+    ctx->dumpfile = NULL;
+    while (*ccount < target)
+        sim_run_cycle(ctx, icount, ccount, &status, NULL);
+    ctx->dumpfile = dumpfile;
+}
+
+/* Go back to cycle target, or as far as the snapshots reach */
+static void rewind_cycles(sim_ctx_ptr ctx, rewind_t rw, word_t target, word_t *icount, word_t *ccount) {
+    rewind_slot_t *slot = rewind_to_cycle(rw, target);
+    if (slot)
+        replay(ctx, slot, target, icount, ccount);
+}
+
+/* Go back to the last cycle that began with target instructions
+   completed, or as far as the snapshots reach */
+static void rewind_instrs(sim_ctx_ptr ctx, rewind_t rw, word_t target, word_t *icount, word_t *ccount) {
+    word_t now = *ccount;
+    word_t last;
+    FILE *dumpfile = ctx->dumpfile;
+    byte_t status;
+    rewind_slot_t *slot;
+    if (target >= *icount)
+        return;
+    slot = rewind_to_icount(rw, target);
+    if (!slot)
+        return;
+    /* Run on until one more instruction completes to find the cycle,
+       then replay up to it */
+    *icount = slot->icount;
+    *ccount = last = slot->cycle;
+    ctx->dumpfile = NULL;
+    while (*ccount < now) {
+        sim_run_cycle(ctx, icount, ccount, &status, NULL);
+        if (*icount > target)
+            break;
+        last = *ccount;
+    }
+    ctx->dumpfile = dumpfile;
+    rewind_cycles(ctx, rw, last, icount, ccount);
+}
+
+/* Result of go, next or cycle in a script */
+static void json_run(json_t j, char *cmd, break_t brk, word_t instrs, word_t cycles, byte_t status) {
+    json_open(j, NULL);
+    json_string(j, "cmd", cmd);
+    json_int(j, "instructions", instrs);
+    json_int(j, "cycles", cycles);
+    json_string(j, "status", stat_name(status));
+    json_break_why(j, brk);
+    json_close(j);
+}
+
+static void json_stage(json_t j, char *name, byte_t icode, byte_t ifun, word_t pc, byte_t status) {
+    json_open(j, NULL);
+    json_string(j, "stage", name);
+    json_string(j, "instr", iname(HPACK(icode, ifun)));
+    json_int(j, "pc", pc);
+    json_string(j, "status", stat_name(status));
+    json_close(j);
+}
+
+/* What arch shows, as members of the current object */
+static void json_state(json_t j, sim_ctx_ptr ctx, word_t icount, word_t ccount) {
+    json_int(j, "cycle", ccount);
+    json_int(j, "instructions", icount);
+    json_string(j, "status", stat_name(ctx->status));
+    json_string(j, "cc", cc_name(ctx->cc));
+    json_int(j, "pc", ctx->fetch_output->predPC);
+    json_open_list(j, "stages");
+    json_stage(j, "D", ctx->decode_output->icode, ctx->decode_output->ifun,
+               ctx->decode_output->stage_pc, ctx->decode_output->status);
+    json_stage(j, "E", ctx->execute_output->icode, ctx->execute_output->ifun,
+               ctx->execute_output->stage_pc, ctx->execute_output->status);
+    json_stage(j, "M", ctx->memory_output->icode, ctx->memory_output->ifun,
+               ctx->memory_output->stage_pc, ctx->memory_output->status);
+    json_stage(j, "W", ctx->writeback_output->icode, ctx->writeback_output->ifun,
+               ctx->writeback_output->stage_pc, ctx->writeback_output->status);
+    json_close_list(j);
+    json_regs(j, "registers", ctx->reg);
+}
+
+static void json_stats(json_t j, sim_ctx_ptr ctx) {
+    json_open(j, NULL);
+    json_string(j, "cmd", "stats");
+    json_int(j, "cycles", ctx->cycles);
+    json_int(j, "instructions", ctx->instructions);
+    json_double(j, "cpi", ctx->instructions > 0 ? (double) ctx->cycles/ctx->instructions : 1.0);
+    json_open(j, "hazard_cycles");
+    json_int(j, "load_use", ctx->hazard_cycles[PROF_LOAD_USE]);
+    json_int(j, "mispredict", ctx->hazard_cycles[PROF_MISPREDICT]);
+    json_int(j, "return", ctx->hazard_cycles[PROF_RET]);
+    json_int(j, "cache_wait", ctx->hazard_cycles[PROF_MEM]);
+    json_int(j, "halt", ctx->hazard_cycles[PROF_HALT]);
+    json_close(j);
+    json_open(j, "dcache");
+    json_int(j, "accesses", ctx->dmem_accesses);
+    json_int(j, "misses", ctx->dmem_misses);
+    json_close(j);
+    json_close(j);
+}
+
+/* The lines of one cache set */
+static void json_set(json_t j, cache_t *cache, int set_index) {
+    int S = 1 << cache->s;
+    int i;
+    if (set_index < 0 || set_index >= S) {
+        json_error(j, "set", "Invalid Set");
+        return;
+    }
+    json_open(j, NULL);
+    json_string(j, "cmd", "set");
+    json_int(j, "set", set_index);
+    json_open_list(j, "lines");
+    for (i = 0; i < cache->E; i++) {
+        cache_line_t *line = &cache->sets[set_index].lines[i];
+        json_open(j, NULL);
+        json_bool(j, "valid", line->valid);
+        json_int(j, "tag", line->tag);
+        json_int(j, "lru", line->lru);
+        json_bool(j, "dirty", line->dirty);
+        json_close(j);
+    }
+    json_close_list(j);
+    json_close(j);
+}
+
+/* Run one of the print functions, which write to the dump file, and
+   put what it wrote in the current object as "text" */
+static void json_text(json_t j, sim_ctx_ptr ctx, void (*print)(sim_ctx_ptr ctx)) {
+    char *text = NULL;
+    size_t len = 0;
+    FILE *dumpfile = ctx->dumpfile;
+    ctx->dumpfile = open_memstream(&text, &len);
+    print(ctx);
+    fclose(ctx->dumpfile);
+    ctx->dumpfile = dumpfile;
+    json_string(j, "text", text);
+    free(text);
+}
+
+/*
+ * sim_interactive - Read commands from in and run them.  With script
+ * set, there is no prompt or per-cycle display and each command
+ * answers with a line of JSON (see script.h).
+ */
+static void sim_interactive(FILE *in, bool script)
 {
-    word_t ccount = 0, icount = 0, ucount = 0;
-    status = STAT_AOK;
+    sim_ctx_ptr ctx = new_sim(cache_s.vals[0], cache_E.vals[0], cache_b.vals[0], cache_d.vals[0]);
+    word_t ccount = 0, icount = 0;
     word_t byte_cnt = 0;
     int instructions_to_run, cycles_to_run;
     int instructions_to_undo, cycles_to_undo;
-
-    unsigned int set_index;
+    int set_index;
     word_t ccount_stored = 0, icount_stored = 0;
     cc_t curr_cc = DEFAULT_CC;
+    bool refetch;
+    json_t j = script ? new_json(stdout) : NULL;
 
-	dumpfile = stdout;
-    sim_init();
+    if (!script)
+        ctx->dumpfile = stdout;
 
     /* Emit simulator name */
-    printf("%s\n", simname);
+    if (!script)
+        printf("%s\n", simname);
 
-    byte_cnt = load_mem(mem, object_file, 1);
+    byte_cnt = load_code(ctx->mem, ctx->syms, object_filename, object_file, 1);
     if (byte_cnt == 0) {
 	    fprintf(stderr, "No lines of code found\n");
 	    exit(1);
+    } else if (script) {
+        json_open(j, NULL);
+        json_string(j, "cmd", "load");
+        json_string(j, "sim", simname);
+        json_string(j, "file", object_filename);
+        json_int(j, "bytes", byte_cnt);
+        json_close(j);
     } else if (verbosity >= 2) {
 	    printf("%lld bytes of code read\n", byte_cnt);
     }
     fclose(object_file);
 
     mem_t mem0, reg0;
-    mem0 = copy_mem(mem);
-    reg0 = copy_mem(reg);
+    mem0 = copy_mem(ctx->mem);
+    reg0 = copy_mem(ctx->reg);
 
-    pipe_cache_restore_t *restore_head = NULL;
+    rewind_t rw = new_rewind(ctx, save_snap, restore_snap, free_snap);
+    break_t brk = new_breaks(ctx->syms);
+    attach_breaks(brk, ctx->mem, ctx->reg);
+    if (script)
+        brk->out = NULL;
 
-    char buffer[20];
-    char stage_buffer[20];
+    char buffer[CMD_LEN];
+    char arg[CMD_LEN];
     byte_t run_status = STAT_AOK;
 
     while(1) {
-        printf("PIPE-CACHE> ");
-
-        int size = scanf("%s", buffer);
-            if (size == 0) {
-            buffer[0] = 'x';
-        }
-        printf("\n");
+        if (!script)
+            printf("PIPE-CACHE> ");
+        if (!read_command(in, buffer, arg))
+            break;
+        if (!script)
+            printf("\n");
+        clear_break_hits(brk);
+        ccount_stored = ccount;
+        icount_stored = icount;
 
         switch(buffer[0]) {
         case 'G':
         case 'g':
             if(run_status == STAT_AOK || run_status == STAT_BUB) {
-                ccount_stored = ccount;
-                icount_stored = icount;
                 while ((run_status == STAT_AOK || run_status == STAT_BUB)) {
-                    pipe_cache_restore_t *new_restore_point = create_pipe_cache_restore_point(&icount, &ccount, &run_status, &curr_cc);
-                    new_restore_point->next = restore_head;
-                    restore_head = new_restore_point;
+                    rewind_note(rw, ccount, icount);
+                    refetch = ctx->fetch_state->op == P_STALL;
+                    sim_run_cycle(ctx, &icount, &ccount, &run_status, &curr_cc);
+                    if (BREAK_STOP(brk, ctx->f_pc, refetch))
+                        break;
                 }
 
-                printf("Simulator ran %lld instructions in %lld cycles\n", icount - icount_stored, ccount - ccount_stored);
-            } else {
+                if (!script)
+                    printf("Simulator ran %lld instructions in %lld cycles\n", icount - icount_stored, ccount - ccount_stored);
+            } else if (!script) {
                 printf("Simulator is in a non AOK state\n");
             }
 
-            printf("Simulator ran to completion\n");
+            if (script)
+                json_run(j, "go", brk, icount - icount_stored, ccount - ccount_stored, run_status);
+            else if (run_status != STAT_AOK && run_status != STAT_BUB) {
+                printf("Simulator ran to completion\n");
+            }
             break;
 
         case 'h':
         case 'H':
-            help();
+            if (script)
+                json_error(j, "help", "Not available in a script");
+            else
+                help();
             break;
 
         case 'Q':
         case 'q':
-            printf("Bye.\n");
+            if (script) {
+                json_open(j, NULL);
+                json_string(j, "cmd", "quit");
+                json_close(j);
+            } else
+                printf("Bye.\n");
             exit(0);
 
         case 'N':
         case 'n':
-            size = scanf("%d", &instructions_to_run);
-            if (size == 0) {
+            if (!arg_int(arg, &instructions_to_run)) {
+                if (script)
+                    json_error(j, "next", "Expected a number of instructions");
+                else
+                    printf("Expected a number of instructions\n");
                 break;
             }
 
             if(run_status == STAT_AOK || run_status == STAT_BUB) {
-                icount_stored = icount;
-                ccount_stored = ccount;
                 while ((run_status == STAT_AOK || run_status == STAT_BUB) && icount - icount_stored < instructions_to_run) {
-                    pipe_cache_restore_t *new_restore_point = create_pipe_cache_restore_point(&icount, &ccount, &run_status, &curr_cc);
-                    new_restore_point->next = restore_head;
-                    restore_head = new_restore_point;
+                    rewind_note(rw, ccount, icount);
+                    refetch = ctx->fetch_state->op == P_STALL;
+                    sim_run_cycle(ctx, &icount, &ccount, &run_status, &curr_cc);
+                    if (BREAK_STOP(brk, ctx->f_pc, refetch))
+                        break;
                 }
 
-                printf("Simulator ran %lld instructions in %lld cycles\n", icount - icount_stored, ccount - ccount_stored);
-            } else {
+                if (!script)
+                    printf("Simulator ran %lld instructions in %lld cycles\n", icount - icount_stored, ccount - ccount_stored);
+            } else if (!script) {
                 printf("Simulator is in a non AOK state\n");
             }
 
-            if (run_status != STAT_AOK && run_status != STAT_BUB) {
+            if (script)
+                json_run(j, "next", brk, icount - icount_stored, ccount - ccount_stored, run_status);
+            else if (run_status != STAT_AOK && run_status != STAT_BUB) {
                 printf("Simulator ran to completion\n");
             }
 
@@ -1435,26 +2356,32 @@ void sim_interactive()
 
         case 'C':
         case 'c':
-            size = scanf("%d", &cycles_to_run);
-            if (size == 0) {
+            if (!arg_int(arg, &cycles_to_run)) {
+                if (script)
+                    json_error(j, "cycle", "Expected a number of cycles");
+                else
+                    printf("Expected a number of cycles\n");
                 break;
             }
 
             if(run_status == STAT_AOK || run_status == STAT_BUB) {
-                icount_stored = icount;
-                ccount_stored = ccount;
                 while ((run_status == STAT_AOK || run_status == STAT_BUB) && ccount - ccount_stored < cycles_to_run) {
-                    pipe_cache_restore_t *new_restore_point = create_pipe_cache_restore_point(&icount, &ccount, &run_status, &curr_cc);
-                    new_restore_point->next = restore_head;
-                    restore_head = new_restore_point;
+                    rewind_note(rw, ccount, icount);
+                    refetch = ctx->fetch_state->op == P_STALL;
+                    sim_run_cycle(ctx, &icount, &ccount, &run_status, &curr_cc);
+                    if (BREAK_STOP(brk, ctx->f_pc, refetch))
+                        break;
                 }
 
-                printf("Simulator ran %lld instructions in %lld cycles\n", icount - icount_stored, ccount - ccount_stored);
-            } else {
+                if (!script)
+                    printf("Simulator ran %lld instructions in %lld cycles\n", icount - icount_stored, ccount - ccount_stored);
+            } else if (!script) {
                 printf("Simulator is in a non AOK state\n");
             }
 
-            if (run_status != STAT_AOK && run_status != STAT_BUB) {
+            if (script)
+                json_run(j, "cycle", brk, icount - icount_stored, ccount - ccount_stored, run_status);
+            else if (run_status != STAT_AOK && run_status != STAT_BUB) {
                 printf("Simulator ran to completion\n");
             }
 
@@ -1462,119 +2389,215 @@ void sim_interactive()
 
         case 'M':
         case 'm':
-            diff_mem(mem0, mem, stdout, true);
+            if (script) {
+                char *text = NULL;
+                size_t len = 0;
+                FILE *f = open_memstream(&text, &len);
+                diff_mem(mem0, ctx->mem, f, ctx->cache);
+                fclose(f);
+                json_open(j, NULL);
+                json_string(j, "cmd", "memory");
+                json_mem_diffs(j, "changes", text);
+                json_close(j);
+                free(text);
+            } else
+                diff_mem(mem0, ctx->mem, stdout, ctx->cache);
             break;
 
         case 'R':
         case 'r':
-            diff_reg(reg0, reg, stdout);
+            if (script) {
+                json_open(j, NULL);
+                json_string(j, "cmd", "registers");
+                json_reg_diffs(j, "changes", reg0, ctx->reg);
+                json_close(j);
+            } else
+                diff_reg(reg0, ctx->reg, stdout);
             break;
 
         case 'U':
         case 'u':
-            size = scanf("%d", &instructions_to_undo);
-            if (size == 0) {
+            if (!arg_int(arg, &instructions_to_undo)) {
+                if (script)
+                    json_error(j, "undo", "Expected a number of instructions");
+                else
+                    printf("Expected a number of instructions\n");
                 break;
             }
-            ucount = 0;
-            icount_stored = icount;
-            ccount_stored = ccount;
-            while (restore_head != NULL && (icount_stored - icount) < instructions_to_undo) {
-                cc = restore_head->state.cc;
-                icount = restore_head->state.icount;
-                ccount = restore_head->cycles;
-                apply_restore(mem, restore_head->state.memory);
-                apply_restore(reg, restore_head->state.registers);
-                status = restore_head->state.status;
-                run_status = status;
-                pipe_cache_restore_t *temp = restore_head;
-                restore_head = restore_head->next;
-                restore_pipes_and_free(temp);
-                ucount++;
+            rewind_instrs(ctx, rw, icount - instructions_to_undo, &icount, &ccount);
+            run_status = ctx->status;
+            if (script) {
+                json_open(j, NULL);
+                json_string(j, "cmd", "undo");
+                json_int(j, "instructions_undone", icount_stored - icount);
+                json_int(j, "cycles_undone", ccount_stored - ccount);
+                json_state(j, ctx, icount, ccount);
+                json_close(j);
+            } else {
+                printf("Instructions undone: %lld Cycles undone: %lld\n", icount_stored - icount, ccount_stored - ccount);
+                print_state(ctx, ccount);
+                dump_reg_display(stdout, ctx->reg);
             }
-            printf("Instructions undone: %lld Cycles undone: %lld\n", icount_stored - icount, ccount_stored - ccount);
-
+            break;
 
         case 'A':
         case 'a':
-            print_state(ccount);
-            dump_reg_display(stdout, reg);
+            if (script) {
+                json_open(j, NULL);
+                json_string(j, "cmd", "arch");
+                json_state(j, ctx, icount, ccount);
+                json_close(j);
+            } else {
+                print_state(ctx, ccount);
+                dump_reg_display(stdout, ctx->reg);
+            }
             break;
 
         case 'B':
         case 'b':
-            size = scanf("%d", &cycles_to_undo);
-            if (size == 0) {
+            if (!strcmp(buffer, "break")) {
+                bool ok = add_break(brk, arg);
+                if (script)
+                    json_result(j, "break", arg, ok);
                 break;
             }
-            ucount = 0;
-            ccount_stored = ccount;
-            icount_stored = icount;
-            while (restore_head != NULL && (ccount_stored - ccount) < cycles_to_undo) {
-                cc = restore_head->state.cc;
-                icount = restore_head->state.icount;
-                ccount = restore_head->cycles;
-                apply_restore(mem, restore_head->state.memory);
-                apply_restore(reg, restore_head->state.registers);
-                status = restore_head->state.status;
-                run_status = status;
-                pipe_cache_restore_t *temp = restore_head;
-                restore_head = restore_head->next;
-                restore_pipes_and_free(temp);
-                ucount++;
+            if (!arg_int(arg, &cycles_to_undo)) {
+                if (script)
+                    json_error(j, "back", "Expected a number of cycles");
+                else
+                    printf("Expected a number of cycles\n");
+                break;
+            }
+            rewind_cycles(ctx, rw, ccount - cycles_to_undo, &icount, &ccount);
+            run_status = ctx->status;
+            if (script) {
+                json_open(j, NULL);
+                json_string(j, "cmd", "back");
+                json_int(j, "instructions_undone", icount_stored - icount);
+                json_int(j, "cycles_undone", ccount_stored - ccount);
+                json_state(j, ctx, icount, ccount);
+                json_close(j);
+            } else {
+                printf("Instructions undone: %lld Cycles undone: %lld\n", icount_stored - icount, ccount_stored - ccount);
+                print_state(ctx, ccount);
+                dump_reg_display(stdout, ctx->reg);
             }
-            printf("Instructions undone: %lld Cycles undone: %lld\n", icount_stored - icount, ccount_stored - ccount);
-            print_state(ccount);
-            dump_reg_display(stdout, reg);
             break;
 
         case 'P':
         case 'p':
-            size = scanf("%s", stage_buffer);
-            if (size == 0) {
-                stage_buffer[0] = 'x';
-            }
-
-            switch(stage_buffer[0]) {
+        {
+            void (*print)(sim_ctx_ptr ctx) = NULL;
+            switch(arg[0]) {
                 case 'f':
                 case 'F':
-                    print_fetch();
+                    print = print_fetch;
                     break;
                 case 'd':
                 case 'D':
-                    print_decode();
+                    print = print_decode;
                     break;
                 case 'e':
                 case 'E':
-                    print_execute();
+                    print = print_execute;
                     break;
                 case 'm':
                 case 'M':
-                    print_memory();
+                    print = print_memory;
                     break;
                 case 'w':
                 case 'W':
-                    print_writeback();
-                    break;
-                default:
-                    printf("Invalid Stage\n");
+                    print = print_writeback;
                     break;
             }
+            if (!print) {
+                if (script)
+                    json_error(j, "pipe", "Invalid Stage");
+                else
+                    printf("Invalid Stage\n");
+            } else if (script) {
+                json_open(j, NULL);
+                json_string(j, "cmd", "pipe");
+                json_string(j, "stage", arg);
+                json_text(j, ctx, print);
+                json_close(j);
+            } else
+                print(ctx);
             break;
-        
-        case 's':
+        }
+
+        case 'L':
+        case 'l':
+            if (script) {
+                json_open(j, NULL);
+                json_string(j, "cmd", "lines");
+                json_text(j, ctx, print_source);
+                json_close(j);
+            } else
+                print_source(ctx);
+            break;
+
         case 'S':
-            size = scanf("%d", &set_index);
-            if (size == 0) {
+        case 's':
+            if (!strcmp(buffer, "stats")) {
+                if (script)
+                    json_stats(j, ctx);
+                else
+                    print_stats(ctx);
+                break;
+            }
+            if (!arg_int(arg, &set_index)) {
+                if (script)
+                    json_error(j, "set", "Expected a set number");
+                else
+                    printf("Expected a set number\n");
                 break;
             }
+            if (script)
+                json_set(j, ctx->cache, set_index);
+            else
+                display_set(ctx->cache, set_index);
+            break;
+
+        case 'W':
+        case 'w':
+            {
+                bool ok = add_watchpoint(brk, arg);
+                if (script)
+                    json_result(j, "watch", arg, ok);
+            }
+            break;
+
+        case 'D':
+        case 'd':
+            {
+                bool ok = delete_break(brk, arg);
+                if (script)
+                    json_result(j, "delete", arg, ok);
+            }
+            break;
 
-            display_set(cache, set_index);
+        case 'I':
+        case 'i':
+            if (script) {
+                json_open(j, NULL);
+                json_string(j, "cmd", "info");
+                json_breaks(j, brk);
+                json_close(j);
+            } else
+                info_breaks(brk);
             break;
 
         default:
-            printf("Invalid Command\n");
+            if (script)
+                json_error(j, buffer, "Invalid Command");
+            else
+                printf("Invalid Command\n");
             break;
         }
     }
-}
\ No newline at end of file
+    free_breaks(brk);
+    free_rewind(rw);
+    if (j)
+        free_json(j);
+}
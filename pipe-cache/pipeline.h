@@ -18,7 +18,8 @@
  ******************************************************************************/
 
 /* Different control operations for pipeline register */
-/* LOAD:   Copy input state to output   */
+/* LOAD:   Swap input and output, so that the input state becomes
+           the output without being copied */
 /* STALL:  Keep output state unchanged */
 /* BUBBLE: Set ouput state to nop     */
 /* ERROR:  Occurs when both stall & load signals set */
@@ -37,19 +38,25 @@ typedef struct {
     p_stat_t op;
 } pipe_ele, *pipe_ptr;
 
+/* Most pipe registers a simulator can create */
+#define MAX_STAGE 10
+
+/* State of one simulation, defined in sim.h */
+typedef struct sim_ctx sim_ctx, *sim_ctx_ptr;
+
 /******************************************************************************
  *	function declarations
  ******************************************************************************/
 
 /* Create new pipe with count bytes of state */
 /* bubble_val indicates state corresponding to pipeline bubble */
-pipe_ptr new_pipe(int count, void *bubble_val);
+pipe_ptr new_pipe(sim_ctx_ptr ctx, int count, void *bubble_val);
 
 /* Update all pipes */
-void update_pipes();
+void update_pipes(sim_ctx_ptr ctx);
 
 /* Set all pipes to bubble values */
-void clear_pipes();
+void clear_pipes(sim_ctx_ptr ctx);
 
 /* Utility code */
 
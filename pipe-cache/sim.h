@@ -4,6 +4,100 @@
 /* Pipeline stage identifiers for stage operation control */
 typedef enum { FETCH_STAGE, DECODE_STAGE, EXECUTE_STAGE, MEMORY_STAGE, WRITEBACK_STAGE } stage_id_t;
 
+/* The complete state of one simulation.  Nothing the pipeline changes
+   lives outside it, so separate contexts can run in separate threads */
+struct sim_ctx {
+    /* Both instruction and data memory */
+    mem_t mem;
+    /* Labels and source lines of the loaded program */
+    symtab_t syms;
+    /* Register file */
+    mem_t reg;
+    /* Condition code register */
+    cc_t cc;
+    /* Status code */
+    stat_t status;
+
+    /* Log file */
+    FILE *dumpfile;
+
+    /* Performance monitoring */
+    /* How many cycles have been simulated? */
+    word_t cycles;
+    /* How many instructions have passed through the WB stage? */
+    word_t instructions;
+    /* Has simulator gotten past initial bubbles? */
+    int starting_up;
+
+    /* Where the pipeline starts, after any fast-forwarding */
+    word_t start_pc;
+
+    /* ISA model run alongside the pipeline in lockstep mode */
+    state_ptr isa_state;
+    /* Has the pipeline diverged from the ISA model? */
+    bool diverged;
+    /* Instructions checked against the ISA model */
+    word_t checked;
+
+    /* Per-PC counts, when profiling */
+    profile_t profile;
+    /* Binary trace of every cycle, when tracing */
+    trace_t trace;
+    /* Cycles lost to each kind of hazard, for the CPI stack */
+    word_t hazard_cycles[PROF_EVENTS];
+
+    /* Data cache, with the miss in flight and its statistics */
+    cache_t *cache;
+    /* Loads and stores started by the memory stage, and those of them
+       that had to wait for a miss.  Retries are not counted again */
+    word_t dmem_accesses;
+    word_t dmem_misses;
+
+    /* Pending updates to state */
+    word_t cc_in;
+    word_t wb_destE;
+    word_t wb_valE;
+    word_t wb_destM;
+    word_t wb_valM;
+    word_t mem_addr;
+    word_t mem_data;
+    bool mem_write;
+
+    /* Output and input states of all pipeline registers */
+    fetch_ptr fetch_output;
+    decode_ptr decode_output;
+    execute_ptr execute_output;
+    memory_ptr memory_output;
+    writeback_ptr writeback_output;
+
+    fetch_ptr fetch_input;
+    decode_ptr decode_input;
+    execute_ptr execute_input;
+    memory_ptr memory_input;
+    writeback_ptr writeback_input;
+
+    /* Intermediate values */
+    word_t f_pc;
+    byte_t imem_icode;
+    byte_t imem_ifun;
+    bool imem_error;
+    bool instr_valid;
+    word_t d_regvala;
+    word_t d_regvalb;
+    word_t e_vala;
+    word_t e_valb;
+    bool e_bcond;
+    byte_t fwd_a;       /* Where decode took valA and valB from, a trace_fwd_t */
+    byte_t fwd_b;
+    mem_status_t dmem_status;
+
+    /* The pipeline state */
+    pipe_ptr fetch_state, decode_state, execute_state, memory_state, writeback_state;
+    /* Every pipe register, in the order created */
+    pipe_ptr pipes[MAX_STAGE];
+    int pipe_count;
+};
+
 /********** Defines **************/
 
 /* Get ra out of one byte regid field */
@@ -15,16 +109,21 @@ typedef enum { FETCH_STAGE, DECODE_STAGE, EXECUTE_STAGE, MEMORY_STAGE, WRITEBACK
 /*************** Simulation Control Functions ***********/
 
 /* Bubble next execution of specified stage */
-void sim_bubble_stage(stage_id_t stage);
+void sim_bubble_stage(sim_ctx_ptr ctx, stage_id_t stage);
 
 /* Stall stage (has effect at next update) */
-void sim_stall_stage(stage_id_t stage);
+void sim_stall_stage(sim_ctx_ptr ctx, stage_id_t stage);
 
-/* Initialize simulator */
-void sim_init();
+/* Create a simulator with its own memory, registers, pipe registers
+   and a cold cache of 2^s sets of E lines of 2^b bytes, whose misses
+   cost d cycles.  It is reset and ready to load a program */
+sim_ctx_ptr new_sim(int s, int E, int b, int d);
+
+/* Free a simulator and everything it holds */
+void free_sim(sim_ctx_ptr ctx);
 
 /* Reset simulator state, including register, instruction, and data memories */
-void sim_reset();
+void sim_reset(sim_ctx_ptr ctx);
 
 /*
   Run pipeline until one of following occurs:
@@ -36,14 +135,23 @@ void sim_reset();
   if statusp nonnull, then will be set to status of final instruction
   if ccp nonnull, then will be set to condition codes of final instruction
 */
-word_t sim_run_pipe(word_t max_instr, word_t max_cycle, byte_t *statusp, cc_t *ccp);
+word_t sim_run_pipe(sim_ctx_ptr ctx, word_t max_instr, word_t max_cycle, byte_t *statusp, cc_t *ccp);
 
-/* If dumpfile set nonNULL, lots of status info printed out */
-void sim_set_dumpfile(FILE *file);
+/*
+ * sim_log dumps a formatted string to the context's dumpfile, if it
+ * has one.  accepts variable argument list
+ */
+void sim_log(sim_ctx_ptr ctx, const char *format, ... );
 
 /*
- * sim_log dumps a formatted string to the dumpfile, if it exists
- * accepts variable argument list
+ * SIM_LOG(ctx, format, ...) is how the simulator traces.  It tests
+ * the dumpfile before evaluating its arguments, so a run without a
+ * trace does not pay for formatting names and addresses.  Building
+ * with -DNO_SIM_LOG compiles the trace out altogether.
  */
-void sim_log( const char *format, ... );
+#ifdef NO_SIM_LOG
+#define SIM_LOG(ctx, ...) ((void) (0 && (sim_log(ctx, __VA_ARGS__), 0)))
+#else
+#define SIM_LOG(ctx, ...) ((ctx)->dumpfile ? sim_log(ctx, __VA_ARGS__) : (void) 0)
+#endif
 
@@ -79,13 +79,13 @@ extern writeback_ele bubble_writeback;
 /************ Function declarations *******************/
 
 /* Stage functions */
-void do_fetch_stage();
-void do_decode_stage();  
-void do_execute_stage();
-void do_memory_stage();
-void do_writeback_stage();
+void do_fetch_stage(sim_ctx_ptr ctx);
+void do_decode_stage(sim_ctx_ptr ctx);
+void do_execute_stage(sim_ctx_ptr ctx);
+void do_memory_stage(sim_ctx_ptr ctx);
+void do_writeback_stage(sim_ctx_ptr ctx);
 
 /* Set stalling conditions for different stages */
-void do_stall_check();
+void do_stall_check(sim_ctx_ptr ctx);
 
 
@@ -0,0 +1,82 @@
+/*
+ * ooo.h - Defines the structures of the out-of-order Y86-64 core: the
+ * fetch queue, the reorder buffer, the reservation stations and the
+ * load/store queue.  Include isa.h first.
+ */
+
+/* Largest sizes the simulator supports */
+#define MAX_WIDTH 8
+#define MAX_ROB 256
+#define MAX_FQ (2*MAX_WIDTH)
+
+/* An instruction fetched but not yet dispatched */
+typedef struct {
+    byte_t icode;
+    byte_t ifun;
+    byte_t ra;
+    byte_t rb;
+    word_t valc;
+    word_t valp;
+    word_t pc;
+    stat_t status;
+    bool predtaken;     /* Conditional jump predicted taken */
+} fetch_slot;
+
+/* Where a renamed register or the condition codes come from.  rob is
+   -1 for the architectural copy */
+typedef struct {
+    int rob;
+    bool valm;          /* The valM result of that entry rather than valE */
+} rename_t;
+
+/* Source operand waiting in a reservation station */
+typedef struct {
+    bool ready;
+    word_t val;
+    rename_t tag;       /* Producer, when not ready */
+} operand_t;
+
+/* Operands of an instruction */
+typedef enum { SRC_A, SRC_B, SRC_CC, NSRC } src_t;
+
+/* Reorder buffer entry.  Entries are allocated in program order at
+   dispatch and freed in program order at retirement */
+typedef struct {
+    byte_t icode;
+    byte_t ifun;
+    word_t valc;
+    word_t valp;
+    word_t pc;
+    stat_t status;
+    byte_t deste;       /* Destination register for valE */
+    byte_t destm;       /* Destination register for valM */
+    bool predtaken;
+    word_t seq;         /* Position in the dynamic instruction stream */
+    bool issued;
+    bool done;          /* Results are ready */
+    word_t done_cycle;  /* Cycle the results become ready, once issued */
+    word_t vale;
+    word_t valm;
+    cc_t cc;            /* Condition codes set, for OPq */
+    bool cnd;           /* Condition held, for jXX and cmovXX */
+    int rs;             /* Reservation station, or -1 */
+    int lsq;            /* Load/store queue entry, or -1 */
+} rob_entry;
+
+/* Reservation station entry: an instruction waiting for its operands */
+typedef struct {
+    bool busy;
+    int rob;
+    operand_t src[NSRC];
+} rs_entry;
+
+/* Load/store queue entry.  Entries are kept in program order so that a
+   load can find the older stores it might depend on */
+typedef struct {
+    int rob;
+    bool store;
+    bool addr_ready;    /* Address (and data, for a store) computed */
+    bool started;       /* Load has been sent to memory or forwarded */
+    word_t addr;
+    word_t data;        /* Store data */
+} lsq_entry;
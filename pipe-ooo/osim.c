@@ -0,0 +1,1467 @@
+/**************************************************************************
+ * osim.c - Out-of-order Y86-64 simulator
+ *
+ * A model of an out-of-order core for capacity studies.  Instructions
+ * are fetched in order, renamed and dispatched into a reorder buffer
+ * and reservation stations, issued as their operands become ready,
+ * and retired in program order.  Loads and stores go through a
+ * load/store queue, and the data cache from ../cache decides how long
+ * each access takes.  Registers are renamed onto reorder buffer
+ * entries, which hold results until they retire.
+ **************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "isa.h"
+#include "asm.h"
+#include "batch.h"
+#include "bpred.h"
+#include "cache.h"
+#include "ooo.h"
+#include "sim.h"
+
+char simname[] = "Y86-64 Processor: out-of-order";
+
+/* Parameters modifed by the command line */
+char *object_filename;   /* The input object file name. */
+FILE *object_file;       /* Input file handle */
+int verbosity = 2;    /* Verbosity level (-v) */
+word_t instr_limit = 10000; /* Instruction limit (-l) */
+bool lockstep = false;    /* Check each instruction as it retires (-k) */
+char *batch_list = NULL; /* Manifest or directory of programs to check (-m) */
+int batch_workers = 1;    /* Worker processes in batch mode (-j) */
+int width = 4;            /* Instructions fetched, dispatched, issued and retired per cycle (-w) */
+int rob_size = 32;        /* Reorder buffer entries (-r) */
+int rs_size = 16;         /* Reservation station entries (-n) */
+int lsq_size = 16;        /* Load/store queue entries (-q) */
+bp_kind_t bpred_kind = BP_TAKEN; /* Branch predictor (-P) */
+int bpred_bits = 10;      /* Predictor tables have 2^bpred_bits entries (-T) */
+int cache_s = -1;         /* Data cache geometry and miss delay (-s -E -b -d) */
+int cache_E = -1;
+int cache_b = -1;
+int cache_d = -1;
+
+/* Data cache, if one was given.  Only its tags are used: data always
+   comes from mem, and the cache decides how long an access takes */
+cache_t *cache = NULL;
+
+/* Log file */
+FILE *dumpfile = NULL;
+
+/* Performance monitoring */
+/* How many cycles have been simulated? */
+word_t cycles = 0;
+/* How many instructions have retired? */
+word_t instructions = 0;
+
+/* Has simulator gotten past initial bubbles? */
+static int starting_up = 1;
+
+/* ISA model run alongside the core in lockstep mode */
+static state_ptr isa_state = NULL;
+/* Has the core diverged from the ISA model? */
+static bool diverged = false;
+/* Instructions checked against the ISA model */
+static word_t checked = 0;
+
+/* Predicts conditional jumps at fetch */
+static bpred_t bpred = NULL;
+
+/* Why dispatch stopped before the fetch queue was empty */
+typedef enum {
+    STALL_ROB,          /* Reorder buffer full */
+    STALL_RS,           /* No free reservation station */
+    STALL_LSQ,          /* Load/store queue full */
+    STALL_REASONS
+} dispatch_stall_t;
+
+/* Statistics */
+static word_t steps = 0;                    /* Cycles simulated, including start up */
+static word_t issue_count[MAX_WIDTH + 1];   /* Cycles in which each number of instructions issued */
+static word_t dispatch_stalls[STALL_REASONS];
+static word_t rob_fill = 0;                 /* Sums of occupancy over all cycles */
+static word_t rs_fill = 0;
+static word_t lsq_fill = 0;
+static word_t loads = 0;                    /* Loads sent to memory or forwarded */
+static word_t forwarded = 0;                /* Of those, forwarded from a store */
+static word_t store_waits = 0;              /* Load-cycles spent behind an older store */
+static word_t squashed = 0;                 /* Instructions squashed by mispredicted jumps */
+
+/* Both instruction and data memory */
+mem_t mem;
+
+/* Labels and source lines of the loaded program */
+symtab_t syms;
+
+/* Register file */
+mem_t reg;
+/* Condition code register */
+cc_t cc;
+/* Status code */
+stat_t status;
+
+/***************************
+ * Function prototypes
+ ***************************/
+
+static void usage(char *name);           /* Print helpful usage message */
+static void run_tty_sim();               /* Run simulator in TTY mode */
+static void run_batch_program(char *fname, batch_result_t *res);
+
+/*******************************************************************
+ * Part 1: Entry point.  Parses the command line, then runs the
+ * simulation in TTY mode or over a batch of programs.
+ *******************************************************************/
+
+/* Parse a structure size in 1..max, or print usage */
+static int size_arg(char *name, char *arg, int max, char *what)
+{
+    int n = atoi(arg);
+    if (n < 1 || n > max) {
+        printf("Invalid %s %d\n", what, n);
+        usage(name);
+    }
+    return n;
+}
+
+int sim_main(int argc, char **argv)
+{
+    int i;
+    int c;
+
+    /* Parse the command line arguments */
+    while ((c = getopt(argc, argv, "hkl:v:m:j:w:r:n:q:P:T:s:E:b:d:")) != -1) {
+        switch(c) {
+        case 'h':
+            usage(argv[0]);
+            break;
+        case 'l':
+            instr_limit = atoll(optarg);
+            break;
+        case 'v':
+            verbosity = atoi(optarg);
+            if (verbosity < 0 || verbosity > 2) {
+                printf("Invalid verbosity %d\n", verbosity);
+                usage(argv[0]);
+            }
+            break;
+        case 'k':
+            lockstep = true;
+            break;
+        case 'm':
+            batch_list = optarg;
+            break;
+        case 'j':
+            batch_workers = atoi(optarg);
+            break;
+        case 'w':
+            width = size_arg(argv[0], optarg, MAX_WIDTH, "width");
+            break;
+        case 'r':
+            rob_size = size_arg(argv[0], optarg, MAX_ROB, "reorder buffer size");
+            break;
+        case 'n':
+            rs_size = size_arg(argv[0], optarg, MAX_ROB, "reservation station count");
+            break;
+        case 'q':
+            lsq_size = size_arg(argv[0], optarg, MAX_ROB, "load/store queue size");
+            break;
+        case 'P':
+            bpred_kind = find_bpred(optarg);
+            if (bpred_kind == BP_NONE) {
+                printf("Invalid branch predictor %s\n", optarg);
+                usage(argv[0]);
+            }
+            break;
+        case 'T':
+            bpred_bits = atoi(optarg);
+            if (bpred_bits < 1 || bpred_bits > 24) {
+                printf("Invalid predictor table size %d\n", bpred_bits);
+                usage(argv[0]);
+            }
+            break;
+        case 's':
+            cache_s = atoi(optarg);
+            break;
+        case 'E':
+            cache_E = atoi(optarg);
+            break;
+        case 'b':
+            cache_b = atoi(optarg);
+            break;
+        case 'd':
+            cache_d = atoi(optarg);
+            break;
+        default:
+            printf("Invalid option '%c'\n", c);
+            usage(argv[0]);
+            break;
+        }
+    }
+
+    /* The cache takes all four of its flags or none */
+    if (cache_s != -1 || cache_E != -1 || cache_b != -1 || cache_d != -1) {
+        if (cache_s < 0 || cache_E < 1 || cache_b < 3 || cache_d < 0) {
+            fprintf(stderr, "Missing flags for create_cache\n");
+            exit(1);
+        }
+    }
+
+    if (batch_list) {
+        verbosity = 0;
+        sim_init();
+        exit(run_batch(batch_list, batch_workers, run_batch_program) ? 1 : 0);
+    }
+
+    /* Do we have too many arguments? */
+    if (optind < argc - 1) {
+	printf("Too many command line arguments:");
+	for (i = optind; i < argc; i++)
+	    printf(" %s", argv[i]);
+	printf("\n");
+	usage(argv[0]);
+    }
+
+    /* The single unflagged argument should be the object file name */
+    object_filename = NULL;
+    object_file = NULL;
+    if (optind < argc) {
+        object_filename = argv[optind];
+        object_file = fopen(object_filename, "r");
+        if (!object_file) {
+            fprintf(stderr, "Couldn't open object file %s\n", object_filename);
+            exit(1);
+        }
+    }
+
+    if (object_filename == NULL) {
+        fprintf(stderr, "No object file specified\n");
+        exit(1);
+    }
+
+    run_tty_sim();
+    exit(0);
+}
+
+int main(int argc, char *argv[]){return sim_main(argc,argv);}
+
+/* Start the ISA model from the loaded state */
+static void isa_start()
+{
+    isa_state = new_state(0);
+    free_mem(isa_state->r);
+    free_mem(isa_state->m);
+    isa_state->m = copy_mem(mem);
+    isa_state->r = copy_mem(reg);
+    isa_state->cc = cc;
+}
+
+/*
+ * isa_check - Compare the final state of the core against the ISA
+ * model, explaining the differences when verbosity > 0.  Errors from
+ * the ISA model go to error_file.
+ */
+static bool isa_check(cc_t result_cc, FILE *error_file)
+{
+    byte_t e = STAT_AOK;
+    word_t step;
+    bool match = true;
+
+    /* In lockstep mode the ISA model has already been stepped and
+       checked alongside the core, so only the condition codes remain
+       to be compared */
+    if (lockstep) {
+        match = !diverged;
+    } else {
+        for (step = 0; step < instr_limit && e == STAT_AOK; step++) {
+            e = step_state(isa_state, error_file);
+        }
+
+        if (diff_reg(isa_state->r, reg, NULL)) {
+            match = false;
+            if (verbosity > 0) {
+                printf("ISA Register != Pipeline Register File\n");
+                printf("\tISA register\t\tPipeline Register\n");
+                diff_reg(isa_state->r, reg, stdout);
+            }
+        }
+
+        if (diff_mem(isa_state->m, mem, NULL)) {
+            match = false;
+            if (verbosity > 0) {
+                printf("ISA Memory != Pipeline Memory\n");
+                printf("\tISA Memory\t\tPipeline Memory\n");
+                diff_mem(isa_state->m, mem, stdout);
+            }
+        }
+    }
+
+    if (isa_state->cc != result_cc) {
+        match = false;
+        if (verbosity > 0) {
+            printf("ISA Cond. Codes (%s) != Pipeline Cond. Codes (%s)\n",
+                cc_name(isa_state->cc), cc_name(result_cc));
+        }
+    }
+    return match;
+}
+
+/* Average of a per-cycle sum */
+static double per_cycle(word_t sum)
+{
+    return steps > 0 ? (double) sum/steps : 0.0;
+}
+
+/*
+ * print_ooo_stats - How busy each structure was, what held dispatch
+ * and loads back, and how well jumps were predicted.
+ */
+static void print_ooo_stats()
+{
+    int i;
+    printf("Issue width %d:", width);
+    for (i = 0; i <= width; i++)
+        printf(" %d in %lld cycles%s", i, issue_count[i], i < width ? "," : "\n");
+    printf("Average occupancy: reorder buffer %.1f/%d, reservation stations %.1f/%d, "
+           "load/store queue %.1f/%d\n",
+           per_cycle(rob_fill), rob_size, per_cycle(rs_fill), rs_size,
+           per_cycle(lsq_fill), lsq_size);
+    printf("Dispatch stalled: %lld cycles for a full reorder buffer, %lld for the reservation stations, "
+           "%lld for the load/store queue\n",
+           dispatch_stalls[STALL_ROB], dispatch_stalls[STALL_RS], dispatch_stalls[STALL_LSQ]);
+    printf("Loads: %lld, %lld forwarded from a store, %lld load-cycles waiting behind an older store\n",
+           loads, forwarded, store_waits);
+    printf("Branch predictor %s", bpred_name(bpred->kind));
+    if (bpred->kind != BP_TAKEN && bpred->kind != BP_BTFN)
+        printf(" (%lld entries)", bpred->mask + 1);
+    printf(": %lld/%lld jumps predicted = %.2f%%, %lld instructions squashed\n",
+           bpred->correct, bpred->branches,
+           bpred->branches > 0 ? 100.0 * bpred->correct/bpred->branches : 100.0,
+           squashed);
+    if (cache)
+        printf("Data cache: %d hits, %d misses, %d dirty evictions\n",
+               cache->hit_count, cache->miss_count, cache->dirty_eviction_count);
+}
+
+/*
+ * run_tty_sim - Run the simulator in TTY mode
+ */
+static void run_tty_sim()
+{
+    word_t icount = 0;
+    byte_t run_status = STAT_AOK;
+    cc_t result_cc = 0;
+    word_t byte_cnt = 0;
+    mem_t mem0, reg0;
+
+    if (verbosity >= 2)
+	    dumpfile = stdout;
+    sim_init();
+
+    /* Emit simulator name */
+    if (verbosity >= 2)
+	    printf("%s\n", simname);
+
+    byte_cnt = load_code(mem, syms, object_filename, object_file, 1);
+    if (byte_cnt == 0) {
+	    fprintf(stderr, "No lines of code found\n");
+	    exit(1);
+    } else if (verbosity >= 2) {
+	    printf("%lld bytes of code read\n", byte_cnt);
+    }
+    fclose(object_file);
+
+    isa_start();
+
+    mem0 = copy_mem(mem);
+    reg0 = copy_mem(reg);
+
+    icount = sim_run_pipe(instr_limit, 5*instr_limit, &run_status, &result_cc);
+    if (verbosity > 0) {
+        printf("%lld instructions executed\n", icount);
+        printf("Status = %s\n", stat_name(run_status));
+        printf("Condition Codes: %s\n", cc_name(result_cc));
+        printf("Changed Register State:\n");
+        diff_reg(reg0, reg, stdout);
+        printf("Changed Memory State:\n");
+        diff_mem(mem0, mem, stdout);
+    }
+
+    bool match = isa_check(result_cc, stdout);
+
+    if (match) {
+        printf("ISA Check Succeeds\n");
+    } else {
+        printf("ISA Check Fails\n");
+    }
+
+    /* Emit CPI statistics */
+    double cpi = instructions > 0 ? (double) cycles/instructions : 1.0;
+    printf("CPI: %lld cycles/%lld instructions = %.2f\n",
+           cycles, instructions, cpi);
+    if (verbosity > 0)
+        print_ooo_stats();
+}
+
+/*
+ * run_batch_program - Run one object file in batch mode and check it
+ * against the ISA model.  Prints nothing.
+ */
+static void run_batch_program(char *fname, batch_result_t *res)
+{
+    byte_t run_status = STAT_AOK;
+    cc_t result_cc = 0;
+    FILE *f = fopen(fname, "r");
+
+    res->ran = false;
+    if (!f)
+        return;
+    sim_reset();
+    clear_mem(mem);
+    clear_symtab(syms);
+    if (load_code(mem, syms, fname, f, 0) == 0) {
+        fclose(f);
+        return;
+    }
+    fclose(f);
+
+    isa_start();
+    sim_run_pipe(instr_limit, 5*instr_limit, &run_status, &result_cc);
+    res->match = isa_check(result_cc, NULL);
+    res->cycles = cycles;
+    res->instructions = instructions;
+    free_state(isa_state);
+    isa_state = NULL;
+    res->ran = true;
+}
+
+/*
+ * usage - print helpful diagnostic information
+ */
+static void usage(char *name)
+{
+    printf("Usage: %s [-hk] [-l m] [-v n] [-w n] [-r n] [-n n] [-q n] [-P p] [-T n]\n"
+           "       [-s s -E E -b b -d d] [-m f [-j n]] file.yo\n", name);
+    printf("   -h     Print this message\n");
+    printf("   -l m   Set instruction limit to m (default %lld)\n", instr_limit);
+    printf("   -v n   Set verbosity level to 0 <= n <= 2 (default %d)\n", verbosity);
+    printf("   -k     Check each instruction against the ISA model as it retires\n");
+    printf("   -w n   Fetch, dispatch, issue and retire up to 1 <= n <= %d instructions per cycle (default %d)\n", MAX_WIDTH, width);
+    printf("   -r n   Give the reorder buffer n <= %d entries (default %d)\n", MAX_ROB, rob_size);
+    printf("   -n n   Give the core n <= %d reservation stations (default %d)\n", MAX_ROB, rs_size);
+    printf("   -q n   Give the load/store queue n <= %d entries (default %d)\n", MAX_ROB, lsq_size);
+    printf("   -P p   Predict conditional jumps with taken, btfn, bimodal, gshare or tournament (default %s)\n", bpred_name(bpred_kind));
+    printf("   -T n   Give the predictor tables 2^n entries (default %d)\n", bpred_bits);
+    printf("   -s s   Data cache has 2^s sets (with -E, -b and -d; default no cache)\n");
+    printf("   -E E   Data cache has E lines per set\n");
+    printf("   -b b   Data cache blocks hold 2^b bytes\n");
+    printf("   -d d   A data cache miss costs d more cycles\n");
+    printf("   -m f   Check every program in manifest or directory f, one line each\n");
+    printf("   -j n   Run batch mode (-m) with n worker processes (default 1)\n");
+    exit(0);
+}
+
+
+/*********************************************************
+ * Part 2: This part contains the core simulator routines.
+ *********************************************************/
+
+/* Instructions fetched but not yet dispatched */
+static fetch_slot fq[MAX_FQ];
+static int fq_head = 0;
+static int fq_count = 0;
+
+/* Reorder buffer, oldest entry at rob_head */
+static rob_entry rob[MAX_ROB];
+static int rob_head = 0;
+static int rob_count = 0;
+
+/* Reservation stations */
+static rs_entry rs[MAX_ROB];
+static int rs_used = 0;
+
+/* Load/store queue, oldest entry at lsq_head */
+static lsq_entry lsq[MAX_ROB];
+static int lsq_head = 0;
+static int lsq_count = 0;
+
+/* Producer of each register and of the condition codes */
+static rename_t rename_reg[REG_NONE];
+static rename_t rename_cc;
+
+/* Fetch state */
+static word_t fetch_pc = 0;
+static bool fetch_wait = false;     /* Stopped at a ret, halt or error */
+
+/* Current cycle, from 0 */
+static word_t now = 0;
+/* First cycle the data memory port is free */
+static word_t port_free = 0;
+/* Next position in the dynamic instruction stream */
+static word_t next_seq = 0;
+/* Retirement stops once this many instructions have retired */
+static word_t retire_limit = 0;
+
+/* Intermediate values */
+static int retired;     /* Instructions retired this cycle */
+static int issued;      /* Instructions issued this cycle */
+
+static int initialized = 0;
+
+/* Slot of the ROB entry age places after the oldest */
+static int rob_slot(int age)
+{
+    return (rob_head + age) % rob_size;
+}
+
+/* How many entries are older than slot r */
+static int rob_age(int r)
+{
+    return (r - rob_head + rob_size) % rob_size;
+}
+
+static lsq_entry *lsq_at(int i)
+{
+    return &lsq[(lsq_head + i) % lsq_size];
+}
+
+/* Forget everything in flight and read registers from the register file */
+static void clear_core()
+{
+    int i;
+    fq_head = fq_count = 0;
+    rob_head = rob_count = 0;
+    lsq_head = lsq_count = 0;
+    rs_used = 0;
+    for (i = 0; i < MAX_ROB; i++)
+        rs[i].busy = false;
+    for (i = 0; i < REG_NONE; i++)
+        rename_reg[i].rob = -1;
+    rename_cc.rob = -1;
+    fetch_pc = 0;
+    fetch_wait = false;
+}
+
+void sim_init()
+{
+    /* Create memory and register files */
+    initialized = 1;
+    mem = init_mem(MEM_SIZE);
+    reg = init_reg();
+    syms = new_symtab();
+    bpred = new_bpred(bpred_kind, bpred_bits);
+
+    sim_reset();
+    clear_mem(mem);
+}
+
+void sim_reset()
+{
+    if (!initialized)
+	    sim_init();
+    clear_core();
+    clear_mem(reg);
+    reset_bpred(bpred);
+    /* Each program starts with a cold cache */
+    if (cache_s >= 0) {
+        if (cache)
+            free_cache(cache);
+        cache = create_cache(cache_s, cache_b, cache_E, cache_d);
+    }
+    starting_up = 1;
+    cycles = instructions = 0;
+    cc = DEFAULT_CC;
+    status = STAT_AOK;
+
+    now = 0;
+    port_free = 0;
+    next_seq = 0;
+    diverged = false;
+    checked = 0;
+    steps = 0;
+    memset(issue_count, 0, sizeof(issue_count));
+    memset(dispatch_stalls, 0, sizeof(dispatch_stalls));
+    rob_fill = rs_fill = lsq_fill = 0;
+    loads = forwarded = store_waits = squashed = 0;
+}
+
+/* Text representation of the state at the start of a cycle */
+static void print_state(word_t cyc)
+{
+    int age;
+    SIM_LOG("\nCycle = %lld. CC = %s, Stat = %s\n", cyc, cc_name(cc), stat_name(status));
+    SIM_LOG("F: fetchPC = %s%s, %d queued\n", pc_name(syms, fetch_pc),
+            fetch_wait ? " (waiting)" : "", fq_count);
+    for (age = 0; age < rob_count; age++) {
+        rob_entry *e = &rob[rob_slot(age)];
+        SIM_LOG("ROB[%d]: instr = %s, %s, valE = 0x%llx, valM = 0x%llx, dstE = %s, dstM = %s, Stat = %s, PC = %s\n",
+                rob_slot(age), iname(HPACK(e->icode, e->ifun)),
+                e->done ? "done" : e->issued ? "issued" : "waiting",
+                e->vale, e->valm, reg_name(e->deste), reg_name(e->destm),
+                stat_name(e->status), pc_name(syms, e->pc));
+    }
+}
+
+/* Address the ISA model is about to write, if its next instruction stores */
+static bool isa_write_addr(word_t *addrp)
+{
+    byte_t byte0 = 0;
+    byte_t byte1 = 0;
+    word_t valc = 0;
+    get_byte_val(isa_state->m, isa_state->pc, &byte0);
+    switch (GET_ICODE(byte0)) {
+    case I_RMMOVQ:
+        get_byte_val(isa_state->m, isa_state->pc + 1, &byte1);
+        get_word_val(isa_state->m, isa_state->pc + 2, &valc);
+        *addrp = valc + get_reg_val(isa_state->r, LO4(byte1));
+        return true;
+    case I_PUSHQ:
+    case I_CALL:
+        *addrp = get_reg_val(isa_state->r, REG_RSP) - 8;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Compare one stored word between the ISA model and the core */
+static bool lockstep_word_match(word_t addr)
+{
+    word_t isa_val = 0;
+    word_t pipe_val = 0;
+    get_word_val(isa_state->m, addr, &isa_val);
+    get_word_val(mem, addr, &pipe_val);
+    if (isa_val == pipe_val)
+        return true;
+    if (verbosity > 0) {
+        printf("ISA Memory != Pipeline Memory\n");
+        printf("\tISA Memory\t\tPipeline Memory\n");
+        printf("0x%.4llx:\t0x%.16llx\t0x%.16llx\n", addr, isa_val, pipe_val);
+    }
+    return false;
+}
+
+/*
+ * lockstep_check - Step the ISA model over the instruction e that has
+ * just retired and compare the state it changed.  Younger instructions
+ * have not changed the register file or memory yet.
+ */
+static void lockstep_check(rob_entry *e)
+{
+    word_t pc = isa_state->pc;
+    word_t isa_addr = 0;
+    bool isa_store = isa_write_addr(&isa_addr);
+    bool match = true;
+
+    if (pc != e->pc) {
+        match = false;
+        if (verbosity > 0)
+            printf("ISA PC (0x%llx) != Pipeline PC (0x%llx)\n", pc, e->pc);
+    } else {
+        byte_t s = step_state(isa_state, NULL);
+        if (s != e->status) {
+            match = false;
+            if (verbosity > 0)
+                printf("ISA Status (%s) != Pipeline Status (%s)\n",
+                       stat_name(s), stat_name(e->status));
+        }
+        if (diff_reg(isa_state->r, reg, NULL)) {
+            match = false;
+            if (verbosity > 0) {
+                printf("ISA Register != Pipeline Register File\n");
+                printf("\tISA register\t\tPipeline Register\n");
+                diff_reg(isa_state->r, reg, stdout);
+            }
+        }
+        if (s == STAT_AOK && isa_store)
+            match = lockstep_word_match(isa_addr) && match;
+        if (e->status == STAT_AOK && e->lsq >= 0 && lsq[e->lsq].store &&
+            !(isa_store && lsq[e->lsq].addr == isa_addr))
+            match = lockstep_word_match(lsq[e->lsq].addr) && match;
+    }
+    checked++;
+    if (!match) {
+        diverged = true;
+        if (verbosity > 0)
+            printf("Lockstep check diverges at instruction %lld, PC 0x%llx\n",
+                   checked, pc);
+    }
+}
+
+static void do_retire_stage();
+static void do_complete_stage();
+static void do_memory_stage();
+static void do_issue_stage();
+static void do_dispatch_stage();
+static void do_fetch_stage();
+
+/*
+ * sim_step_pipe - Simulate one cycle.  Returns the status of the last
+ * instruction to retire, or STAT_BUB if none did.
+ */
+static byte_t sim_step_pipe()
+{
+    if (dumpfile)
+        print_state(now);
+
+    /* Stages run from retirement back to fetch, so each sees what the
+       stages before it did last cycle.  Results complete before issue
+       looks for ready operands, so an instruction can issue the cycle
+       its operands are produced */
+    do_retire_stage();
+    do_complete_stage();
+    do_memory_stage();
+    do_issue_stage();
+    do_dispatch_stage();
+    do_fetch_stage();
+
+    /* Performance monitoring */
+    steps++;
+    issue_count[issued]++;
+    rob_fill += rob_count;
+    rs_fill += rs_used;
+    lsq_fill += lsq_count;
+    if (retired > 0) {
+        starting_up = 0;
+        instructions += retired;
+        cycles++;
+    } else {
+	    if (!starting_up)
+	        cycles++;
+    }
+    now++;
+
+    return retired > 0 ? status : STAT_BUB;
+}
+
+/*
+  Run the core until one of following occurs:
+  - An instruction with an exception status retires.
+  - max_instr instructions have retired
+  - max_cycle cycles have been simulated
+
+  Return number of instructions executed.
+  if statusp nonnull, then will be set to status of final instruction
+  if ccp nonnull, then will be set to condition codes of final instruction
+*/
+word_t sim_run_pipe(word_t max_instr, word_t max_cycle, byte_t *statusp, cc_t *ccp)
+{
+    word_t ccount     = 0;
+    byte_t run_status = STAT_AOK;
+    retire_limit = max_instr;
+    while (instructions < max_instr && ccount < max_cycle) {
+        run_status = sim_step_pipe();
+        if (run_status != STAT_AOK && run_status != STAT_BUB)
+            break;
+        if (diverged)
+            break;
+        ccount++;
+    }
+    if (statusp)
+	    *statusp = run_status;
+    if (ccp)
+	    *ccp = cc;
+    return instructions;
+}
+
+/*********************************************************
+ * Part 3: The stages, from retirement back to fetch.
+ *********************************************************/
+
+/* Does the instruction use the load/store queue? */
+static bool uses_memory(byte_t icode)
+{
+    return icode == I_RMMOVQ || icode == I_MRMOVQ || icode == I_CALL ||
+        icode == I_RET || icode == I_PUSHQ || icode == I_POPQ;
+}
+
+/* Does the instruction write memory? */
+static bool is_store(byte_t icode)
+{
+    return icode == I_RMMOVQ || icode == I_CALL || icode == I_PUSHQ;
+}
+
+/* Cycles a data access to the word at addr takes: one, plus the miss
+   delay for each block of it missing from the cache */
+static int access_cycles(word_t addr, operation_t op)
+{
+    word_t bsize, block, last;
+    int lat = 1;
+    if (!cache)
+        return lat;
+    bsize = (word_t) 1 << cache->b;
+    last = (addr + 7) & ~(bsize - 1);
+    for (block = addr & ~(bsize - 1); ; block += bsize) {
+        if (!check_hit(cache, block, op)) {
+            evicted_line_t *evicted = handle_miss(cache, block, op, NULL);
+            free(evicted->data);
+            free(evicted);
+            lat += cache->d;
+        }
+        if (block == last)
+            break;
+    }
+    return lat;
+}
+
+/* Result of the producer t of source s */
+static word_t rob_result(rename_t t, src_t s)
+{
+    rob_entry *e = &rob[t.rob];
+    if (s == SRC_CC)
+        return e->cc;
+    return t.valm ? e->valm : e->vale;
+}
+
+static void squash_after(int age);
+
+/* Was an instruction in flight fetched from any of the 8 bytes at addr? */
+static bool fetched_from(word_t addr)
+{
+    int i;
+    for (i = 0; i < rob_count; i++) {
+        rob_entry *e = &rob[rob_slot(i)];
+        if (e->pc < addr + 8 && addr < e->valp)
+            return true;
+    }
+    for (i = 0; i < fq_count; i++) {
+        fetch_slot *f = &fq[(fq_head + i) % MAX_FQ];
+        if (f->pc < addr + 8 && addr < f->valp)
+            return true;
+    }
+    return false;
+}
+
+/**************************** Retire stage *************************
+ * Retire completed instructions in program order.  Stores write
+ * memory here, through the data memory port; one that overwrites an
+ * instruction already fetched squashes everything after it.
+ * Retirement stops at the first instruction with an exception.
+ *******************************************************************/
+static void do_retire_stage()
+{
+    int i;
+
+    status = STAT_BUB;
+    retired = 0;
+    while (retired < width && rob_count > 0 &&
+           instructions + retired < retire_limit) {
+        rob_entry *e = &rob[rob_head];
+        lsq_entry *l = e->lsq >= 0 ? &lsq[e->lsq] : NULL;
+        if (!e->done)
+            break;
+        if (l && l->store && e->status == STAT_AOK) {
+            if (port_free > now)
+                break;
+            if (set_word_val(mem, l->addr, l->data)) {
+                SIM_LOG("\tRetire: Wrote 0x%llx to address 0x%llx\n", l->data, l->addr);
+                port_free = now + access_cycles(l->addr, WRITE);
+            } else {
+                SIM_LOG("\tRetire: Couldn't write to address 0x%llx\n", l->addr);
+                e->status = STAT_ADR;
+            }
+        }
+        status = e->status;
+        if (e->status == STAT_AOK) {
+            if (e->deste != REG_NONE) {
+                SIM_LOG("\tRetire: Wrote 0x%llx to register %s\n",
+                        e->vale, reg_name(e->deste));
+                set_reg_val(reg, e->deste, e->vale);
+            }
+            if (e->destm != REG_NONE) {
+                SIM_LOG("\tRetire: Wrote 0x%llx to register %s\n",
+                        e->valm, reg_name(e->destm));
+                set_reg_val(reg, e->destm, e->valm);
+            }
+            if (e->icode == I_ALU)
+                cc = e->cc;
+        }
+        for (i = 0; i < REG_NONE; i++)
+            if (rename_reg[i].rob == rob_head)
+                rename_reg[i].rob = -1;
+        if (rename_cc.rob == rob_head)
+            rename_cc.rob = -1;
+        if (l) {
+            lsq_head = (lsq_head + 1) % lsq_size;
+            lsq_count--;
+        }
+        rob_head = (rob_head + 1) % rob_size;
+        rob_count--;
+        retired++;
+        if (lockstep && isa_state)
+            lockstep_check(e);
+        if (e->status != STAT_AOK || diverged)
+            break;
+        if (l && l->store && fetched_from(l->addr)) {
+            // the store changed code already fetched: start again after it
+            SIM_LOG("\tRetire: Store to 0x%llx overwrote fetched code\n", l->addr);
+            fetch_pc = rob_count > 0 ? rob[rob_head].pc : fq[fq_head].pc;
+            squash_after(-1);
+            fetch_wait = false;
+            break;
+        }
+    }
+}
+
+/* Rebuild the rename table from the instructions left in the ROB */
+static void rebuild_rename()
+{
+    int age;
+    int i;
+    for (i = 0; i < REG_NONE; i++)
+        rename_reg[i].rob = -1;
+    rename_cc.rob = -1;
+    for (age = 0; age < rob_count; age++) {
+        int r = rob_slot(age);
+        rob_entry *e = &rob[r];
+        if (e->deste != REG_NONE) {
+            rename_reg[e->deste].rob = r;
+            rename_reg[e->deste].valm = false;
+        }
+        if (e->destm != REG_NONE) {
+            rename_reg[e->destm].rob = r;
+            rename_reg[e->destm].valm = true;
+        }
+        if (e->icode == I_ALU) {
+            rename_cc.rob = r;
+            rename_cc.valm = false;
+        }
+    }
+}
+
+/* Discard every instruction younger than the ROB entry of the given age,
+   along with the fetch queue */
+static void squash_after(int age)
+{
+    int a;
+    while (lsq_count > 0 && rob_age(lsq_at(lsq_count - 1)->rob) > age)
+        lsq_count--;
+    for (a = age + 1; a < rob_count; a++) {
+        rob_entry *e = &rob[rob_slot(a)];
+        if (e->rs >= 0 && rs[e->rs].busy) {
+            rs[e->rs].busy = false;
+            rs_used--;
+        }
+        squashed++;
+    }
+    squashed += fq_count;
+    rob_count = age + 1;
+    fq_count = 0;
+    rebuild_rename();
+}
+
+/* Pass the result of ROB entry r to the reservation stations waiting on it */
+static void broadcast(int r)
+{
+    int i;
+    src_t s;
+    for (i = 0; i < rs_size; i++) {
+        if (!rs[i].busy)
+            continue;
+        for (s = 0; s < NSRC; s++) {
+            operand_t *op = &rs[i].src[s];
+            if (!op->ready && op->tag.rob == r) {
+                op->ready = true;
+                op->val = rob_result(op->tag, s);
+            }
+        }
+    }
+}
+
+/*************************** Complete stage ************************
+ * Instructions whose results are ready wake up the reservation
+ * stations waiting on them.  Jumps are resolved here: a mispredicted
+ * one squashes everything younger and redirects fetch.  A ret lets
+ * fetch continue from its return address.
+ *******************************************************************/
+static void do_complete_stage()
+{
+    int age;
+    for (age = 0; age < rob_count; age++) {
+        int r = rob_slot(age);
+        rob_entry *e = &rob[r];
+        if (e->done || !e->issued || e->done_cycle < 0 || e->done_cycle > now)
+            continue;
+        e->done = true;
+        broadcast(r);
+        if (e->status != STAT_AOK)
+            continue;
+        if (e->icode == I_JMP) {
+            bpred_update(bpred, e->pc, e->predtaken, e->cnd);
+            if (e->cnd != e->predtaken) {
+                SIM_LOG("\tComplete: Mispredicted jump at %s\n", pc_name(syms, e->pc));
+                squash_after(age);
+                fetch_pc = e->cnd ? e->valc : e->valp;
+                fetch_wait = false;
+                break;
+            }
+        } else if (e->icode == I_RET) {
+            fetch_pc = e->valm;
+            fetch_wait = false;
+        }
+    }
+}
+
+/**************************** Memory stage *************************
+ * Start at most one load through the data memory port.  A load waits
+ * until every older store has its address.  If the youngest older
+ * store to overlap it writes the same word, the store's data is
+ * forwarded without using the port; any other overlap waits for that
+ * store to retire.
+ *******************************************************************/
+static void do_memory_stage()
+{
+    int i, j;
+    for (i = 0; i < lsq_count; i++) {
+        lsq_entry *l = lsq_at(i);
+        rob_entry *e = &rob[l->rob];
+        lsq_entry *fwd = NULL;
+        bool blocked = false;
+        if (l->store || l->started || !l->addr_ready)
+            continue;
+        for (j = 0; j < i; j++) {
+            lsq_entry *s = lsq_at(j);
+            if (!s->store)
+                continue;
+            if (!s->addr_ready) {
+                blocked = true;
+                break;
+            }
+            if (s->addr < l->addr + 8 && l->addr < s->addr + 8)
+                fwd = s;
+        }
+        if (blocked || (fwd && fwd->addr != l->addr)) {
+            store_waits++;
+            continue;
+        }
+        if (fwd) {
+            e->valm = fwd->data;
+            e->done_cycle = now + 1;
+            l->started = true;
+            loads++;
+            forwarded++;
+            SIM_LOG("\tMemory: Forwarded 0x%llx for 0x%llx\n", e->valm, l->addr);
+            continue;
+        }
+        if (port_free > now)
+            continue;
+        l->started = true;
+        loads++;
+        if (get_word_val(mem, l->addr, &e->valm)) {
+            SIM_LOG("\tMemory: Read 0x%llx from 0x%llx\n", e->valm, l->addr);
+            port_free = now + access_cycles(l->addr, READ);
+        } else {
+            SIM_LOG("\tMemory: Couldn't Read from 0x%llx\n", l->addr);
+            e->status = STAT_ADR;
+            port_free = now + 1;
+        }
+        e->done_cycle = port_free;
+    }
+}
+
+/* Compute the results of ROB entry r from the operands in s */
+static void execute(rob_entry *e, rs_entry *s)
+{
+    word_t vala = s->src[SRC_A].val;
+    word_t valb = s->src[SRC_B].val;
+    cc_t ccin = s->src[SRC_CC].val;
+    lsq_entry *l = e->lsq >= 0 ? &lsq[e->lsq] : NULL;
+
+    switch (e->icode) {
+    case I_RRMOVQ: // aka CMOVQ
+        // a move whose condition fails writes back the old value of rB
+        e->cnd = cond_holds(ccin, e->ifun);
+        e->vale = e->cnd ? vala : valb;
+        break;
+    case I_IRMOVQ:
+        e->vale = e->valc;
+        break;
+    case I_ALU:
+        e->vale = compute_alu(e->ifun, vala, valb);
+        e->cc = compute_cc(e->ifun, vala, valb);
+        break;
+    case I_JMP:
+        e->cnd = cond_holds(ccin, e->ifun);
+        break;
+    case I_RMMOVQ:
+        l->addr = e->valc + valb;
+        l->data = vala;
+        break;
+    case I_MRMOVQ:
+        l->addr = e->valc + valb;
+        break;
+    case I_PUSHQ:
+    case I_CALL:
+        e->vale = valb - 8;
+        l->addr = e->vale;
+        l->data = e->icode == I_CALL ? e->valp : vala;
+        break;
+    case I_POPQ:
+    case I_RET:
+        e->vale = valb + 8;
+        l->addr = vala;
+        break;
+    default:
+        break;
+    }
+    if (l)
+        l->addr_ready = true;
+    // loads finish in the memory stage
+    e->done_cycle = l && !l->store ? -1 : now + 1;
+}
+
+/**************************** Issue stage **************************
+ * Issue up to width instructions whose operands are all ready, oldest
+ * first.  Everything but a load produces its result the next cycle.
+ *******************************************************************/
+static void do_issue_stage()
+{
+    int age;
+    issued = 0;
+    for (age = 0; age < rob_count && issued < width; age++) {
+        rob_entry *e = &rob[rob_slot(age)];
+        rs_entry *s;
+        src_t i;
+        bool ready = true;
+        if (e->issued || e->rs < 0)
+            continue;
+        s = &rs[e->rs];
+        for (i = 0; i < NSRC; i++)
+            ready = ready && s->src[i].ready;
+        if (!ready)
+            continue;
+        SIM_LOG("\tIssue: %s at %s\n", iname(HPACK(e->icode, e->ifun)), pc_name(syms, e->pc));
+        execute(e, s);
+        e->issued = true;
+        s->busy = false;
+        rs_used--;
+        issued++;
+    }
+}
+
+/* Read source s of an instruction from register id, or from its producer */
+static void rename_src(operand_t *op, byte_t id)
+{
+    op->ready = true;
+    op->val = 0;
+    if (id >= REG_NONE)
+        return;
+    op->tag = rename_reg[id];
+    if (op->tag.rob < 0)
+        op->val = get_reg_val(reg, id);
+    else if (rob[op->tag.rob].done)
+        op->val = rob_result(op->tag, SRC_A);
+    else
+        op->ready = false;
+}
+
+/* Read the condition codes, or their producer */
+static void rename_cc_src(operand_t *op)
+{
+    op->ready = true;
+    op->tag = rename_cc;
+    if (op->tag.rob < 0)
+        op->val = cc;
+    else if (rob[op->tag.rob].done)
+        op->val = rob_result(op->tag, SRC_CC);
+    else
+        op->ready = false;
+}
+
+/*
+ * dispatch_instr - Rename the instruction f and give it a ROB entry,
+ * a reservation station and a load/store queue entry as it needs
+ * them.  Returns false, counting why, if one is not free.
+ */
+static bool dispatch_instr(fetch_slot *f)
+{
+    bool valid = f->status == STAT_AOK;
+    bool needs_rs = valid && f->icode != I_NOP && f->icode != I_HALT &&
+        !(f->icode == I_JMP && f->ifun == C_YES);
+    bool needs_lsq = valid && uses_memory(f->icode);
+    byte_t srca = REG_NONE;
+    byte_t srcb = REG_NONE;
+    bool srccc = false;
+    int r;
+    rob_entry *e;
+
+    if (rob_count == rob_size) {
+        dispatch_stalls[STALL_ROB]++;
+        return false;
+    }
+    if (needs_rs && rs_used == rs_size) {
+        dispatch_stalls[STALL_RS]++;
+        return false;
+    }
+    if (needs_lsq && lsq_count == lsq_size) {
+        dispatch_stalls[STALL_LSQ]++;
+        return false;
+    }
+
+    r = rob_slot(rob_count++);
+    e = &rob[r];
+    memset(e, 0, sizeof(*e));
+    e->icode = f->icode;
+    e->ifun = f->ifun;
+    e->valc = f->valc;
+    e->valp = f->valp;
+    e->pc = f->pc;
+    e->status = f->status;
+    e->predtaken = f->predtaken;
+    e->seq = next_seq++;
+    e->deste = REG_NONE;
+    e->destm = REG_NONE;
+    e->rs = -1;
+    e->lsq = -1;
+    e->done_cycle = -1;
+
+    if (valid) {
+        switch (f->icode) {
+        case I_RRMOVQ: // aka CMOVQ
+            srca = f->ra;
+            if (f->ifun != C_YES) {
+                srcb = f->rb;
+                srccc = true;
+            }
+            e->deste = f->rb;
+            break;
+        case I_IRMOVQ:
+            e->deste = f->rb;
+            break;
+        case I_RMMOVQ:
+            srca = f->ra;
+            srcb = f->rb;
+            break;
+        case I_MRMOVQ:
+            srcb = f->rb;
+            e->destm = f->ra;
+            break;
+        case I_ALU:
+            srca = f->ra;
+            srcb = f->rb;
+            e->deste = f->rb;
+            break;
+        case I_JMP:
+            srccc = f->ifun != C_YES;
+            break;
+        case I_CALL:
+            srcb = REG_RSP;
+            e->deste = REG_RSP;
+            break;
+        case I_RET:
+            srca = REG_RSP;
+            srcb = REG_RSP;
+            e->deste = REG_RSP;
+            break;
+        case I_PUSHQ:
+            srca = f->ra;
+            srcb = REG_RSP;
+            e->deste = REG_RSP;
+            break;
+        case I_POPQ:
+            srca = REG_RSP;
+            srcb = REG_RSP;
+            e->deste = REG_RSP;
+            e->destm = f->ra;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (needs_rs) {
+        rs_entry *s;
+        for (e->rs = 0; rs[e->rs].busy; e->rs++)
+            ;
+        s = &rs[e->rs];
+        s->busy = true;
+        s->rob = r;
+        rs_used++;
+        rename_src(&s->src[SRC_A], srca);
+        rename_src(&s->src[SRC_B], srcb);
+        if (srccc) {
+            rename_cc_src(&s->src[SRC_CC]);
+        } else {
+            s->src[SRC_CC].ready = true;
+            s->src[SRC_CC].val = 0;
+        }
+    } else {
+        e->done = true;
+    }
+
+    if (needs_lsq) {
+        lsq_entry *l;
+        e->lsq = (lsq_head + lsq_count) % lsq_size;
+        l = &lsq[e->lsq];
+        memset(l, 0, sizeof(*l));
+        l->rob = r;
+        l->store = is_store(f->icode);
+        lsq_count++;
+    }
+
+    // valM is renamed last, so that popq %rsp leaves %rsp with the popped value
+    if (e->deste != REG_NONE) {
+        rename_reg[e->deste].rob = r;
+        rename_reg[e->deste].valm = false;
+    }
+    if (e->destm != REG_NONE) {
+        rename_reg[e->destm].rob = r;
+        rename_reg[e->destm].valm = true;
+    }
+    if (e->icode == I_ALU) {
+        rename_cc.rob = r;
+        rename_cc.valm = false;
+    }
+    return true;
+}
+
+/*************************** Dispatch stage ************************
+ * Move up to width instructions from the fetch queue into the core,
+ * in order, stopping at the first that finds a structure full.
+ *******************************************************************/
+static void do_dispatch_stage()
+{
+    int i;
+    for (i = 0; i < width && fq_count > 0; i++) {
+        if (!dispatch_instr(&fq[fq_head]))
+            break;
+        fq_head = (fq_head + 1) % MAX_FQ;
+        fq_count--;
+    }
+}
+
+/* Fetch the instruction at pc into slot f */
+static void fetch_instr(word_t pc, fetch_slot *f)
+{
+    byte_t byte0 = 0;
+    byte_t regids = 0;
+    bool imem_error = !get_byte_val(mem, pc, &byte0);
+
+    f->pc = pc;
+    f->icode = GET_ICODE(byte0);
+    f->ifun = GET_FUN(byte0);
+    f->ra = REG_NONE;
+    f->rb = REG_NONE;
+    f->valc = 0;
+    f->valp = pc + 1;
+    f->status = STAT_AOK;
+    f->predtaken = false;
+
+    switch (byte0) {
+    case HPACK(I_NOP, F_NONE):
+    case HPACK(I_RET, F_NONE):
+        break;
+
+    case HPACK(I_HALT, F_NONE):
+        f->status = STAT_HLT;
+        break;
+
+    case HPACK(I_RRMOVQ, F_NONE):
+    case HPACK(I_RRMOVQ, C_LE):
+    case HPACK(I_RRMOVQ, C_L):
+    case HPACK(I_RRMOVQ, C_E):
+    case HPACK(I_RRMOVQ, C_NE):
+    case HPACK(I_RRMOVQ, C_GE):
+    case HPACK(I_RRMOVQ, C_G):
+    case HPACK(I_ALU, A_ADD):
+    case HPACK(I_ALU, A_SUB):
+    case HPACK(I_ALU, A_AND):
+    case HPACK(I_ALU, A_XOR):
+    case HPACK(I_PUSHQ, F_NONE):
+    case HPACK(I_POPQ, F_NONE):
+        imem_error |= !get_byte_val(mem, pc + 1, &regids);
+        f->ra = HI4(regids);
+        f->rb = LO4(regids);
+        f->valp = pc + 2;
+        break;
+
+    case HPACK(I_IRMOVQ, F_NONE):
+    case HPACK(I_RMMOVQ, F_NONE):
+    case HPACK(I_MRMOVQ, F_NONE):
+        imem_error |= !get_byte_val(mem, pc + 1, &regids);
+        f->ra = HI4(regids);
+        f->rb = LO4(regids);
+        imem_error |= !get_word_val(mem, pc + 2, &f->valc);
+        f->valp = pc + 10;
+        break;
+
+    case HPACK(I_JMP, C_YES):
+    case HPACK(I_JMP, C_LE):
+    case HPACK(I_JMP, C_L):
+    case HPACK(I_JMP, C_E):
+    case HPACK(I_JMP, C_NE):
+    case HPACK(I_JMP, C_GE):
+    case HPACK(I_JMP, C_G):
+    case HPACK(I_CALL, F_NONE):
+        imem_error |= !get_word_val(mem, pc + 1, &f->valc);
+        f->valp = pc + 9;
+        break;
+
+    default:
+        f->status = STAT_INS;
+        break;
+    }
+    if (imem_error)
+        f->status = STAT_ADR;
+
+    if (f->status == STAT_AOK)
+        SIM_LOG("\tFetch: f_pc = 0x%llx, f_instr = %s\n",
+                pc, iname(HPACK(f->icode, f->ifun)));
+}
+
+/**************************** Fetch stage **************************
+ * Fetch up to width instructions in order into the fetch queue,
+ * following at most one change of control flow per cycle.  Jumps are
+ * predicted by the branch predictor and calls are followed.  Fetch
+ * stops at a ret until the ret completes, and at a halt or an error
+ * until a mispredicted jump redirects it.
+ *******************************************************************/
+static void do_fetch_stage()
+{
+    int i;
+    if (fetch_wait)
+        return;
+    for (i = 0; i < width && fq_count < 2 * width; i++) {
+        fetch_slot *f = &fq[(fq_head + fq_count) % MAX_FQ];
+        fetch_instr(fetch_pc, f);
+        fq_count++;
+        if (f->status != STAT_AOK || f->icode == I_RET) {
+            fetch_wait = true;
+            return;
+        }
+        if (f->icode == I_CALL ||
+            (f->icode == I_JMP && f->ifun == C_YES)) {
+            fetch_pc = f->valc;
+            return;
+        }
+        if (f->icode == I_JMP) {
+            f->predtaken = bpred_predict(bpred, f->pc, f->valc);
+            if (f->predtaken) {
+                fetch_pc = f->valc;
+                return;
+            }
+        }
+        fetch_pc = f->valp;
+    }
+}
+
+/**************************************************************
+ * Part 4: Logging
+ **************************************************************/
+
+/*
+ * sim_log dumps a formatted string to the dumpfile, if it exists
+ * accepts variable argument list
+ */
+void sim_log( const char *format, ... ) {
+    if (dumpfile) {
+        va_list arg;
+        va_start( arg, format );
+        vfprintf( dumpfile, format, arg );
+        va_end( arg );
+    }
+}
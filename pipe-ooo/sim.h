@@ -0,0 +1,46 @@
+
+/********** Defines **************/
+
+/* Get ra out of one byte regid field */
+#define GET_RA(r) HI4(r)
+
+/* Get rb out of one byte regid field */
+#define GET_RB(r) LO4(r)
+
+/*************** Simulation Control Functions ***********/
+
+/* Initialize simulator */
+void sim_init();
+
+/* Reset simulator state, including register, instruction, and data memories */
+void sim_reset();
+
+/*
+  Run the core until one of following occurs:
+  - An instruction with an exception status retires.
+  - max_instr instructions have retired
+  - max_cycle cycles have been simulated
+
+  Return number of instructions executed.
+  if statusp nonnull, then will be set to status of final instruction
+  if ccp nonnull, then will be set to condition codes of final instruction
+*/
+word_t sim_run_pipe(word_t max_instr, word_t max_cycle, byte_t *statusp, cc_t *ccp);
+
+/*
+ * sim_log dumps a formatted string to the dumpfile, if it exists
+ * accepts variable argument list
+ */
+void sim_log( const char *format, ... );
+
+/*
+ * SIM_LOG(format, ...) is how the simulator traces.  It tests the
+ * dumpfile before evaluating its arguments, so a run without a trace
+ * does not pay for formatting names and addresses.  Building with
+ * -DNO_SIM_LOG compiles the trace out altogether.
+ */
+#ifdef NO_SIM_LOG
+#define SIM_LOG(...) ((void) (0 && (sim_log(__VA_ARGS__), 0)))
+#else
+#define SIM_LOG(...) (dumpfile ? sim_log(__VA_ARGS__) : (void) 0)
+#endif
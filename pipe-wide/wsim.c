@@ -0,0 +1,1681 @@
+/**************************************************************************
+ * wsim.c - Multi-issue pipelined Y86-64 simulator
+ *
+ * A variant of PIPE that fetches, decodes, executes and retires up to
+ * width instructions per cycle.  Each pipe register holds a bundle of
+ * instructions, oldest first.  Decode issues the longest prefix of its
+ * bundle that can execute together; the rest stay in decode for the
+ * next cycle.  Fetch, execute and memory can each take several
+ * cycles, as a chain of sub-stages behind the one that does the work.
+ **************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "isa.h"
+#include "asm.h"
+#include "batch.h"
+#include "pipeline.h"
+#include "stages.h"
+#include "sim.h"
+
+char simname[] = "Y86-64 Processor: PIPE, multi-issue";
+
+/* Parameters modifed by the command line */
+char *object_filename;   /* The input object file name. */
+FILE *object_file;       /* Input file handle */
+int verbosity = 2;    /* Verbosity level [Non interactive Mode only] (-v) */
+word_t instr_limit = 10000; /* Instruction limit [Non interactive Mode only] (-l) */
+bool lockstep = false;    /* Check each instruction as it retires [Non interactive Mode only] (-k) */
+char *batch_list = NULL; /* Manifest or directory of programs to check (-m) */
+int batch_workers = 1;    /* Worker processes in batch mode (-j) */
+int width = 2;            /* Instructions per bundle (-w) */
+int fetch_depth = 1;      /* Cycles fetch takes (-F) */
+int execute_depth = 1;    /* Cycles execute takes (-E) */
+int memory_depth = 1;     /* Cycles memory takes (-M) */
+
+/* Log file */
+FILE *dumpfile = NULL;
+
+/* Performance monitoring */
+/* How many cycles have been simulated? */
+word_t cycles = 0;
+/* How many instructions have passed through the WB stage? */
+word_t instructions = 0;
+
+/* Has simulator gotten past initial bubbles? */
+static int starting_up = 1;
+
+/* ISA model run alongside the pipeline in lockstep mode */
+static state_ptr isa_state = NULL;
+/* Has the pipeline diverged from the ISA model? */
+static bool diverged = false;
+/* Instructions checked against the ISA model */
+static word_t checked = 0;
+
+/* Why decode issued only part of its bundle */
+typedef enum {
+    ISSUE_OK,
+    ISSUE_DEPEND,       /* Source written by an older instruction in the bundle */
+    ISSUE_CC,           /* Reads condition codes set earlier in the bundle */
+    ISSUE_MEM,          /* Second memory access in the bundle */
+    ISSUE_LOAD_USE,     /* Source loaded by an instruction in execute or memory */
+    ISSUE_ALU_USE,      /* Source computed by an instruction still in execute */
+    ISSUE_REASONS
+} issue_t;
+
+/* Cycles in which execute held each number of instructions */
+static word_t issue_count[MAX_WIDTH + 1];
+/* Cycles decode held back part of its bundle, by reason */
+static word_t issue_cuts[ISSUE_REASONS];
+
+/* Both instruction and data memory */
+mem_t mem;
+
+/* Labels and source lines of the loaded program */
+symtab_t syms;
+
+/* Register file */
+mem_t reg;
+/* Condition code register */
+cc_t cc;
+/* Status code */
+stat_t status;
+
+/***************************
+ * Function prototypes
+ ***************************/
+
+word_t sim_run_pipe(word_t max_instr, word_t max_cycle, byte_t *statusp, cc_t *ccp);
+static void usage(char *name);           /* Print helpful usage message */
+static void run_tty_sim();               /* Run simulator in TTY mode */
+static void run_batch_program(char *fname, batch_result_t *res);
+static int get_depth(char *name, char *arg);
+
+/*******************************************************************
+ * Part 1: Entry point.  Parses the command line, then runs the
+ * simulation in TTY mode or over a batch of programs.
+ *******************************************************************/
+
+int sim_main(int argc, char **argv)
+{
+    int i;
+    int c;
+
+    /* Parse the command line arguments */
+    while ((c = getopt(argc, argv, "hkl:v:m:j:w:F:E:M:")) != -1) {
+        switch(c) {
+        case 'h':
+            usage(argv[0]);
+            break;
+        case 'l':
+            instr_limit = atoll(optarg);
+            break;
+        case 'v':
+            verbosity = atoi(optarg);
+            if (verbosity < 0 || verbosity > 2) {
+                printf("Invalid verbosity %d\n", verbosity);
+                usage(argv[0]);
+            }
+            break;
+        case 'k':
+            lockstep = true;
+            break;
+        case 'm':
+            batch_list = optarg;
+            break;
+        case 'j':
+            batch_workers = atoi(optarg);
+            break;
+        case 'w':
+            width = atoi(optarg);
+            if (width < 1 || width > MAX_WIDTH) {
+                printf("Invalid width %d\n", width);
+                usage(argv[0]);
+            }
+            break;
+        case 'F':
+            fetch_depth = get_depth("fetch", optarg);
+            break;
+        case 'E':
+            execute_depth = get_depth("execute", optarg);
+            break;
+        case 'M':
+            memory_depth = get_depth("memory", optarg);
+            break;
+        default:
+            printf("Invalid option '%c'\n", c);
+            usage(argv[0]);
+            break;
+        }
+    }
+
+    if (batch_list) {
+        verbosity = 0;
+        sim_init();
+        exit(run_batch(batch_list, batch_workers, run_batch_program) ? 1 : 0);
+    }
+
+    /* Do we have too many arguments? */
+    if (optind < argc - 1) {
+	printf("Too many command line arguments:");
+	for (i = optind; i < argc; i++)
+	    printf(" %s", argv[i]);
+	printf("\n");
+	usage(argv[0]);
+    }
+
+    /* The single unflagged argument should be the object file name */
+    object_filename = NULL;
+    object_file = NULL;
+    if (optind < argc) {
+        object_filename = argv[optind];
+        object_file = fopen(object_filename, "r");
+        if (!object_file) {
+            fprintf(stderr, "Couldn't open object file %s\n", object_filename);
+            exit(1);
+        }
+    }
+
+    if (object_filename == NULL) {
+        fprintf(stderr, "No object file specified\n");
+        exit(1);
+    }
+
+    run_tty_sim();
+    exit(0);
+}
+
+int main(int argc, char *argv[]){return sim_main(argc,argv);}
+
+/* Parse the number of cycles a stage takes */
+static int get_depth(char *name, char *arg)
+{
+    int depth = atoi(arg);
+    if (depth < 1 || depth > MAX_DEPTH) {
+        printf("Invalid %s depth %d\n", name, depth);
+        usage("wsim");
+    }
+    return depth;
+}
+
+/* Start the ISA model from the loaded pipeline state */
+static void isa_start()
+{
+    isa_state = new_state(0);
+    free_mem(isa_state->r);
+    free_mem(isa_state->m);
+    isa_state->m = copy_mem(mem);
+    isa_state->r = copy_mem(reg);
+    isa_state->cc = cc;
+}
+
+/*
+ * isa_check - Compare the final pipeline state against the ISA model,
+ * explaining the differences when verbosity > 0.  Errors from the ISA
+ * model go to error_file.
+ */
+static bool isa_check(cc_t result_cc, FILE *error_file)
+{
+    byte_t e = STAT_AOK;
+    word_t step;
+    bool match = true;
+
+    /* In lockstep mode the ISA model has already been stepped and
+       checked alongside the pipeline, so only the condition codes
+       remain to be compared */
+    if (lockstep) {
+        match = !diverged;
+    } else {
+        for (step = 0; step < instr_limit && e == STAT_AOK; step++) {
+            e = step_state(isa_state, error_file);
+        }
+
+        if (diff_reg(isa_state->r, reg, NULL)) {
+            match = false;
+            if (verbosity > 0) {
+                printf("ISA Register != Pipeline Register File\n");
+                printf("\tISA register\t\tPipeline Register\n");
+                diff_reg(isa_state->r, reg, stdout);
+            }
+        }
+
+        if (diff_mem(isa_state->m, mem, NULL)) {
+            match = false;
+            if (verbosity > 0) {
+                printf("ISA Memory != Pipeline Memory\n");
+                printf("\tISA Memory\t\tPipeline Memory\n");
+                diff_mem(isa_state->m, mem, stdout);
+            }
+        }
+    }
+
+    if (isa_state->cc != result_cc) {
+        match = false;
+        if (verbosity > 0) {
+            printf("ISA Cond. Codes (%s) != Pipeline Cond. Codes (%s)\n",
+                cc_name(isa_state->cc), cc_name(result_cc));
+        }
+    }
+    return match;
+}
+
+/*
+ * print_issue_stats - How many instructions execute held each cycle,
+ * and why decode issued only part of a bundle.
+ */
+static void print_issue_stats()
+{
+    int i;
+    printf("Issue width %d:", width);
+    for (i = 0; i <= width; i++)
+        printf(" %d in %lld cycles%s", i, issue_count[i], i < width ? "," : "\n");
+    printf("Decode held instructions back: %lld cycles for a dependency, %lld for condition codes, "
+           "%lld for the memory port, %lld for a load/use hazard\n",
+           issue_cuts[ISSUE_DEPEND], issue_cuts[ISSUE_CC],
+           issue_cuts[ISSUE_MEM], issue_cuts[ISSUE_LOAD_USE]);
+    if (fetch_depth > 1 || execute_depth > 1 || memory_depth > 1)
+        printf("Fetch, execute and memory take %d, %d and %d cycles; "
+               "decode waited %lld cycles for an ALU result\n",
+               fetch_depth, execute_depth, memory_depth, issue_cuts[ISSUE_ALU_USE]);
+}
+
+/*
+ * run_tty_sim - Run the simulator in TTY mode
+ */
+static void run_tty_sim()
+{
+    word_t icount = 0;
+    byte_t run_status = STAT_AOK;
+    cc_t result_cc = 0;
+    word_t byte_cnt = 0;
+    mem_t mem0, reg0;
+
+    if (verbosity >= 2)
+	    dumpfile = stdout;
+    sim_init();
+
+    /* Emit simulator name */
+    if (verbosity >= 2)
+	    printf("%s\n", simname);
+
+    byte_cnt = load_code(mem, syms, object_filename, object_file, 1);
+    if (byte_cnt == 0) {
+	    fprintf(stderr, "No lines of code found\n");
+	    exit(1);
+    } else if (verbosity >= 2) {
+	    printf("%lld bytes of code read\n", byte_cnt);
+    }
+    fclose(object_file);
+
+    isa_start();
+
+    mem0 = copy_mem(mem);
+    reg0 = copy_mem(reg);
+
+    icount = sim_run_pipe(instr_limit, 5*instr_limit, &run_status, &result_cc);
+    if (verbosity > 0) {
+        printf("%lld instructions executed\n", icount);
+        printf("Status = %s\n", stat_name(run_status));
+        printf("Condition Codes: %s\n", cc_name(result_cc));
+        printf("Changed Register State:\n");
+        diff_reg(reg0, reg, stdout);
+        printf("Changed Memory State:\n");
+        diff_mem(mem0, mem, stdout);
+    }
+
+    bool match = isa_check(result_cc, stdout);
+
+    if (match) {
+        printf("ISA Check Succeeds\n");
+    } else {
+        printf("ISA Check Fails\n");
+    }
+
+    /* Emit CPI statistics */
+    double cpi = instructions > 0 ? (double) cycles/instructions : 1.0;
+    printf("CPI: %lld cycles/%lld instructions = %.2f\n",
+           cycles, instructions, cpi);
+    if (verbosity > 0)
+        print_issue_stats();
+}
+
+/*
+ * run_batch_program - Run one object file in batch mode and check it
+ * against the ISA model.  Prints nothing.
+ */
+static void run_batch_program(char *fname, batch_result_t *res)
+{
+    byte_t run_status = STAT_AOK;
+    cc_t result_cc = 0;
+    FILE *f = fopen(fname, "r");
+
+    res->ran = false;
+    if (!f)
+        return;
+    sim_reset();
+    clear_mem(mem);
+    clear_symtab(syms);
+    if (load_code(mem, syms, fname, f, 0) == 0) {
+        fclose(f);
+        return;
+    }
+    fclose(f);
+
+    isa_start();
+    sim_run_pipe(instr_limit, 5*instr_limit, &run_status, &result_cc);
+    res->match = isa_check(result_cc, NULL);
+    res->cycles = cycles;
+    res->instructions = instructions;
+    free_state(isa_state);
+    isa_state = NULL;
+    res->ran = true;
+}
+
+/*
+ * usage - print helpful diagnostic information
+ */
+static void usage(char *name)
+{
+    printf("Usage: %s [-hk] [-l m] [-v n] [-w n] [-F n] [-E n] [-M n] [-m f [-j n]] file.yo\n", name);
+    printf("   -h     Print this message\n");
+    printf("   -l m   Set instruction limit to m (default %lld)\n", instr_limit);
+    printf("   -v n   Set verbosity level to 0 <= n <= 2 (default %d)\n", verbosity);
+    printf("   -k     Check each instruction against the ISA model as it retires\n");
+    printf("   -w n   Issue up to 1 <= n <= %d instructions per cycle (default %d)\n", MAX_WIDTH, width);
+    printf("   -F n   Fetch takes 1 <= n <= %d cycles (default %d)\n", MAX_DEPTH, fetch_depth);
+    printf("   -E n   Execute takes 1 <= n <= %d cycles (default %d)\n", MAX_DEPTH, execute_depth);
+    printf("   -M n   Memory takes 1 <= n <= %d cycles (default %d)\n", MAX_DEPTH, memory_depth);
+    printf("   -m f   Check every program in manifest or directory f, one line each\n");
+    printf("   -j n   Run batch mode (-m) with n worker processes (default 1)\n");
+    exit(0);
+}
+
+
+/*********************************************************
+ * Part 2: This part contains the core simulator routines.
+ *********************************************************/
+
+/* Pending updates to state */
+word_t mem_addr = 0;
+word_t mem_data = 0;
+bool mem_write  = false;
+bool mem_read   = false;
+
+/* Output and input states of all pipeline registers */
+fetch_ptr fetch_output;
+decode_ptr decode_output;
+execute_ptr execute_output;
+memory_ptr memory_output;
+writeback_ptr writeback_output;
+
+fetch_ptr fetch_input;
+decode_ptr decode_input;
+execute_ptr execute_input;
+memory_ptr memory_input;
+writeback_ptr writeback_input;
+
+/* Registers between the sub-stages of fetch, execute and memory.
+   fetch_delay[k] holds a bundle fetched k+1 cycles ago on its way to
+   decode; execute_delay[k] and memory_delay[k] hold results the same
+   way */
+pipe_ptr fetch_delay[MAX_DEPTH - 1];
+pipe_ptr execute_delay[MAX_DEPTH - 1];
+pipe_ptr memory_delay[MAX_DEPTH - 1];
+
+/* Where fetch, execute and memory put their results: the first of
+   their sub-stages, or the next stage when they take one cycle */
+decode_ptr f_out;
+memory_ptr e_out;
+writeback_ptr m_out;
+
+/* Intermediate values */
+bool dmem_error;
+int d_count;       /* Instructions in decode */
+int d_issued;      /* Of those, issued to execute this cycle */
+issue_t d_cut;     /* Why the rest were held back */
+int wb_retired;    /* Instructions retired this cycle */
+
+/* The pipeline state */
+pipe_ptr fetch_state, decode_state, execute_state, memory_state, writeback_state;
+
+
+/*****************************************************************************
+ * pipeline control
+ *****************************************************************************/
+
+/* bubble stage (has effect at next update) */
+void sim_bubble_stage(stage_id_t stage)
+{
+    switch (stage)
+	{
+	case FETCH_STAGE     : fetch_state->op     = P_BUBBLE; break;
+	case DECODE_STAGE    : decode_state->op    = P_BUBBLE; break;
+	case EXECUTE_STAGE   : execute_state->op   = P_BUBBLE; break;
+	case MEMORY_STAGE    : memory_state->op    = P_BUBBLE; break;
+	case WRITEBACK_STAGE : writeback_state->op = P_BUBBLE; break;
+	}
+}
+
+/* stall stage (has effect at next update) */
+void sim_stall_stage(stage_id_t stage) {
+    switch (stage)
+	{
+	case FETCH_STAGE     : fetch_state->op     = P_STALL; break;
+	case DECODE_STAGE    : decode_state->op    = P_STALL; break;
+	case EXECUTE_STAGE   : execute_state->op   = P_STALL; break;
+	case MEMORY_STAGE    : memory_state->op    = P_STALL; break;
+	case WRITEBACK_STAGE : writeback_state->op = P_STALL; break;
+	}
+}
+
+static int initialized = 0;
+
+/* Fill in the bubble value of each pipe register */
+static void init_bubbles()
+{
+    int i;
+    bubble_fetch.predPC = 0;
+    bubble_fetch.status = STAT_AOK;
+    for (i = 0; i < MAX_WIDTH; i++) {
+        decode_slot *d = &bubble_decode.slot[i];
+        execute_slot *e = &bubble_execute.slot[i];
+        memory_slot *m = &bubble_memory.slot[i];
+        writeback_slot *w = &bubble_writeback.slot[i];
+        memset(d, 0, sizeof(*d));
+        d->icode = I_NOP;
+        d->ra = d->rb = REG_NONE;
+        d->status = STAT_BUB;
+        memset(e, 0, sizeof(*e));
+        e->icode = I_NOP;
+        e->srca = e->srcb = e->deste = e->destm = REG_NONE;
+        e->status = STAT_BUB;
+        memset(m, 0, sizeof(*m));
+        m->icode = I_NOP;
+        m->deste = m->destm = REG_NONE;
+        m->status = STAT_BUB;
+        memset(w, 0, sizeof(*w));
+        w->icode = I_NOP;
+        w->deste = w->destm = REG_NONE;
+        w->status = STAT_BUB;
+    }
+}
+
+/* Connect the stages to the current buffers of the pipe registers.  A
+   load swaps a register's input and output, so this follows every
+   update */
+static void connect_pipes()
+{
+    fetch_input      = fetch_state->input;
+    fetch_output     = fetch_state->output;
+
+    decode_input     = decode_state->input;
+    decode_output    = decode_state->output;
+
+    execute_input    = execute_state->input;
+    execute_output   = execute_state->output;
+
+    memory_input     = memory_state->input;
+    memory_output    = memory_state->output;
+
+    writeback_input  = writeback_state->input;
+    writeback_output = writeback_state->output;
+
+    f_out = fetch_depth > 1 ? fetch_delay[0]->input : decode_input;
+    e_out = execute_depth > 1 ? execute_delay[0]->input : memory_input;
+    m_out = memory_depth > 1 ? memory_delay[0]->input : writeback_input;
+}
+
+void sim_init()
+{
+    int k;
+
+    /* Create memory and register files */
+    initialized = 1;
+    mem = init_mem(MEM_SIZE);
+    reg = init_reg();
+    syms = new_symtab();
+
+    /* create 5 pipe registers */
+    init_bubbles();
+    fetch_state     = new_pipe(sizeof(fetch_ele), (void *) &bubble_fetch);
+    decode_state    = new_pipe(sizeof(decode_ele), (void *) &bubble_decode);
+    execute_state   = new_pipe(sizeof(execute_ele), (void *) &bubble_execute);
+    memory_state    = new_pipe(sizeof(memory_ele), (void *) &bubble_memory);
+    writeback_state = new_pipe(sizeof(writeback_ele), (void *) &bubble_writeback);
+
+    /* chain the sub-stages in front of them, and connect them all to
+       the pipeline stages */
+    for (k = 0; k < fetch_depth - 1; k++)
+        fetch_delay[k] = new_pipe(sizeof(decode_ele), (void *) &bubble_decode);
+    for (k = 0; k < execute_depth - 1; k++)
+        execute_delay[k] = new_pipe(sizeof(memory_ele), (void *) &bubble_memory);
+    for (k = 0; k < memory_depth - 1; k++)
+        memory_delay[k] = new_pipe(sizeof(writeback_ele), (void *) &bubble_writeback);
+    connect_pipes();
+
+    sim_reset();
+    clear_mem(mem);
+}
+
+void sim_reset()
+{
+    if (!initialized)
+	    sim_init();
+    clear_pipes();
+    clear_mem(reg);
+    starting_up = 1;
+    cycles = instructions = 0;
+    cc = DEFAULT_CC;
+    status = STAT_AOK;
+
+    mem_addr  = 0;
+    mem_data  = 0;
+    mem_write = false;
+    dmem_error = false;
+    diverged = false;
+    checked = 0;
+    memset(issue_count, 0, sizeof(issue_count));
+    memset(issue_cuts, 0, sizeof(issue_cuts));
+}
+
+static void print_state(word_t cyc) {
+    SIM_LOG("\nCycle = %lld. CC = %s, Stat = %s\n", cyc, cc_name(cc), stat_name(status));
+}
+
+static void print_fetch() {
+    SIM_LOG("F: predPC = %s\n", pc_name(syms, fetch_output->predPC));
+}
+
+static void print_decode(char *name, decode_ptr bundle) {
+    int i;
+    for (i = 0; i < width; i++) {
+        decode_slot *d = &bundle->slot[i];
+        SIM_LOG("%s[%d]: instr = %s, rA = %s, rB = %s, valC = 0x%llx, valP = 0x%llx, Stat = %s, Stage PC = %s\n",
+                name, i, iname(HPACK(d->icode, d->ifun)),
+                reg_name(d->ra), reg_name(d->rb), d->valc, d->valp,
+                stat_name(d->status), pc_name(syms, d->stage_pc));
+    }
+}
+
+static void print_execute() {
+    int i;
+    for (i = 0; i < width; i++) {
+        execute_slot *e = &execute_output->slot[i];
+        SIM_LOG("E[%d]: instr = %s, valC = 0x%llx, valA = 0x%llx, valB = 0x%llx\n   srcA = %s, srcB = %s, dstE = %s, dstM = %s, Stat = %s, Stage PC = %s\n",
+                i, iname(HPACK(e->icode, e->ifun)), e->valc, e->vala, e->valb,
+                reg_name(e->srca), reg_name(e->srcb),
+                reg_name(e->deste), reg_name(e->destm),
+                stat_name(e->status), pc_name(syms, e->stage_pc));
+    }
+}
+
+static void print_memory(char *name, memory_ptr bundle) {
+    int i;
+    for (i = 0; i < width; i++) {
+        memory_slot *m = &bundle->slot[i];
+        SIM_LOG("%s[%d]: instr = %s, Cnd = %d, valE = 0x%llx, valA = 0x%llx\n   dstE = %s, dstM = %s, Stat = %s, Stage PC = %s\n",
+                name, i, iname(HPACK(m->icode, m->ifun)), m->takebranch, m->vale, m->vala,
+                reg_name(m->deste), reg_name(m->destm),
+                stat_name(m->status), pc_name(syms, m->stage_pc));
+    }
+}
+
+static void print_writeback(char *name, writeback_ptr bundle) {
+    int i;
+    for (i = 0; i < width; i++) {
+        writeback_slot *w = &bundle->slot[i];
+        SIM_LOG("%s[%d]: instr = %s, valE = 0x%llx, valM = 0x%llx, dstE = %s, dstM = %s, Stat = %s, Stage PC = %s\n",
+                name, i, iname(HPACK(w->icode, w->ifun)), w->vale, w->valm,
+                reg_name(w->deste), reg_name(w->destm),
+                stat_name(w->status), pc_name(syms, w->stage_pc));
+    }
+}
+
+/* Text representation of status.  A sub-stage is named after its
+   stage and the cycle of the stage it is in, so E2 is the second
+   cycle of execute */
+void tty_report(word_t cyc) {
+    char name[8];
+    int k;
+
+    print_state(cyc);
+    print_fetch();
+    for (k = 0; k < fetch_depth - 1; k++) {
+        sprintf(name, "F%d", k + 2);
+        print_decode(name, fetch_delay[k]->output);
+    }
+    print_decode("D", decode_output);
+    print_execute();
+    for (k = 0; k < execute_depth - 1; k++) {
+        sprintf(name, "E%d", k + 2);
+        print_memory(name, execute_delay[k]->output);
+    }
+    print_memory("M", memory_output);
+    for (k = 0; k < memory_depth - 1; k++) {
+        sprintf(name, "M%d", k + 2);
+        print_writeback(name, memory_delay[k]->output);
+    }
+    print_writeback("W", writeback_output);
+}
+
+/* Address the ISA model is about to write, if its next instruction stores */
+static bool isa_write_addr(word_t *addrp)
+{
+    byte_t byte0 = 0;
+    byte_t byte1 = 0;
+    word_t valc = 0;
+    get_byte_val(isa_state->m, isa_state->pc, &byte0);
+    switch (GET_ICODE(byte0)) {
+    case I_RMMOVQ:
+        get_byte_val(isa_state->m, isa_state->pc + 1, &byte1);
+        get_word_val(isa_state->m, isa_state->pc + 2, &valc);
+        *addrp = valc + get_reg_val(isa_state->r, LO4(byte1));
+        return true;
+    case I_PUSHQ:
+    case I_CALL:
+        *addrp = get_reg_val(isa_state->r, REG_RSP) - 8;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Compare one stored word between the ISA model and the pipeline */
+static bool lockstep_word_match(word_t addr)
+{
+    word_t isa_val = 0;
+    word_t pipe_val = 0;
+    get_word_val(isa_state->m, addr, &isa_val);
+    get_word_val(mem, addr, &pipe_val);
+    if (isa_val == pipe_val)
+        return true;
+    if (verbosity > 0) {
+        printf("ISA Memory != Pipeline Memory\n");
+        printf("\tISA Memory\t\tPipeline Memory\n");
+        printf("0x%.4llx:\t0x%.16llx\t0x%.16llx\n", addr, isa_val, pipe_val);
+    }
+    return false;
+}
+
+/*
+ * rewritten - Has a younger store already written part of the word at
+ * addr?
+ * Stores write memory in the first cycle of memory, so with a deeper
+ * memory stage younger ones do so before an older store retires.
+ */
+static bool rewritten(word_t addr)
+{
+    int i, k;
+    for (k = 0; k < memory_depth - 1; k++) {
+        writeback_ptr bundle = memory_delay[k]->output;
+        for (i = 0; i < width; i++) {
+            writeback_slot *w = &bundle->slot[i];
+            if (w->status == STAT_AOK && w->vale + 8 > addr && addr + 8 > w->vale &&
+                (w->icode == I_RMMOVQ || w->icode == I_PUSHQ || w->icode == I_CALL))
+                return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * lockstep_check - Step the ISA model over the instruction w that has
+ * just retired and compare the state it changed.  Instructions later
+ * in the bundle have not written the register file yet.
+ */
+static void lockstep_check(writeback_slot *w)
+{
+    word_t pc = isa_state->pc;
+    word_t isa_addr = 0;
+    bool isa_store = isa_write_addr(&isa_addr);
+    bool match = true;
+
+    if (pc != w->stage_pc) {
+        match = false;
+        if (verbosity > 0)
+            printf("ISA PC (0x%llx) != Pipeline PC (0x%llx)\n", pc, w->stage_pc);
+    } else {
+        byte_t e = step_state(isa_state, NULL);
+        if (e != w->status) {
+            match = false;
+            if (verbosity > 0)
+                printf("ISA Status (%s) != Pipeline Status (%s)\n",
+                       stat_name(e), stat_name(w->status));
+        }
+        if (diff_reg(isa_state->r, reg, NULL)) {
+            match = false;
+            if (verbosity > 0) {
+                printf("ISA Register != Pipeline Register File\n");
+                printf("\tISA register\t\tPipeline Register\n");
+                diff_reg(isa_state->r, reg, stdout);
+            }
+        }
+        if (e == STAT_AOK && isa_store && !rewritten(isa_addr))
+            match = lockstep_word_match(isa_addr) && match;
+        if (w->status == STAT_AOK &&
+            (w->icode == I_RMMOVQ || w->icode == I_PUSHQ || w->icode == I_CALL) &&
+            !(isa_store && w->vale == isa_addr) && !rewritten(w->vale))
+            match = lockstep_word_match(w->vale) && match;
+    }
+    checked++;
+    if (!match) {
+        diverged = true;
+        if (verbosity > 0)
+            printf("Lockstep check diverges at instruction %lld, PC 0x%llx\n",
+                   checked, pc);
+    }
+}
+
+/*
+ * pass_delays - Move the bundles in a chain of n sub-stage registers
+ * on by one sub-stage, the last one into next.
+ */
+static void pass_delays(pipe_ptr *chain, int n, void *next)
+{
+    int k;
+    for (k = 0; k < n; k++)
+        memcpy(k < n - 1 ? chain[k + 1]->input : next, chain[k]->output, chain[k]->count);
+}
+
+/*
+ * sim_step_pipe - Simulate one cycle.  Returns the status of the last
+ * instruction to retire, or STAT_BUB if none did.
+ */
+static byte_t sim_step_pipe(word_t ccount)
+{
+    /* Update pipe registers */
+    update_pipes();
+    connect_pipes();
+    /* print status report in TTY mode */
+    if (dumpfile)
+        tty_report(ccount);
+    /* error checking */
+    if (fetch_state->op == P_ERROR)
+	    fetch_output->status = STAT_PIP;
+    if (decode_state->op == P_ERROR)
+	    decode_output->slot[0].status = STAT_PIP;
+    if (execute_state->op == P_ERROR)
+	    execute_output->slot[0].status = STAT_PIP;
+    if (memory_state->op == P_ERROR)
+	    memory_output->slot[0].status = STAT_PIP;
+    if (writeback_state->op == P_ERROR)
+	    writeback_output->slot[0].status = STAT_PIP;
+
+    /* As in PIPE, decode runs after execute and memory so that it can
+       forward the values they compute this cycle.  Their later
+       sub-stages only carry results along, so those are ready too */
+    do_writeback_stage();
+    do_memory_stage();
+    pass_delays(memory_delay, memory_depth - 1, writeback_input);
+    do_execute_stage();
+    pass_delays(execute_delay, execute_depth - 1, memory_input);
+    do_decode_stage();
+    do_fetch_stage();
+    pass_delays(fetch_delay, fetch_depth - 1, decode_input);
+
+    do_stall_check();
+
+    /* Performance monitoring */
+    if (wb_retired > 0) {
+        starting_up = 0;
+        instructions += wb_retired;
+        cycles++;
+    } else {
+	    if (!starting_up)
+	        cycles++;
+    }
+
+    return status;
+}
+
+/*
+  Run pipeline until one of following occurs:
+  - A status error is encountered in WB.
+  - max_instr instructions have completed through WB
+  - max_cycle cycles have been simulated
+
+  Return number of instructions executed.
+  if statusp nonnull, then will be set to status of final instruction
+  if ccp nonnull, then will be set to condition codes of final instruction
+*/
+word_t sim_run_pipe(word_t max_instr, word_t max_cycle, byte_t *statusp, cc_t *ccp)
+{
+    word_t ccount     = 0;
+    byte_t run_status = STAT_AOK;
+    while (instructions < max_instr && ccount < max_cycle) {
+        run_status = sim_step_pipe(ccount);
+        if (run_status != STAT_AOK && run_status != STAT_BUB)
+            break;
+        if (diverged)
+            break;
+        ccount++;
+    }
+    if (statusp)
+	    *statusp = run_status;
+    if (ccp)
+	    *ccp = cc;
+    return instructions;
+}
+
+/*********************************************************
+ * Part 3: The stages.  Each works through its bundle from the oldest
+ * slot to the youngest.
+ *********************************************************/
+
+/* Does the instruction use the data memory port? */
+static bool uses_memory(byte_t icode)
+{
+    return icode == I_RMMOVQ || icode == I_MRMOVQ || icode == I_CALL ||
+        icode == I_RET || icode == I_PUSHQ || icode == I_POPQ;
+}
+
+/* Does the instruction read the condition codes? */
+static bool reads_cc(byte_t icode, byte_t ifun)
+{
+    return (icode == I_JMP || icode == I_RRMOVQ) && ifun != C_YES;
+}
+
+/*
+ * fetch_instr - Fetch the instruction at pc into slot d.  Returns true
+ * if the bundle must end with it: fetch follows at most one change of
+ * control flow per cycle, and stops at errors and halt.
+ */
+static bool fetch_instr(word_t pc, decode_slot *d)
+{
+    byte_t byte0 = 0;
+    byte_t regids = 0;
+    bool imem_error = !get_byte_val(mem, pc, &byte0);
+
+    d->stage_pc = pc;
+    d->icode = GET_ICODE(byte0);
+    d->ifun = GET_FUN(byte0);
+    d->ra = REG_NONE;
+    d->rb = REG_NONE;
+    d->valc = 0;
+    d->valp = pc + 1;
+    d->status = STAT_AOK;
+
+    switch (byte0) {
+    case HPACK(I_NOP, F_NONE):
+    case HPACK(I_HALT, F_NONE):
+    case HPACK(I_RET, F_NONE):
+        break;
+
+    case HPACK(I_RRMOVQ, F_NONE):
+    case HPACK(I_RRMOVQ, C_LE):
+    case HPACK(I_RRMOVQ, C_L):
+    case HPACK(I_RRMOVQ, C_E):
+    case HPACK(I_RRMOVQ, C_NE):
+    case HPACK(I_RRMOVQ, C_GE):
+    case HPACK(I_RRMOVQ, C_G):
+    case HPACK(I_ALU, A_ADD):
+    case HPACK(I_ALU, A_SUB):
+    case HPACK(I_ALU, A_AND):
+    case HPACK(I_ALU, A_XOR):
+    case HPACK(I_PUSHQ, F_NONE):
+    case HPACK(I_POPQ, F_NONE):
+        imem_error |= !get_byte_val(mem, pc + 1, &regids);
+        d->ra = HI4(regids);
+        d->rb = LO4(regids);
+        d->valp = pc + 2;
+        break;
+
+    case HPACK(I_IRMOVQ, F_NONE):
+    case HPACK(I_RMMOVQ, F_NONE):
+    case HPACK(I_MRMOVQ, F_NONE):
+        imem_error |= !get_byte_val(mem, pc + 1, &regids);
+        d->ra = HI4(regids);
+        d->rb = LO4(regids);
+        imem_error |= !get_word_val(mem, pc + 2, &d->valc);
+        d->valp = pc + 10;
+        break;
+
+    case HPACK(I_JMP, C_YES):
+    case HPACK(I_JMP, C_LE):
+    case HPACK(I_JMP, C_L):
+    case HPACK(I_JMP, C_E):
+    case HPACK(I_JMP, C_NE):
+    case HPACK(I_JMP, C_GE):
+    case HPACK(I_JMP, C_G):
+    case HPACK(I_CALL, F_NONE):
+        imem_error |= !get_word_val(mem, pc + 1, &d->valc);
+        d->valp = pc + 9;
+        break;
+
+    default:
+        d->status = STAT_INS;
+        break;
+    }
+    if (imem_error)
+        d->status = STAT_ADR;
+
+    if (d->status == STAT_AOK)
+        SIM_LOG("\tFetch: f_pc = 0x%llx, f_instr = %s\n",
+                pc, iname(HPACK(d->icode, d->ifun)));
+    return d->status != STAT_AOK || d->icode == I_JMP || d->icode == I_CALL ||
+        d->icode == I_RET || d->icode == I_HALT;
+}
+
+/************************** Fetch stage ****************************
+ * Fetch up to width instructions in program order, predicting jumps
+ * and calls taken.  A ret leaving memory this cycle gives fetch its
+ * return address.
+ *******************************************************************/
+void do_fetch_stage()
+{
+    word_t pc;
+    int i;
+
+    for (i = 0; i < width; i++) {
+        writeback_slot *w = &writeback_input->slot[i];
+        if (w->icode == I_RET && w->status != STAT_BUB)
+            fetch_output->predPC = w->valm;
+    }
+    pc = fetch_output->predPC;
+
+    memcpy(f_out, &bubble_decode, sizeof(decode_ele));
+    fetch_input->status = STAT_AOK;
+    for (i = 0; i < width; i++) {
+        decode_slot *d = &f_out->slot[i];
+        bool last = fetch_instr(pc, d);
+        if (d->status == STAT_AOK && (d->icode == I_JMP || d->icode == I_CALL))
+            pc = d->valc;
+        else
+            pc = d->valp;
+        if (last)
+            break;
+    }
+    fetch_input->predPC = pc;
+}
+
+/* Register IDs the instruction in d reads and writes */
+static void decode_regs(decode_slot *d, execute_slot *e)
+{
+    switch (d->icode) {
+    case I_RRMOVQ: // aka CMOVQ
+        e->srca = d->ra;
+        e->deste = d->rb;
+        break;
+
+    case I_IRMOVQ:
+        e->deste = d->rb;
+        break;
+
+    case I_RMMOVQ:
+        e->srca = d->ra;
+        e->srcb = d->rb;
+        break;
+
+    case I_MRMOVQ:
+        e->srcb = d->rb;
+        e->destm = d->ra;
+        break;
+
+    case I_ALU:
+        e->srca = d->ra;
+        e->srcb = d->rb;
+        e->deste = d->rb;
+        break;
+
+    case I_CALL:
+        e->srcb = REG_RSP;
+        e->deste = REG_RSP;
+        break;
+
+    case I_RET:
+    case I_POPQ:
+        e->srca = REG_RSP;
+        e->srcb = REG_RSP;
+        e->deste = REG_RSP;
+        if (d->icode == I_POPQ)
+            e->destm = d->ra;
+        break;
+
+    case I_PUSHQ:
+        e->srca = d->ra;
+        e->srcb = REG_RSP;
+        e->deste = REG_RSP;
+        break;
+
+    default:
+        break;
+    }
+}
+
+/* Does instruction x write register r? */
+static bool writes(execute_slot *x, byte_t r)
+{
+    return r != REG_NONE && (x->deste == r || x->destm == r);
+}
+
+/*
+ * in_flight - Must e wait for an older instruction, still in execute
+ * or memory, that writes deste and destm?  A load has not read its
+ * value until it leaves memory, and no result can be forwarded before
+ * it leaves execute (vale_ready).
+ */
+static issue_t in_flight(execute_slot *e, byte_t deste, byte_t destm, bool vale_ready)
+{
+    if (destm != REG_NONE && (destm == e->srca || destm == e->srcb))
+        return ISSUE_LOAD_USE;
+    if (!vale_ready && deste != REG_NONE && (deste == e->srca || deste == e->srcb))
+        return ISSUE_ALU_USE;
+    return ISSUE_OK;
+}
+
+/*
+ * can_issue - Can the instruction in slot i of decode, with registers
+ * e, go to execute along with the older instructions issued before it?
+ */
+static issue_t can_issue(int i, execute_slot *e, bool mem_used, bool cc_set)
+{
+    issue_t cut = ISSUE_OK;
+    int j, k;
+
+    /* Results not ready by the end of this cycle.  Only the last
+       sub-stage of memory has loaded its value */
+    for (j = 0; j < width && cut == ISSUE_OK; j++) {
+        execute_slot *x = &execute_output->slot[j];
+        cut = in_flight(e, x->deste, x->destm, execute_depth == 1);
+        for (k = 0; k < execute_depth - 1 && cut == ISSUE_OK; k++) {
+            memory_slot *y = &((memory_ptr) execute_delay[k]->output)->slot[j];
+            cut = in_flight(e, y->deste, y->destm, k == execute_depth - 2);
+        }
+        if (memory_depth > 1 && cut == ISSUE_OK)
+            cut = in_flight(e, REG_NONE, memory_output->slot[j].destm, true);
+        for (k = 0; k < memory_depth - 2 && cut == ISSUE_OK; k++) {
+            writeback_slot *y = &((writeback_ptr) memory_delay[k]->output)->slot[j];
+            cut = in_flight(e, REG_NONE, y->destm, true);
+        }
+    }
+    if (cut != ISSUE_OK)
+        return cut;
+    /* Instructions in one bundle execute in the same cycle, so none can
+       use another's result */
+    for (j = 0; j < i; j++) {
+        execute_slot *x = &execute_input->slot[j];
+        if (writes(x, e->srca) || writes(x, e->srcb))
+            return ISSUE_DEPEND;
+    }
+    if (cc_set && reads_cc(e->icode, e->ifun))
+        return ISSUE_CC;
+    if (mem_used && uses_memory(e->icode))
+        return ISSUE_MEM;
+    return ISSUE_OK;
+}
+
+/*
+ * forward - Value of register r for an instruction in decode: the
+ * result of the youngest instruction leaving execute, in memory or
+ * leaving memory that writes it, else the register file.  Writeback
+ * has already updated the register file this cycle.  Instructions
+ * still in execute or loading never supply a value, since can_issue
+ * holds back their users.
+ */
+static word_t forward(byte_t r)
+{
+    int i, k;
+    if (r == REG_NONE)
+        return 0;
+    for (i = width - 1; i >= 0; i--) {
+        if (memory_input->slot[i].deste == r)
+            return memory_input->slot[i].vale;
+    }
+    if (memory_depth > 1) {
+        for (i = width - 1; i >= 0; i--) {
+            if (memory_output->slot[i].deste == r)
+                return memory_output->slot[i].vale;
+        }
+    }
+    for (k = 0; k < memory_depth - 2; k++) {
+        writeback_ptr w = memory_delay[k]->output;
+        for (i = width - 1; i >= 0; i--) {
+            if (w->slot[i].deste == r)
+                return w->slot[i].vale;
+        }
+    }
+    for (i = width - 1; i >= 0; i--) {
+        /* popq %rsp: the value loaded wins */
+        if (writeback_input->slot[i].destm == r)
+            return writeback_input->slot[i].valm;
+        if (writeback_input->slot[i].deste == r)
+            return writeback_input->slot[i].vale;
+    }
+    return get_reg_val(reg, r);
+}
+
+/*************************** Decode stage ***************************
+ * Issue the longest prefix of the bundle that can execute together.
+ * The rest stays in decode; do_stall_check holds it there.
+ *******************************************************************/
+void do_decode_stage()
+{
+    bool mem_used = false;
+    bool cc_set = false;
+    int i;
+
+    memcpy(execute_input, &bubble_execute, sizeof(execute_ele));
+    d_count = 0;
+    d_issued = 0;
+    d_cut = ISSUE_OK;
+    for (i = 0; i < width && decode_output->slot[i].status != STAT_BUB; i++)
+        d_count++;
+
+    for (i = 0; i < d_count; i++) {
+        decode_slot *d = &decode_output->slot[i];
+        execute_slot *e = &execute_input->slot[i];
+
+        e->status = d->status;
+        e->icode = d->icode;
+        e->ifun = d->ifun;
+        e->valc = d->valc;
+        e->stage_pc = d->stage_pc;
+        decode_regs(d, e);
+
+        d_cut = can_issue(i, e, mem_used, cc_set);
+        if (d_cut != ISSUE_OK) {
+            memcpy(e, &bubble_execute.slot[i], sizeof(execute_slot));
+            break;
+        }
+        e->vala = forward(e->srca);
+        e->valb = forward(e->srcb);
+        // return address forwarding
+        if (d->icode == I_CALL || d->icode == I_JMP)
+            e->vala = d->valp;
+        mem_used |= uses_memory(d->icode);
+        cc_set |= d->icode == I_ALU;
+        d_issued++;
+    }
+}
+
+/* Has an instruction in the bundle raised an exception? */
+static bool excepts(stat_t s)
+{
+    return s != STAT_AOK && s != STAT_BUB;
+}
+
+static bool memory_excepts(memory_ptr bundle)
+{
+    int i;
+    for (i = 0; i < width; i++)
+        if (excepts(bundle->slot[i].status))
+            return true;
+    return false;
+}
+
+static bool writeback_excepts(writeback_ptr bundle)
+{
+    int i;
+    for (i = 0; i < width; i++)
+        if (excepts(bundle->slot[i].status))
+            return true;
+    return false;
+}
+
+/* Has an instruction raised an exception in memory, this cycle or
+   earlier? */
+static bool exception_in_memory()
+{
+    int k;
+    if (writeback_excepts(m_out))
+        return true;
+    for (k = 0; k < memory_depth - 1; k++)
+        if (writeback_excepts(memory_delay[k]->output))
+            return true;
+    return false;
+}
+
+/************************** Execute stage **************************
+ * Instructions of a bundle are independent, so they can be executed
+ * in order.  None sets the condition codes while an older instruction
+ * has raised an exception in a later sub-stage of execute, in memory
+ * or in writeback.
+ *******************************************************************/
+void do_execute_stage()
+{
+    bool exception = exception_in_memory() || writeback_excepts(writeback_output);
+    int i, k, n = 0;
+
+    for (k = 0; k < execute_depth - 1; k++)
+        exception |= memory_excepts(execute_delay[k]->output);
+
+    for (i = 0; i < width; i++) {
+        execute_slot *e = &execute_output->slot[i];
+        memory_slot *m = &e_out->slot[i];
+        alu_t alufun = A_NONE;
+        word_t alua = 0, alub = 0;
+
+        m->status = e->status;
+        m->icode = e->icode;
+        m->ifun = e->ifun;
+        m->takebranch = false;
+        m->vale = 0;
+        m->vala = e->vala;
+        m->deste = e->deste;
+        m->destm = e->destm;
+        m->stage_pc = e->stage_pc;
+        if (e->status != STAT_BUB)
+            n++;
+        m->cc = cc;
+        if (e->status != STAT_AOK)
+            continue;
+
+        switch (e->icode) {
+        case I_RRMOVQ: // aka CMOVQ
+            m->vale = e->vala;
+            if (!cond_holds(cc, e->ifun))
+                m->deste = REG_NONE;
+            break;
+
+        case I_IRMOVQ:
+            m->vale = e->valc;
+            break;
+
+        case I_RMMOVQ:
+        case I_MRMOVQ:
+            m->vale = e->valb + e->valc;
+            break;
+
+        case I_ALU:
+            alufun = e->ifun;
+            alua = e->vala;
+            alub = e->valb;
+            m->vale = compute_alu(alufun, alua, alub);
+            SIM_LOG("\tExecute: ALU: %c 0x%llx 0x%llx --> 0x%llx\n",
+                    op_name(alufun), alua, alub, m->vale);
+            if (!exception) {
+                cc = compute_cc(alufun, alua, alub);
+                SIM_LOG("\tExecute: New cc=%s\n", cc_name(cc));
+            }
+            break;
+
+        case I_JMP:
+            m->takebranch = cond_holds(cc, e->ifun);
+            SIM_LOG("\tExecute: instr = %s, cc = %s, branch %staken\n",
+                    iname(HPACK(e->icode, e->ifun)), cc_name(cc),
+                    m->takebranch ? "" : "not ");
+            break;
+
+        case I_CALL:
+        case I_PUSHQ:
+            m->vale = e->valb - 8;
+            break;
+
+        case I_RET:
+        case I_POPQ:
+            m->vale = e->valb + 8;
+            break;
+
+        default:
+            break;
+        }
+        m->cc = cc;
+    }
+    issue_count[n]++;
+}
+
+/*************************** Memory stage **************************
+ * A bundle holds at most one memory access.  If it fails, the younger
+ * instructions of the bundle have already executed, so the condition
+ * codes go back to what they were after the access.
+ *******************************************************************/
+void do_memory_stage()
+{
+    int i;
+
+    for (i = 0; i < width; i++) {
+        memory_slot *m = &memory_output->slot[i];
+        writeback_slot *w = &m_out->slot[i];
+
+        mem_addr   = 0;
+        mem_data   = 0;
+        mem_write  = false;
+        mem_read   = false;
+        dmem_error = false;
+
+        w->status = m->status;
+        w->icode = m->icode;
+        w->ifun = m->ifun;
+        w->vale = m->vale;
+        w->valm = 0;
+        w->deste = m->deste;
+        w->destm = m->destm;
+        w->stage_pc = m->stage_pc;
+        if (m->status != STAT_AOK)
+            continue;
+
+        switch (m->icode) {
+        case I_HALT:
+            w->status = STAT_HLT;
+            break;
+
+        case I_RMMOVQ:
+        case I_CALL:
+        case I_PUSHQ:
+            mem_write = true;
+            mem_addr = m->vale;
+            mem_data = m->vala;
+            break;
+
+        case I_MRMOVQ:
+            mem_read = true;
+            mem_addr = m->vale;
+            break;
+
+        case I_RET:
+        case I_POPQ:
+            mem_read = true;
+            mem_addr = m->vala;
+            break;
+
+        default:
+            break;
+        }
+
+        if (mem_read) {
+            if ((dmem_error = !get_word_val(mem, mem_addr, &mem_data))) {
+                SIM_LOG("\tMemory: Couldn't Read from 0x%llx\n", mem_addr);
+            } else {
+                SIM_LOG("\tMemory: Read 0x%llx from 0x%llx\n", mem_data, mem_addr);
+            }
+            w->valm = mem_data;
+        }
+        if (mem_write) {
+            if ((dmem_error = !set_word_val(mem, mem_addr, mem_data))) {
+                SIM_LOG("\tMemory: Couldn't write to address 0x%llx\n", mem_addr);
+            } else {
+                SIM_LOG("\tMemory: Wrote 0x%llx to address 0x%llx\n", mem_data, mem_addr);
+            }
+        }
+        if (dmem_error) {
+            w->status = STAT_ADR;
+            cc = m->cc;
+        }
+    }
+}
+
+/*************************** Writeback stage ***********************
+ * Retire the bundle in order, stopping at the first instruction that
+ * raised an exception.
+ *******************************************************************/
+void do_writeback_stage()
+{
+    int i;
+
+    status = STAT_BUB;
+    wb_retired = 0;
+    for (i = 0; i < width; i++) {
+        writeback_slot *w = &writeback_output->slot[i];
+        if (w->status == STAT_BUB)
+            continue;
+        status = w->status;
+        if (w->deste != REG_NONE && w->status == STAT_AOK) {
+            SIM_LOG("\tWriteback: Wrote 0x%llx to register %s\n",
+                    w->vale, reg_name(w->deste));
+            set_reg_val(reg, w->deste, w->vale);
+        }
+        if (w->destm != REG_NONE && w->status == STAT_AOK) {
+            SIM_LOG("\tWriteback: Wrote 0x%llx to register %s\n",
+                    w->valm, reg_name(w->destm));
+            set_reg_val(reg, w->destm, w->valm);
+        }
+        wb_retired++;
+        if (lockstep && isa_state)
+            lockstep_check(w);
+        if (w->status != STAT_AOK || diverged)
+            break;
+    }
+}
+
+/*
+ * pipe_cntl - Choose the control operation for a pipe register from
+ * its stall and bubble signals.
+ */
+p_stat_t pipe_cntl(char *name, word_t stall, word_t bubble)
+{
+    if (stall) {
+        if (bubble) {
+            SIM_LOG("%s: Conflicting control signals for pipe register\n",
+                name);
+            return P_ERROR;
+        } else {
+            return P_STALL;
+        }
+    } else {
+	    return bubble ? P_BUBBLE : P_LOAD;
+    }
+}
+
+/* Is an instruction of kind icode anywhere in the bundle? */
+static bool decode_has(decode_ptr bundle, byte_t icode)
+{
+    int i;
+    for (i = 0; i < width; i++)
+        if (bundle->slot[i].icode == icode && bundle->slot[i].status != STAT_BUB)
+            return true;
+    return false;
+}
+
+static bool execute_has(execute_ptr bundle, byte_t icode)
+{
+    int i;
+    for (i = 0; i < width; i++)
+        if (bundle->slot[i].icode == icode && bundle->slot[i].status != STAT_BUB)
+            return true;
+    return false;
+}
+
+static bool memory_has(memory_ptr bundle, byte_t icode)
+{
+    int i;
+    for (i = 0; i < width; i++)
+        if (bundle->slot[i].icode == icode && bundle->slot[i].status != STAT_BUB)
+            return true;
+    return false;
+}
+
+static bool writeback_has(writeback_ptr bundle, byte_t icode)
+{
+    int i;
+    for (i = 0; i < width; i++)
+        if (bundle->slot[i].icode == icode && bundle->slot[i].status != STAT_BUB)
+            return true;
+    return false;
+}
+
+/* Is an instruction of kind icode between fetch and writeback? */
+static bool in_pipe(byte_t icode)
+{
+    int k;
+    for (k = 0; k < fetch_depth - 1; k++)
+        if (decode_has(fetch_delay[k]->output, icode))
+            return true;
+    for (k = 0; k < execute_depth - 1; k++)
+        if (memory_has(execute_delay[k]->output, icode))
+            return true;
+    for (k = 0; k < memory_depth - 1; k++)
+        if (writeback_has(memory_delay[k]->output, icode))
+            return true;
+    return decode_has(decode_output, icode) || execute_has(execute_output, icode) ||
+        memory_has(memory_output, icode);
+}
+
+/* Move the instructions decode held back to the front of its bundle */
+static void shift_decode(int n)
+{
+    int i;
+    for (i = 0; i < width; i++) {
+        if (i + n < width)
+            decode_output->slot[i] = decode_output->slot[i + n];
+        else
+            decode_output->slot[i] = bubble_decode.slot[i];
+    }
+}
+
+/******************** Pipeline Register Control ********************
+ * A mispredicted jump is always the last instruction of its bundle,
+ * so when it leaves execute it squashes everything in the earlier
+ * sub-stages of execute, in decode and in fetch.  Otherwise decode
+ * holds back what it did not issue, and fetch waits behind ret and
+ * halt as in PIPE.
+ *******************************************************************/
+void do_stall_check()
+{
+    pipe_ptr after_fetch = fetch_depth > 1 ? fetch_delay[0] : decode_state;
+    int i, k;
+
+    fetch_state->op = pipe_cntl("PC", false, false);
+    decode_state->op = pipe_cntl("ID", false, false);
+    execute_state->op = pipe_cntl("EX", false, false);
+    memory_state->op = pipe_cntl("MEM", false, false);
+    writeback_state->op = pipe_cntl("WB", false, false);
+    for (k = 0; k < fetch_depth - 1; k++)
+        fetch_delay[k]->op = pipe_cntl("IF", false, false);
+    for (k = 0; k < execute_depth - 1; k++)
+        execute_delay[k]->op = pipe_cntl("EX", false, false);
+    for (k = 0; k < memory_depth - 1; k++)
+        memory_delay[k]->op = pipe_cntl("MEM", false, false);
+
+    // an exception in memory keeps the next bundle from writing memory
+    if (exception_in_memory())
+        memory_state->op = pipe_cntl("MEM", false, true);
+
+    // mispredicted branch
+    for (i = 0; i < width; i++) {
+        memory_slot *m = &memory_input->slot[i];
+        if (m->icode == I_JMP && m->status == STAT_AOK && !m->takebranch) {
+            for (k = 0; k < fetch_depth - 1; k++)
+                fetch_delay[k]->op = pipe_cntl("IF", false, true);
+            decode_state->op = pipe_cntl("ID", false, true);
+            execute_state->op = pipe_cntl("EX", false, true);
+            for (k = 0; k < execute_depth - 1; k++)
+                execute_delay[k]->op = pipe_cntl("EX", false, true);
+            // undo the condition codes set by squashed instructions,
+            // unless an exception has already put them back
+            if (!exception_in_memory() && !writeback_excepts(writeback_output))
+                cc = m->cc;
+            // vala is valp i.e. fall through
+            fetch_input->predPC = m->vala;
+            return;
+        }
+    }
+
+    if (d_issued < d_count) {
+        // hold back the rest of the bundle
+        issue_cuts[d_cut]++;
+        fetch_state->op = pipe_cntl("PC", true, false);
+        for (k = 0; k < fetch_depth - 1; k++)
+            fetch_delay[k]->op = pipe_cntl("IF", true, false);
+        decode_state->op = pipe_cntl("ID", true, false);
+        if (d_issued > 0)
+            shift_decode(d_issued);
+    } else if (in_pipe(I_RET) || in_pipe(I_HALT)) {
+        fetch_state->op = pipe_cntl("PC", true, false);
+        after_fetch->op = pipe_cntl(after_fetch == decode_state ? "ID" : "IF", false, true);
+    }
+}
+
+/**************************************************************
+ * Part 4: Code for implementing pipelined processor simulators
+ **************************************************************/
+
+/******************************************************************************
+ *	defines
+ ******************************************************************************/
+
+#define MAX_STAGE (5 + 3*(MAX_DEPTH - 1))
+
+/******************************************************************************
+ *	static variables
+ ******************************************************************************/
+
+static pipe_ptr pipes[MAX_STAGE];
+static int pipe_count = 0;
+
+/******************************************************************************
+ *	function definitions
+ ******************************************************************************/
+
+/* Create new pipe with count bytes of state */
+/* bubble_val indicates state corresponding to pipeline bubble */
+pipe_ptr new_pipe(int count, void *bubble_val)
+{
+    pipe_ptr result = (pipe_ptr) malloc(sizeof(pipe_ele));
+    result->output = malloc(count);
+    result->input = malloc(count);
+    memcpy(result->output, bubble_val, count);
+    memcpy(result->input, bubble_val, count);
+    result->count = count;
+    result->op = P_LOAD;
+    result->bubble_val = bubble_val;
+    pipes[pipe_count++] = result;
+    return result;
+}
+
+/* Update all pipes */
+void update_pipes()
+{
+    int s;
+    void *tmp;
+    for (s = 0; s < pipe_count; s++) {
+        pipe_ptr p = pipes[s];
+        switch (p->op) {
+        case P_BUBBLE:
+        case P_ERROR:
+            /* insert a bubble into the next stage */
+            memcpy(p->output, p->bubble_val, p->count);
+            break;
+        case P_LOAD:
+            /* the state calculated by the previous stage becomes the
+               output, and the old output is written over next cycle */
+            tmp = p->output;
+            p->output = p->input;
+            p->input = tmp;
+            break;
+        case P_STALL:
+        default:
+            /* do nothing: next stage gets same instr again */
+            ;
+        }
+        if (p->op != P_ERROR)
+            p->op = P_LOAD;
+    }
+}
+
+/* Set all pipes to bubble values */
+void clear_pipes()
+{
+    int s;
+    for (s = 0; s < pipe_count; s++) {
+        pipe_ptr p = pipes[s];
+        memcpy(p->output, p->bubble_val, p->count);
+        memcpy(p->input, p->bubble_val, p->count);
+        p->op = P_LOAD;
+    }
+}
+
+/*************** Bubbled version of stages *************/
+
+/* Filled in by init_bubbles */
+fetch_ele bubble_fetch;
+decode_ele bubble_decode;
+execute_ele bubble_execute;
+memory_ele bubble_memory;
+writeback_ele bubble_writeback;
+
+/*
+ * sim_log dumps a formatted string to the dumpfile, if it exists
+ * accepts variable argument list
+ */
+void sim_log( const char *format, ... ) {
+    if (dumpfile) {
+        va_list arg;
+        va_start( arg, format );
+        vfprintf( dumpfile, format, arg );
+        va_end( arg );
+    }
+}
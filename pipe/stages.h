@@ -17,18 +17,20 @@ typedef struct {
     byte_t ifun;    /* ALU/JMP qualifier */
     byte_t ra; /* Register ra ID */
     byte_t rb; /* Register rb ID */
-    word_t valc;  /* Instruction word encoding immediate data */
+    word_t valc;  /* Instruction word encoding immediate data,
+                     or the return address predicted for ret */
     word_t valp; /* Incremented program counter */
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    bool predtaken;  /* Jump predicted taken, or ret predicted, at fetch */
 } decode_ele, *decode_ptr;
 
 /* ID/EX Pipe Register */
 typedef struct {
     byte_t icode;        /* Instruction code */
     byte_t ifun;        /* ALU/JMP qualifier */
-    word_t valc;        /* Immediate data */
+    word_t valc;        /* Immediate data, or predicted return address */
     word_t vala;        /* valA */
     word_t valb;        /* valB */
     byte_t srca;  /* Source Reg ID for valA */
@@ -38,6 +40,7 @@ typedef struct {
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    bool predtaken;  /* Jump predicted taken, or ret predicted, at fetch */
 } execute_ele, *execute_ptr;
 
 /* EX/MEM Pipe Register */
@@ -53,6 +56,8 @@ typedef struct {
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    bool predtaken;  /* Ret was predicted by the return address stack */
+    word_t predpc;   /* Return address it predicted */
 } memory_ele, *memory_ptr;
 
 /* Mem/WB Pipe Register */
@@ -79,13 +84,13 @@ extern writeback_ele bubble_writeback;
 /************ Function declarations *******************/
 
 /* Stage functions */
-void do_fetch_stage();
-void do_decode_stage();  
-void do_execute_stage();
-void do_memory_stage();
-void do_writeback_stage();
+void do_fetch_stage(sim_ctx_ptr ctx);
+void do_decode_stage(sim_ctx_ptr ctx);
+void do_execute_stage(sim_ctx_ptr ctx);
+void do_memory_stage(sim_ctx_ptr ctx);
+void do_writeback_stage(sim_ctx_ptr ctx);
 
 /* Set stalling conditions for different stages */
-void do_stall_check();
+void do_stall_check(sim_ctx_ptr ctx);
 
 
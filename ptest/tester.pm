@@ -2,9 +2,6 @@
 
 # Common declarations for testing code
 
-# Where's the assembler?
-$yas = "../misc/yas";
-
 # Which simulator is being tested?
 $sim = "../pipe/psim";
 
@@ -33,6 +30,9 @@ $vtest = "../verilog/test-sim.pl";
 
 $testcache = 0;
 
+# Number of batch workers; 0 runs the simulator once per test
+$batchjobs = 0;
+
 $tcount = 0;
 $ecount = 0;
 $pecount = 0;
@@ -53,21 +53,33 @@ sub run_sim_test
 {
     local ($tname) = @_;
     local ($cache) = $_[1];
-    system "$yas $tname.ys" || die "Can't open file $tname.ys\n";
+    # The simulators assemble .ys files themselves
+    if ($batchjobs) {
+	# Checked by run_batches once every test has been generated
+	push @{$batch{$cache}}, $tname;
+	return;
+    }
     local $result = ``;
     if (testcache) {
-        $result = `$sim -v 0 $cache $tname.yo`;
+        $result = `$sim -v 0 $cache $tname.ys`;
     } else {
-        $result = `$sim -v 0 $tname.yo`;
+        $result = `$sim -v 0 $tname.ys`;
     }
-    if (!($result =~ "Succeed")) {
+    if (&check_result($tname, $cache, $result)) {
+	system "rm $tname.ys";
+    } elsif (!($outputdir eq ".")) {
+	system "mv $tname.ys $outputdir";
+    }
+}
+
+# Score one simulator result.  Returns true if the ISA check succeeded
+sub check_result
+{
+    local ($tname, $cache, $result) = @_;
+    local $pass = ($result =~ "Succeed");
+    if (!$pass) {
 	print "Test $tname $cache failed\n";
 	$ecount++;
-	if (!($outputdir eq ".")) {
-	  system "mv $tname.ys $outputdir";
-	}
-    } else {
-	system "rm $tname.ys";
     }
     if ($gen_perf) {
 	$_ = $result;
@@ -90,7 +102,39 @@ sub run_sim_test
 	}
     }
     $tcount++;
-    system "rm $tname.yo";
+    return $pass;
+}
+
+# In batch mode, run all the queued tests with one simulator process per
+# cache configuration
+sub run_batches
+{
+    local %failed = ();
+    local %names = ();
+    foreach $cache (sort keys %batch) {
+	open (MFILE, ">batch-manifest") || die "Can't write to batch-manifest\n";
+	foreach $tname (@{$batch{$cache}}) {
+	    print MFILE "$tname.ys\n";
+	}
+	close MFILE;
+	local @lines = `$sim $cache -m batch-manifest -j $batchjobs`;
+	foreach $tname (@{$batch{$cache}}) {
+	    local ($line) = grep(/^\Q$tname\E\.ys:/, @lines);
+	    $names{$tname} = 1;
+	    if (!&check_result($tname, $cache, $line)) {
+		$failed{$tname} = 1;
+	    }
+	}
+	system "rm batch-manifest";
+    }
+    foreach $tname (sort keys %names) {
+	if (!$failed{$tname}) {
+	    system "rm $tname.ys";
+	} elsif (!($outputdir eq ".")) {
+	    system "mv $tname.ys $outputdir";
+	}
+    }
+    %batch = ();
 }
 
 sub run_vlog_test
@@ -126,6 +170,9 @@ sub run_vlog_test
 
 sub test_stat
 {
+    if ($batchjobs) {
+	&run_batches();
+    }
     if ($ecount == 0) {
 	print "  All $tcount ISA Checks Succeed\n";
     } else {
@@ -142,7 +189,7 @@ sub test_stat
 
 sub cmdline {
     # parse command line arguments
-    getopts('his:Pp:d:Vm:c');
+    getopts('his:Pp:d:Vm:cj:');
 
     if ($opt_h) {
         print STDERR "Usage $argv[0] [-h] [-i] [-s <sim>] [-P] [-p <pfile>]\n";
@@ -155,6 +202,7 @@ sub cmdline {
         print STDERR "   -V       test Verilog implementation\n";
         print STDERR "   -m <model> Model for Verilog\n";
         print STDERR "   -c       if cache parameters are to be passed\n";
+        print STDERR "   -j <n>   Check all tests in one batch run with n workers\n";
         die "\n";
     }
 
@@ -162,6 +210,10 @@ sub cmdline {
     $testcache = 1;
     }
 
+    if ($opt_j) {
+	$batchjobs = $opt_j;
+    }
+
     if ($opt_i) {
 	$testiaddq = 1;
     }
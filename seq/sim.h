@@ -8,50 +8,75 @@
 #define GET_RB(r) LO4(r)
 
 
-/************ Global state declaration ****************/
-
-/* Both instruction and data memory */
-extern mem_t mem;
-
-/* Register file */
-extern mem_t reg;
-/* Condition code register */
-extern cc_t cc;
-/* Program counter */
-extern word_t pc;
-
-/* Intermdiate stage values that must be used by control functions */
-extern byte_t imem_icode;
-extern byte_t imem_ifun;
-extern byte_t icode;
-extern word_t ifun;
-extern word_t ra;
-extern word_t rb;
-extern word_t valc;
-extern word_t valp;
-extern bool imem_error;
-extern bool instr_valid;
-extern word_t vala;
-extern word_t valb;
-extern word_t vale;
-extern bool bcond;
-extern bool cond;
-extern word_t valm;
-extern bool dmem_error;
-extern byte_t status;
-
-/* Log file */
-extern FILE *dumpfile;
+/************ Simulator state ****************/
+
+/* The complete state of one simulation.  Nothing the processor changes
+   lives outside it, so separate contexts can run in separate threads */
+typedef struct sim_ctx {
+    /* Both instruction and data memory */
+    mem_t mem;
+    /* Labels and source lines of the loaded program */
+    symtab_t syms;
+    /* Copies of mem and reg at the start, for diff display */
+    mem_t mem0, reg0;
+
+    /* Register file */
+    mem_t reg;
+    /* Condition code register */
+    cc_t cc;
+    /* Input to condition code register */
+    cc_t cc_in;
+    /* Program counter */
+    word_t pc;
+    /* Input to program counter */
+    word_t pc_in;
+
+    /* Intermediate stage values */
+    byte_t icode;
+    word_t ifun;
+    byte_t instr;
+    word_t ra;
+    word_t rb;
+    word_t valc;
+    word_t valp;
+    bool imem_error;
+    bool instr_invalid;
+
+    word_t srcA;
+    word_t srcB;
+    word_t destE;
+    word_t destM;
+    word_t vala;
+    word_t valb;
+    word_t vale;
+
+    bool bcond;
+    bool cond;
+    word_t valm;
+    bool dmem_error;
+
+    bool mem_write;
+    word_t mem_addr;
+    word_t mem_data;
+    byte_t status;
+
+    /* Log file */
+    FILE *dumpfile;
+} sim_ctx, *sim_ctx_ptr;
 
 
 /* Sets the simulator name (called from main routine in HCL file) */
 void set_simname(char *name);
 
-/* Initialize simulator */
-void sim_init();
+/* Create a simulator with its own memory and registers, reset and
+   ready to load a program */
+sim_ctx_ptr new_sim();
+
+/* Free a simulator and everything it holds */
+void free_sim(sim_ctx_ptr ctx);
 
 /* Reset simulator state, including register, instruction, and data memories */
-void sim_reset();
+void sim_reset(sim_ctx_ptr ctx);
 
 /*
   Run processor until one of following occurs:
@@ -62,15 +87,27 @@ void sim_reset();
   if statusp nonnull, then will be set to status of final instruction
   if ccp nonnull, then will be set to condition codes of final instruction
 */
-word_t sim_run(word_t max_instr, byte_t *statusp, cc_t *ccp);
+word_t sim_run(sim_ctx_ptr ctx, word_t max_instr, byte_t *statusp, cc_t *ccp);
 
 /* If dumpfile set nonNULL, lots of status info printed out */
-void sim_set_dumpfile(FILE *file);
+void sim_set_dumpfile(sim_ctx_ptr ctx, FILE *file);
+
+/*
+ * sim_log dumps a formatted string to the context's dumpfile, if it
+ * has one.  accepts variable argument list
+ */
+void sim_log(sim_ctx_ptr ctx, const char *format, ... );
 
 /*
- * sim_log dumps a formatted string to the dumpfile, if it exists
- * accepts variable argument list
+ * SIM_LOG(ctx, format, ...) is how the simulator traces.  It tests
+ * the dumpfile before evaluating its arguments, so a run without a
+ * trace does not pay for formatting names and addresses.  Building
+ * with -DNO_SIM_LOG compiles the trace out altogether.
  */
-void sim_log( const char *format, ... );
+#ifdef NO_SIM_LOG
+#define SIM_LOG(ctx, ...) ((void) (0 && (sim_log(ctx, __VA_ARGS__), 0)))
+#else
+#define SIM_LOG(ctx, ...) ((ctx)->dumpfile ? sim_log(ctx, __VA_ARGS__) : (void) 0)
+#endif
 
 								       
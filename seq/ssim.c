@@ -15,6 +15,10 @@
 #include <string.h>
 #include <assert.h>
 #include "isa.h"
+#include "asm.h"
+#include "rewind.h"
+#include "script.h"
+#include "breaks.h"
 #include "sim.h"
 
 /***************
@@ -28,9 +32,7 @@ char *object_filename;   /* The input object file name. */
 FILE *object_file;       /* Input file handle */
 int verbosity = 2;    /* Verbosity level [TTY only] (-v) */
 word_t instr_limit = 10000; /* Instruction limit [TTY only] (-l) */
-
-/* keep a copy of mem and reg for diff display */
-mem_t mem0, reg0;
+char *script_filename = NULL; /* Interactive commands answered in JSON, - for stdin (-x) */
 
 /***************************
  * Begin function prototypes
@@ -38,7 +40,7 @@ mem_t mem0, reg0;
 
 static void usage(char *name);           /* Print helpful usage message */
 static void run_tty_sim();               /* Run simulator in TTY mode */
-static void sim_interactive();
+static void sim_interactive(FILE *in, bool script);
 
 /*************************
  * End function prototypes
@@ -64,7 +66,7 @@ int sim_main(int argc, char **argv)
     int interactive = 0;
 
     /* Parse the command line arguments */
-    while ((c = getopt(argc, argv, "ihtl:v:")) != -1) {
+    while ((c = getopt(argc, argv, "ihtl:v:x:")) != -1) {
 	switch(c) {
 	case 'h':
 	    usage(argv[0]);
@@ -82,6 +84,9 @@ int sim_main(int argc, char **argv)
     case 'i':
         interactive = true;
         break;
+    case 'x':
+        script_filename = optarg;
+        break;
 	default:
 	    printf("Invalid option '%c'\n", c);
 	    usage(argv[0]);
@@ -117,8 +122,15 @@ int sim_main(int argc, char **argv)
         exit(1);
     }
 
-    if(interactive) {
-        sim_interactive();
+    if (script_filename) {
+        FILE *script = strcmp(script_filename, "-") ? fopen(script_filename, "r") : stdin;
+        if (!script) {
+            fprintf(stderr, "Couldn't open script %s\n", script_filename);
+            exit(1);
+        }
+        sim_interactive(script, true);
+    } else if(interactive) {
+        sim_interactive(stdin, false);
     } else {
         run_tty_sim();
     }
@@ -136,20 +148,19 @@ int main(int argc, char *argv[]) {return sim_main(argc,argv);}
 static void run_tty_sim()
 {
     word_t icount = 0;
-    status = STAT_AOK;
     cc_t result_cc = 0;
     word_t byte_cnt = 0;
     state_ptr isa_state = NULL;
+    sim_ctx_ptr ctx = new_sim();
 
     /* Initializations */
     if (verbosity >= 2)
-	sim_set_dumpfile(stdout);
-    sim_init();
+	sim_set_dumpfile(ctx, stdout);
 
     /* Emit simulator name */
     printf("%s\n", simname);
 
-    byte_cnt = load_mem(mem, object_file, 1);
+    byte_cnt = load_code(ctx->mem, ctx->syms, object_filename, object_file, 1);
     if (byte_cnt == 0) {
 	fprintf(stderr, "No lines of code found\n");
 	exit(1);
@@ -161,22 +172,22 @@ static void run_tty_sim()
 	isa_state = new_state(0);
 	free_mem(isa_state->r);
 	free_mem(isa_state->m);
-	isa_state->m = copy_mem(mem);
-	isa_state->r = copy_mem(reg);
-	isa_state->cc = cc;
+	isa_state->m = copy_mem(ctx->mem);
+	isa_state->r = copy_mem(ctx->reg);
+	isa_state->cc = ctx->cc;
 
-    mem0 = copy_mem(mem);
-    reg0 = copy_mem(reg);
+    ctx->mem0 = copy_mem(ctx->mem);
+    ctx->reg0 = copy_mem(ctx->reg);
 
-    icount = sim_run(instr_limit, &status, &result_cc);
+    icount = sim_run(ctx, instr_limit, &ctx->status, &result_cc);
     if (verbosity > 0) {
         printf("%lld instructions executed\n", icount);
-        printf("Status = %s\n", stat_name(status));
+        printf("Status = %s\n", stat_name(ctx->status));
         printf("Condition Codes: %s\n", cc_name(result_cc));
         printf("Changed Register State:\n");
-        diff_reg(reg0, reg, stdout);
+        diff_reg(ctx->reg0, ctx->reg, stdout);
         printf("Changed Memory State:\n");
-        diff_mem(mem0, mem, stdout);
+        diff_mem(ctx->mem0, ctx->mem, stdout);
     }
 
 	byte_t e = STAT_AOK;
@@ -187,18 +198,18 @@ static void run_tty_sim()
 	    e = step_state(isa_state, stdout);
 	}
 
-	if (diff_reg(isa_state->r, reg, NULL)) {
+	if (diff_reg(isa_state->r, ctx->reg, NULL)) {
 	    match = false;
 	    if (verbosity > 0) {
             printf("ISA Register != Pipeline Register File\n");
-            diff_reg(isa_state->r, reg, stdout);
+            diff_reg(isa_state->r, ctx->reg, stdout);
 	    }
 	}
-	if (diff_mem(isa_state->m, mem, NULL)) {
+	if (diff_mem(isa_state->m, ctx->mem, NULL)) {
 	    match = false;
 	    if (verbosity > 0) {
             printf("ISA Memory != Pipeline Memory\n");
-            diff_mem(isa_state->m, mem, stdout);
+            diff_mem(isa_state->m, ctx->mem, stdout);
 	    }
 	}
 	if (isa_state->cc != result_cc) {
@@ -222,11 +233,12 @@ static void run_tty_sim()
  */
 static void usage(char *name)
 {
-    printf("Usage: %s [-hi] [-l m] [-v n] file.yo\n", name);
+    printf("Usage: %s [-hi] [-l m] [-v n] [-x f] file.yo\n", name);
     printf("   -h     Print this message\n");
     printf("   -l m   Set instruction limit to m [non interactive mode only] (default %lld)\n", instr_limit);
     printf("   -v n   Set verbosity level to 0 <= n <= 3 (default %d)\n", verbosity);
     printf("   -i     Runs the simulator in interactive mode\n");
+    printf("   -x f   Run the interactive commands in file f (- for stdin), answering each with a line of JSON\n");
     exit(0);
 }
 
@@ -237,111 +249,66 @@ static void usage(char *name)
  * You only need to modify function sim_step()
  *********************************************************/
 
-/**********************
- * Begin Part 2 Globals
- **********************/
-
-/*
- * Variables related to hardware units in the processor
- */
-mem_t mem;  /* Instruction and data memory */
-
-/* Other processor state */
-mem_t reg;               /* Register file */
-cc_t cc = DEFAULT_CC;    /* Condition code register */
-cc_t cc_in = DEFAULT_CC; /* Input to condition code register */
-
-/* Program Counter */
-word_t pc = 0; /* Program counter value */
-word_t pc_in = 0;/* Input to program counter */
-
-/* Intermediate values */
-byte_t imem_icode = I_NOP;
-byte_t imem_ifun = F_NONE;
-byte_t icode = I_NOP;
-word_t ifun = 0;
-byte_t instr = HPACK(I_NOP, F_NONE);
-word_t ra = REG_NONE;
-word_t rb = REG_NONE;
-word_t valc = 0;
-word_t valp = 0;
-bool imem_error;
-bool instr_invalid;
-
-word_t srcA = REG_NONE;
-word_t srcB = REG_NONE;
-word_t destE = REG_NONE;
-word_t destM = REG_NONE;
-word_t vala = 0;
-word_t valb = 0;
-word_t vale = 0;
-
-bool bcond = false;
-bool cond = false;
-word_t valm = 0;
-bool dmem_error;
-
-bool mem_write = false;
-word_t mem_addr = 0;
-word_t mem_data = 0;
-byte_t status = STAT_AOK;
-
-/* Log file */
-FILE *dumpfile = NULL;
-
-
-/********************
- * End Part 2 Globals
- ********************/
-
-
-static int initialized = 0;
-void sim_init()
+sim_ctx_ptr new_sim()
 {
+    sim_ctx_ptr ctx = calloc(1, sizeof(sim_ctx));
 
     /* Create memory and register files */
-    initialized = 1;
-    mem = init_mem(MEM_SIZE);
-    reg = init_reg();
-    sim_reset();
-    clear_mem(mem);
+    ctx->mem = init_mem(MEM_SIZE);
+    ctx->reg = init_reg();
+    ctx->syms = new_symtab();
+    sim_reset(ctx);
+    clear_mem(ctx->mem);
+    return ctx;
+}
+
+void free_sim(sim_ctx_ptr ctx)
+{
+    if (ctx->mem0)
+        free_mem(ctx->mem0);
+    if (ctx->reg0)
+        free_mem(ctx->reg0);
+    free_symtab(ctx->syms);
+    free_reg(ctx->reg);
+    free_mem(ctx->mem);
+    free(ctx);
 }
 
-void sim_reset()
+void sim_reset(sim_ctx_ptr ctx)
 {
-    if (!initialized)
-	sim_init();
-    clear_mem(reg);
-
-	pc_in = 0;
-    cc = DEFAULT_CC;
-    cc_in = DEFAULT_CC;
-    destE = REG_NONE;
-    destM = REG_NONE;
-    mem_write = false;
-    mem_addr = 0;
-    mem_data = 0;
+    clear_mem(ctx->reg);
+
+    ctx->pc = 0;
+	ctx->pc_in = 0;
+    ctx->cc = DEFAULT_CC;
+    ctx->cc_in = DEFAULT_CC;
+    ctx->destE = REG_NONE;
+    ctx->destM = REG_NONE;
+    ctx->mem_write = false;
+    ctx->mem_addr = 0;
+    ctx->mem_data = 0;
+    ctx->status = STAT_AOK;
 
     /* Reset intermediate values to clear display */
-    icode = I_NOP;
-    ifun = 0;
-    instr = HPACK(I_NOP, F_NONE);
-    ra = REG_NONE;
-    rb = REG_NONE;
-    valc = 0;
-    valp = 0;
-
-    srcA = REG_NONE;
-    srcB = REG_NONE;
-    destE = REG_NONE;
-    destM = REG_NONE;
-    vala = 0;
-    valb = 0;
-    vale = 0;
-
-    cond = false;
-    bcond = false;
-    valm = 0;
+    ctx->icode = I_NOP;
+    ctx->ifun = 0;
+    ctx->instr = HPACK(I_NOP, F_NONE);
+    ctx->ra = REG_NONE;
+    ctx->rb = REG_NONE;
+    ctx->valc = 0;
+    ctx->valp = 0;
+
+    ctx->srcA = REG_NONE;
+    ctx->srcB = REG_NONE;
+    ctx->destE = REG_NONE;
+    ctx->destM = REG_NONE;
+    ctx->vala = 0;
+    ctx->valb = 0;
+    ctx->vale = 0;
+
+    ctx->cond = false;
+    ctx->bcond = false;
+    ctx->valm = 0;
 }
 
 /*****************************************************************
@@ -349,31 +316,31 @@ void sim_reset()
  * It executes one instruction but split it into multiple stages.
  * For each stage, you should update the corresponding intermediate
  * values. At the end of this function, you should make sure the
- * global state values [mem, reg, cc, pc] are updated correctly,
+ * state values [mem, reg, cc, pc] in ctx are updated correctly,
  * and then return the correct status.
  *****************************************************************/
 
-static byte_t sim_step()
+static byte_t sim_step(sim_ctx_ptr ctx)
 {
-    status = STAT_AOK;
-    instr_invalid = imem_error = dmem_error = false;
+    ctx->status = STAT_AOK;
+    ctx->instr_invalid = ctx->imem_error = ctx->dmem_error = false;
 
     /*********************** Fetch stage ************************/
 
 		byte_t tempB;
-		imem_error |= !get_byte_val(mem, pc, &instr);
-		icode = HI4(instr);
-        ifun = LO4(instr);
-		ra = REG_NONE;
-		rb = REG_NONE;
-		valc = 0;
-
-		switch (instr) {
+		ctx->imem_error |= !get_byte_val(ctx->mem, ctx->pc, &ctx->instr);
+		ctx->icode = HI4(ctx->instr);
+        ctx->ifun = LO4(ctx->instr);
+		ctx->ra = REG_NONE;
+		ctx->rb = REG_NONE;
+		ctx->valc = 0;
+
+		switch (ctx->instr) {
 			case HPACK(I_NOP, F_NONE):
-				valp = pc + 1;
+				ctx->valp = ctx->pc + 1;
 				break;
 			case HPACK(I_HALT, F_NONE):
-				valp = pc + 1;
+				ctx->valp = ctx->pc + 1;
 				break;
 
 			case HPACK(I_RRMOVQ, F_NONE):
@@ -383,43 +350,43 @@ static byte_t sim_step()
 			case HPACK(I_RRMOVQ, C_NE):
 			case HPACK(I_RRMOVQ, C_GE):
 			case HPACK(I_RRMOVQ, C_G):
-				imem_error |= !get_byte_val(mem, pc + 1, &tempB);
-				ra = HI4(tempB);
-				rb = LO4(tempB);
-				valp = pc + 2;
+				ctx->imem_error |= !get_byte_val(ctx->mem, ctx->pc + 1, &tempB);
+				ctx->ra = HI4(tempB);
+				ctx->rb = LO4(tempB);
+				ctx->valp = ctx->pc + 2;
 				break;
 
 			case HPACK(I_IRMOVQ, F_NONE):
-				imem_error |= !get_byte_val(mem, pc + 1, &tempB);
-				rb = LO4(tempB);
-				imem_error |= !get_word_val(mem, pc + 2, &valc);
-				valp = pc + 10;
+				ctx->imem_error |= !get_byte_val(ctx->mem, ctx->pc + 1, &tempB);
+				ctx->rb = LO4(tempB);
+				ctx->imem_error |= !get_word_val(ctx->mem, ctx->pc + 2, &ctx->valc);
+				ctx->valp = ctx->pc + 10;
 				break;
 
 			case HPACK(I_RMMOVQ, F_NONE):
-				imem_error |= !get_byte_val(mem, pc + 1, &tempB);
-				ra = HI4(tempB);
-				rb = LO4(tempB);
-				imem_error |= !get_word_val(mem, pc + 2, &valc);
-				valp = pc + 10;
+				ctx->imem_error |= !get_byte_val(ctx->mem, ctx->pc + 1, &tempB);
+				ctx->ra = HI4(tempB);
+				ctx->rb = LO4(tempB);
+				ctx->imem_error |= !get_word_val(ctx->mem, ctx->pc + 2, &ctx->valc);
+				ctx->valp = ctx->pc + 10;
 				break;
 
 			case HPACK(I_MRMOVQ, F_NONE):
-				imem_error |= !get_byte_val(mem, pc + 1, &tempB);
-				ra = HI4(tempB);
-				rb = LO4(tempB);
-				imem_error |= !get_word_val(mem, pc + 2, &valc);
-				valp = pc + 10;
+				ctx->imem_error |= !get_byte_val(ctx->mem, ctx->pc + 1, &tempB);
+				ctx->ra = HI4(tempB);
+				ctx->rb = LO4(tempB);
+				ctx->imem_error |= !get_word_val(ctx->mem, ctx->pc + 2, &ctx->valc);
+				ctx->valp = ctx->pc + 10;
 				break;
 
 			case HPACK(I_ALU, A_ADD):
 			case HPACK(I_ALU, A_SUB):
 			case HPACK(I_ALU, A_AND):
 			case HPACK(I_ALU, A_XOR):
-				imem_error |= !get_byte_val(mem, pc + 1, &tempB);
-				ra = HI4(tempB);
-				rb = LO4(tempB);
-				valp = pc + 2;
+				ctx->imem_error |= !get_byte_val(ctx->mem, ctx->pc + 1, &tempB);
+				ctx->ra = HI4(tempB);
+				ctx->rb = LO4(tempB);
+				ctx->valp = ctx->pc + 2;
 				break;
 
 			case HPACK(I_JMP, C_YES):
@@ -429,185 +396,185 @@ static byte_t sim_step()
 			case HPACK(I_JMP, C_NE):
 			case HPACK(I_JMP, C_GE):
 			case HPACK(I_JMP, C_G):
-				imem_error |= !get_word_val(mem, pc + 1, &valc);
-				valp = pc + 9;
+				ctx->imem_error |= !get_word_val(ctx->mem, ctx->pc + 1, &ctx->valc);
+				ctx->valp = ctx->pc + 9;
 				break;
 
 			case HPACK(I_CALL, F_NONE):
-				imem_error |= !get_word_val(mem, pc + 1, &valc);
-				valp = pc + 9;
+				ctx->imem_error |= !get_word_val(ctx->mem, ctx->pc + 1, &ctx->valc);
+				ctx->valp = ctx->pc + 9;
 				break;
 
 			case HPACK(I_RET, F_NONE):
-				valp = pc + 1;
+				ctx->valp = ctx->pc + 1;
 				break;
 
 			case HPACK(I_PUSHQ, F_NONE):
-				imem_error |= !get_byte_val(mem, pc + 1, &tempB);
-				ra = HI4(tempB);
-				rb = LO4(tempB);
-				valp = pc + 2;
+				ctx->imem_error |= !get_byte_val(ctx->mem, ctx->pc + 1, &tempB);
+				ctx->ra = HI4(tempB);
+				ctx->rb = LO4(tempB);
+				ctx->valp = ctx->pc + 2;
 				break;
 
 			case HPACK(I_POPQ, F_NONE):
-				imem_error |= !get_byte_val(mem, pc + 1, &tempB);
-				ra = HI4(tempB);
-				rb = LO4(tempB);
-				valp = pc + 2;
+				ctx->imem_error |= !get_byte_val(ctx->mem, ctx->pc + 1, &tempB);
+				ctx->ra = HI4(tempB);
+				ctx->rb = LO4(tempB);
+				ctx->valp = ctx->pc + 2;
 				break;
 
 			default:
-				instr_invalid = true;
+				ctx->instr_invalid = true;
 				printf("Invalid instruction\n");
 				break;
 		}
 
-    sim_log("IF: Fetched %s at 0x%llx.  ra=%s, rb=%s, valC = 0x%llx\n",
-	    iname(HPACK(icode,ifun)), pc, reg_name(ra), reg_name(rb), valc);
+    SIM_LOG(ctx, "IF: Fetched %s at %s.  ra=%s, rb=%s, valC = 0x%llx\n",
+	    iname(HPACK(ctx->icode,ctx->ifun)), pc_name(ctx->syms, ctx->pc), reg_name(ctx->ra), reg_name(ctx->rb), ctx->valc);
 
     /*********************** Decode stage ************************/
-    srcA = REG_NONE;
-    srcB = REG_NONE;
-    destE = REG_NONE;
-    destM = REG_NONE;
-    vala = 0;
-    valb = 0;
-		switch (icode) {
+    ctx->srcA = REG_NONE;
+    ctx->srcB = REG_NONE;
+    ctx->destE = REG_NONE;
+    ctx->destM = REG_NONE;
+    ctx->vala = 0;
+    ctx->valb = 0;
+		switch (ctx->icode) {
 			case I_HALT: break;
 
 			case I_NOP: break;
 
 			case I_RRMOVQ: // aka CMOVQ
-				srcA = ra;
-				destE = rb;
+				ctx->srcA = ctx->ra;
+				ctx->destE = ctx->rb;
 				break;
 
 			case I_IRMOVQ:
-				destE = rb;
+				ctx->destE = ctx->rb;
 				break;
 
 			case I_RMMOVQ:
-				srcA = ra;
-				srcB = rb;
+				ctx->srcA = ctx->ra;
+				ctx->srcB = ctx->rb;
 				break;
 
 			case I_MRMOVQ:
-				srcB = rb;
-				destM = ra;
+				ctx->srcB = ctx->rb;
+				ctx->destM = ctx->ra;
 				break;
 
 			case I_ALU:
-				srcA = ra;
-				srcB = rb;
-				destE = rb;
+				ctx->srcA = ctx->ra;
+				ctx->srcB = ctx->rb;
+				ctx->destE = ctx->rb;
 				break;
 
 			case I_JMP: break;
 
 			case I_CALL:
-				srcB = REG_RSP;
-				destE = REG_RSP;
+				ctx->srcB = REG_RSP;
+				ctx->destE = REG_RSP;
 				break;
 
 			case I_RET:
-				srcA = REG_RSP;
-				srcB = REG_RSP;
-				destE = REG_RSP;
+				ctx->srcA = REG_RSP;
+				ctx->srcB = REG_RSP;
+				ctx->destE = REG_RSP;
 				break;
 
 			case I_PUSHQ:
-				srcA = ra;
-				srcB = REG_RSP;
-				destE = REG_RSP;
+				ctx->srcA = ctx->ra;
+				ctx->srcB = REG_RSP;
+				ctx->destE = REG_RSP;
 				break;
 
 			case I_POPQ:
-				srcA = REG_RSP;
-				srcB = REG_RSP;
-				destE = REG_RSP;
-				destM = ra;
+				ctx->srcA = REG_RSP;
+				ctx->srcB = REG_RSP;
+				ctx->destE = REG_RSP;
+				ctx->destM = ctx->ra;
 				break;
 
 			default:
-				printf("icode is not valid (%d)", icode);
+				printf("icode is not valid (%d)", ctx->icode);
 				break;
 		}
 
-		vala = get_reg_val(reg, srcA);
-		valb = get_reg_val(reg, srcB);
+		ctx->vala = get_reg_val(ctx->reg, ctx->srcA);
+		ctx->valb = get_reg_val(ctx->reg, ctx->srcB);
 
     /*********************** Execute stage **********************/
 
-    vale = 0;
-    cc_in = cc;
+    ctx->vale = 0;
+    ctx->cc_in = ctx->cc;
 		bool cnd = false;
 
-		switch (icode) {
+		switch (ctx->icode) {
 			case I_HALT: break;
 
 			case I_NOP: break;
 
 			case I_RRMOVQ: // aka CMOVQ
-				cnd = cond_holds(cc, ifun);
-				vale = vala;
+				cnd = cond_holds(ctx->cc, ctx->ifun);
+				ctx->vale = ctx->vala;
 				if (!cnd) {
-					destE = REG_NONE;
+					ctx->destE = REG_NONE;
 				}
 				break;
 
 			case I_IRMOVQ:
-				vale = valc;
+				ctx->vale = ctx->valc;
 				break;
 
 			case I_RMMOVQ:
-				vale = valb + valc;
+				ctx->vale = ctx->valb + ctx->valc;
 				break;
 
 			case I_MRMOVQ:
-				vale = valb + valc;
+				ctx->vale = ctx->valb + ctx->valc;
 				break;
 
 			case I_ALU:
-				vale = compute_alu(ifun, vala, valb);
-				cc_in = compute_cc(ifun, vala, valb);
+				ctx->vale = compute_alu(ctx->ifun, ctx->vala, ctx->valb);
+				ctx->cc_in = compute_cc(ctx->ifun, ctx->vala, ctx->valb);
 				break;
 
 			case I_JMP:
-				cnd = cond_holds(cc, ifun);
+				cnd = cond_holds(ctx->cc, ctx->ifun);
 				break;
 
 			case I_CALL:
-				vale = valb - 8;
+				ctx->vale = ctx->valb - 8;
 				break;
 
 			case I_RET:
-				vale = valb + 8;
+				ctx->vale = ctx->valb + 8;
 				break;
 
 			case I_PUSHQ:
-				vale = valb - 8;
+				ctx->vale = ctx->valb - 8;
 				break;
 
 			case I_POPQ:
-				vale = valb + 8;
+				ctx->vale = ctx->valb + 8;
 				break;
 
 			default:
-				printf("icode is not valid (%d)", icode);
+				printf("icode is not valid (%d)", ctx->icode);
 				break;
 		}
 
     /*********************** Memory stage ***********************/
 
-    valm = 0;
-    mem_write = false;
-    mem_addr = 0;
-    mem_data = 0;
-    status = STAT_AOK;
+    ctx->valm = 0;
+    ctx->mem_write = false;
+    ctx->mem_addr = 0;
+    ctx->mem_data = 0;
+    ctx->status = STAT_AOK;
 
-		switch (icode) {
+		switch (ctx->icode) {
 			case I_HALT:
-				status = STAT_HLT;
+				ctx->status = STAT_HLT;
 				break;
 
 			case I_NOP: break;
@@ -617,13 +584,13 @@ static byte_t sim_step()
 			case I_IRMOVQ: break;
 
 			case I_RMMOVQ:
-				mem_write = true;
-				mem_addr = vale;
-				mem_data = vala;
+				ctx->mem_write = true;
+				ctx->mem_addr = ctx->vale;
+				ctx->mem_data = ctx->vala;
 				break;
 
 			case I_MRMOVQ:
-				dmem_error |= !get_word_val(mem, vale, &valm);
+				ctx->dmem_error |= !get_word_val(ctx->mem, ctx->vale, &ctx->valm);
 				break;
 
 			case I_ALU: break;
@@ -631,110 +598,110 @@ static byte_t sim_step()
 			case I_JMP: break;
 
 			case I_CALL:
-				mem_write = true;
-				mem_addr = vale;
-				mem_data = valp;
+				ctx->mem_write = true;
+				ctx->mem_addr = ctx->vale;
+				ctx->mem_data = ctx->valp;
 				break;
 
 			case I_RET:
-				dmem_error |= !get_word_val(mem, vala, &valm);
+				ctx->dmem_error |= !get_word_val(ctx->mem, ctx->vala, &ctx->valm);
 				break;
 
 			case I_PUSHQ:
-				mem_write = true;
-				mem_addr = vale;
-				mem_data = vala;
+				ctx->mem_write = true;
+				ctx->mem_addr = ctx->vale;
+				ctx->mem_data = ctx->vala;
 				break;
 
 			case I_POPQ:
-				dmem_error |= !get_word_val(mem, vala, &valm);
+				ctx->dmem_error |= !get_word_val(ctx->mem, ctx->vala, &ctx->valm);
 				break;
 
 			default:
-				printf("icode is not valid (%d)", icode);
+				printf("icode is not valid (%d)", ctx->icode);
 				break;
 		}
 
-		if (mem_write && !instr_invalid) {
-			dmem_error |= !set_word_val(mem, mem_addr, mem_data);
-	        sim_log("Wrote 0x%llx to address 0x%llx\n", mem_data, mem_addr);
+		if (ctx->mem_write && !ctx->instr_invalid) {
+			ctx->dmem_error |= !set_word_val(ctx->mem, ctx->mem_addr, ctx->mem_data);
+	        SIM_LOG(ctx, "Wrote 0x%llx to address 0x%llx\n", ctx->mem_data, ctx->mem_addr);
         }
 
 
     /****************** Program Counter Update ******************/
 
-    pc_in = 0;
+    ctx->pc_in = 0;
 
-		switch (icode) {
+		switch (ctx->icode) {
 			case I_HALT:
-				pc_in = valp;
+				ctx->pc_in = ctx->valp;
 				break;
 
 			case I_NOP:
-				pc_in = valp;
+				ctx->pc_in = ctx->valp;
 				break;
 
 			case I_RRMOVQ: // aka CMOVQ
-				pc_in = valp;
+				ctx->pc_in = ctx->valp;
 				break;
 
 			case I_IRMOVQ:
-				pc_in = valp;
+				ctx->pc_in = ctx->valp;
 				break;
 
 			case I_RMMOVQ:
-				pc_in = valp;
+				ctx->pc_in = ctx->valp;
 				break;
 
 			case I_MRMOVQ:
-				pc_in = valp;
+				ctx->pc_in = ctx->valp;
 				break;
 
 			case I_ALU:
-				pc_in = valp;
+				ctx->pc_in = ctx->valp;
 				break;
 
 			case I_JMP:
-				pc_in = cnd ? valc : valp;
+				ctx->pc_in = cnd ? ctx->valc : ctx->valp;
 				break;
 
 			case I_CALL:
-				pc_in = valc;
+				ctx->pc_in = ctx->valc;
 				break;
 
 			case I_RET:
-				pc_in = valm;
+				ctx->pc_in = ctx->valm;
 				break;
 
 			case I_PUSHQ:
-				pc_in = valp;
+				ctx->pc_in = ctx->valp;
 				break;
 
 			case I_POPQ:
-				pc_in = valp;
+				ctx->pc_in = ctx->valp;
 				break;
 
 			default:
-				printf("icode is not valid (%d)", icode);
+				printf("icode is not valid (%d)", ctx->icode);
 				break;
 
 		}
 
-    pc = pc_in;
-    cc = cc_in;
+    ctx->pc = ctx->pc_in;
+    ctx->cc = ctx->cc_in;
     /* Writeback */
-    if (destE != REG_NONE && !imem_error && !dmem_error && !instr_invalid)
-        set_reg_val(reg, destE, vale);
-    if (destM != REG_NONE && !dmem_error && !imem_error && !instr_invalid)
-        set_reg_val(reg, destM, valm);
+    if (ctx->destE != REG_NONE && !ctx->imem_error && !ctx->dmem_error && !ctx->instr_invalid)
+        set_reg_val(ctx->reg, ctx->destE, ctx->vale);
+    if (ctx->destM != REG_NONE && !ctx->dmem_error && !ctx->imem_error && !ctx->instr_invalid)
+        set_reg_val(ctx->reg, ctx->destM, ctx->valm);
 
 
 
-    return instr_invalid
+    return ctx->instr_invalid
 			? STAT_INS
-			: (dmem_error || imem_error)
+			: (ctx->dmem_error || ctx->imem_error)
 			? STAT_ADR
-			: status;
+			: ctx->status;
 }
 
 /*
@@ -746,25 +713,25 @@ static byte_t sim_step()
   if statusp nonnull, then will be set to status of final instruction
   if ccp nonnull, then will be set to condition codes of final instruction
 */
-word_t sim_run(word_t max_instr, byte_t *statusp, cc_t *ccp)
+word_t sim_run(sim_ctx_ptr ctx, word_t max_instr, byte_t *statusp, cc_t *ccp)
 {
     word_t icount = 0;
     byte_t run_status = STAT_AOK;
     while (icount < max_instr) {
         if (verbosity == 3) {
-            sim_log("-------- Step %d --------\n", icount + 1);
+            SIM_LOG(ctx, "-------- Step %d --------\n", icount + 1);
         }
-        run_status = sim_step();
+        run_status = sim_step(ctx);
         icount++;
 
         /* print step-wise diff if verbosity = 3 */
         if (verbosity == 3) {
-            sim_log("Status '%s', CC %s\n", stat_name(status), cc_name(cc_in));
-            sim_log("Changes to registers:\n");
-            diff_reg(reg0, reg, stdout);
+            SIM_LOG(ctx, "Status '%s', CC %s\n", stat_name(ctx->status), cc_name(ctx->cc_in));
+            SIM_LOG(ctx, "Changes to registers:\n");
+            diff_reg(ctx->reg0, ctx->reg, stdout);
 
             printf("\nChanges to memory:\n");
-            diff_mem(mem0, mem, stdout);
+            diff_mem(ctx->mem0, ctx->mem, stdout);
             printf("\n");
         }
 
@@ -774,7 +741,7 @@ word_t sim_run(word_t max_instr, byte_t *statusp, cc_t *ccp)
     if (statusp)
 	*statusp = run_status;
     if (ccp)
-	*ccp = cc;
+	*ccp = ctx->cc;
     return icount;
 }
 
@@ -789,149 +756,232 @@ void help() {
     printf("registers         -  display differences in registers\n");
     printf("arch              -  display processor state\n");
     printf("undo n            -  steps back n instructions\n");
+    printf("stats             -  display the number of instructions completed\n");
+    printf("break X           -  stop before the instruction at address or label X\n");
+    printf("watch X           -  stop when register X (e.g. %%rax) or the word at X changes\n");
+    printf("delete X          -  remove the breakpoint or watchpoint on X\n");
+    printf("info              -  list breakpoints and watchpoints\n");
     printf("quit              -  exit the program\n\n");
 }
 
-typedef struct seq_restore_struct {
-    processor_state_t state;
-    struct seq_restore_struct *next;
-} seq_restore_t;
-
-static seq_restore_t *create_restore_point(word_t icount, stat_t old_status, word_t old_pc, cc_t old_cc, mem_t previous_memory, mem_t previous_register) {
-    seq_restore_t *restore_point = malloc(sizeof(seq_restore_t));
-    restore_point->state.cc = old_cc;
-    restore_point->state.icount = icount;
-    restore_point->state.memory = create_memory_restore(previous_memory, mem);
-    restore_point->state.registers = create_memory_restore(previous_register, reg);
-    restore_point->state.status = old_status;
-    restore_point->state.pc = old_pc;
-    return restore_point;
+/* Saved state for reverse execution (see rewind.h).  The memory and
+   registers are copy-on-write copies */
+typedef struct {
+    sim_ctx ctx;
+    mem_t mem;
+    mem_t reg;
+} snap_t;
+
+static void *save_snap(void *sim) {
+    sim_ctx_ptr ctx = (sim_ctx_ptr) sim;
+    snap_t *snap = (snap_t *) malloc(sizeof(snap_t));
+    snap->ctx = *ctx;
+    snap->mem = copy_mem(ctx->mem);
+    snap->reg = copy_reg(ctx->reg);
+    return snap;
+}
+
+/* Put a snapshot back, keeping the live initial copies and log file */
+static void restore_snap(void *sim, void *data) {
+    sim_ctx_ptr ctx = (sim_ctx_ptr) sim;
+    snap_t *snap = (snap_t *) data;
+    sim_ctx live = *ctx;
+    *ctx = snap->ctx;
+    ctx->mem0 = live.mem0;
+    ctx->reg0 = live.reg0;
+    ctx->dumpfile = live.dumpfile;
+    ctx->mem = copy_mem(snap->mem);
+    ctx->reg = copy_reg(snap->reg);
+    ctx->mem->watch = live.mem->watch;
+    ctx->reg->watch = live.reg->watch;
+    free_mem(live.mem);
+    free_reg(live.reg);
 }
 
-static void free_restore_point(seq_restore_t *restore_point) {
-    if (restore_point->state.memory->positions != NULL)
-        free(restore_point->state.memory->positions);
-    if (restore_point->state.memory->values != NULL)
-        free(restore_point->state.memory->values);
-    free(restore_point->state.memory);
+static void free_snap(void *data) {
+    snap_t *snap = (snap_t *) data;
+    free_mem(snap->mem);
+    free_reg(snap->reg);
+    free(snap);
+}
+
+/* Go back to when target instructions had completed, or as far as the
+   snapshots reach */
+static void rewind_instrs(sim_ctx_ptr ctx, rewind_t rw, word_t target, word_t *icount) {
+    FILE *dumpfile = ctx->dumpfile;
+    rewind_slot_t *slot;
+    if (target >= *icount || !(slot = rewind_to_cycle(rw, target)))
+        return;
+    *icount = slot->icount;
+    ctx->dumpfile = NULL;
+    while (*icount < target) {
+        sim_step(ctx);
+        (*icount)++;
+    }
+    ctx->dumpfile = dumpfile;
+    /* Every instruction before the current one ran normally */
+    ctx->status = STAT_AOK;
+}
+
+/* What the arch command shows */
+static void print_state(sim_ctx_ptr ctx, word_t icount) {
+    printf("Status: %s\n", stat_name(ctx->status));
+    printf("PC: %llx\n", ctx->pc);
+    printf("CC: %s\n", cc_name(ctx->cc));
+    printf("Instructions Completed: %lld\n", icount);
+    dump_reg(stdout, ctx->reg);
+}
 
-    if (restore_point->state.registers->positions != NULL)
-        free(restore_point->state.registers->positions);
-    if (restore_point->state.registers->values != NULL)
-        free(restore_point->state.registers->values);
-    free(restore_point->state.registers);
+/* Result of go or next in a script */
+static void json_run(json_t j, char *cmd, break_t brk, word_t instrs, byte_t status) {
+    json_open(j, NULL);
+    json_string(j, "cmd", cmd);
+    json_int(j, "instructions", instrs);
+    json_string(j, "status", stat_name(status));
+    json_break_why(j, brk);
+    json_close(j);
+}
 
-    free(restore_point);
+/* What arch shows, as members of the current object */
+static void json_state(json_t j, sim_ctx_ptr ctx, word_t icount) {
+    json_string(j, "status", stat_name(ctx->status));
+    json_int(j, "pc", ctx->pc);
+    json_string(j, "cc", cc_name(ctx->cc));
+    json_int(j, "instructions", icount);
+    json_regs(j, "registers", ctx->reg);
 }
 
-void sim_interactive()
+/*
+ * sim_interactive - Read commands from in and run them.  With script
+ * set, there is no prompt or per-instruction display and each command
+ * answers with a line of JSON (see script.h).
+ */
+static void sim_interactive(FILE *in, bool script)
 {
+    sim_ctx_ptr ctx = new_sim();
     word_t icount = 0;
-    word_t ucount = 0;
-    status = STAT_AOK;
     word_t byte_cnt = 0;
     int instructions_to_run, instructions_to_undo;
     word_t icount_stored = 0;
+    json_t j = script ? new_json(stdout) : NULL;
 
-	sim_set_dumpfile(stdout);
-    sim_init();
+    if (!script)
+	sim_set_dumpfile(ctx, stdout);
 
     /* Emit simulator name */
-    printf("%s\n", simname);
+    if (!script)
+        printf("%s\n", simname);
 
-    byte_cnt = load_mem(mem, object_file, 1);
+    byte_cnt = load_code(ctx->mem, ctx->syms, object_filename, object_file, 1);
     if (byte_cnt == 0) {
 	    fprintf(stderr, "No lines of code found\n");
 	    exit(1);
+    } else if (script) {
+        json_open(j, NULL);
+        json_string(j, "cmd", "load");
+        json_string(j, "sim", simname);
+        json_string(j, "file", object_filename);
+        json_int(j, "bytes", byte_cnt);
+        json_close(j);
     } else if (verbosity >= 2) {
 	    printf("%lld bytes of code read\n", byte_cnt);
     }
     fclose(object_file);
 
-    mem0 = copy_mem(mem);
-    reg0 = copy_mem(reg);
-
-    mem_t previous_memory = copy_mem(mem);
-    mem_t previous_registers = copy_mem(reg);
+    ctx->mem0 = copy_mem(ctx->mem);
+    ctx->reg0 = copy_mem(ctx->reg);
 
-    seq_restore_t *restore_head = NULL;
+    rewind_t rw = new_rewind(ctx, save_snap, restore_snap, free_snap);
+    break_t brk = new_breaks(ctx->syms);
+    attach_breaks(brk, ctx->mem, ctx->reg);
+    if (script)
+        brk->out = NULL;
 
-    char buffer[20];
+    char buffer[CMD_LEN];
+    char arg[CMD_LEN];
     byte_t run_status = STAT_AOK;
 
     while(1) {
-        printf("SEQ> ");
-
-        int size = scanf("%s", buffer);
-            if (size == 0) {
-            buffer[0] = 'x';
-        }
-        printf("\n");
+        if (!script)
+            printf("SEQ> ");
+        if (!read_command(in, buffer, arg))
+            break;
+        if (!script)
+            printf("\n");
+        clear_break_hits(brk);
+        icount_stored = icount;
 
         switch(buffer[0]) {
         case 'G':
         case 'g':
             if(run_status == STAT_AOK || run_status == STAT_BUB) {
-                icount_stored = icount;
                 while (run_status == STAT_AOK) {
-                    previous_memory = copy_mem(mem);
-                    previous_registers = copy_mem(reg);
-                    word_t old_pc = pc;
-                    stat_t old_status = run_status;
-                    cc_t old_cc = cc;
-                    run_status = sim_step();
-                    seq_restore_t *new_restore_point = create_restore_point(icount, old_status, old_pc, old_cc, previous_memory, previous_registers);
+                    rewind_note(rw, icount, icount);
+                    run_status = sim_step(ctx);
                     icount++;
-                    new_restore_point->next = restore_head;
-                    restore_head = new_restore_point;
+                    if (BREAK_STOP(brk, ctx->pc, false))
+                        break;
                 }
 
-                printf("Simulator Ran %lld instructions\n", icount - icount_stored);
-            } else {
+                if (!script)
+                    printf("Simulator Ran %lld instructions\n", icount - icount_stored);
+            } else if (!script) {
                 printf("Simulator is in a non AOK state\n");
             }
 
-            printf("Simulator ran to completion\n");
+            if (script)
+                json_run(j, "go", brk, icount - icount_stored, run_status);
+            else if (run_status != STAT_AOK) {
+                printf("Simulator ran to completion\n");
+            }
             break;
 
         case 'h':
         case 'H':
-            help();
+            if (script)
+                json_error(j, "help", "Not available in a script");
+            else
+                help();
             break;
 
         case 'Q':
         case 'q':
-            printf("Bye.\n");
+            if (script) {
+                json_open(j, NULL);
+                json_string(j, "cmd", "quit");
+                json_close(j);
+            } else
+                printf("Bye.\n");
             exit(0);
 
         case 'N':
         case 'n':
-            size = scanf("%d", &instructions_to_run);
-            if (size == 0) {
+            if (!arg_int(arg, &instructions_to_run)) {
+                if (script)
+                    json_error(j, "next", "Expected a number of instructions");
+                else
+                    printf("Expected a number of instructions\n");
                 break;
             }
 
             if(run_status == STAT_AOK || run_status == STAT_BUB) {
-                icount_stored = icount;
                 while (run_status == STAT_AOK && instructions_to_run--) {
-                    previous_memory = copy_mem(mem);
-                    previous_registers = copy_mem(reg);
-                    word_t old_pc = pc;
-                    stat_t old_status = run_status;
-                    cc_t old_cc = cc;
-                    run_status = sim_step();
-                    seq_restore_t *new_restore_point = create_restore_point(icount, old_status, old_pc, old_cc, previous_memory, previous_registers);
+                    rewind_note(rw, icount, icount);
+                    run_status = sim_step(ctx);
                     icount++;
-                    new_restore_point->next = restore_head;
-                    restore_head = new_restore_point;
+                    if (BREAK_STOP(brk, ctx->pc, false))
+                        break;
                 }
 
-                printf("Simulator ran %lld instructions\n", icount - icount_stored);
-            } else {
+                if (!script)
+                    printf("Simulator ran %lld instructions\n", icount - icount_stored);
+            } else if (!script) {
                 printf("Simulator is in a non AOK state\n");
             }
 
-            if (run_status != STAT_AOK) {
+            if (script)
+                json_run(j, "next", brk, icount - icount_stored, run_status);
+            else if (run_status != STAT_AOK) {
                 printf("Simulator ran to completion\n");
             }
 
@@ -939,68 +989,151 @@ void sim_interactive()
 
         case 'M':
         case 'm':
-            diff_mem(mem0, mem, stdout);
+            if (script) {
+                char *text = NULL;
+                size_t len = 0;
+                FILE *f = open_memstream(&text, &len);
+                diff_mem(ctx->mem0, ctx->mem, f);
+                fclose(f);
+                json_open(j, NULL);
+                json_string(j, "cmd", "memory");
+                json_mem_diffs(j, "changes", text);
+                json_close(j);
+                free(text);
+            } else
+                diff_mem(ctx->mem0, ctx->mem, stdout);
             break;
 
         case 'R':
         case 'r':
-            diff_reg(reg0, reg, stdout);
+            if (script) {
+                json_open(j, NULL);
+                json_string(j, "cmd", "registers");
+                json_reg_diffs(j, "changes", ctx->reg0, ctx->reg);
+                json_close(j);
+            } else
+                diff_reg(ctx->reg0, ctx->reg, stdout);
             break;
 
         case 'U':
         case 'u':
-            size = scanf("%d", &instructions_to_undo);
-            if (size == 0) {
+            if (!arg_int(arg, &instructions_to_undo)) {
+                if (script)
+                    json_error(j, "undo", "Expected a number of instructions");
+                else
+                    printf("Expected a number of instructions\n");
                 break;
             }
-            ucount = 0;
-            while (restore_head != NULL && instructions_to_undo--) {
-                cc = restore_head->state.cc;
-                icount = restore_head->state.icount;
-                apply_restore(mem, restore_head->state.memory);
-                apply_restore(reg, restore_head->state.registers);
-                pc = restore_head->state.pc;
-                status = restore_head->state.status;
-                run_status = status;
-                seq_restore_t *temp = restore_head;
-                restore_head = restore_head->next;
-                free_restore_point(temp);
-                ucount++;
+            rewind_instrs(ctx, rw, icount - instructions_to_undo, &icount);
+            run_status = ctx->status;
+            if (script) {
+                json_open(j, NULL);
+                json_string(j, "cmd", "undo");
+                json_int(j, "instructions_undone", icount_stored - icount);
+                json_state(j, ctx, icount);
+                json_close(j);
+            } else {
+                printf("Instructions undone: %lld\n", icount_stored - icount);
+                print_state(ctx, icount);
             }
-            printf("Instructions undone: %lld\n", ucount);
+            break;
 
         case 'A':
         case 'a':
-            printf("Status: %s\n", stat_name(status));
-            printf("PC: %llx\n", pc);
-            printf("CC: %s\n", cc_name(cc));
-            printf("Instructions Completed: %lld\n", icount);
-            dump_reg(stdout, reg);
+            if (script) {
+                json_open(j, NULL);
+                json_string(j, "cmd", "arch");
+                json_state(j, ctx, icount);
+                json_close(j);
+            } else
+                print_state(ctx, icount);
             break;
 
+        case 'S':
+        case 's':
+            if (script) {
+                json_open(j, NULL);
+                json_string(j, "cmd", "stats");
+                json_int(j, "instructions", icount);
+                json_close(j);
+            } else
+                printf("Instructions Completed: %lld\n", icount);
+            break;
+
+        case 'B':
+        case 'b':
+            if (strcmp(buffer, "break")) {
+                if (script)
+                    json_error(j, buffer, "Invalid Command");
+                else
+                    printf("Invalid Command\n");
+                break;
+            }
+            {
+                bool ok = add_break(brk, arg);
+                if (script)
+                    json_result(j, "break", arg, ok);
+            }
+            break;
+
+        case 'W':
+        case 'w':
+            {
+                bool ok = add_watchpoint(brk, arg);
+                if (script)
+                    json_result(j, "watch", arg, ok);
+            }
+            break;
+
+        case 'D':
+        case 'd':
+            {
+                bool ok = delete_break(brk, arg);
+                if (script)
+                    json_result(j, "delete", arg, ok);
+            }
+            break;
+
+        case 'I':
+        case 'i':
+            if (script) {
+                json_open(j, NULL);
+                json_string(j, "cmd", "info");
+                json_breaks(j, brk);
+                json_close(j);
+            } else
+                info_breaks(brk);
+            break;
 
         default:
-            printf("Invalid Command\n");
+            if (script)
+                json_error(j, buffer, "Invalid Command");
+            else
+                printf("Invalid Command\n");
             break;
         }
     }
+    free_breaks(brk);
+    free_rewind(rw);
+    if (j)
+        free_json(j);
 }
 
 /* If dumpfile set nonNULL, lots of status info printed out */
-void sim_set_dumpfile(FILE *df)
+void sim_set_dumpfile(sim_ctx_ptr ctx, FILE *df)
 {
-    dumpfile = df;
+    ctx->dumpfile = df;
 }
 
 /*
  * sim_log dumps a formatted string to the dumpfile, if it exists
  * accepts variable argument list
  */
-void sim_log( const char *format, ... ) {
-    if (dumpfile) {
+void sim_log(sim_ctx_ptr ctx, const char *format, ... ) {
+    if (ctx->dumpfile) {
 	va_list arg;
 	va_start( arg, format );
-	vfprintf( dumpfile, format, arg );
+	vfprintf( ctx->dumpfile, format, arg );
 	va_end( arg );
     }
 }
\ No newline at end of file
@@ -0,0 +1,43 @@
+#!/usr/bin/perl
+# Time simulators at -v 0 and report the cycles each simulates per second
+#
+# usage: bench.pl [-h] [-l n] [-r n] [-f file.yo] sim ...
+#   Each sim is a simulator command, with any flags it needs, e.g.
+#   ./bench.pl ../pipe/psim "../pipe-cache/pcsim -s 2 -E 2 -b 4 -d 10"
+
+use Getopt::Std;
+use Time::HiRes qw(time);
+
+getopts('hl:r:f:');
+
+if ($opt_h || @ARGV == 0) {
+    print STDERR "Usage $0: [-h] [-l n] [-r n] [-f file.yo] sim ...\n";
+    print STDERR "   -h         Print this message\n";
+    print STDERR "   -l n       Run n instructions (default 3000000)\n";
+    print STDERR "   -r n       Time each simulator n times and keep the best (default 3)\n";
+    print STDERR "   -f file.yo Program to run (default loop.yo)\n";
+    die "\n";
+}
+
+$limit = $opt_l ? $opt_l : 3000000;
+$runs = $opt_r ? $opt_r : 3;
+$prog = $opt_f ? $opt_f : "loop.yo";
+
+(-e $prog) || die "Can't find $prog (try make $prog)\n";
+
+printf("%-48s %12s %8s %14s\n", "Simulator", "Cycles", "Seconds", "Cycles/sec");
+foreach $sim (@ARGV) {
+    $best = 0;
+    $cycles = 0;
+    for ($i = 0; $i < $runs; $i++) {
+	$start = time;
+	$out = `$sim -v 0 -l $limit $prog`;
+	$elapsed = time - $start;
+	($out =~ /CPI: (\d+) cycles/) || die "$sim did not report a CPI\n";
+	$cycles = $1;
+	if ($best == 0 || $elapsed < $best) {
+	    $best = $elapsed;
+	}
+    }
+    printf("%-48s %12d %8.2f %14.0f\n", $sim, $cycles, $best, $cycles/$best);
+}